@@ -44,6 +44,21 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
 #endif /*_MSC_VER */
 
+/*
+SIMD: SSE2 is always available on x86-64 (and on x86 when the compiler targets it). With GCC and Clang,
+functions using SSSE3 and AVX2 are compiled with target attributes and selected at runtime with
+__builtin_cpu_supports. Define LODEPNG_NO_COMPILE_SIMD to use only the portable C code.
+*/
+#if !defined(LODEPNG_NO_COMPILE_SIMD) &&\
+    (defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__)))
+#define LODEPNG_SIMD_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) /*GCC, Clang (target attribute and __builtin_cpu_supports)*/
+#define LODEPNG_SIMD_X86_RUNTIME
+#include <immintrin.h>
+#endif /*__GNUC__*/
+#endif /*LODEPNG_NO_COMPILE_SIMD*/
+
 const char* LODEPNG_VERSION_STRING = "20220109";
 
 /*
@@ -1234,14 +1249,237 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   return error;
 }
 
-/*inflate a block with dynamic of fixed Huffman tree. btype must be 1 or 2.*/
+/* ////////////////////////////////////////////////////////////////////////// */
+/* / Inflator fast path                                                     / */
+/* ////////////////////////////////////////////////////////////////////////// */
+
+/*
+Table-driven fast path of inflateHuffmanBlock, enabled when a 64-bit integer type is available.
+It keeps the bits in a 64-bit buffer that is refilled without branches (one refill gives at least
+56 bits, enough for a length/distance pair with all extra bits), decodes literals and lengths
+from a combined table that can also give two literals with one lookup, and copies matches in
+8-byte chunks. It only runs while at least 8 input bytes and enough output space remain, and
+leaves everything unusual (end code, symbols longer than the table, invalid symbols or
+distances) to one iteration of the per-symbol decoder at the same bit position, so the output
+is the same as with the per-symbol decoder alone. Corrupt input is rejected by both, but the
+error code and the partial output can differ when the decoder runs past the end of the input,
+since the per-symbol decoder checks for that only every two symbols.
+*/
+#if (defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 199901L)) || (defined(__cplusplus) && (__cplusplus >= 201103L))
+#define LODEPNG_FAST_INFLATE
+#endif
+
+#ifdef LODEPNG_FAST_INFLATE
+
+typedef unsigned long long LodePNGBitBuffer;
+
+/*index bits of the fast literal/length and distance tables*/
+#define FAST_LL_BITS 11u
+#define FAST_D_BITS 10u
+
+/*
+fast table entry: bits 0-7: amount of bits of the huffman code(s), bits 8-11: extra bits,
+bits 12-13: kind, bits 16-31: literal(s) (the second literal in bits 24-31) or length/distance base
+*/
+#define FAST_SLOW 0u /*must be handled by the per-symbol decoder*/
+#define FAST_LITERAL 1u
+#define FAST_LITERAL2 2u
+#define FAST_MATCH 3u
+#define FAST_ENTRY(kind, codebits, extrabits, value)\
+  ((codebits) | ((extrabits) << 8u) | ((kind) << 12u) | ((unsigned)(value) << 16u))
+
+/*space kept free at the end of the output for a match of 258 bytes and the overrun of the 8-byte copies*/
+#define FAST_OUT_MARGIN (258u + 8u)
+
+/*little endian 64-bit load, compilers turn this into a single load where possible*/
+static LODEPNG_INLINE LodePNGBitBuffer lodepng_read64bitLE(const unsigned char* p) {
+  return (LodePNGBitBuffer)p[0] | ((LodePNGBitBuffer)p[1] << 8u) | ((LodePNGBitBuffer)p[2] << 16u) |
+         ((LodePNGBitBuffer)p[3] << 24u) | ((LodePNGBitBuffer)p[4] << 32u) | ((LodePNGBitBuffer)p[5] << 40u) |
+         ((LodePNGBitBuffer)p[6] << 48u) | ((LodePNGBitBuffer)p[7] << 56u);
+}
+
+/*
+Like huffmanDecodeSymbol, but from the given bits (LSB first, at least 15 valid bits or zeros after
+the code) instead of the bit reader. The length of the code is written to len.
+*/
+static LODEPNG_INLINE unsigned huffmanDecodeBits(const HuffmanTree* codetree, unsigned bits, unsigned* len) {
+  unsigned code = bits & ((1u << FIRSTBITS) - 1u);
+  unsigned l = codetree->table_len[code];
+  unsigned value = codetree->table_value[code];
+  if(l <= FIRSTBITS) {
+    *len = l;
+    return value;
+  }
+  value += (bits >> FIRSTBITS) & ((1u << (l - FIRSTBITS)) - 1u);
+  *len = codetree->table_len[value];
+  return codetree->table_value[value];
+}
+
+/*
+Fill the fast literal/length table (1 << FAST_LL_BITS entries). The index bits after a code are zero
+while building, which gives the right symbol for every code that fits in FAST_LL_BITS because the
+HuffmanTree tables repeat each symbol for all values of the bits after it.
+*/
+static void makeFastLitLenTable(unsigned* table, const HuffmanTree* tree_ll) {
+  unsigned i;
+  for(i = 0; i != (1u << FAST_LL_BITS); ++i) {
+    unsigned l1, l2;
+    unsigned symbol1 = huffmanDecodeBits(tree_ll, i, &l1);
+    table[i] = FAST_ENTRY(FAST_SLOW, 0u, 0u, 0u);
+    if(l1 > FAST_LL_BITS) continue; /*long code: read past the index bits*/
+    if(symbol1 <= 255) {
+      table[i] = FAST_ENTRY(FAST_LITERAL, l1, 0u, symbol1);
+      if(l1 < FAST_LL_BITS) {
+        unsigned symbol2 = huffmanDecodeBits(tree_ll, i >> l1, &l2);
+        if(symbol2 <= 255 && l1 + l2 <= FAST_LL_BITS) {
+          table[i] = FAST_ENTRY(FAST_LITERAL2, l1 + l2, 0u, symbol1 | (symbol2 << 8u));
+        }
+      }
+    } else if(symbol1 >= FIRST_LENGTH_CODE_INDEX && symbol1 <= LAST_LENGTH_CODE_INDEX) {
+      table[i] = FAST_ENTRY(FAST_MATCH, l1, LENGTHEXTRA[symbol1 - FIRST_LENGTH_CODE_INDEX],
+                            LENGTHBASE[symbol1 - FIRST_LENGTH_CODE_INDEX]);
+    } /*else end code or invalid symbol: per-symbol decoder*/
+  }
+}
+
+/*Fill the fast distance table (1 << FAST_D_BITS entries), see makeFastLitLenTable.*/
+static void makeFastDistanceTable(unsigned* table, const HuffmanTree* tree_d) {
+  unsigned i;
+  for(i = 0; i != (1u << FAST_D_BITS); ++i) {
+    unsigned l;
+    unsigned symbol = huffmanDecodeBits(tree_d, i, &l);
+    if(l <= FAST_D_BITS && symbol <= 29) {
+      table[i] = FAST_ENTRY(FAST_MATCH, l, DISTANCEEXTRA[symbol], DISTANCEBASE[symbol]);
+    } else {
+      table[i] = FAST_ENTRY(FAST_SLOW, 0u, 0u, 0u);
+    }
+  }
+}
+
+/*
+Decodes symbols with the fast tables for as long as possible, and updates reader->bp to the first
+symbol that was not decoded. Returns error code (only allocation failure, other errors are left to
+the per-symbol decoder). Afterwards there are at least 260 bytes of free space in out as
+inflateHuffmanBlock requires.
+*/
+static unsigned inflateHuffmanFast(ucvector* out, LodePNGBitReader* reader,
+                                   const unsigned* table_ll, const unsigned* table_d,
+                                   size_t max_output_size) {
+  const unsigned char* in_end = reader->data + reader->size;
+  const unsigned char* in_next = reader->data + (reader->bp >> 3u);
+  LodePNGBitBuffer bitbuf = 0;
+  unsigned bitcount = 0;
+
+  if(reader->bp >= reader->bitsize || (size_t)(in_end - in_next) < 8u) return 0;
+  /*the 8th byte is above bitcount, see the refill below*/
+  bitbuf = lodepng_read64bitLE(in_next) >> (reader->bp & 7u);
+  bitcount = 56u - (unsigned)(reader->bp & 7u);
+  in_next += 7;
+
+  for(;;) {
+    LodePNGBitBuffer saved_bitbuf;
+    unsigned saved_bitcount, entry, entry_d, codebits, kind;
+    size_t length, distance;
+    unsigned char* dst;
+
+    if(out->allocsize - out->size < FAST_OUT_MARGIN) {
+      if(!ucvector_reserve(out, out->size + FAST_OUT_MARGIN)) return 83; /*alloc fail*/
+    }
+    if(max_output_size && out->size + 258u > max_output_size) break;
+    if((size_t)(in_end - in_next) < 8u) break;
+
+    /*branchless refill: add whole bytes until there are at least 56 bits. The bits above bitcount
+    are either zero or the same input bits that the next refill adds again.*/
+    bitbuf |= lodepng_read64bitLE(in_next) << bitcount;
+    in_next += (63u - bitcount) >> 3u;
+    bitcount |= 56u;
+    saved_bitbuf = bitbuf;
+    saved_bitcount = bitcount;
+
+    entry = table_ll[bitbuf & ((1u << FAST_LL_BITS) - 1u)];
+    codebits = entry & 255u;
+    kind = (entry >> 12u) & 3u;
+    if(kind == FAST_LITERAL) {
+      out->data[out->size++] = (unsigned char)(entry >> 16u);
+      bitbuf >>= codebits;
+      bitcount -= codebits;
+      continue;
+    } else if(kind == FAST_LITERAL2) {
+      out->data[out->size++] = (unsigned char)(entry >> 16u);
+      out->data[out->size++] = (unsigned char)(entry >> 24u);
+      bitbuf >>= codebits;
+      bitcount -= codebits;
+      continue;
+    } else if(kind == FAST_SLOW) {
+      break;
+    }
+
+    /*length code and its extra bits*/
+    bitbuf >>= codebits;
+    length = (entry >> 16u) + (size_t)(bitbuf & ((1u << ((entry >> 8u) & 15u)) - 1u));
+    bitbuf >>= (entry >> 8u) & 15u;
+    bitcount -= codebits + ((entry >> 8u) & 15u);
+
+    /*distance code and its extra bits*/
+    entry_d = table_d[bitbuf & ((1u << FAST_D_BITS) - 1u)];
+    if(((entry_d >> 12u) & 3u) != FAST_MATCH) {
+      bitbuf = saved_bitbuf;
+      bitcount = saved_bitcount;
+      break;
+    }
+    codebits = entry_d & 255u;
+    bitbuf >>= codebits;
+    distance = (entry_d >> 16u) + (size_t)(bitbuf & ((1u << ((entry_d >> 8u) & 15u)) - 1u));
+    if(distance > out->size) { /*error 52 is given by the per-symbol decoder*/
+      bitbuf = saved_bitbuf;
+      bitcount = saved_bitcount;
+      break;
+    }
+    bitbuf >>= (entry_d >> 8u) & 15u;
+    bitcount -= codebits + ((entry_d >> 8u) & 15u);
+
+    /*copy the match. The 8-byte chunks never overlap their own source when distance >= 8, and may
+    write up to 7 bytes past the match, which FAST_OUT_MARGIN leaves room for.*/
+    dst = out->data + out->size;
+    out->size += length;
+    if(distance >= 8) {
+      const unsigned char* src = dst - distance;
+      const unsigned char* end = dst + length;
+      do {
+        lodepng_memcpy(dst, src, 8);
+        dst += 8;
+        src += 8;
+      } while(dst < end);
+    } else if(distance == 1) {
+      lodepng_memset(dst, dst[-1], length);
+    } else {
+      size_t i;
+      for(i = 0; i != length; ++i) dst[i] = dst[i - distance];
+    }
+  }
+
+  reader->bp = (size_t)(in_next - reader->data) * 8u - bitcount;
+  return 0;
+}
+
+#endif /*LODEPNG_FAST_INFLATE*/
+
+/*inflate a block with dynamic of fixed Huffman tree. btype must be 1 or 2.
+If reference_inflate is 0, symbols are decoded with inflateHuffmanFast where possible.*/
 static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
-                                    unsigned btype, size_t max_output_size) {
+                                    unsigned btype, size_t max_output_size,
+                                    unsigned reference_inflate) {
   unsigned error = 0;
   HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
   HuffmanTree tree_d; /*the huffman tree for distance codes*/
   const size_t reserved_size = 260; /* must be at least 258 for max length, and a few extra for adding a few extra literals */
   int done = 0;
+#ifdef LODEPNG_FAST_INFLATE
+  unsigned table_ll[1u << FAST_LL_BITS]; /*fast literal/length table*/
+  unsigned table_d[1u << FAST_D_BITS]; /*fast distance table*/
+#else
+  (void)reference_inflate;
+#endif
 
   if(!ucvector_reserve(out, out->size + reserved_size)) return 83; /*alloc fail*/
 
@@ -1251,10 +1489,23 @@ static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
   if(btype == 1) error = getTreeInflateFixed(&tree_ll, &tree_d);
   else /*if(btype == 2)*/ error = getTreeInflateDynamic(&tree_ll, &tree_d, reader);
 
+#ifdef LODEPNG_FAST_INFLATE
+  if(!error && !reference_inflate) {
+    makeFastLitLenTable(table_ll, &tree_ll);
+    makeFastDistanceTable(table_d, &tree_d);
+  }
+#endif
 
   while(!error && !done) /*decode all symbols until end reached, breaks at end code*/ {
     /*code_ll is literal, length or end code*/
     unsigned code_ll;
+#ifdef LODEPNG_FAST_INFLATE
+    /*decode as much as possible with the fast path, the rest of this loop handles the next symbol*/
+    if(!reference_inflate) {
+      error = inflateHuffmanFast(out, reader, table_ll, table_d, max_output_size);
+      if(error) break;
+    }
+#endif
     /* ensure enough bits for 2 huffman code reads (15 bits each): if the first is a literal, a second literal is read at once. This
     appears to be slightly faster, than ensuring 20 bits here for 1 huffman symbol and the potential 5 extra bits for the length symbol.*/
     ensureBits32(reader, 30);
@@ -1393,7 +1644,8 @@ static unsigned lodepng_inflatev(ucvector* out,
 
     if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
     else if(BTYPE == 0) error = inflateNoCompression(out, &reader, settings); /*no compression*/
-    else error = inflateHuffmanBlock(out, &reader, BTYPE, settings->max_output_size); /*compression, BTYPE 01 or 10*/
+    else error = inflateHuffmanBlock(out, &reader, BTYPE, settings->max_output_size,
+                                     settings->reference_inflate); /*compression, BTYPE 01 or 10*/
     if(!error && settings->max_output_size && out->size > settings->max_output_size) error = 109;
     if(error) break;
   }
@@ -1730,9 +1982,58 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
   return error;
 }
 
+/*
+Faster alternative of encodeLZ77, used with fast_lz77, with the same output format. hash->head only
+holds the last position of each hash of 4 bytes, so there is a single candidate (no chains) and the
+first match found is taken (greedy, no lazy matching). The positions inside a match are not hashed.
+The candidate is always compared with the data, so an outdated entry can't give a wrong match.
+*/
+static unsigned encodeLZ77Fast(uivector* out, Hash* hash, const unsigned char* in,
+                               size_t inpos, size_t insize, unsigned windowsize) {
+  size_t pos = inpos;
+  size_t outpos = out->size;
+  /*a match has 4 values but is at least 4 bytes long, so there are never more values than bytes*/
+  if(!uivector_resize(out, out->size + (insize - inpos))) return 83; /*alloc fail*/
+
+  while(pos + 4u <= insize) {
+    unsigned value = in[pos] | ((unsigned)in[pos + 1u] << 8u) | ((unsigned)in[pos + 2u] << 16u) |
+                     ((unsigned)in[pos + 3u] << 24u);
+    unsigned hashval = ((value * 2654435761u) >> 16u) & HASH_BIT_MASK;
+    int head = hash->head[hashval];
+    /*positions are stored modulo 2^31, which only matters for more than 2GB of data*/
+    hash->head[hashval] = (int)(pos & 0x7fffffffu);
+    if(head >= 0) {
+      size_t distance = (pos - (size_t)head) & 0x7fffffffu;
+      const unsigned char* match = &in[pos - (distance <= windowsize ? distance : 0)];
+      if(distance != 0 && distance <= windowsize && match[0] == in[pos] && match[1] == in[pos + 1u] &&
+         match[2] == in[pos + 2u] && match[3] == in[pos + 3u]) {
+        size_t length = 4;
+        size_t maxlength = LODEPNG_MIN(MAX_SUPPORTED_DEFLATE_LENGTH, insize - pos);
+        unsigned length_code, dist_code;
+        while(length < maxlength && match[length] == in[pos + length]) ++length;
+
+        length_code = (unsigned)searchCodeIndex(LENGTHBASE, 29, length);
+        dist_code = (unsigned)searchCodeIndex(DISTANCEBASE, 30, distance);
+        out->data[outpos++] = length_code + FIRST_LENGTH_CODE_INDEX;
+        out->data[outpos++] = (unsigned)(length - LENGTHBASE[length_code]);
+        out->data[outpos++] = dist_code;
+        out->data[outpos++] = (unsigned)(distance - DISTANCEBASE[dist_code]);
+        pos += length;
+        continue;
+      }
+    }
+    out->data[outpos++] = in[pos++];
+  }
+  while(pos < insize) out->data[outpos++] = in[pos++];
+
+  out->size = outpos;
+  return 0;
+}
+
 /* /////////////////////////////////////////////////////////////////////////// */
 
-static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize) {
+static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize,
+                                     unsigned final) {
   /*non compressed deflate block data: 1 bit BFINAL,2 bits BTYPE,(5 bits): it jumps to start of next byte,
   2 bytes LEN, 2 bytes NLEN, LEN bytes literal DATA*/
 
@@ -1743,7 +2044,7 @@ static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, s
     unsigned char firstbyte;
     size_t pos = out->size;
 
-    BFINAL = (i == numdeflateblocks - 1);
+    BFINAL = final && (i == numdeflateblocks - 1);
     BTYPE = 0;
 
     LEN = 65535;
@@ -1769,13 +2070,41 @@ static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, s
 write the lz77-encoded data, which has lit, len and dist codes, to compressed stream using huffman trees.
 tree_ll: the tree for lit and len codes.
 tree_d: the tree for distance codes.
+Gives the same bits as writeBits and writeBitsReversed, but the codes are reversed only once per tree and
+the bits are collected in an integer and stored 16 at a time instead of one by one.
 */
-static void writeLZ77data(LodePNGBitWriter* writer, const uivector* lz77_encoded,
-                          const HuffmanTree* tree_ll, const HuffmanTree* tree_d) {
-  size_t i = 0;
+/*returns error code (83 if out of memory)*/
+static unsigned writeLZ77data(LodePNGBitWriter* writer, const uivector* lz77_encoded,
+                              const HuffmanTree* tree_ll, const HuffmanTree* tree_d) {
+  unsigned codes_ll[NUM_DEFLATE_CODE_SYMBOLS]; /*the codes with reversed bits, to write them LSB first*/
+  unsigned codes_d[NUM_DISTANCE_SYMBOLS];
+  ucvector* data = writer->data;
+  unsigned buffer = 0; /*bits that are not stored yet, LSB first*/
+  unsigned numbits = writer->bp & 7u; /*less than 16 between the values*/
+  size_t i, pos = data->size;
+
+  for(i = 0; i != tree_ll->numcodes; ++i) codes_ll[i] = reverseBits(tree_ll->codes[i], tree_ll->lengths[i]);
+  for(i = 0; i != tree_d->numcodes; ++i) codes_d[i] = reverseBits(tree_d->codes[i], tree_d->lengths[i]);
+
+  /*continue in the incomplete last byte*/
+  if(numbits) buffer = data->data[--pos];
+  /*each value has at most 15 bits, so 2 bytes per value are enough*/
+  if(!ucvector_resize(data, pos + lz77_encoded->size * 2u + 2u)) return 83; /*alloc fail*/
+
+#define PUTBITS(value, nbits){\
+  buffer |= (value) << numbits;\
+  numbits += (nbits);\
+  if(numbits >= 16u) {\
+    data->data[pos++] = (unsigned char)(buffer & 255u);\
+    data->data[pos++] = (unsigned char)((buffer >> 8u) & 255u);\
+    buffer >>= 16u;\
+    numbits -= 16u;\
+  }\
+}
+
   for(i = 0; i != lz77_encoded->size; ++i) {
     unsigned val = lz77_encoded->data[i];
-    writeBitsReversed(writer, tree_ll->codes[val], tree_ll->lengths[val]);
+    PUTBITS(codes_ll[val], tree_ll->lengths[val]);
     if(val > 256) /*for a length code, 3 more things have to be added*/ {
       unsigned length_index = val - FIRST_LENGTH_CODE_INDEX;
       unsigned n_length_extra_bits = LENGTHEXTRA[length_index];
@@ -1787,11 +2116,20 @@ static void writeLZ77data(LodePNGBitWriter* writer, const uivector* lz77_encoded
       unsigned n_distance_extra_bits = DISTANCEEXTRA[distance_index];
       unsigned distance_extra_bits = lz77_encoded->data[++i];
 
-      writeBits(writer, length_extra_bits, n_length_extra_bits);
-      writeBitsReversed(writer, tree_d->codes[distance_code], tree_d->lengths[distance_code]);
-      writeBits(writer, distance_extra_bits, n_distance_extra_bits);
+      PUTBITS(length_extra_bits, n_length_extra_bits);
+      PUTBITS(codes_d[distance_code], tree_d->lengths[distance_code]);
+      PUTBITS(distance_extra_bits, n_distance_extra_bits);
     }
   }
+
+#undef PUTBITS
+
+  /*store the remaining bits, the last byte may be incomplete*/
+  for(; numbits >= 8u; numbits -= 8u, buffer >>= 8u) data->data[pos++] = (unsigned char)(buffer & 255u);
+  if(numbits) data->data[pos++] = (unsigned char)(buffer & 255u);
+  data->size = pos;
+  writer->bp = (unsigned char)numbits;
+  return 0;
 }
 
 /*Deflate for a block of type "dynamic", that is, with freely, optimally, created huffman trees*/
@@ -1856,8 +2194,12 @@ static unsigned deflateDynamic(LodePNGBitWriter* writer, Hash* hash,
     lodepng_memset(frequencies_cl, 0, NUM_CODE_LENGTH_CODES * sizeof(*frequencies_cl));
 
     if(settings->use_lz77) {
-      error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                         settings->minmatch, settings->nicematch, settings->lazymatching);
+      if(settings->fast_lz77) {
+        error = encodeLZ77Fast(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize);
+      } else {
+        error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
+                           settings->minmatch, settings->nicematch, settings->lazymatching);
+      }
       if(error) break;
     } else {
       if(!uivector_resize(&lz77_encoded, datasize)) ERROR_BREAK(83 /*alloc fail*/);
@@ -1993,7 +2335,8 @@ static unsigned deflateDynamic(LodePNGBitWriter* writer, Hash* hash,
     }
 
     /*write the compressed data symbols*/
-    writeLZ77data(writer, &lz77_encoded, &tree_ll, &tree_d);
+    error = writeLZ77data(writer, &lz77_encoded, &tree_ll, &tree_d);
+    if(error) break;
     /*error: the length of the end code 256 must be larger than 0*/
     if(tree_ll.lengths[256] == 0) ERROR_BREAK(64);
 
@@ -2042,9 +2385,13 @@ static unsigned deflateFixed(LodePNGBitWriter* writer, Hash* hash,
     if(settings->use_lz77) /*LZ77 encoded*/ {
       uivector lz77_encoded;
       uivector_init(&lz77_encoded);
-      error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                         settings->minmatch, settings->nicematch, settings->lazymatching);
-      if(!error) writeLZ77data(writer, &lz77_encoded, &tree_ll, &tree_d);
+      if(settings->fast_lz77) {
+        error = encodeLZ77Fast(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize);
+      } else {
+        error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
+                           settings->minmatch, settings->nicematch, settings->lazymatching);
+      }
+      if(!error) error = writeLZ77data(writer, &lz77_encoded, &tree_ll, &tree_d);
       uivector_cleanup(&lz77_encoded);
     } else /*no LZ77, but still will be Huffman compressed*/ {
       for(i = datapos; i < dataend; ++i) {
@@ -2062,8 +2409,11 @@ static unsigned deflateFixed(LodePNGBitWriter* writer, Hash* hash,
   return error;
 }
 
-static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
-                                 const LodePNGCompressSettings* settings) {
+/*deflates in as a part of a deflate stream. If final is 0, none of the blocks has BFINAL set and the
+output ends with an empty stored block (like zlib's Z_SYNC_FLUSH), so it is byte aligned and another
+part can be appended to it. Matches never refer to data before in, so the parts are independent.*/
+static unsigned deflatePart(ucvector* out, const unsigned char* in, size_t insize,
+                            const LodePNGCompressSettings* settings, unsigned final) {
   unsigned error = 0;
   size_t i, blocksize, numdeflateblocks;
   Hash hash;
@@ -2072,7 +2422,8 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
   LodePNGBitWriter_init(&writer, out);
 
   if(settings->btype > 2) return 61;
-  else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
+  /*stored blocks already end byte aligned*/
+  else if(settings->btype == 0) return deflateNoCompression(out, in, insize, final);
   else if(settings->btype == 1) blocksize = insize;
   else /*if(settings->btype == 2)*/ {
     /*on PNGs, deflate blocks of 65-262k seem to give most dense encoding*/
@@ -2088,21 +2439,34 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
 
   if(!error) {
     for(i = 0; i != numdeflateblocks && !error; ++i) {
-      unsigned final = (i == numdeflateblocks - 1);
+      unsigned BFINAL = final && (i == numdeflateblocks - 1);
       size_t start = i * blocksize;
       size_t end = start + blocksize;
       if(end > insize) end = insize;
 
-      if(settings->btype == 1) error = deflateFixed(&writer, &hash, in, start, end, settings, final);
-      else if(settings->btype == 2) error = deflateDynamic(&writer, &hash, in, start, end, settings, final);
+      if(settings->btype == 1) error = deflateFixed(&writer, &hash, in, start, end, settings, BFINAL);
+      else if(settings->btype == 2) error = deflateDynamic(&writer, &hash, in, start, end, settings, BFINAL);
     }
   }
 
+  if(!error && !final) {
+    /*empty stored block: 3 header bits, the rest of the byte is padding, then LEN 0 and NLEN 0xffff*/
+    static const unsigned char emptyblock[4] = {0, 0, 255, 255};
+    writeBits(&writer, 0, 3);
+    if(!ucvector_resize(out, out->size + 4)) error = 83; /*alloc fail*/
+    else lodepng_memcpy(out->data + out->size - 4, emptyblock, 4);
+  }
+
   hash_cleanup(&hash);
 
   return error;
 }
 
+static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
+                                 const LodePNGCompressSettings* settings) {
+  return deflatePart(out, in, insize, settings, 1);
+}
+
 unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGCompressSettings* settings) {
@@ -2131,14 +2495,103 @@ static unsigned deflate(unsigned char** out, size_t* outsize,
 /* / Adler32                                                                / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
-static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len) {
+#ifdef LODEPNG_SIMD_X86_RUNTIME
+/*
+Adler32 with SIMD, for len a multiple of 32. s1 is the sum of the bytes (psadbw) and s2 the sum of the bytes
+weighted by their distance to the end of the 32 byte block (pmaddubsw), plus 32 times the s1 before each
+block, which is collected in ps. At most 5552 bytes are summed between two modulo divisions, as in the
+scalar code.
+*/
+__attribute__((target("ssse3")))
+static unsigned update_adler32Ssse3(unsigned adler, const unsigned char* data, size_t len) {
+  const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+  const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  unsigned s1 = adler & 0xffffu;
+  unsigned s2 = (adler >> 16u) & 0xffffu;
+  size_t blocks = len / 32u;
+
+  while(blocks != 0) {
+    size_t n = blocks > 5552u / 32u ? 5552u / 32u : blocks;
+    __m128i ps = _mm_cvtsi32_si128((int)(s1 * n)), vs1 = zero, vs2 = _mm_cvtsi32_si128((int)s2);
+    blocks -= n;
+    for(; n != 0; --n, data += 32) {
+      __m128i bytes1 = _mm_loadu_si128((const __m128i*)data);
+      __m128i bytes2 = _mm_loadu_si128((const __m128i*)(data + 16));
+      ps = _mm_add_epi32(ps, vs1);
+      vs1 = _mm_add_epi32(vs1, _mm_add_epi32(_mm_sad_epu8(bytes1, zero), _mm_sad_epu8(bytes2, zero)));
+      vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+      vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+    }
+    vs2 = _mm_add_epi32(vs2, _mm_slli_epi32(ps, 5));
+    vs1 = _mm_add_epi32(vs1, _mm_shuffle_epi32(vs1, _MM_SHUFFLE(1, 0, 3, 2)));
+    vs2 = _mm_add_epi32(vs2, _mm_shuffle_epi32(vs2, _MM_SHUFFLE(1, 0, 3, 2)));
+    vs2 = _mm_add_epi32(vs2, _mm_shuffle_epi32(vs2, _MM_SHUFFLE(2, 3, 0, 1)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(vs1)) % 65521u;
+    s2 = (unsigned)_mm_cvtsi128_si32(vs2) % 65521u;
+  }
+
+  return (s2 << 16u) | s1;
+}
+
+/*Same as update_adler32Ssse3, but a 32 byte block in one AVX2 register*/
+__attribute__((target("avx2")))
+static unsigned update_adler32Avx2(unsigned adler, const unsigned char* data, size_t len) {
+  const __m256i tap = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                       16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
   unsigned s1 = adler & 0xffffu;
   unsigned s2 = (adler >> 16u) & 0xffffu;
+  size_t blocks = len / 32u;
+
+  while(blocks != 0) {
+    size_t n = blocks > 5552u / 32u ? 5552u / 32u : blocks;
+    __m256i ps = _mm256_setr_epi32((int)(s1 * n), 0, 0, 0, 0, 0, 0, 0), vs1 = zero;
+    __m256i vs2 = _mm256_setr_epi32((int)s2, 0, 0, 0, 0, 0, 0, 0);
+    __m128i s1sum, s2sum;
+    blocks -= n;
+    for(; n != 0; --n, data += 32) {
+      __m256i bytes = _mm256_loadu_si256((const __m256i*)data);
+      ps = _mm256_add_epi32(ps, vs1);
+      vs1 = _mm256_add_epi32(vs1, _mm256_sad_epu8(bytes, zero));
+      vs2 = _mm256_add_epi32(vs2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, tap), ones));
+    }
+    vs2 = _mm256_add_epi32(vs2, _mm256_slli_epi32(ps, 5));
+    s1sum = _mm_add_epi32(_mm256_castsi256_si128(vs1), _mm256_extracti128_si256(vs1, 1));
+    s2sum = _mm_add_epi32(_mm256_castsi256_si128(vs2), _mm256_extracti128_si256(vs2, 1));
+    s1sum = _mm_add_epi32(s1sum, _mm_shuffle_epi32(s1sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    s2sum = _mm_add_epi32(s2sum, _mm_shuffle_epi32(s2sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    s2sum = _mm_add_epi32(s2sum, _mm_shuffle_epi32(s2sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(s1sum)) % 65521u;
+    s2 = (unsigned)_mm_cvtsi128_si32(s2sum) % 65521u;
+  }
+
+  return (s2 << 16u) | s1;
+}
+#endif /*LODEPNG_SIMD_X86_RUNTIME*/
 
+static unsigned update_adler32(unsigned adler, const unsigned char* data, size_t len) {
+  unsigned s1, s2;
+
+#ifdef LODEPNG_SIMD_X86_RUNTIME
+  if(len >= 64) {
+    size_t amount = len & ~(size_t)31u;
+    if(__builtin_cpu_supports("avx2")) adler = update_adler32Avx2(adler, data, amount);
+    else if(__builtin_cpu_supports("ssse3")) adler = update_adler32Ssse3(adler, data, amount);
+    else amount = 0;
+    data += amount;
+    len -= amount;
+  }
+#endif /*LODEPNG_SIMD_X86_RUNTIME*/
+
+  s1 = adler & 0xffffu;
+  s2 = (adler >> 16u) & 0xffffu;
   while(len != 0u) {
-    unsigned i;
+    size_t i;
     /*at least 5552 sums can be done before the sums overflow, saving a lot of module divisions*/
-    unsigned amount = len > 5552u ? 5552u : len;
+    size_t amount = len > 5552u ? 5552u : len;
     len -= amount;
     for(i = 0; i != amount; ++i) {
       s1 += (*data++);
@@ -2156,6 +2609,27 @@ static unsigned adler32(const unsigned char* data, unsigned len) {
   return update_adler32(1u, data, len);
 }
 
+unsigned lodepng_adler32(const unsigned char* data, size_t len) {
+  return update_adler32(1u, data, len);
+}
+
+#ifdef LODEPNG_COMPILE_ENCODER
+/*Return the adler32 of A followed by B, given adler1 of A, adler2 of B and the length of B, as zlib's
+adler32_combine. s1 of A is added once for each byte of B to s2, and the initial 1 of B is removed.*/
+static unsigned adler32_combine(unsigned adler1, unsigned adler2, size_t len2) {
+  unsigned rem = (unsigned)(len2 % 65521u);
+  unsigned s1 = adler1 & 0xffffu;
+  unsigned s2 = (unsigned)(((unsigned long)rem * s1) % 65521u);
+  s1 += (adler2 & 0xffffu) + 65521u - 1u;
+  s2 += ((adler1 >> 16u) & 0xffffu) + ((adler2 >> 16u) & 0xffffu) + 65521u - rem;
+  if(s1 >= 65521u) s1 -= 65521u;
+  if(s1 >= 65521u) s1 -= 65521u;
+  if(s2 >= 65521u * 2u) s2 -= 65521u * 2u;
+  if(s2 >= 65521u) s2 -= 65521u;
+  return (s2 << 16u) | s1;
+}
+#endif /*LODEPNG_COMPILE_ENCODER*/
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Zlib                                                                   / */
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -2329,13 +2803,14 @@ void lodepng_compress_settings_init(LodePNGCompressSettings* settings) {
   settings->minmatch = 3;
   settings->nicematch = 128;
   settings->lazymatching = 1;
+  settings->fast_lz77 = 0;
 
   settings->custom_zlib = 0;
   settings->custom_deflate = 0;
   settings->custom_context = 0;
 }
 
-const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0};
+const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0, 0};
 
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
@@ -2350,9 +2825,10 @@ void lodepng_decompress_settings_init(LodePNGDecompressSettings* settings) {
   settings->custom_zlib = 0;
   settings->custom_inflate = 0;
   settings->custom_context = 0;
+  settings->reference_inflate = 0;
 }
 
-const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0, 0, 0};
+const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0, 0, 0, 0};
 
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -2370,50 +2846,376 @@ const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0,
 
 
 #ifndef LODEPNG_NO_COMPILE_CRC
-/* CRC polynomial: 0xedb88320 */
-static unsigned lodepng_crc32_table[256] = {
-           0u, 1996959894u, 3993919788u, 2567524794u,  124634137u, 1886057615u, 3915621685u, 2657392035u,
-   249268274u, 2044508324u, 3772115230u, 2547177864u,  162941995u, 2125561021u, 3887607047u, 2428444049u,
-   498536548u, 1789927666u, 4089016648u, 2227061214u,  450548861u, 1843258603u, 4107580753u, 2211677639u,
-   325883990u, 1684777152u, 4251122042u, 2321926636u,  335633487u, 1661365465u, 4195302755u, 2366115317u,
-   997073096u, 1281953886u, 3579855332u, 2724688242u, 1006888145u, 1258607687u, 3524101629u, 2768942443u,
-   901097722u, 1119000684u, 3686517206u, 2898065728u,  853044451u, 1172266101u, 3705015759u, 2882616665u,
-   651767980u, 1373503546u, 3369554304u, 3218104598u,  565507253u, 1454621731u, 3485111705u, 3099436303u,
-   671266974u, 1594198024u, 3322730930u, 2970347812u,  795835527u, 1483230225u, 3244367275u, 3060149565u,
-  1994146192u,   31158534u, 2563907772u, 4023717930u, 1907459465u,  112637215u, 2680153253u, 3904427059u,
-  2013776290u,  251722036u, 2517215374u, 3775830040u, 2137656763u,  141376813u, 2439277719u, 3865271297u,
-  1802195444u,  476864866u, 2238001368u, 4066508878u, 1812370925u,  453092731u, 2181625025u, 4111451223u,
-  1706088902u,  314042704u, 2344532202u, 4240017532u, 1658658271u,  366619977u, 2362670323u, 4224994405u,
-  1303535960u,  984961486u, 2747007092u, 3569037538u, 1256170817u, 1037604311u, 2765210733u, 3554079995u,
-  1131014506u,  879679996u, 2909243462u, 3663771856u, 1141124467u,  855842277u, 2852801631u, 3708648649u,
-  1342533948u,  654459306u, 3188396048u, 3373015174u, 1466479909u,  544179635u, 3110523913u, 3462522015u,
-  1591671054u,  702138776u, 2966460450u, 3352799412u, 1504918807u,  783551873u, 3082640443u, 3233442989u,
-  3988292384u, 2596254646u,   62317068u, 1957810842u, 3939845945u, 2647816111u,   81470997u, 1943803523u,
-  3814918930u, 2489596804u,  225274430u, 2053790376u, 3826175755u, 2466906013u,  167816743u, 2097651377u,
-  4027552580u, 2265490386u,  503444072u, 1762050814u, 4150417245u, 2154129355u,  426522225u, 1852507879u,
-  4275313526u, 2312317920u,  282753626u, 1742555852u, 4189708143u, 2394877945u,  397917763u, 1622183637u,
-  3604390888u, 2714866558u,  953729732u, 1340076626u, 3518719985u, 2797360999u, 1068828381u, 1219638859u,
-  3624741850u, 2936675148u,  906185462u, 1090812512u, 3747672003u, 2825379669u,  829329135u, 1181335161u,
-  3412177804u, 3160834842u,  628085408u, 1382605366u, 3423369109u, 3138078467u,  570562233u, 1426400815u,
-  3317316542u, 2998733608u,  733239954u, 1555261956u, 3268935591u, 3050360625u,  752459403u, 1541320221u,
-  2607071920u, 3965973030u, 1969922972u,   40735498u, 2617837225u, 3943577151u, 1913087877u,   83908371u,
-  2512341634u, 3803740692u, 2075208622u,  213261112u, 2463272603u, 3855990285u, 2094854071u,  198958881u,
-  2262029012u, 4057260610u, 1759359992u,  534414190u, 2176718541u, 4139329115u, 1873836001u,  414664567u,
-  2282248934u, 4279200368u, 1711684554u,  285281116u, 2405801727u, 4167216745u, 1634467795u,  376229701u,
-  2685067896u, 3608007406u, 1308918612u,  956543938u, 2808555105u, 3495958263u, 1231636301u, 1047427035u,
-  2932959818u, 3654703836u, 1088359270u,  936918000u, 2847714899u, 3736837829u, 1202900863u,  817233897u,
-  3183342108u, 3401237130u, 1404277552u,  615818150u, 3134207493u, 3453421203u, 1423857449u,  601450431u,
-  3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
+/*
+CRC polynomial: 0xedb88320. Table k is the CRC of a byte followed by k zero bytes, so slice-by-8 can look
+up 8 bytes at once: lodepng_crc32_table[0] is the usual byte-at-a-time table.
+*/
+static const unsigned lodepng_crc32_table[8][256] = {
+  {
+             0u, 1996959894u, 3993919788u, 2567524794u,  124634137u, 1886057615u, 3915621685u, 2657392035u,
+     249268274u, 2044508324u, 3772115230u, 2547177864u,  162941995u, 2125561021u, 3887607047u, 2428444049u,
+     498536548u, 1789927666u, 4089016648u, 2227061214u,  450548861u, 1843258603u, 4107580753u, 2211677639u,
+     325883990u, 1684777152u, 4251122042u, 2321926636u,  335633487u, 1661365465u, 4195302755u, 2366115317u,
+     997073096u, 1281953886u, 3579855332u, 2724688242u, 1006888145u, 1258607687u, 3524101629u, 2768942443u,
+     901097722u, 1119000684u, 3686517206u, 2898065728u,  853044451u, 1172266101u, 3705015759u, 2882616665u,
+     651767980u, 1373503546u, 3369554304u, 3218104598u,  565507253u, 1454621731u, 3485111705u, 3099436303u,
+     671266974u, 1594198024u, 3322730930u, 2970347812u,  795835527u, 1483230225u, 3244367275u, 3060149565u,
+    1994146192u,   31158534u, 2563907772u, 4023717930u, 1907459465u,  112637215u, 2680153253u, 3904427059u,
+    2013776290u,  251722036u, 2517215374u, 3775830040u, 2137656763u,  141376813u, 2439277719u, 3865271297u,
+    1802195444u,  476864866u, 2238001368u, 4066508878u, 1812370925u,  453092731u, 2181625025u, 4111451223u,
+    1706088902u,  314042704u, 2344532202u, 4240017532u, 1658658271u,  366619977u, 2362670323u, 4224994405u,
+    1303535960u,  984961486u, 2747007092u, 3569037538u, 1256170817u, 1037604311u, 2765210733u, 3554079995u,
+    1131014506u,  879679996u, 2909243462u, 3663771856u, 1141124467u,  855842277u, 2852801631u, 3708648649u,
+    1342533948u,  654459306u, 3188396048u, 3373015174u, 1466479909u,  544179635u, 3110523913u, 3462522015u,
+    1591671054u,  702138776u, 2966460450u, 3352799412u, 1504918807u,  783551873u, 3082640443u, 3233442989u,
+    3988292384u, 2596254646u,   62317068u, 1957810842u, 3939845945u, 2647816111u,   81470997u, 1943803523u,
+    3814918930u, 2489596804u,  225274430u, 2053790376u, 3826175755u, 2466906013u,  167816743u, 2097651377u,
+    4027552580u, 2265490386u,  503444072u, 1762050814u, 4150417245u, 2154129355u,  426522225u, 1852507879u,
+    4275313526u, 2312317920u,  282753626u, 1742555852u, 4189708143u, 2394877945u,  397917763u, 1622183637u,
+    3604390888u, 2714866558u,  953729732u, 1340076626u, 3518719985u, 2797360999u, 1068828381u, 1219638859u,
+    3624741850u, 2936675148u,  906185462u, 1090812512u, 3747672003u, 2825379669u,  829329135u, 1181335161u,
+    3412177804u, 3160834842u,  628085408u, 1382605366u, 3423369109u, 3138078467u,  570562233u, 1426400815u,
+    3317316542u, 2998733608u,  733239954u, 1555261956u, 3268935591u, 3050360625u,  752459403u, 1541320221u,
+    2607071920u, 3965973030u, 1969922972u,   40735498u, 2617837225u, 3943577151u, 1913087877u,   83908371u,
+    2512341634u, 3803740692u, 2075208622u,  213261112u, 2463272603u, 3855990285u, 2094854071u,  198958881u,
+    2262029012u, 4057260610u, 1759359992u,  534414190u, 2176718541u, 4139329115u, 1873836001u,  414664567u,
+    2282248934u, 4279200368u, 1711684554u,  285281116u, 2405801727u, 4167216745u, 1634467795u,  376229701u,
+    2685067896u, 3608007406u, 1308918612u,  956543938u, 2808555105u, 3495958263u, 1231636301u, 1047427035u,
+    2932959818u, 3654703836u, 1088359270u,  936918000u, 2847714899u, 3736837829u, 1202900863u,  817233897u,
+    3183342108u, 3401237130u, 1404277552u,  615818150u, 3134207493u, 3453421203u, 1423857449u,  601450431u,
+    3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
+  },
+  {
+             0u,  421212481u,  842424962u,  724390851u, 1684849924u, 2105013317u, 1448781702u, 1329698503u,
+    3369699848u, 3519200073u, 4210026634u, 3824474571u, 2897563404u, 3048111693u, 2659397006u, 2274893007u,
+    1254232657u, 1406739216u, 2029285587u, 1643069842u,  783210325u,  934667796u,  479770071u,   92505238u,
+    2182846553u, 2600511768u, 2955803355u, 2838940570u, 3866582365u, 4285295644u, 3561045983u, 3445231262u,
+    2508465314u, 2359236067u, 2813478432u, 3198777185u, 4058571174u, 3908292839u, 3286139684u, 3670389349u,
+    1566420650u, 1145479147u, 1869335592u, 1987116393u,  959540142u,  539646703u,  185010476u,  303839341u,
+    3745920755u, 3327985586u, 3983561841u, 4100678960u, 3140154359u, 2721170102u, 2300350837u, 2416418868u,
+     396344571u,  243568058u,  631889529u, 1018359608u, 1945336319u, 1793607870u, 1103436669u, 1490954812u,
+    4034481925u, 3915546180u, 3259968903u, 3679722694u, 2484439553u, 2366552896u, 2787371139u, 3208174018u,
+     950060301u,  565965900u,  177645455u,  328046286u, 1556873225u, 1171730760u, 1861902987u, 2011255754u,
+    3132841300u, 2745199637u, 2290958294u, 2442530455u, 3738671184u, 3352078609u, 3974232786u, 4126854035u,
+    1919080284u, 1803150877u, 1079293406u, 1498383519u,  370020952u,  253043481u,  607678682u, 1025720731u,
+    1711106983u, 2095471334u, 1472923941u, 1322268772u,   26324643u,  411738082u,  866634785u,  717028704u,
+    2904875439u, 3024081134u, 2668790573u, 2248782444u, 3376948395u, 3495106026u, 4219356713u, 3798300520u,
+     792689142u,  908347575u,  487136116u,   68299317u, 1263779058u, 1380486579u, 2036719216u, 1618931505u,
+    3890672638u, 4278043327u, 3587215740u, 3435896893u, 2206873338u, 2593195963u, 2981909624u, 2829542713u,
+     998479947u,  580430090u,  162921161u,  279890824u, 1609522511u, 1190423566u, 1842954189u, 1958874764u,
+    4082766403u, 3930137346u, 3245109441u, 3631694208u, 2536953671u, 2385372678u, 2768287173u, 3155920004u,
+    1900120602u, 1750776667u, 1131931800u, 1517083097u,  355290910u,  204897887u,  656092572u, 1040194781u,
+    3113746450u, 2692952403u, 2343461520u, 2461357009u, 3723805974u, 3304059991u, 4022511508u, 4141455061u,
+    2919742697u, 3072101800u, 2620513899u, 2234183466u, 3396041197u, 3547351212u, 4166851439u, 3779471918u,
+    1725839073u, 2143618976u, 1424512099u, 1307796770u,   45282277u,  464110244u,  813994343u,  698327078u,
+    3838160568u, 4259225593u, 3606301754u, 3488152955u, 2158586812u, 2578602749u, 2996767038u, 2877569151u,
+     740041904u,  889656817u,  506086962u,  120682355u, 1215357364u, 1366020341u, 2051441462u, 1667084919u,
+    3422213966u, 3538019855u, 4190942668u, 3772220557u, 2945847882u, 3062702859u, 2644537544u, 2226864521u,
+      52649286u,  439905287u,  823476164u,  672009861u, 1733269570u, 2119477507u, 1434057408u, 1281543041u,
+    2167981343u, 2552493150u, 3004082077u, 2853541596u, 3847487515u, 4233048410u, 3613549209u, 3464057816u,
+    1239502615u, 1358593622u, 2077699477u, 1657543892u,  764250643u,  882293586u,  532408465u,  111204816u,
+    1585378284u, 1197851309u, 1816695150u, 1968414767u,  974272232u,  587794345u,  136598634u,  289367339u,
+    2527558116u, 2411481253u, 2760973158u, 3179948583u, 4073438432u, 3956313505u, 3237863010u, 3655790371u,
+     347922877u,  229101820u,  646611775u, 1066513022u, 1892689081u, 1774917112u, 1122387515u, 1543337850u,
+    3697634229u, 3313392372u, 3998419255u, 4148705398u, 3087642289u, 2702352368u, 2319436851u, 2468674930u
+  },
+  {
+             0u,   29518391u,   59036782u,   38190681u,  118073564u,  114017003u,   76381362u,   89069189u,
+     236147128u,  265370511u,  228034006u,  206958561u,  152762724u,  148411219u,  178138378u,  190596925u,
+     472294256u,  501532999u,  530741022u,  509615401u,  456068012u,  451764635u,  413917122u,  426358261u,
+     305525448u,  334993663u,  296822438u,  275991697u,  356276756u,  352202787u,  381193850u,  393929805u,
+     944588512u,  965684439u, 1003065998u,  973863097u, 1061482044u, 1049003019u, 1019230802u, 1023561829u,
+     912136024u,  933002607u,  903529270u,  874031361u,  827834244u,  815125939u,  852716522u,  856752605u,
+     611050896u,  631869351u,  669987326u,  640506825u,  593644876u,  580921211u,  551983394u,  556069653u,
+     712553512u,  733666847u,  704405574u,  675154545u,  762387700u,  749958851u,  787859610u,  792175277u,
+    1889177024u, 1901651959u, 1931368878u, 1927033753u, 2006131996u, 1985040171u, 1947726194u, 1976933189u,
+    2122964088u, 2135668303u, 2098006038u, 2093965857u, 2038461604u, 2017599123u, 2047123658u, 2076625661u,
+    1824272048u, 1836991623u, 1866005214u, 1861914857u, 1807058540u, 1786244187u, 1748062722u, 1777547317u,
+    1655668488u, 1668093247u, 1630251878u, 1625932113u, 1705433044u, 1684323811u, 1713505210u, 1742760333u,
+    1222101792u, 1226154263u, 1263738702u, 1251046777u, 1339974652u, 1310460363u, 1281013650u, 1301863845u,
+    1187289752u, 1191637167u, 1161842422u, 1149379777u, 1103966788u, 1074747507u, 1112139306u, 1133218845u,
+    1425107024u, 1429406311u, 1467333694u, 1454888457u, 1408811148u, 1379576507u, 1350309090u, 1371438805u,
+    1524775400u, 1528845279u, 1499917702u, 1487177649u, 1575719220u, 1546255107u, 1584350554u, 1605185389u,
+    3778354048u, 3774312887u, 3803303918u, 3816007129u, 3862737756u, 3892238699u, 3854067506u, 3833203973u,
+    4012263992u, 4007927823u, 3970080342u, 3982554209u, 3895452388u, 3924658387u, 3953866378u, 3932773565u,
+    4245928176u, 4241609415u, 4271336606u, 4283762345u, 4196012076u, 4225268251u, 4187931714u, 4166823541u,
+    4076923208u, 4072833919u, 4035198246u, 4047918865u, 4094247316u, 4123732899u, 4153251322u, 4132437965u,
+    3648544096u, 3636082519u, 3673983246u, 3678331705u, 3732010428u, 3753090955u, 3723829714u, 3694611429u,
+    3614117080u, 3601426159u, 3572488374u, 3576541825u, 3496125444u, 3516976691u, 3555094634u, 3525581405u,
+    3311336976u, 3298595879u, 3336186494u, 3340255305u, 3260503756u, 3281337595u, 3251864226u, 3222399125u,
+    3410866088u, 3398419871u, 3368647622u, 3372945905u, 3427010420u, 3448139075u, 3485520666u, 3456284973u,
+    2444203584u, 2423127159u, 2452308526u, 2481530905u, 2527477404u, 2539934891u, 2502093554u, 2497740997u,
+    2679949304u, 2659102159u, 2620920726u, 2650438049u, 2562027300u, 2574714131u, 2603727690u, 2599670141u,
+    2374579504u, 2353749767u, 2383274334u, 2412743529u, 2323684844u, 2336421851u, 2298759554u, 2294686645u,
+    2207933576u, 2186809023u, 2149495014u, 2178734801u, 2224278612u, 2236720739u, 2266437690u, 2262135309u,
+    2850214048u, 2820717207u, 2858812622u, 2879680249u, 2934667388u, 2938704459u, 2909776914u, 2897069605u,
+    2817622296u, 2788420399u, 2759153014u, 2780249921u, 2700618180u, 2704950259u, 2742877610u, 2730399645u,
+    3049550800u, 3020298727u, 3057690558u, 3078802825u, 2999835404u, 3004150075u, 2974355298u, 2961925461u,
+    3151438440u, 3121956959u, 3092510214u, 3113327665u, 3168701108u, 3172786307u, 3210370778u, 3197646061u
+  },
+  {
+             0u, 3099354981u, 2852767883u,  313896942u, 2405603159u,  937357362u,  627793884u, 2648127673u,
+    3316918511u, 2097696650u, 1874714724u, 3607201537u, 1255587768u, 4067088605u, 3772741427u, 1482887254u,
+    1343838111u, 3903140090u, 4195393300u, 1118632049u, 3749429448u, 1741137837u, 1970407491u, 3452858150u,
+    2511175536u,  756094997u, 1067759611u, 2266550430u,  449832999u, 2725482306u, 2965774508u,  142231497u,
+    2687676222u,  412010587u,  171665333u, 2995192016u,  793786473u, 2548850444u, 2237264098u, 1038456711u,
+    1703315409u, 3711623348u, 3482275674u, 1999841343u, 3940814982u, 1381529571u, 1089329165u, 4166106984u,
+    4029413537u, 1217896388u, 1512189994u, 3802027855u, 2135519222u, 3354724499u, 3577784189u, 1845280792u,
+     899665998u, 2367928107u, 2677414085u,  657096608u, 3137160985u,   37822588u,  284462994u, 2823350519u,
+    2601801789u,  598228824u,  824021174u, 2309093331u,  343330666u, 2898962447u, 3195996129u,  113467524u,
+    1587572946u, 3860600759u, 4104763481u, 1276501820u, 3519211397u, 1769898208u, 2076913422u, 3279374443u,
+    3406630818u, 1941006535u, 1627703081u, 3652755532u, 1148164341u, 4241751952u, 3999682686u, 1457141531u,
+     247015245u, 3053797416u, 2763059142u,  470583459u, 2178658330u,  963106687u,  735213713u, 2473467892u,
+     992409347u, 2207944806u, 2435792776u,  697522413u, 3024379988u,  217581361u,  508405983u, 2800865210u,
+    4271038444u, 1177467017u, 1419450215u, 3962007554u, 1911572667u, 3377213406u, 3690561584u, 1665525589u,
+    1799331996u, 3548628985u, 3241568279u, 2039091058u, 3831314379u, 1558270126u, 1314193216u, 4142438437u,
+    2928380019u,  372764438u,   75645176u, 3158189981u,  568925988u, 2572515393u, 2346768303u,  861712586u,
+    3982079547u, 1441124702u, 1196457648u, 4293663189u, 1648042348u, 3666298377u, 3358779879u, 1888390786u,
+     686661332u, 2421291441u, 2196002399u,  978858298u, 2811169155u,  523464422u,  226935048u, 3040519789u,
+    3175145892u,  100435649u,  390670639u, 2952089162u,  841119475u, 2325614998u, 2553003640u,  546822429u,
+    2029308235u, 3225988654u, 3539796416u, 1782671013u, 4153826844u, 1328167289u, 1570739863u, 3844338162u,
+    1298864389u, 4124540512u, 3882013070u, 1608431339u, 3255406162u, 2058742071u, 1744848601u, 3501990332u,
+    2296328682u,  811816591u,  584513889u, 2590678532u,  129869501u, 3204563416u, 2914283062u,  352848211u,
+     494030490u, 2781751807u, 3078325777u,  264757620u, 2450577869u,  715964072u,  941166918u, 2158327331u,
+    3636881013u, 1618608400u, 1926213374u, 3396585883u, 1470427426u, 4011365959u, 4255988137u, 1158766284u,
+    1984818694u, 3471935843u, 3695453837u, 1693991400u, 4180638033u, 1100160564u, 1395044826u, 3952793279u,
+    3019491049u,  189112716u,  435162722u, 2706139399u, 1016811966u, 2217162459u, 2526189877u,  774831696u,
+     643086745u, 2666061564u, 2354934034u,  887166583u, 2838900430u,  294275499u,   54519365u, 3145957664u,
+    3823145334u, 1532818963u, 1240029693u, 4048895640u, 1820460577u, 3560857924u, 3331051178u, 2117577167u,
+    3598663992u, 1858283101u, 2088143283u, 3301633750u, 1495127663u, 3785470218u, 4078182116u, 1269332353u,
+     332098007u, 2876706482u, 3116540252u,   25085497u, 2628386432u,  605395429u,  916469259u, 2384220526u,
+    2254837415u, 1054503362u,  745528876u, 2496903497u,  151290352u, 2981684885u, 2735556987u,  464596510u,
+    1137851976u, 4218313005u, 3923506883u, 1365741990u, 3434129695u, 1946996346u, 1723425172u, 3724871409u
+  },
+  {
+             0u, 1029712304u, 2059424608u, 1201699536u, 4118849216u, 3370159984u, 2403399072u, 2988497936u,
+     812665793u,  219177585u, 1253054625u, 2010132753u, 3320900865u, 4170237105u, 3207642721u, 2186319825u,
+    1625331586u, 1568718386u,  438355170u,  658566482u, 2506109250u, 2818578674u, 4020265506u, 3535817618u,
+    1351670851u, 1844508147u,  709922595u,  389064339u, 2769320579u, 2557498163u, 3754961379u, 3803185235u,
+    3250663172u, 4238411444u, 3137436772u, 2254525908u,  876710340u,  153198708u, 1317132964u, 1944187668u,
+    4054934725u, 3436268917u, 2339452837u, 3054575125u,   70369797u,  961670069u, 2129760613u, 1133623509u,
+    2703341702u, 2621542710u, 3689016294u, 3867263574u, 1419845190u, 1774270454u,  778128678u,  318858390u,
+    2438067015u, 2888948471u, 3952189479u, 3606153623u, 1691440519u, 1504803895u,  504432359u,  594620247u,
+    1492342857u, 1704161785u,  573770537u,  525542041u, 2910060169u, 2417219385u, 3618876905u, 3939730521u,
+    1753420680u, 1440954936u,  306397416u,  790849880u, 2634265928u, 2690882808u, 3888375336u, 3668168600u,
+     940822475u,   91481723u, 1121164459u, 2142483739u, 3448989963u, 4042473659u, 3075684971u, 2318603227u,
+     140739594u,  889433530u, 1923340138u, 1338244826u, 4259521226u, 3229813626u, 2267247018u, 3124975642u,
+    2570221389u, 2756861693u, 3824297005u, 3734113693u, 1823658381u, 1372780605u,  376603373u,  722643805u,
+    2839690380u, 2485261628u, 3548540908u, 4007806556u, 1556257356u, 1638052860u,  637716780u,  459464860u,
+    4191346895u, 3300051327u, 2199040943u, 3195181599u,  206718479u,  825388991u, 1989285231u, 1274166495u,
+    3382881038u, 4106388158u, 3009607790u, 2382549470u, 1008864718u,   21111934u, 1189240494u, 2072147742u,
+    2984685714u, 2357631266u, 3408323570u, 4131834434u, 1147541074u, 2030452706u, 1051084082u,   63335554u,
+    2174155603u, 3170292451u, 4216760371u, 3325460867u, 1947622803u, 1232499747u,  248909555u,  867575619u,
+    3506841360u, 3966111392u, 2881909872u, 2527485376u,  612794832u,  434546784u, 1581699760u, 1663499008u,
+    3782634705u, 3692447073u, 2612412337u, 2799048193u,  351717905u,  697754529u, 1849071985u, 1398190273u,
+    1881644950u, 1296545318u,  182963446u,  931652934u, 2242328918u, 3100053734u, 4284967478u, 3255255942u,
+    1079497815u, 2100821479u,  983009079u,  133672583u, 3050795671u, 2293717799u, 3474399735u, 4067887175u,
+     281479188u,  765927844u, 1778867060u, 1466397380u, 3846680276u, 3626469220u, 2676489652u, 2733102084u,
+     548881365u,  500656741u, 1517752501u, 1729575173u, 3577210133u, 3898068133u, 2952246901u, 2459410373u,
+    3910527195u, 3564487019u, 2480257979u, 2931134987u,  479546907u,  569730987u, 1716854139u, 1530213579u,
+    3647316762u, 3825568426u, 2745561210u, 2663766474u,  753206746u,  293940330u, 1445287610u, 1799716618u,
+    2314567513u, 3029685993u, 4080348217u, 3461678473u, 2088098201u, 1091956777u,  112560889u, 1003856713u,
+    3112514712u, 2229607720u, 3276105720u, 4263857736u, 1275433560u, 1902492648u,  918929720u,  195422344u,
+     685033439u,  364179055u, 1377080511u, 1869921551u, 3713294623u, 3761522863u, 2811507327u, 2599689167u,
+     413436958u,  633644462u, 1650777982u, 1594160846u, 3978570462u, 3494118254u, 2548332990u, 2860797966u,
+    1211387997u, 1968470509u,  854852413u,  261368461u, 3182753437u, 2161434413u, 3346310653u, 4195650637u,
+    2017729436u, 1160000044u,   42223868u, 1071931724u, 2378480988u, 2963576044u, 4144295484u, 3395602316u
+  },
+  {
+             0u, 3411858341u, 1304994059u, 2257875630u, 2609988118u, 1355649459u, 3596215069u,  486879416u,
+    3964895853u,  655315400u, 2711298918u, 1791488195u, 2009251963u, 3164476382u,  973758832u, 4048990933u,
+      64357019u, 3364540734u, 1310630800u, 2235723829u, 2554806413u, 1394316072u, 3582976390u,  517157411u,
+    4018503926u,  618222419u, 2722963965u, 1762783832u, 1947517664u, 3209171269u,  970744811u, 4068520014u,
+     128714038u, 3438335635u, 1248109629u, 2167961496u, 2621261600u, 1466012805u, 3522553387u,  447296910u,
+    3959392091u,  547575038u, 2788632144u, 1835791861u, 1886307661u, 3140622056u, 1034314822u, 4143626211u,
+      75106221u, 3475428360u, 1236444838u, 2196665603u, 2682996155u, 1421317662u, 3525567664u,  427767573u,
+    3895035328u,  594892389u, 2782995659u, 1857943406u, 1941489622u, 3101955187u, 1047553757u, 4113347960u,
+     257428076u, 3288652233u, 1116777319u, 2311878850u, 2496219258u, 1603640287u, 3640781169u,  308099796u,
+    3809183745u,  676813732u, 2932025610u, 1704983215u, 2023410199u, 3016104370u,  894593820u, 4262377657u,
+     210634999u, 3352484690u, 1095150076u, 2316991065u, 2535410401u, 1547934020u, 3671583722u,  294336591u,
+    3772615322u,  729897279u, 2903845777u, 1716123700u, 2068629644u, 2953845545u,  914647431u, 4258839074u,
+     150212442u, 3282623743u, 1161604689u, 2388688372u, 2472889676u, 1480171241u, 3735940167u,  368132066u,
+    3836185911u,  805002898u, 2842635324u, 1647574937u, 2134298401u, 3026852996u,  855535146u, 4188192143u,
+     186781121u, 3229539940u, 1189784778u, 2377547631u, 2427670487u, 1542429810u, 3715886812u,  371670393u,
+    3882979244u,  741170185u, 2864262823u, 1642462466u, 2095107514u, 3082559007u,  824732849u, 4201955092u,
+     514856152u, 3589064573u, 1400419795u, 2552522358u, 2233554638u, 1316849003u, 3370776517u,   62202976u,
+    4075001525u,  968836368u, 3207280574u, 1954014235u, 1769133219u, 2720925446u,  616199592u, 4024870413u,
+     493229635u, 3594175974u, 1353627464u, 2616354029u, 2264355925u, 1303087088u, 3409966430u,    6498043u,
+    4046820398u,  979978123u, 3170710821u, 2007099008u, 1789187640u, 2717386141u,  661419827u, 3962610838u,
+     421269998u, 3527459403u, 1423225061u, 2676515648u, 2190300152u, 1238466653u, 3477467891u,   68755798u,
+    4115633027u, 1041448998u, 3095868040u, 1943789869u, 1860096405u, 2776760880u,  588673182u, 3897205563u,
+     449450869u, 3516317904u, 1459794558u, 2623431131u, 2170245475u, 1242006214u, 3432247400u,  131015629u,
+    4137259288u, 1036337853u, 3142660115u, 1879958454u, 1829294862u, 2790523051u,  549483013u, 3952910752u,
+     300424884u, 3669282065u, 1545650111u, 2541513754u, 2323209378u, 1092980487u, 3350330793u,  216870412u,
+    4256931033u,  921128828u, 2960342482u, 2066738807u, 1714085583u, 2910195050u,  736264132u, 3770592353u,
+     306060335u, 3647131530u, 1610005796u, 2494197377u, 2309971513u, 1123257756u, 3295149874u,  255536279u,
+    4268596802u,  892423655u, 3013951305u, 2029645036u, 1711070292u, 2929725425u,  674528607u, 3815288570u,
+     373562242u, 3709388839u, 1535949449u, 2429577516u, 2379569556u, 1183418929u, 3223189663u,  188820282u,
+    4195850735u,  827017802u, 3084859620u, 2089020225u, 1636228089u, 2866415708u,  743340786u, 3876759895u,
+     361896217u, 3738094268u, 1482340370u, 2466671543u, 2382584591u, 1163888810u, 3284924932u,  144124321u,
+    4190215028u,  849168593u, 3020503679u, 2136336858u, 1649465698u, 2836138695u,  798521449u, 3838094284u
+  },
+  {
+             0u, 2792819636u, 2543784233u,  837294749u, 4098827283u, 1379413927u, 1674589498u, 3316072078u,
+     871321191u, 2509784531u, 2758827854u,   34034938u, 3349178996u, 1641505216u, 1346337629u, 4131942633u,
+    1742642382u, 3249117050u, 4030828007u, 1446413907u, 2475800797u,  904311657u,   68069876u, 2725880384u,
+    1412551337u, 4064729373u, 3283010432u, 1708771380u, 2692675258u,  101317902u,  937551763u, 2442587175u,
+    3485284764u, 1774858792u, 1478633653u, 4266992385u, 1005723023u, 2642744891u, 2892827814u,  169477906u,
+    4233263099u, 1512406095u, 1808623314u, 3451546982u,  136139752u, 2926205020u, 2676114113u,  972376437u,
+    2825102674u,  236236518u, 1073525883u, 2576072655u, 1546420545u, 4200303349u, 3417542760u, 1841601500u,
+    2609703733u, 1039917185u,  202635804u, 2858742184u, 1875103526u, 3384067218u, 4166835727u, 1579931067u,
+    1141601657u, 3799809741u, 3549717584u, 1977839588u, 2957267306u,  372464350u,  668680259u, 2175552503u,
+    2011446046u, 3516084394u, 3766168119u, 1175200131u, 2209029901u,  635180217u,  338955812u, 2990736784u,
+     601221559u, 2242044419u, 3024812190u,  306049834u, 3617246628u, 1911408144u, 1074125965u, 3866285881u,
+     272279504u, 3058543716u, 2275784441u,  567459149u, 3832906691u, 1107462263u, 1944752874u, 3583875422u,
+    2343980261u,  767641425u,  472473036u, 3126744696u, 2147051766u, 3649987394u, 3899029983u, 1309766251u,
+    3092841090u,  506333494u,  801510315u, 2310084639u, 1276520081u, 3932237093u, 3683203000u, 2113813516u,
+    3966292011u, 1243601823u, 2079834370u, 3716205238u,  405271608u, 3192979340u, 2411259153u,  701492901u,
+    3750207052u, 2045810168u, 1209569125u, 4000285905u,  734575199u, 2378150379u, 3159862134u,  438345922u,
+    2283203314u,  778166598u,  529136603u, 3120492655u, 2086260449u, 3660498261u, 3955679176u, 1303499900u,
+    3153699989u,  495890209u,  744928700u, 2316418568u, 1337360518u, 3921775410u, 3626602927u, 2120129051u,
+    4022892092u, 1237286280u, 2018993941u, 3726666913u,  461853231u, 3186645403u, 2350400262u,  711936178u,
+    3693557851u, 2052076527u, 1270360434u, 3989775046u,  677911624u, 2384402428u, 3220639073u,  427820757u,
+    1202443118u, 3789347034u, 3493118535u, 1984154099u, 3018127229u,  362020041u,  612099668u, 2181885408u,
+    1950653705u, 3526596285u, 3822816288u, 1168934804u, 2148251930u,  645706414u,  395618355u, 2984485767u,
+     544559008u, 2248295444u, 3085590153u,  295523645u, 3560598451u, 1917673479u, 1134918298u, 3855773998u,
+     328860103u, 3052210803u, 2214924526u,  577903450u, 3889505748u, 1101147744u, 1883911421u, 3594338121u,
+    3424493451u, 1785369663u, 1535282850u, 4260726038u,  944946072u, 2653270060u, 2949491377u,  163225861u,
+    4294103532u, 1501944408u, 1752023237u, 3457862513u,  196998655u, 2915761739u, 2619532502u,  978710370u,
+    2881684293u,  229902577u, 1012666988u, 2586515928u, 1603020630u, 4193987810u, 3356702335u, 1852063179u,
+    2553040162u, 1046169238u,  263412747u, 2848217023u, 1818454321u, 3390333573u, 4227627032u, 1569420204u,
+      60859927u, 2782375331u, 2487203646u,  843627658u, 4159668740u, 1368951216u, 1617990445u, 3322386585u,
+     810543216u, 2520310724u, 2815490393u,   27783917u, 3288386659u, 1652017111u, 1402985802u, 4125677310u,
+    1685994201u, 3255382381u, 4091620336u, 1435902020u, 2419138250u,  910562686u,  128847843u, 2715354199u,
+    1469150398u, 4058414858u, 3222168983u, 1719234083u, 2749255853u,   94984985u,  876691844u, 2453031472u
+  },
+  {
+             0u, 3433693342u, 1109723005u, 2391738339u, 2219446010u, 1222643300u, 3329165703u,  180685081u,
+    3555007413u,  525277995u, 2445286600u, 1567235158u, 1471092047u, 2600801745u,  361370162u, 3642757804u,
+    2092642603u, 2953916853u, 1050555990u, 4063508168u, 4176560081u,  878395215u, 3134470316u, 1987983410u,
+    2942184094u, 1676945920u, 3984272867u,  567356797u,  722740324u, 3887998202u, 1764827929u, 2778407815u,
+    4185285206u,  903635656u, 3142804779u, 2012833205u, 2101111980u, 2979425330u, 1058630609u, 4088621903u,
+     714308067u, 3862526333u, 1756790430u, 2753330688u, 2933487385u, 1651734407u, 3975966820u,  542535930u,
+    2244825981u, 1231508451u, 3353891840u,  188896414u,   25648519u, 3442302233u, 1134713594u, 2399689316u,
+    1445480648u, 2592229462u,  336416693u, 3634843435u, 3529655858u,  516441772u, 2420588879u, 1559052753u,
+     698204909u, 3845636723u, 1807271312u, 2803025166u, 2916600855u, 1635634313u, 4025666410u,  593021940u,
+    4202223960u,  919787974u, 3093159461u, 1962401467u, 2117261218u, 2996361020u, 1008193759u, 4038971457u,
+    1428616134u, 2576151384u,  386135227u, 3685348389u, 3513580860u,  499580322u, 2471098945u, 1608776415u,
+    2260985971u, 1248454893u, 3303468814u,  139259792u,   42591881u, 3458459159u, 1085071860u, 2349261162u,
+    3505103035u,  474062885u, 2463016902u, 1583654744u, 1419882049u, 2550902495u,  377792828u, 3660491170u,
+      51297038u, 3483679632u, 1093385331u, 2374089965u, 2269427188u, 1273935210u, 3311514249u,  164344343u,
+    2890961296u, 1627033870u, 4000683757u,  585078387u,  672833386u, 3836780532u, 1782552599u, 2794821769u,
+    2142603813u, 3005188795u, 1032883544u, 4047146438u, 4227826911u,  928351297u, 3118105506u, 1970307900u,
+    1396409818u, 2677114180u,  287212199u, 3719594553u, 3614542624u,  467372990u, 2505346141u, 1509854403u,
+    2162073199u, 1282711281u, 3271268626u,  240228748u,   76845205u, 3359543307u, 1186043880u, 2317064054u,
+     796964081u, 3811226735u, 1839575948u, 2702160658u, 2882189835u, 1734392469u, 3924802934u,  625327592u,
+    4234522436u,  818917338u, 3191908409u, 1927981223u, 2016387518u, 3028656416u,  973776579u, 4137723485u,
+    2857232268u, 1726474002u, 3899187441u,  616751215u,  772270454u, 3803048424u, 1814228491u, 2693328533u,
+    2041117753u, 3036871847u,  999160644u, 4146592730u, 4259508931u,  826864221u, 3217552830u, 1936586016u,
+    3606501031u,  442291769u, 2496909786u, 1484378436u, 1388107869u, 2652297411u,  278519584u, 3694387134u,
+      85183762u, 3384397196u, 1194773103u, 2342308593u, 2170143720u, 1307820918u, 3279733909u,  265733131u,
+    2057717559u, 3054258089u,  948125770u, 4096344276u, 4276898253u,  843467091u, 3167309488u, 1885556270u,
+    2839764098u, 1709792284u, 3949353983u,  667704161u,  755585656u, 3785577190u, 1865176325u, 2743489947u,
+     102594076u, 3401021058u, 1144549729u, 2291298815u, 2186770662u, 1325234296u, 3228729243u,  215514885u,
+    3589828009u,  424832311u, 2547870420u, 1534552650u, 1370645331u, 2635621325u,  328688686u, 3745342640u,
+    2211456353u, 1333405183u, 3254067740u,  224338562u,  127544219u, 3408931589u, 1170156774u, 2299866232u,
+    1345666772u, 2627681866u,  303053225u, 3736746295u, 3565105198u,  416624816u, 2522494803u, 1525692365u,
+    4285207626u,  868291796u, 3176010551u, 1910772649u, 2065767088u, 3079346734u,  956571085u, 4121828691u,
+     747507711u, 3760459617u, 1856702594u, 2717976604u, 2831417605u, 1684930971u, 3940615800u,  642451174u
+  }
 };
 
+/*Updates the (not inverted) CRC r with the bytes data[0..length-1], 8 bytes at a time*/
+static unsigned lodepng_crc32_slice8(unsigned r, const unsigned char* data, size_t length) {
+  for(; length >= 8; length -= 8, data += 8) {
+    unsigned one = r ^ ((unsigned)data[0] | ((unsigned)data[1] << 8u) |
+                        ((unsigned)data[2] << 16u) | ((unsigned)data[3] << 24u));
+    r = lodepng_crc32_table[7][one & 0xffu] ^ lodepng_crc32_table[6][(one >> 8u) & 0xffu] ^
+        lodepng_crc32_table[5][(one >> 16u) & 0xffu] ^ lodepng_crc32_table[4][(one >> 24u) & 0xffu] ^
+        lodepng_crc32_table[3][data[4]] ^ lodepng_crc32_table[2][data[5]] ^
+        lodepng_crc32_table[1][data[6]] ^ lodepng_crc32_table[0][data[7]];
+  }
+  for(; length != 0; --length, ++data) {
+    r = lodepng_crc32_table[0][(r ^ *data) & 0xffu] ^ (r >> 8u);
+  }
+  return r;
+}
+
+#ifdef LODEPNG_SIMD_X86_RUNTIME
+/*
+Updates the (not inverted) CRC r with the bytes data[0..length-1] with PCLMULQDQ, length must be a multiple
+of 16 and at least 64. Folds 4x128 bits in parallel, then to 128 and 64 bits, and finally does a Barrett
+reduction to 32 bits, as in Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+Instruction". The constants are x^(4*128+32) mod P, x^(4*128-32) mod P (k1, k2), the same for 128 bits
+(k3, k4), x^64 mod P (k5), and P and floor(x^64 / P) (mu), all bit-reflected.
+*/
+__attribute__((target("pclmul,sse2")))
+static unsigned lodepng_crc32Pclmul(unsigned r, const unsigned char* data, size_t length) {
+  const __m128i k1k2 = _mm_set_epi32(0x00000001, 0xc6e41596, 0x00000001, 0x54442bd4);
+  const __m128i k3k4 = _mm_set_epi32(0x00000000, 0xccaa009e, 0x00000001, 0x751997d0);
+  const __m128i k5 = _mm_set_epi32(0, 0, 0x00000001, 0x63cd6124);
+  const __m128i poly = _mm_set_epi32(0x00000001, 0xf7011641, 0x00000001, 0xdb710641);
+  const __m128i mask32 = _mm_set_epi32(0, -1, 0, -1);
+  __m128i x0, x1, x2, x3, x4;
+
+  x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)data), _mm_cvtsi32_si128((int)r));
+  x2 = _mm_loadu_si128((const __m128i*)(data + 16));
+  x3 = _mm_loadu_si128((const __m128i*)(data + 32));
+  x4 = _mm_loadu_si128((const __m128i*)(data + 48));
+  data += 64;
+  length -= 64;
+
+  /*fold 4x128 bits by 512 bits*/
+  for(; length >= 64; data += 64, length -= 64) {
+    __m128i y1 = _mm_clmulepi64_si128(x1, k1k2, 0x00), y2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    __m128i y3 = _mm_clmulepi64_si128(x3, k1k2, 0x00), y4 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x11), y1);
+    x2 = _mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x11), y2);
+    x3 = _mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x11), y3);
+    x4 = _mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x11), y4);
+    x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)data));
+    x2 = _mm_xor_si128(x2, _mm_loadu_si128((const __m128i*)(data + 16)));
+    x3 = _mm_xor_si128(x3, _mm_loadu_si128((const __m128i*)(data + 32)));
+    x4 = _mm_xor_si128(x4, _mm_loadu_si128((const __m128i*)(data + 48)));
+  }
+
+  /*fold the 4 values into 1, then the remaining 16 byte blocks, by 128 bits*/
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), _mm_clmulepi64_si128(x1, k3k4, 0x00)), x2);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), _mm_clmulepi64_si128(x1, k3k4, 0x00)), x3);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), _mm_clmulepi64_si128(x1, k3k4, 0x00)), x4);
+  for(; length >= 16; data += 16, length -= 16) {
+    x2 = _mm_loadu_si128((const __m128i*)data);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), _mm_clmulepi64_si128(x1, k3k4, 0x00)), x2);
+  }
+
+  /*fold 128 bits to 64 bits*/
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5, 0x00), x2);
+
+  /*Barrett reduction to 32 bits*/
+  x0 = _mm_and_si128(x1, mask32);
+  x0 = _mm_clmulepi64_si128(x0, poly, 0x10);
+  x0 = _mm_and_si128(x0, mask32);
+  x0 = _mm_clmulepi64_si128(x0, poly, 0x00);
+  x1 = _mm_xor_si128(x1, x0);
+  return (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif /*LODEPNG_SIMD_X86_RUNTIME*/
+
 /*Return the CRC of the bytes buf[0..len-1].*/
 unsigned lodepng_crc32(const unsigned char* data, size_t length) {
   unsigned r = 0xffffffffu;
-  size_t i;
-  for(i = 0; i < length; ++i) {
-    r = lodepng_crc32_table[(r ^ data[i]) & 0xffu] ^ (r >> 8u);
+#ifdef LODEPNG_SIMD_X86_RUNTIME
+  if(length >= 64 && __builtin_cpu_supports("pclmul")) {
+    size_t amount = length & ~(size_t)15u;
+    r = lodepng_crc32Pclmul(r, data, amount);
+    data += amount;
+    length -= amount;
   }
-  return r ^ 0xffffffffu;
+#endif /*LODEPNG_SIMD_X86_RUNTIME*/
+  return lodepng_crc32_slice8(r, data, length) ^ 0xffffffffu;
 }
 #else /* !LODEPNG_NO_COMPILE_CRC */
 unsigned lodepng_crc32(const unsigned char* data, size_t length);
@@ -3971,6 +4773,23 @@ static unsigned char paethPredictor(short a, short b, short c) {
   return (pc < pa) ? c : a;
 }
 
+#ifdef LODEPNG_SIMD_SSE2
+/*|x| of 16-bit values with SSE2*/
+static LODEPNG_INLINE __m128i lodepng_abs16Sse2(__m128i x) {
+  return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+/*paethPredictor of the 16-bit values a (left), b (up) and c (upper left), given pa = |b - c|,
+pb = |a - c| and pc = |a + b - 2c|*/
+static LODEPNG_INLINE __m128i lodepng_paeth16(__m128i a, __m128i b, __m128i c,
+                                              __m128i pa, __m128i pb, __m128i pc) {
+  __m128i use_b = _mm_cmplt_epi16(pb, pa);
+  __m128i use_c = _mm_cmplt_epi16(pc, _mm_min_epi16(pa, pb));
+  __m128i nearest = _mm_or_si128(_mm_and_si128(use_b, b), _mm_andnot_si128(use_b, a));
+  return _mm_or_si128(_mm_and_si128(use_c, c), _mm_andnot_si128(use_c, nearest));
+}
+#endif /*LODEPNG_SIMD_SSE2*/
+
 /*shared values used by multiple Adam7 related functions*/
 
 static const unsigned ADAM7_IX[7] = { 0, 4, 0, 2, 0, 1, 0 }; /*x start values*/
@@ -4089,8 +4908,207 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h, LodePNGState* state,
   return state->error;
 }
 
+#ifdef LODEPNG_SIMD_SSE2
+/*
+SIMD versions of unfilterScanline for rows that have a previous row (precon). Up is done on the
+whole row at once, Sub, Average and Paeth one pixel at a time for bytewidth 3 and 4 (the pixels depend
+on each other, but the bytes of a pixel do not), and Sub also for bytewidth 1 with a prefix sum.
+Each pixel is loaded from scanline before recon is written, which keeps recon == scanline and the
+overlapping in-place use of unfilter working. The results are the same as the scalar code.
+*/
+
+static LODEPNG_INLINE __m128i lodepng_load3(const unsigned char* p) {
+  unsigned v = (unsigned)p[0] | ((unsigned)p[1] << 8u) | ((unsigned)p[2] << 16u);
+  return _mm_cvtsi32_si128((int)v);
+}
+
+static LODEPNG_INLINE void lodepng_store3(unsigned char* p, __m128i v) {
+  unsigned u = (unsigned)_mm_cvtsi128_si32(v);
+  p[0] = (unsigned char)u;
+  p[1] = (unsigned char)(u >> 8u);
+  p[2] = (unsigned char)(u >> 16u);
+}
+
+static LODEPNG_INLINE __m128i lodepng_load4(const unsigned char* p) {
+  int v;
+  lodepng_memcpy(&v, p, 4);
+  return _mm_cvtsi32_si128(v);
+}
+
+static LODEPNG_INLINE void lodepng_store4(unsigned char* p, __m128i v) {
+  int u = _mm_cvtsi128_si32(v);
+  lodepng_memcpy(p, &u, 4);
+}
+
+/*bytewidth 3 or 4 pixel (in the lowest bytes)*/
+static LODEPNG_INLINE __m128i lodepng_loadPixel(const unsigned char* p, size_t bytewidth) {
+  return bytewidth == 4 ? lodepng_load4(p) : lodepng_load3(p);
+}
+
+static LODEPNG_INLINE void lodepng_storePixel(unsigned char* p, __m128i v, size_t bytewidth) {
+  if(bytewidth == 4) lodepng_store4(p, v);
+  else lodepng_store3(p, v);
+}
+
+/*Up with SSE2, returns the amount of bytes done*/
+static size_t unfilterUpSse2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                             size_t length) {
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i*)(scanline + i));
+    __m128i p = _mm_loadu_si128((const __m128i*)(precon + i));
+    _mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(s, p));
+  }
+  return i;
+}
+
+/*Sub for bytewidth 1 with a prefix sum of 16 bytes, returns the amount of bytes done*/
+static size_t unfilterSub1Sse2(unsigned char* recon, const unsigned char* scanline, size_t length) {
+  size_t i = 0;
+  __m128i last = _mm_setzero_si128(); /*previous byte of recon in all bytes*/
+  for(; i + 16 <= length; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi8(x, last);
+    _mm_storeu_si128((__m128i*)(recon + i), x);
+    /*broadcast byte 15*/
+    last = _mm_unpackhi_epi8(x, x);
+    last = _mm_shufflehi_epi16(last, 0xff);
+    last = _mm_unpackhi_epi64(last, last);
+  }
+  return i;
+}
+
+/*Sub for bytewidth 3 and 4, length must be a multiple of bytewidth*/
+static void unfilterSubSse2(unsigned char* recon, const unsigned char* scanline, size_t bytewidth,
+                            size_t length) {
+  size_t i;
+  __m128i a = _mm_setzero_si128();
+  for(i = 0; i != length; i += bytewidth) {
+    a = _mm_add_epi8(a, lodepng_loadPixel(scanline + i, bytewidth));
+    lodepng_storePixel(recon + i, a, bytewidth);
+  }
+}
+
+/*Average for bytewidth 3 and 4, length must be a multiple of bytewidth*/
+static void unfilterAverageSse2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, size_t length) {
+  size_t i;
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128(); /*the left pixel is 0 for the first pixel*/
+  for(i = 0; i != length; i += bytewidth) {
+    __m128i b = lodepng_loadPixel(precon + i, bytewidth);
+    /*(a + b) >> 1: _mm_avg_epu8 rounds up, subtract the rounding*/
+    __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    a = _mm_add_epi8(lodepng_loadPixel(scanline + i, bytewidth), average);
+    lodepng_storePixel(recon + i, a, bytewidth);
+  }
+}
+
+/*Paeth for bytewidth 3 and 4 with SSE2, length must be a multiple of bytewidth*/
+static void unfilterPaethSse2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                              size_t bytewidth, size_t length) {
+  size_t i;
+  const __m128i zero = _mm_setzero_si128();
+  /*16-bit values of the left and upper left pixels, 0 for the first pixel*/
+  __m128i a = zero, c = zero;
+  for(i = 0; i != length; i += bytewidth) {
+    __m128i b = _mm_unpacklo_epi8(lodepng_loadPixel(precon + i, bytewidth), zero);
+    __m128i p = _mm_sub_epi16(b, c), q = _mm_sub_epi16(a, c);
+    __m128i predictor = lodepng_paeth16(a, b, c, lodepng_abs16Sse2(p), lodepng_abs16Sse2(q),
+                                        lodepng_abs16Sse2(_mm_add_epi16(p, q)));
+    __m128i x = _mm_add_epi8(lodepng_loadPixel(scanline + i, bytewidth), _mm_packus_epi16(predictor, zero));
+    lodepng_storePixel(recon + i, x, bytewidth);
+    a = _mm_unpacklo_epi8(x, zero);
+    c = b;
+  }
+}
+
+#ifdef LODEPNG_SIMD_X86_RUNTIME
+/*Up with AVX2, returns the amount of bytes done*/
+__attribute__((target("avx2")))
+static size_t unfilterUpAvx2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                             size_t length) {
+  size_t i = 0;
+  for(; i + 32 <= length; i += 32) {
+    __m256i s = _mm256_loadu_si256((const __m256i*)(scanline + i));
+    __m256i p = _mm256_loadu_si256((const __m256i*)(precon + i));
+    _mm256_storeu_si256((__m256i*)(recon + i), _mm256_add_epi8(s, p));
+  }
+  return i;
+}
+
+/*Paeth for bytewidth 3 and 4 with SSSE3 (pabsw instead of max(x, -x)), see unfilterPaethSse2*/
+__attribute__((target("ssse3")))
+static void unfilterPaethSsse3(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                               size_t bytewidth, size_t length) {
+  size_t i;
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  for(i = 0; i != length; i += bytewidth) {
+    __m128i b = _mm_unpacklo_epi8(lodepng_loadPixel(precon + i, bytewidth), zero);
+    __m128i p = _mm_sub_epi16(b, c), q = _mm_sub_epi16(a, c);
+    __m128i predictor = lodepng_paeth16(a, b, c, _mm_abs_epi16(p), _mm_abs_epi16(q),
+                                        _mm_abs_epi16(_mm_add_epi16(p, q)));
+    __m128i x = _mm_add_epi8(lodepng_loadPixel(scanline + i, bytewidth), _mm_packus_epi16(predictor, zero));
+    lodepng_storePixel(recon + i, x, bytewidth);
+    a = _mm_unpacklo_epi8(x, zero);
+    c = b;
+  }
+}
+#endif /*LODEPNG_SIMD_X86_RUNTIME*/
+
+/*
+Unfilters the scanline with SIMD if there is a SIMD version for the filter type and bytewidth, see
+unfilterScanline for the parameters. Returns 1 if done, 0 if the scalar code must be used.
+*/
+static int unfilterScanlineSimd(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, unsigned char filterType, size_t length) {
+  size_t i;
+  if(filterType == 1 && bytewidth == 1) {
+    i = unfilterSub1Sse2(recon, scanline, length);
+    for(; i != length; ++i) recon[i] = scanline[i] + (i ? recon[i - 1] : 0);
+    return 1;
+  }
+  if(filterType == 1 && (bytewidth == 3 || bytewidth == 4)) {
+    unfilterSubSse2(recon, scanline, bytewidth, length);
+    return 1;
+  }
+  if(!precon) return 0; /*the first row is as cheap as Sub or a copy*/
+  if(filterType == 2) {
+#ifdef LODEPNG_SIMD_X86_RUNTIME
+    if(__builtin_cpu_supports("avx2")) i = unfilterUpAvx2(recon, scanline, precon, length);
+    else i = unfilterUpSse2(recon, scanline, precon, length);
+#else
+    i = unfilterUpSse2(recon, scanline, precon, length);
+#endif
+    for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
+    return 1;
+  }
+  if(bytewidth != 3 && bytewidth != 4) return 0;
+  if(filterType == 3) {
+    unfilterAverageSse2(recon, scanline, precon, bytewidth, length);
+    return 1;
+  }
+  if(filterType == 4) {
+#ifdef LODEPNG_SIMD_X86_RUNTIME
+    if(__builtin_cpu_supports("ssse3")) unfilterPaethSsse3(recon, scanline, precon, bytewidth, length);
+    else unfilterPaethSse2(recon, scanline, precon, bytewidth, length);
+#else
+    unfilterPaethSse2(recon, scanline, precon, bytewidth, length);
+#endif
+    return 1;
+  }
+  return 0;
+}
+#endif /*LODEPNG_SIMD_SSE2*/
+
 static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
-                                 size_t bytewidth, unsigned char filterType, size_t length) {
+                                 size_t bytewidth, unsigned char filterType, size_t length,
+                                 unsigned reference_unfilter) {
   /*
   For PNG filter method 0
   unfilter a PNG image scanline by scanline. when the pixels are smaller than 1 byte,
@@ -4098,9 +5116,15 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   precon is the previous unfiltered scanline, recon the result, scanline the current one
   the incoming scanlines do NOT include the filtertype byte, that one is given in the parameter filterType instead
   recon and scanline MAY be the same memory address! precon must be disjoint.
+  if reference_unfilter is 0, SIMD versions are used where available.
   */
 
   size_t i;
+#ifdef LODEPNG_SIMD_SSE2
+  if(!reference_unfilter && unfilterScanlineSimd(recon, scanline, precon, bytewidth, filterType, length)) return 0;
+#else
+  (void)reference_unfilter;
+#endif
   switch(filterType) {
     case 0:
       for(i = 0; i != length; ++i) recon[i] = scanline[i];
@@ -4219,7 +5243,8 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   return 0;
 }
 
-static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp) {
+static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp,
+                         unsigned reference_unfilter) {
   /*
   For PNG filter method 0
   this function unfilters a single image (e.g. without interlacing this is called once, with Adam7 seven times)
@@ -4241,7 +5266,8 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
     size_t inindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
     unsigned char filterType = in[inindex];
 
-    CERROR_TRY_RETURN(unfilterScanline(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes));
+    CERROR_TRY_RETURN(unfilterScanline(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes,
+                                       reference_unfilter));
 
     prevline = &out[outindex];
   }
@@ -4328,7 +5354,8 @@ static void removePaddingBits(unsigned char* out, const unsigned char* in,
 the IDAT chunks (with filter index bytes and possible padding bits)
 return value is error*/
 static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
-                                     unsigned w, unsigned h, const LodePNGInfo* info_png) {
+                                     unsigned w, unsigned h, const LodePNGInfo* info_png,
+                                     unsigned reference_unfilter) {
   /*
   This function converts the filtered-padded-interlaced data into pure 2D image buffer with the PNG's colortype.
   Steps:
@@ -4341,11 +5368,11 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
 
   if(info_png->interlace_method == 0) {
     if(bpp < 8 && w * bpp != ((w * bpp + 7u) / 8u) * 8u) {
-      CERROR_TRY_RETURN(unfilter(in, in, w, h, bpp));
+      CERROR_TRY_RETURN(unfilter(in, in, w, h, bpp, reference_unfilter));
       removePaddingBits(out, in, w * bpp, ((w * bpp + 7u) / 8u) * 8u, h);
     }
     /*we can immediately filter into the out buffer, no other steps needed*/
-    else CERROR_TRY_RETURN(unfilter(out, in, w, h, bpp));
+    else CERROR_TRY_RETURN(unfilter(out, in, w, h, bpp, reference_unfilter));
   } else /*interlace_method is 1 (Adam7)*/ {
     unsigned passw[7], passh[7]; size_t filter_passstart[8], padded_passstart[8], passstart[8];
     unsigned i;
@@ -4353,7 +5380,8 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
     Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
 
     for(i = 0; i != 7; ++i) {
-      CERROR_TRY_RETURN(unfilter(&in[padded_passstart[i]], &in[filter_passstart[i]], passw[i], passh[i], bpp));
+      CERROR_TRY_RETURN(unfilter(&in[padded_passstart[i]], &in[filter_passstart[i]], passw[i], passh[i], bpp,
+                                 reference_unfilter));
       /*TODO: possible efficiency improvement: if in this reduced image the bits fit nicely in 1 scanline,
       move bytes instead of bits or move not at all*/
       if(bpp < 8) {
@@ -4967,7 +5995,8 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   }
   if(!state->error) {
     lodepng_memset(*out, 0, outsize);
-    state->error = postProcessScanlines(*out, scanlines, *w, *h, &state->info_png);
+    state->error = postProcessScanlines(*out, scanlines, *w, *h, &state->info_png,
+                                        state->decoder.reference_unfilter);
   }
   lodepng_free(scanlines);
 }
@@ -5069,6 +6098,7 @@ void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings) {
   settings->ignore_crc = 0;
   settings->ignore_critical = 0;
   settings->ignore_end = 0;
+  settings->reference_unfilter = 0;
   lodepng_decompress_settings_init(&settings->zlibsettings);
 }
 
@@ -5193,13 +6223,127 @@ static unsigned addChunk_tRNS(ucvector* out, const LodePNGColorMode* info) {
   return 0;
 }
 
-static unsigned addChunk_IDAT(ucvector* out, const unsigned char* data, size_t datasize,
-                              LodePNGCompressSettings* zlibsettings) {
+/*number of stripes to split count scanlines in, 1 if the multithreading is not enabled*/
+static size_t getNumStripes(const LodePNGEncoderSettings* settings, size_t count) {
+  size_t numstripes = settings->parallel_for ? settings->num_stripes : 1u;
+  if(numstripes > count) numstripes = count;
+  return numstripes ? numstripes : 1u;
+}
+
+/*the first of count scanlines that belongs to stripe i, computed without overflow of count * i*/
+static size_t getStripeBegin(size_t count, size_t numstripes, size_t i) {
+  return count / numstripes * i + count % numstripes * i / numstripes;
+}
+
+#ifdef LODEPNG_COMPILE_ZLIB
+typedef struct DeflateStripes {
+  const unsigned char* in;
+  size_t insize;
+  size_t linesize; /*stripes are split at multiples of linesize bytes*/
+  size_t numstripes;
+  const LodePNGCompressSettings* zlibsettings;
+  ucvector* deflated; /*the deflate data of each stripe*/
+  unsigned* adler; /*the adler32 of each stripe*/
+  unsigned* errors;
+} DeflateStripes;
+
+/*the bytes [begin, end) of the data that belong to stripe i, the last stripe gets the remainder*/
+static void getDeflateStripe(const DeflateStripes* d, size_t i, size_t* begin, size_t* end) {
+  size_t numlines = d->insize / d->linesize;
+  *begin = getStripeBegin(numlines, d->numstripes, i) * d->linesize;
+  *end = (i + 1u == d->numstripes) ? d->insize : getStripeBegin(numlines, d->numstripes, i + 1u) * d->linesize;
+}
+
+static void deflateStripeTask(void* data, size_t index) {
+  DeflateStripes* d = (DeflateStripes*)data;
+  size_t begin, end;
+  getDeflateStripe(d, index, &begin, &end);
+  d->adler[index] = adler32(&d->in[begin], (unsigned)(end - begin));
+  d->errors[index] = deflatePart(&d->deflated[index], &d->in[begin], end - begin, d->zlibsettings,
+                                 index + 1u == d->numstripes);
+}
+
+/*Same as lodepng_zlib_compress, but the stripes are deflated in parallel with settings->parallel_for.
+The deflate data of the stripes is concatenated and their adler32 checksums are combined.*/
+static unsigned zlib_compress_stripes(unsigned char** out, size_t* outsize, const unsigned char* in,
+                                      size_t insize, size_t linesize, size_t numstripes,
+                                      const LodePNGEncoderSettings* settings) {
+  unsigned error = 0;
+  size_t i, begin, end, pos, deflatesize = 0;
+  unsigned ADLER32 = 1;
+  DeflateStripes stripes;
+  stripes.in = in;
+  stripes.insize = insize;
+  stripes.linesize = linesize;
+  stripes.numstripes = numstripes;
+  stripes.zlibsettings = &settings->zlibsettings;
+  stripes.deflated = (ucvector*)lodepng_malloc(numstripes * sizeof(ucvector));
+  stripes.adler = (unsigned*)lodepng_malloc(numstripes * sizeof(unsigned));
+  stripes.errors = (unsigned*)lodepng_malloc(numstripes * sizeof(unsigned));
+
+  *out = NULL;
+  *outsize = 0;
+  if(!stripes.deflated || !stripes.adler || !stripes.errors) error = 83; /*alloc fail*/
+
+  if(!error) {
+    for(i = 0; i != numstripes; ++i) stripes.deflated[i] = ucvector_init(NULL, 0);
+    settings->parallel_for(deflateStripeTask, &stripes, numstripes, settings->parallel_context);
+
+    for(i = 0; i != numstripes; ++i) {
+      if(!error) error = stripes.errors[i];
+      deflatesize += stripes.deflated[i].size;
+      getDeflateStripe(&stripes, i, &begin, &end);
+      ADLER32 = adler32_combine(ADLER32, stripes.adler[i], end - begin);
+    }
+  }
+
+  if(!error) {
+    *outsize = deflatesize + 6;
+    *out = (unsigned char*)lodepng_malloc(*outsize);
+    if(!*out) error = 83; /*alloc fail*/
+  }
+
+  if(!error) {
+    /*the same zlib header as lodepng_zlib_compress: CMF 120 (CM 8, CINFO 7) and FLG 1 (FCHECK only)*/
+    (*out)[0] = 120;
+    (*out)[1] = 1;
+    pos = 2;
+    for(i = 0; i != numstripes; ++i) {
+      lodepng_memcpy(&(*out)[pos], stripes.deflated[i].data, stripes.deflated[i].size);
+      pos += stripes.deflated[i].size;
+    }
+    lodepng_set32bitInt(&(*out)[pos], ADLER32);
+  }
+
+  if(stripes.deflated) {
+    for(i = 0; i != numstripes; ++i) lodepng_free(stripes.deflated[i].data);
+  }
+  lodepng_free(stripes.deflated);
+  lodepng_free(stripes.adler);
+  lodepng_free(stripes.errors);
+  return error;
+}
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
+/*linesize: size in bytes of a filtered scanline, the IDAT data is only split in stripes between them*/
+static unsigned addChunk_IDAT(ucvector* out, const unsigned char* data, size_t datasize, size_t linesize,
+                              const LodePNGEncoderSettings* settings) {
   unsigned error = 0;
   unsigned char* zlib = 0;
   size_t zlibsize = 0;
+#ifdef LODEPNG_COMPILE_ZLIB
+  size_t numstripes = getNumStripes(settings, datasize / linesize);
 
-  error = zlib_compress(&zlib, &zlibsize, data, datasize, zlibsettings);
+  /*a custom zlib or deflate can only compress the whole data at once*/
+  if(numstripes > 1 && !settings->zlibsettings.custom_zlib && !settings->zlibsettings.custom_deflate) {
+    error = zlib_compress_stripes(&zlib, &zlibsize, data, datasize, linesize, numstripes, settings);
+  } else
+#else /*no LODEPNG_COMPILE_ZLIB*/
+  (void)linesize;
+#endif /*LODEPNG_COMPILE_ZLIB*/
+  {
+    error = zlib_compress(&zlib, &zlibsize, data, datasize, &settings->zlibsettings);
+  }
   if(!error) {
     error = lodepng_chunk_createv(out, zlibsize, "IDAT", zlib);
   }
@@ -5400,6 +6544,72 @@ static unsigned addChunk_iCCP(ucvector* out, const LodePNGInfo* info, LodePNGCom
 
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
+#ifdef LODEPNG_SIMD_SSE2
+/*
+SIMD versions of filterScanline. Unlike unfiltering, every byte only depends on unfiltered bytes, so
+they do 16 bytes at once for any bytewidth. They start at byte i and return the amount of bytes done,
+the scalar code does the rest. The results are the same as the scalar code.
+*/
+
+static size_t filterSubSse2(unsigned char* out, const unsigned char* scanline, size_t bytewidth,
+                            size_t i, size_t length) {
+  for(; i + 16 <= length; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+    __m128i a = _mm_loadu_si128((const __m128i*)(scanline + i - bytewidth));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_sub_epi8(x, a));
+  }
+  return i;
+}
+
+static size_t filterUpSse2(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                           size_t i, size_t length) {
+  for(; i + 16 <= length; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(prevline + i));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_sub_epi8(x, b));
+  }
+  return i;
+}
+
+static size_t filterAverageSse2(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                                size_t bytewidth, size_t i, size_t length) {
+  const __m128i one = _mm_set1_epi8(1);
+  for(; i + 16 <= length; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+    __m128i a = _mm_loadu_si128((const __m128i*)(scanline + i - bytewidth));
+    __m128i b = _mm_loadu_si128((const __m128i*)(prevline + i));
+    /*(a + b) >> 1: _mm_avg_epu8 rounds up, subtract the rounding*/
+    __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_sub_epi8(x, average));
+  }
+  return i;
+}
+
+/*paethPredictor of 8 pixel bytes given as 16-bit values*/
+static LODEPNG_INLINE __m128i lodepng_paethPredictor16(__m128i a, __m128i b, __m128i c) {
+  __m128i p = _mm_sub_epi16(b, c), q = _mm_sub_epi16(a, c);
+  return lodepng_paeth16(a, b, c, lodepng_abs16Sse2(p), lodepng_abs16Sse2(q),
+                         lodepng_abs16Sse2(_mm_add_epi16(p, q)));
+}
+
+static size_t filterPaethSse2(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                              size_t bytewidth, size_t i, size_t length) {
+  const __m128i zero = _mm_setzero_si128();
+  for(; i + 16 <= length; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+    __m128i a = _mm_loadu_si128((const __m128i*)(scanline + i - bytewidth));
+    __m128i b = _mm_loadu_si128((const __m128i*)(prevline + i));
+    __m128i c = _mm_loadu_si128((const __m128i*)(prevline + i - bytewidth));
+    __m128i lo = lodepng_paethPredictor16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+                                          _mm_unpacklo_epi8(c, zero));
+    __m128i hi = lodepng_paethPredictor16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+                                          _mm_unpackhi_epi8(c, zero));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_sub_epi8(x, _mm_packus_epi16(lo, hi)));
+  }
+  return i;
+}
+#endif /*LODEPNG_SIMD_SSE2*/
+
 static void filterScanline(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
                            size_t length, size_t bytewidth, unsigned char filterType) {
   size_t i;
@@ -5409,11 +6619,18 @@ static void filterScanline(unsigned char* out, const unsigned char* scanline, co
       break;
     case 1: /*Sub*/
       for(i = 0; i != bytewidth; ++i) out[i] = scanline[i];
-      for(i = bytewidth; i < length; ++i) out[i] = scanline[i] - scanline[i - bytewidth];
+#ifdef LODEPNG_SIMD_SSE2
+      i = filterSubSse2(out, scanline, bytewidth, bytewidth, length);
+#endif /*LODEPNG_SIMD_SSE2*/
+      for(; i < length; ++i) out[i] = scanline[i] - scanline[i - bytewidth];
       break;
     case 2: /*Up*/
       if(prevline) {
-        for(i = 0; i != length; ++i) out[i] = scanline[i] - prevline[i];
+        i = 0;
+#ifdef LODEPNG_SIMD_SSE2
+        i = filterUpSse2(out, scanline, prevline, 0, length);
+#endif /*LODEPNG_SIMD_SSE2*/
+        for(; i != length; ++i) out[i] = scanline[i] - prevline[i];
       } else {
         for(i = 0; i != length; ++i) out[i] = scanline[i];
       }
@@ -5421,7 +6638,10 @@ static void filterScanline(unsigned char* out, const unsigned char* scanline, co
     case 3: /*Average*/
       if(prevline) {
         for(i = 0; i != bytewidth; ++i) out[i] = scanline[i] - (prevline[i] >> 1);
-        for(i = bytewidth; i < length; ++i) out[i] = scanline[i] - ((scanline[i - bytewidth] + prevline[i]) >> 1);
+#ifdef LODEPNG_SIMD_SSE2
+        i = filterAverageSse2(out, scanline, prevline, bytewidth, bytewidth, length);
+#endif /*LODEPNG_SIMD_SSE2*/
+        for(; i < length; ++i) out[i] = scanline[i] - ((scanline[i - bytewidth] + prevline[i]) >> 1);
       } else {
         for(i = 0; i != bytewidth; ++i) out[i] = scanline[i];
         for(i = bytewidth; i < length; ++i) out[i] = scanline[i] - (scanline[i - bytewidth] >> 1);
@@ -5431,7 +6651,10 @@ static void filterScanline(unsigned char* out, const unsigned char* scanline, co
       if(prevline) {
         /*paethPredictor(0, prevline[i], 0) is always prevline[i]*/
         for(i = 0; i != bytewidth; ++i) out[i] = (scanline[i] - prevline[i]);
-        for(i = bytewidth; i < length; ++i) {
+#ifdef LODEPNG_SIMD_SSE2
+        i = filterPaethSse2(out, scanline, prevline, bytewidth, bytewidth, length);
+#endif /*LODEPNG_SIMD_SSE2*/
+        for(; i < length; ++i) {
           out[i] = (scanline[i] - paethPredictor(scanline[i - bytewidth], prevline[i], prevline[i - bytewidth]));
         }
       } else {
@@ -5465,8 +6688,11 @@ static size_t ilog2i(size_t i) {
   return i * l + ((i - (1u << l)) << 1u);
 }
 
-static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
-                       const LodePNGColorMode* color, const LodePNGEncoderSettings* settings) {
+/*filters the scanlines y_begin until y_end. out and in are the whole image, so the scanline above
+y_begin is used as prevline.*/
+static unsigned filterStripe(unsigned char* out, const unsigned char* in, unsigned w,
+                             unsigned y_begin, unsigned y_end,
+                             const LodePNGColorMode* color, const LodePNGEncoderSettings* settings) {
   /*
   For PNG filter method 0
   out must be a buffer with as size: h + (w * h * bpp + 7u) / 8u, because there are
@@ -5479,7 +6705,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
 
   /*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise*/
   size_t bytewidth = (bpp + 7u) / 8u;
-  const unsigned char* prevline = 0;
+  const unsigned char* prevline = y_begin ? &in[(y_begin - 1u) * linebytes] : 0;
   unsigned x, y;
   unsigned error = 0;
   LodePNGFilterStrategy strategy = settings->filter_strategy;
@@ -5504,7 +6730,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
 
   if(strategy >= LFS_ZERO && strategy <= LFS_FOUR) {
     unsigned char type = (unsigned char)strategy;
-    for(y = 0; y != h; ++y) {
+    for(y = y_begin; y != y_end; ++y) {
       size_t outindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
       size_t inindex = linebytes * y;
       out[outindex] = type; /*filter type byte*/
@@ -5523,7 +6749,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     }
 
     if(!error) {
-      for(y = 0; y != h; ++y) {
+      for(y = y_begin; y != y_end; ++y) {
         /*try the 5 filter types*/
         for(type = 0; type != 5; ++type) {
           size_t sum = 0;
@@ -5570,7 +6796,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     }
 
     if(!error) {
-      for(y = 0; y != h; ++y) {
+      for(y = y_begin; y != y_end; ++y) {
         /*try the 5 filter types*/
         for(type = 0; type != 5; ++type) {
           size_t sum = 0;
@@ -5598,7 +6824,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
 
     for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
   } else if(strategy == LFS_PREDEFINED) {
-    for(y = 0; y != h; ++y) {
+    for(y = y_begin; y != y_end; ++y) {
       size_t outindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
       size_t inindex = linebytes * y;
       unsigned char type = settings->predefined_filters[y];
@@ -5631,7 +6857,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
       if(!attempt[type]) error = 83; /*alloc fail*/
     }
     if(!error) {
-      for(y = 0; y != h; ++y) /*try the 5 filter types*/ {
+      for(y = y_begin; y != y_end; ++y) /*try the 5 filter types*/ {
         for(type = 0; type != 5; ++type) {
           unsigned testsize = (unsigned)linebytes;
           /*if(testsize > 8) testsize /= 8;*/ /*it already works good enough by testing a part of the row*/
@@ -5659,6 +6885,49 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
   return error;
 }
 
+typedef struct FilterStripes {
+  unsigned char* out;
+  const unsigned char* in;
+  unsigned w, h;
+  size_t numstripes;
+  const LodePNGColorMode* color;
+  const LodePNGEncoderSettings* settings;
+  unsigned* errors;
+} FilterStripes;
+
+static void filterStripeTask(void* data, size_t index) {
+  FilterStripes* f = (FilterStripes*)data;
+  unsigned y_begin = (unsigned)getStripeBegin(f->h, f->numstripes, index);
+  unsigned y_end = (unsigned)getStripeBegin(f->h, f->numstripes, index + 1u);
+  f->errors[index] = filterStripe(f->out, f->in, f->w, y_begin, y_end, f->color, f->settings);
+}
+
+/*filters all scanlines, in row stripes with settings->parallel_for if enabled. Filtering only reads the
+unfiltered previous scanline, so the result doesn't depend on the stripes.*/
+static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
+                       const LodePNGColorMode* color, const LodePNGEncoderSettings* settings) {
+  unsigned error = 0;
+  size_t i;
+  FilterStripes stripes;
+  stripes.numstripes = getNumStripes(settings, h);
+  if(stripes.numstripes <= 1) return filterStripe(out, in, w, 0, h, color, settings);
+
+  stripes.out = out;
+  stripes.in = in;
+  stripes.w = w;
+  stripes.h = h;
+  stripes.color = color;
+  stripes.settings = settings;
+  stripes.errors = (unsigned*)lodepng_malloc(stripes.numstripes * sizeof(unsigned));
+  if(!stripes.errors) return 83; /*alloc fail*/
+
+  settings->parallel_for(filterStripeTask, &stripes, stripes.numstripes, settings->parallel_context);
+  for(i = 0; i != stripes.numstripes && !error; ++i) error = stripes.errors[i];
+
+  lodepng_free(stripes.errors);
+  return error;
+}
+
 static void addPaddingBits(unsigned char* out, const unsigned char* in,
                            size_t olinebits, size_t ilinebits, unsigned h) {
   /*The opposite of the removePaddingBits function
@@ -6015,7 +7284,9 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
     }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
     /*IDAT (multiple IDAT chunks must be consecutive)*/
-    state->error = addChunk_IDAT(&outv, data, datasize, &state->encoder.zlibsettings);
+    state->error = addChunk_IDAT(&outv, data, datasize,
+                                 info.interlace_method == 0 ? lodepng_get_raw_size_idat(w, 1, lodepng_get_bpp(&info.color)) : 1u,
+                                 &state->encoder);
     if(state->error) goto cleanup;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
     /*tIME*/
@@ -6146,12 +7417,28 @@ void lodepng_encoder_settings_init(LodePNGEncoderSettings* settings) {
   settings->auto_convert = 1;
   settings->force_palette = 0;
   settings->predefined_filters = 0;
+  settings->num_stripes = 0;
+  settings->parallel_for = 0;
+  settings->parallel_context = 0;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   settings->add_id = 0;
   settings->text_compression = 1;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 }
 
+void lodepng_encoder_settings_fast(LodePNGEncoderSettings* settings) {
+  /*trying all filters per scanline and computing the color statistics for auto_convert both cost
+  about as much as the fast deflate itself*/
+  settings->auto_convert = 0;
+  settings->filter_palette_zero = 1;
+  settings->filter_strategy = LFS_FOUR;
+  settings->zlibsettings.btype = 2;
+  settings->zlibsettings.use_lz77 = 1;
+  /*a larger window doesn't make fast_lz77 slower*/
+  settings->zlibsettings.windowsize = 32768;
+  settings->zlibsettings.fast_lz77 = 1;
+}
+
 #endif /*LODEPNG_COMPILE_ENCODER*/
 #endif /*LODEPNG_COMPILE_PNG*/
 
@@ -6445,6 +7732,17 @@ unsigned encode(std::vector<unsigned char>& out,
   return encode(out, in.empty() ? 0 : &in[0], w, h, colortype, bitdepth);
 }
 
+unsigned encode_fast(std::vector<unsigned char>& out, const unsigned char* in, unsigned w, unsigned h,
+                     LodePNGColorType colortype, unsigned bitdepth) {
+  State state;
+  state.info_raw.colortype = colortype;
+  state.info_raw.bitdepth = bitdepth;
+  state.info_png.color.colortype = colortype;
+  state.info_png.color.bitdepth = bitdepth;
+  lodepng_encoder_settings_fast(&state.encoder);
+  return encode(out, in, w, h, state);
+}
+
 unsigned encode(std::vector<unsigned char>& out,
                 const unsigned char* in, unsigned w, unsigned h,
                 State& state) {
@@ -6481,6 +7779,15 @@ unsigned encode(const std::string& filename,
   if(lodepng_get_raw_size_lct(w, h, colortype, bitdepth) > in.size()) return 84;
   return encode(filename, in.empty() ? 0 : &in[0], w, h, colortype, bitdepth);
 }
+
+unsigned encode_fast(const std::string& filename,
+                     const unsigned char* in, unsigned w, unsigned h,
+                     LodePNGColorType colortype, unsigned bitdepth) {
+  std::vector<unsigned char> buffer;
+  unsigned error = encode_fast(buffer, in, w, h, colortype, bitdepth);
+  if(!error) error = save_file(buffer, filename);
+  return error;
+}
 #endif /* LODEPNG_COMPILE_DISK */
 #endif /* LODEPNG_COMPILE_ENCODER */
 #endif /* LODEPNG_COMPILE_PNG */
@@ -259,6 +259,11 @@ unsigned encode(std::vector<unsigned char>& out,
 unsigned encode(std::vector<unsigned char>& out,
                 const std::vector<unsigned char>& in, unsigned w, unsigned h,
                 LodePNGColorType colortype = LCT_RGBA, unsigned bitdepth = 8);
+/*Same as encode, but with lodepng_encoder_settings_fast: several times faster and a larger PNG,
+the PNG color type is the same as colortype.*/
+unsigned encode_fast(std::vector<unsigned char>& out,
+                     const unsigned char* in, unsigned w, unsigned h,
+                     LodePNGColorType colortype = LCT_RGBA, unsigned bitdepth = 8);
 #ifdef LODEPNG_COMPILE_DISK
 /*
 Converts 32-bit RGBA raw pixel data into a PNG file on disk.
@@ -275,6 +280,10 @@ unsigned encode(const std::string& filename,
 unsigned encode(const std::string& filename,
                 const std::vector<unsigned char>& in, unsigned w, unsigned h,
                 LodePNGColorType colortype = LCT_RGBA, unsigned bitdepth = 8);
+/*Same as encode_fast, but saves the PNG to the file.*/
+unsigned encode_fast(const std::string& filename,
+                     const unsigned char* in, unsigned w, unsigned h,
+                     LodePNGColorType colortype = LCT_RGBA, unsigned bitdepth = 8);
 #endif /* LODEPNG_COMPILE_DISK */
 #endif /* LODEPNG_COMPILE_ENCODER */
 } /* namespace lodepng */
@@ -314,6 +323,10 @@ struct LodePNGDecompressSettings {
                              const LodePNGDecompressSettings*);
 
   const void* custom_context; /*optional custom settings for custom functions*/
+
+  /*if 1, decode every Huffman symbol with the plain per-symbol decoder instead of the table-driven
+  fast path (default: 0). The output is identical, this is for comparison and benchmarking.*/
+  unsigned reference_inflate;
 };
 
 extern const LodePNGDecompressSettings lodepng_default_decompress_settings;
@@ -347,6 +360,11 @@ struct LodePNGCompressSettings /*deflate = compress*/ {
                              const LodePNGCompressSettings*);
 
   const void* custom_context; /*optional custom settings for custom functions*/
+
+  /*use a much faster LZ77 instead: a hash table with only the last position of each 4-byte sequence
+  (a single probe instead of hash chains) and greedy parsing. The output is larger. minmatch, nicematch
+  and lazymatching are ignored. Default: 0*/
+  unsigned fast_lz77;
 };
 
 extern const LodePNGCompressSettings lodepng_default_compress_settings;
@@ -676,6 +694,10 @@ typedef struct LodePNGDecoderSettings {
 
   unsigned color_convert; /*whether to convert the PNG to the color type you want. Default: yes*/
 
+  /*if 1, unfilter the scanlines with the portable C code only instead of SIMD (SSE2, SSSE3, AVX2) where
+  available (default: 0). The output is identical, this is for comparison and benchmarking.*/
+  unsigned reference_unfilter;
+
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned read_text_chunks; /*if false but remember_unknown_chunks is true, they're stored in the unknown chunks*/
 
@@ -772,6 +794,19 @@ typedef struct LodePNGEncoderSettings {
   /*force creating a PLTE chunk if colortype is 2 or 6 (= a suggested palette).
   If colortype is 3, PLTE is _always_ created.*/
   unsigned force_palette;
+
+  /*Optional multithreading, LodePNG itself does not create threads. If num_stripes > 1 and
+  parallel_for is set, the scanlines are filtered and the IDAT data is deflated in num_stripes
+  independent row stripes. parallel_for must call task(data, index) once for every index in
+  [0, count), in any order and on any threads, and return when all calls have finished.
+  Every stripe except the last one ends with an empty stored block (like zlib's Z_SYNC_FLUSH),
+  so the stripes concatenate into one valid zlib stream that any PNG decoder can read. It is
+  slightly larger than the single-threaded output since matches can't cross stripes.
+  Not used with custom_zlib or custom_deflate. Default: 0 (single-threaded)*/
+  unsigned num_stripes;
+  void (*parallel_for)(void (*task)(void* data, size_t index), void* data, size_t count,
+                       const void* parallel_context);
+  const void* parallel_context; /*optional custom settings for parallel_for*/
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   /*add LodePNG identifier and version as a text chunk, for debugging*/
   unsigned add_id;
@@ -781,6 +816,10 @@ typedef struct LodePNGEncoderSettings {
 } LodePNGEncoderSettings;
 
 void lodepng_encoder_settings_init(LodePNGEncoderSettings* settings);
+/*Changes the settings into the fast preset, for when encoding speed matters more than the file size:
+no auto_convert (info_png.color is used as is), the Paeth filter for every scanline and fast_lz77
+with dynamic huffman trees. Other settings, such as the multithreading, are not changed.*/
+void lodepng_encoder_settings_fast(LodePNGEncoderSettings* settings);
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 
@@ -948,6 +987,9 @@ buffer. It cannot be used to create gzip files however, and it only supports the
 part of zlib that is required for PNG, it does not support dictionaries.
 */
 
+/*Calculate the Adler-32 checksum of buffer, as used in the zlib trailer*/
+unsigned lodepng_adler32(const unsigned char* buf, size_t len);
+
 #ifdef LODEPNG_COMPILE_DECODER
 /*Inflate a buffer. Inflate is the decompression step of deflate. Out buffer must be freed after use.*/
 unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
@@ -1817,6 +1859,7 @@ state.encoder.zlibsettings.windowsize: tweak LZ77 windowsize
 state.encoder.zlibsettings.minmatch: tweak min LZ77 length to match
 state.encoder.zlibsettings.nicematch: tweak LZ77 match where to stop searching
 state.encoder.zlibsettings.lazymatching: try one more LZ77 matching
+state.encoder.zlibsettings.fast_lz77: much faster LZ77 with a single-probe hash, larger output
 state.encoder.zlibsettings.custom_...: use custom deflate function
 state.encoder.auto_convert: choose optimal PNG color type, if 0 uses info_png
 state.encoder.filter_palette_zero: PNG filter strategy for palette
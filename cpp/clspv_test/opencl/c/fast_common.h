@@ -0,0 +1,197 @@
+// OpenCL port of the FAST corner detector.
+// Copyright (C) 2014, Itseez Inc. See the license at http://opencv.org
+
+// FAST のカーネル (fast_*.cl) が共有する判定とスコア
+#ifndef CLSPV_TEST_FAST_COMMON_H_
+#define CLSPV_TEST_FAST_COMMON_H_
+
+// img が指す画素が FAST のコーナー (候補) なら 1 を返す
+inline int isFastCorner(__global const uchar* img, int step, int threshold)
+{
+    int v = img[0], t0 = v - threshold, t1 = v + threshold;
+    int k, tofs, v0, v1;
+    int m0 = 0, m1 = 0;
+
+    #define UPDATE_MASK(idx, ofs) \
+        tofs = ofs; v0 = img[tofs]; v1 = img[-tofs]; \
+        m0 |= ((v0 < t0) << idx) | ((v1 < t0) << (8 + idx)); \
+        m1 |= ((v0 > t1) << idx) | ((v1 > t1) << (8 + idx))
+
+    UPDATE_MASK(0, 3);
+    if( (m0 | m1) == 0 )
+        return 0;
+
+    UPDATE_MASK(2, -step*2+2);
+    UPDATE_MASK(4, -step*3);
+    UPDATE_MASK(6, -step*2-2);
+
+    #define EVEN_MASK (1+4+16+64)
+
+    if( ((m0 | (m0 >> 8)) & EVEN_MASK) != EVEN_MASK &&
+        ((m1 | (m1 >> 8)) & EVEN_MASK) != EVEN_MASK )
+        return 0;
+
+    UPDATE_MASK(1, -step+3);
+    UPDATE_MASK(3, -step*3+1);
+    UPDATE_MASK(5, -step*3-1);
+    UPDATE_MASK(7, -step-3);
+    if( ((m0 | (m0 >> 8)) & 255) != 255 &&
+        ((m1 | (m1 >> 8)) & 255) != 255 )
+        return 0;
+
+    m0 |= m0 << 16;
+    m1 |= m1 << 16;
+
+    #define CHECK0(i) ((m0 & (511 << i)) == (511 << i))
+    #define CHECK1(i) ((m1 & (511 << i)) == (511 << i))
+
+    return CHECK0(0) + CHECK0(1) + CHECK0(2) + CHECK0(3) +
+           CHECK0(4) + CHECK0(5) + CHECK0(6) + CHECK0(7) +
+           CHECK0(8) + CHECK0(9) + CHECK0(10) + CHECK0(11) +
+           CHECK0(12) + CHECK0(13) + CHECK0(14) + CHECK0(15) +
+
+           CHECK1(0) + CHECK1(1) + CHECK1(2) + CHECK1(3) +
+           CHECK1(4) + CHECK1(5) + CHECK1(6) + CHECK1(7) +
+           CHECK1(8) + CHECK1(9) + CHECK1(10) + CHECK1(11) +
+           CHECK1(12) + CHECK1(13) + CHECK1(14) + CHECK1(15) != 0;
+}
+
+// 円周上の 16 画素を idx の順 (UPDATE_MASK, LOAD2 と同じ) に c[16] に読む
+// (img は __global でも __local でもよい)
+#define LOAD_CIRCLE(c, img, step) \
+    c[0] = img[3];            c[8]  = img[-3]; \
+    c[1] = img[-step+3];      c[9]  = img[step-3]; \
+    c[2] = img[-step*2+2];    c[10] = img[step*2-2]; \
+    c[3] = img[-step*3+1];    c[11] = img[step*3-1]; \
+    c[4] = img[-step*3];      c[12] = img[step*3]; \
+    c[5] = img[-step*3-1];    c[13] = img[step*3+1]; \
+    c[6] = img[-step*2-2];    c[14] = img[step*2+2]; \
+    c[7] = img[-step-3];      c[15] = img[step+3]
+
+// isFastCorner と同じ判定を、中心 v と LOAD_CIRCLE で読んだ円周 c から行う
+// (ローカルメモリのタイル用。読み込みは安いので先に 16 画素を比べる)
+inline int isFastCornerCircle(int v, const int* c, int threshold)
+{
+    int t0 = v - threshold, t1 = v + threshold;
+    int m0 = 0, m1 = 0;
+
+    #pragma unroll
+    for( int k = 0; k < 16; k++ )
+    {
+        m0 |= (c[k] < t0) << k;
+        m1 |= (c[k] > t1) << k;
+    }
+
+    // isFastCorner の UPDATE_MASK(0, 3), EVEN_MASK, 全ての対 の順の早期棄却
+    if( ((m0 | m1) & 0x101) == 0 )
+        return 0;
+    if( ((m0 | (m0 >> 8)) & EVEN_MASK) != EVEN_MASK &&
+        ((m1 | (m1 >> 8)) & EVEN_MASK) != EVEN_MASK )
+        return 0;
+    if( ((m0 | (m0 >> 8)) & 255) != 255 &&
+        ((m1 | (m1 >> 8)) & 255) != 255 )
+        return 0;
+
+    m0 |= m0 << 16;
+    m1 |= m1 << 16;
+
+    return CHECK0(0) + CHECK0(1) + CHECK0(2) + CHECK0(3) +
+           CHECK0(4) + CHECK0(5) + CHECK0(6) + CHECK0(7) +
+           CHECK0(8) + CHECK0(9) + CHECK0(10) + CHECK0(11) +
+           CHECK0(12) + CHECK0(13) + CHECK0(14) + CHECK0(15) +
+
+           CHECK1(0) + CHECK1(1) + CHECK1(2) + CHECK1(3) +
+           CHECK1(4) + CHECK1(5) + CHECK1(6) + CHECK1(7) +
+           CHECK1(8) + CHECK1(9) + CHECK1(10) + CHECK1(11) +
+           CHECK1(12) + CHECK1(13) + CHECK1(14) + CHECK1(15) != 0;
+}
+
+// 中心 v と LOAD_CIRCLE で読んだ円周 c からスコアを計算する
+// threshold >= 1 のとき、コーナーのスコアは threshold 以上で、コーナーでない
+// 画素のスコアは threshold 未満になる
+inline int cornerScoreCircle(int v, const int* c)
+{
+    int k, a0 = 0, b0;
+    int d[16];
+    #pragma unroll
+    for( k = 0; k < 16; k++ )
+        d[k] = (short)(v - c[k]);
+
+    #pragma unroll
+    for( k = 0; k < 16; k += 2 )
+    {
+        int a = min((int)d[(k+1)&15], (int)d[(k+2)&15]);
+        a = min(a, (int)d[(k+3)&15]);
+        a = min(a, (int)d[(k+4)&15]);
+        a = min(a, (int)d[(k+5)&15]);
+        a = min(a, (int)d[(k+6)&15]);
+        a = min(a, (int)d[(k+7)&15]);
+        a = min(a, (int)d[(k+8)&15]);
+        a0 = max(a0, min(a, (int)d[k&15]));
+        a0 = max(a0, min(a, (int)d[(k+9)&15]));
+    }
+
+    b0 = -a0;
+    #pragma unroll
+    for( k = 0; k < 16; k += 2 )
+    {
+        int b = max((int)d[(k+1)&15], (int)d[(k+2)&15]);
+        b = max(b, (int)d[(k+3)&15]);
+        b = max(b, (int)d[(k+4)&15]);
+        b = max(b, (int)d[(k+5)&15]);
+        b = max(b, (int)d[(k+6)&15]);
+        b = max(b, (int)d[(k+7)&15]);
+        b = max(b, (int)d[(k+8)&15]);
+
+        b0 = min(b0, max(b, (int)d[k]));
+        b0 = min(b0, max(b, (int)d[(k+9)&15]));
+    }
+
+    return -b0-1;
+}
+
+// img が指す画素のスコア
+inline int cornerScore(__global const uchar* img, int step)
+{
+    int c[16];
+    LOAD_CIRCLE(c, img, step);
+    return cornerScoreCircle(img[0], c);
+}
+
+// 画像の (x0, y0) を左上とする tile_w x tile_h 画素を、ワークグループ全体で
+// 32bit (4 画素) ずつ読んで tile (1 行 tile_w byte) に書く
+// img32 は _img と同じバッファを uint として見たもの。各行の先頭は 4 byte
+// 境界に揃っていないので、行の範囲を含む 32bit の語を読み、範囲内の byte
+// だけを書く (バッファの大きさは 4 byte の倍数にしておく)。
+// 画像の外の画素は書かない (読まれない)。呼び出した後に barrier が必要。
+inline void loadTile32(__global const uint* img32, int step, int img_offset,
+                       int rows, int cols, int x0, int y0,
+                       int tile_w, int tile_h, __local uchar* tile,
+                       int lid, int local_size)
+{
+    // 1 行あたりの語の数の上限 (先頭のずれ 3 byte を含む)
+    const int words_per_row = (tile_w + 6) >> 2;
+    const int begin_x = max(x0, 0);
+    const int end_x = min(x0 + tile_w, cols);
+    for( int k = lid; k < words_per_row * tile_h; k += local_size )
+    {
+        const int ty = k / words_per_row;
+        const int y = y0 + ty;
+        if( y < 0 || y >= rows || begin_x >= end_x )
+            continue;
+        const int row = img_offset + y * step;
+        const int word = ((row + begin_x) >> 2) + k % words_per_row;
+        if( (word << 2) >= row + end_x )
+            continue;
+        const uint v = img32[word];
+        #pragma unroll
+        for( int b = 0; b < 4; b++ )
+        {
+            const int x = (word << 2) + b - row;
+            if( begin_x <= x && x < end_x )
+                tile[ty * tile_w + x - x0] = (uchar)(v >> (8 * b));
+        }
+    }
+}
+
+#endif  // CLSPV_TEST_FAST_COMMON_H_
@@ -1,6 +1,16 @@
 // OpenCL port of the FAST corner detector.
 // Copyright (C) 2014, Itseez Inc. See the license at http://opencv.org
 
+// FAST_findKeypoints_aggregated のワークグループサイズの上限
+// (ローカルメモリの確保に使う。ホスト側の FIND_WORKGROUP_SIZE^2 以上にする)
+#define MAX_WORKGROUP_SIZE 256
+// FAST_findKeypoints_tiled のワークグループサイズ (1辺) の上限
+// (タイルは周囲 3 画素を含めて (16 + 6) x (16 + 6) byte)
+#define MAX_TILE_WORKGROUP_SIZE 16
+#define MAX_TILE_SIZE (MAX_TILE_WORKGROUP_SIZE + 6)
+
+#include "fast_common.h"
+
 __kernel
 void FAST_findKeypoints(
     __global const uchar * _img, int step, int img_offset,
@@ -14,52 +24,107 @@ void FAST_findKeypoints(
     if (i < img_rows - 3 && j < img_cols - 3)
     {
         __global const uchar* img = _img + mad24(i, step, j + img_offset);
-        int v = img[0], t0 = v - threshold, t1 = v + threshold;
-        int k, tofs, v0, v1;
-        int m0 = 0, m1 = 0;
+        if( !isFastCorner(img, step, threshold) )
+            return;
 
-        #define UPDATE_MASK(idx, ofs) \
-            tofs = ofs; v0 = img[tofs]; v1 = img[-tofs]; \
-            m0 |= ((v0 < t0) << idx) | ((v1 < t0) << (8 + idx)); \
-            m1 |= ((v0 > t1) << idx) | ((v1 > t1) << (8 + idx))
+        {
+            int idx = atomic_inc(kp_loc);
+            if( idx < max_keypoints )
+            {
+                kp_loc[1 + 2*idx] = j;
+                kp_loc[2 + 2*idx] = i;
+            }
+        }
+    }
+}
 
-        UPDATE_MASK(0, 3);
-        if( (m0 | m1) == 0 )
-            return;
+// FAST_findKeypoints と同じ候補を出力するが、候補をワークグループの中で
+// ローカルメモリにまとめてから、グローバルのカウンタへの atomic_add を
+// ワークグループごとに1回だけ行う。
+// 候補の順序 (と max_keypoints を超えたときに残る候補) は FAST_findKeypoints
+// と異なるが、集合としては一致する。
+__kernel
+void FAST_findKeypoints_aggregated(
+    __global const uchar * _img, int step, int img_offset,
+    int img_rows, int img_cols,
+    volatile __global int* kp_loc,
+    int max_keypoints, int threshold )
+{
+    __local int local_loc[2 * MAX_WORKGROUP_SIZE];
+    __local int local_count;
+    __local int global_base;
 
-        UPDATE_MASK(2, -step*2+2);
-        UPDATE_MASK(4, -step*3);
-        UPDATE_MASK(6, -step*2-2);
+    const int local_size = (int)(get_local_size(0) * get_local_size(1));
+    const int lid =
+        (int)(get_local_id(1) * get_local_size(0) + get_local_id(0));
+    if (lid == 0)
+        local_count = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-        #define EVEN_MASK (1+4+16+64)
+    // バリアがあるので、範囲外のスレッドも途中で return しない
+    int j = (int)get_global_id(0) + 3;
+    int i = (int)get_global_id(1) + 3;
+    if (i < img_rows - 3 && j < img_cols - 3 &&
+        isFastCorner(_img + mad24(i, step, j + img_offset), step, threshold))
+    {
+        int local_idx = atomic_inc(&local_count);
+        local_loc[2*local_idx] = j;
+        local_loc[2*local_idx + 1] = i;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-        if( ((m0 | (m0 >> 8)) & EVEN_MASK) != EVEN_MASK &&
-            ((m1 | (m1 >> 8)) & EVEN_MASK) != EVEN_MASK )
-            return;
+    if (lid == 0)
+        global_base = local_count > 0 ? atomic_add(kp_loc, local_count) : 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-        UPDATE_MASK(1, -step+3);
-        UPDATE_MASK(3, -step*3+1);
-        UPDATE_MASK(5, -step*3-1);
-        UPDATE_MASK(7, -step-3);
-        if( ((m0 | (m0 >> 8)) & 255) != 255 &&
-            ((m1 | (m1 >> 8)) & 255) != 255 )
-            return;
+    // ワークグループの候補は連続した領域に書き込む
+    for (int k = lid; k < local_count; k += local_size)
+    {
+        int idx = global_base + k;
+        if( idx < max_keypoints )
+        {
+            kp_loc[1 + 2*idx] = local_loc[2*k];
+            kp_loc[2 + 2*idx] = local_loc[2*k + 1];
+        }
+    }
+}
 
-        m0 |= m0 << 16;
-        m1 |= m1 << 16;
+// FAST_findKeypoints と同じ候補を出力するが、画素ごとに円周の 16 画素を
+// __global から 1 byte ずつ読む代わりに、ワークグループの範囲と周囲 3 画素の
+// タイルを 32bit ずつ読んでローカルメモリに置き、判定はタイルから行う。
+// _img32 は FAST_findKeypoints の _img と同じバッファ (descriptor set は共通)。
+__kernel
+void FAST_findKeypoints_tiled(
+    __global const uint * _img32, int step, int img_offset,
+    int img_rows, int img_cols,
+    volatile __global int* kp_loc,
+    int max_keypoints, int threshold )
+{
+    __local uchar tile[MAX_TILE_SIZE * MAX_TILE_SIZE];
 
-        #define CHECK0(i) ((m0 & (511 << i)) == (511 << i))
-        #define CHECK1(i) ((m1 & (511 << i)) == (511 << i))
+    const int local_w = (int)get_local_size(0);
+    const int local_h = (int)get_local_size(1);
+    const int lid =
+        (int)(get_local_id(1) * get_local_size(0) + get_local_id(0));
+    const int tile_w = local_w + 6;
 
-        if( CHECK0(0) + CHECK0(1) + CHECK0(2) + CHECK0(3) +
-            CHECK0(4) + CHECK0(5) + CHECK0(6) + CHECK0(7) +
-            CHECK0(8) + CHECK0(9) + CHECK0(10) + CHECK0(11) +
-            CHECK0(12) + CHECK0(13) + CHECK0(14) + CHECK0(15) +
+    // (j, i) = (get_global_id + 3) なので、タイルの左上はワークグループの
+    // 最初の画素の 3 画素左上
+    loadTile32(_img32, step, img_offset, img_rows, img_cols,
+               (int)(get_group_id(0) * local_w),
+               (int)(get_group_id(1) * local_h), tile_w, local_h + 6,
+               tile, lid, local_w * local_h);
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-            CHECK1(0) + CHECK1(1) + CHECK1(2) + CHECK1(3) +
-            CHECK1(4) + CHECK1(5) + CHECK1(6) + CHECK1(7) +
-            CHECK1(8) + CHECK1(9) + CHECK1(10) + CHECK1(11) +
-            CHECK1(12) + CHECK1(13) + CHECK1(14) + CHECK1(15) == 0 )
+    int j = (int)get_global_id(0) + 3;
+    int i = (int)get_global_id(1) + 3;
+    if (i < img_rows - 3 && j < img_cols - 3)
+    {
+        __local const uchar* img = tile +
+            ((int)get_local_id(1) + 3) * tile_w + (int)get_local_id(0) + 3;
+        int c[16];
+        LOAD_CIRCLE(c, img, tile_w);
+        if( !isFastCornerCircle(img[0], c, threshold) )
             return;
 
         {
@@ -72,4 +137,3 @@ void FAST_findKeypoints(
         }
     }
 }
-
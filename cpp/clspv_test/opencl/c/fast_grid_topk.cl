@@ -0,0 +1,155 @@
+// FAST のキーポイントを格子 (cell_size x cell_size のセル) に分け、セルごとに
+// スコアの高い per_cell 個を選ぶ (ORB-SLAM の格子ごとの選択と同じ)。
+//
+// FAST_nonmaxSupression (または FAST_nonmaxScoreMap) の出力 kp_out
+// ([0]: 数, [1 + 3 * i] ...: x, y, score) から
+//   1. FAST_gridCount   : セルごとのキーポイントの数を数える
+//   2. FAST_gridScan    : 数の累積和から各セルの items の開始位置を作る
+//   3. FAST_gridScatter : キーポイントの番号をセルごとに items に並べる
+//   4. FAST_gridSelect  : セルごとに上位 per_cell 個を選ぶ
+// の順に実行し、grid_out[3 * (per_cell * cell + r)] ... に
+// (x, y, score) を書く (r はスコアの降順。足りない分は (-1, -1, -1))。
+//
+// セルの中の順序は (score の降順, セル内の位置の昇順) の全順序で決めるので、
+// atomic による items の並びに関わらず結果は決定的になる。
+// (kp_out が max_keypoints で溢れた場合は、残ったキーポイント自体が
+//  決定的でない)
+//
+// cells は [0, num_cells) がセルごとの数、[num_cells, 2 * num_cells) が
+// items への書き込み位置 (FAST_gridScatter の後はセルの終わり) で、
+// 実行前に 0 にしておく。
+// 4 つのカーネルは同じ引数 (descriptor set と push constant) を共有する。
+
+// cell_size の上限 (セル内の位置を 12bit で表す)
+#define MAX_CELL_SIZE 64
+
+// FAST_gridScan のワークグループサイズ (1 つのワークグループで実行する)
+#define SCAN_WORKGROUP_SIZE 256
+
+inline int numKeypoints(__global const int *kp_out, int max_keypoints) {
+  return min(kp_out[0], max_keypoints);
+}
+
+inline int cellIndex(__global const int *kp_out, int idx, int cell_size,
+                     int grid_cols) {
+  const int x = kp_out[1 + 3 * idx];
+  const int y = kp_out[2 + 3 * idx];
+  return (y / cell_size) * grid_cols + x / cell_size;
+}
+
+// セルの中での順序のキー (大きいほど先)
+// スコア (8bit) が高いほど、同じスコアならセル内で左上にあるほど大きい
+inline int selectKey(__global const int *kp_out, int idx, int cell_size) {
+  const int x     = kp_out[1 + 3 * idx];
+  const int y     = kp_out[2 + 3 * idx];
+  const int score = kp_out[3 + 3 * idx];
+  const int pos   = (y % cell_size) * cell_size + x % cell_size;
+  return (score << 12) | (MAX_CELL_SIZE * MAX_CELL_SIZE - 1 - pos);
+}
+
+__kernel void FAST_gridCount(__global const int *kp_out,
+                             volatile __global int *cells,
+                             __global int *items, __global int *grid_out,
+                             int cell_size, int grid_cols, int grid_rows,
+                             int per_cell, int max_keypoints) {
+  const int idx = (int)get_global_id(0);
+  if (idx < numKeypoints(kp_out, max_keypoints)) {
+    atomic_inc(&cells[cellIndex(kp_out, idx, cell_size, grid_cols)]);
+  }
+}
+
+__attribute__((reqd_work_group_size(SCAN_WORKGROUP_SIZE, 1, 1)))
+__kernel void FAST_gridScan(__global const int *kp_out,
+                            volatile __global int *cells,
+                            __global int *items, __global int *grid_out,
+                            int cell_size, int grid_cols, int grid_rows,
+                            int per_cell, int max_keypoints) {
+  __local int partial[SCAN_WORKGROUP_SIZE];
+
+  // 各スレッドが連続した chunk 個のセルを受け持つ
+  const int num_cells = grid_cols * grid_rows;
+  const int lid       = (int)get_local_id(0);
+  const int chunk = (num_cells + SCAN_WORKGROUP_SIZE - 1) / SCAN_WORKGROUP_SIZE;
+  const int begin = min(lid * chunk, num_cells);
+  const int end   = min(begin + chunk, num_cells);
+
+  int sum = 0;
+  for (int i = begin; i < end; ++i) {
+    sum += cells[i];
+  }
+  partial[lid] = sum;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  // chunk ごとの和の排他的累積和 (SCAN_WORKGROUP_SIZE 個なので逐次で十分)
+  if (lid == 0) {
+    int acc = 0;
+    for (int i = 0; i < SCAN_WORKGROUP_SIZE; ++i) {
+      const int v = partial[i];
+      partial[i]  = acc;
+      acc += v;
+    }
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  int offset = partial[lid];
+  for (int i = begin; i < end; ++i) {
+    cells[num_cells + i] = offset;
+    offset += cells[i];
+  }
+}
+
+__kernel void FAST_gridScatter(__global const int *kp_out,
+                               volatile __global int *cells,
+                               __global int *items, __global int *grid_out,
+                               int cell_size, int grid_cols, int grid_rows,
+                               int per_cell, int max_keypoints) {
+  const int idx = (int)get_global_id(0);
+  if (idx < numKeypoints(kp_out, max_keypoints)) {
+    const int num_cells = grid_cols * grid_rows;
+    const int cell      = cellIndex(kp_out, idx, cell_size, grid_cols);
+    items[atomic_inc(&cells[num_cells + cell])] = idx;
+  }
+}
+
+__kernel void FAST_gridSelect(__global const int *kp_out,
+                              volatile __global int *cells,
+                              __global int *items, __global int *grid_out,
+                              int cell_size, int grid_cols, int grid_rows,
+                              int per_cell, int max_keypoints) {
+  const int cell      = (int)get_global_id(0);
+  const int num_cells = grid_cols * grid_rows;
+  if (cell >= num_cells) {
+    return;
+  }
+
+  // FAST_gridScatter の後の書き込み位置はセルの終わり
+  const int count = cells[cell];
+  const int start = cells[num_cells + cell] - count;
+  __global int *out = grid_out + 3 * per_cell * cell;
+
+  // 前に選んだキーより小さいキーの最大値を per_cell 回選ぶ
+  // (per_cell は小さいので、セルの中を per_cell 回走査する)
+  int last_key = INT_MAX;
+  for (int r = 0; r < per_cell; ++r) {
+    int best_key = -1;
+    int best_idx = -1;
+    for (int k = 0; k < count; ++k) {
+      const int idx = items[start + k];
+      const int key = selectKey(kp_out, idx, cell_size);
+      if (key < last_key && key > best_key) {
+        best_key = key;
+        best_idx = idx;
+      }
+    }
+    if (best_idx < 0) {
+      out[3 * r]     = -1;
+      out[3 * r + 1] = -1;
+      out[3 * r + 2] = -1;
+      continue;
+    }
+    out[3 * r]     = kp_out[1 + 3 * best_idx];
+    out[3 * r + 1] = kp_out[2 + 3 * best_idx];
+    out[3 * r + 2] = kp_out[3 + 3 * best_idx];
+    last_key       = best_key;
+  }
+}
@@ -1,56 +1,35 @@
 // OpenCL port of the FAST corner detector.
 // Copyright (C) 2014, Itseez Inc. See the license at http://opencv.org
 
-inline int cornerScore(__global const uchar* img, int step)
-{
-    int k, tofs, v = img[0], a0 = 0, b0;
-    int d[16];
-    #define LOAD2(idx, ofs) \
-        tofs = ofs; d[idx] = (short)(v - img[tofs]); d[idx+8] = (short)(v - img[-tofs])
-    LOAD2(0, 3);
-    LOAD2(1, -step+3);
-    LOAD2(2, -step*2+2);
-    LOAD2(3, -step*3+1);
-    LOAD2(4, -step*3);
-    LOAD2(5, -step*3-1);
-    LOAD2(6, -step*2-2);
-    LOAD2(7, -step-3);
+#include "fast_common.h"
 
-    #pragma unroll
-    for( k = 0; k < 16; k += 2 )
-    {
-        int a = min((int)d[(k+1)&15], (int)d[(k+2)&15]);
-        a = min(a, (int)d[(k+3)&15]);
-        a = min(a, (int)d[(k+4)&15]);
-        a = min(a, (int)d[(k+5)&15]);
-        a = min(a, (int)d[(k+6)&15]);
-        a = min(a, (int)d[(k+7)&15]);
-        a = min(a, (int)d[(k+8)&15]);
-        a0 = max(a0, min(a, (int)d[k&15]));
-        a0 = max(a0, min(a, (int)d[(k+9)&15]));
-    }
+///////////////////////////////////////////////////////////////////////////
+// nonmaxSupression
 
-    b0 = -a0;
-    #pragma unroll
-    for( k = 0; k < 16; k += 2 )
-    {
-        int b = max((int)d[(k+1)&15], (int)d[(k+2)&15]);
-        b = max(b, (int)d[(k+3)&15]);
-        b = max(b, (int)d[(k+4)&15]);
-        b = max(b, (int)d[(k+5)&15]);
-        b = max(b, (int)d[(k+6)&15]);
-        b = max(b, (int)d[(k+7)&15]);
-        b = max(b, (int)d[(k+8)&15]);
+// FAST_nonmaxSupression_aggregated のワークグループサイズの上限
+// (ローカルメモリの確保に使う。ホスト側の NMS_WORKGROUP_SIZE 以上にする)
+#define MAX_WORKGROUP_SIZE 256
 
-        b0 = min(b0, max(b, (int)d[k]));
-        b0 = min(b0, max(b, (int)d[(k+9)&15]));
-    }
+// (x, y) のスコアが 3x3 の近傍の中で最大なら 1 を返し、score にスコアを書く
+inline int isLocalMax(__global const uchar* img, int step, int x, int y,
+                      int rows, int cols, int* score)
+{
+    int s = cornerScore(img, step);
 
-    return -b0-1;
-}
+    if( (x < 4 || s > cornerScore(img-1, step)) +
+        (y < 4 || s > cornerScore(img-step, step)) != 2 )
+        return 0;
+    if( (x >= cols - 4 || s > cornerScore(img+1, step)) +
+        (y >= rows - 4 || s > cornerScore(img+step, step)) +
+        (x < 4 || y < 4 || s > cornerScore(img-step-1, step)) +
+        (x >= cols - 4 || y < 4 || s > cornerScore(img-step+1, step)) +
+        (x < 4 || y >= rows - 4 || s > cornerScore(img+step-1, step)) +
+        (x >= cols - 4 || y >= rows - 4 || s > cornerScore(img+step+1, step)) != 6)
+        return 0;
 
-///////////////////////////////////////////////////////////////////////////
-// nonmaxSupression
+    *score = s;
+    return 1;
+}
 
 __kernel
 void FAST_nonmaxSupression(
@@ -60,23 +39,17 @@ void FAST_nonmaxSupression(
 {
     const int idx = get_global_id(0);
 
-    if (idx < counter)
+    // counter はホストが読み戻したカウンタ (読み戻さない場合は
+    // max_keypoints)。間接ディスパッチではスレッド数がワークグループ単位に
+    // 切り上げられるので、デバイス上のカウンタ (kp_in[0]) でも制限する。
+    if (idx < min(counter, kp_in[0]))
     {
         int x = kp_in[1 + 2*idx];
         int y = kp_in[2 + 2*idx];
         __global const uchar* img = _img + mad24(y, step, x + img_offset);
 
-        int s = cornerScore(img, step);
-
-        if( (x < 4 || s > cornerScore(img-1, step)) +
-            (y < 4 || s > cornerScore(img-step, step)) != 2 )
-            return;
-        if( (x >= cols - 4 || s > cornerScore(img+1, step)) +
-            (y >= rows - 4 || s > cornerScore(img+step, step)) +
-            (x < 4 || y < 4 || s > cornerScore(img-step-1, step)) +
-            (x >= cols - 4 || y < 4 || s > cornerScore(img-step+1, step)) +
-            (x < 4 || y >= rows - 4 || s > cornerScore(img+step-1, step)) +
-            (x >= cols - 4 || y >= rows - 4 || s > cornerScore(img+step+1, step)) == 6)
+        int s;
+        if( isLocalMax(img, step, x, y, rows, cols, &s) )
         {
             int new_idx = atomic_inc(kp_out);
             if( new_idx < max_keypoints )
@@ -88,3 +61,53 @@ void FAST_nonmaxSupression(
         }
     }
 }
+
+// FAST_nonmaxSupression と同じキーポイントを出力するが、ワークグループの
+// 中でローカルメモリにまとめてから、グローバルのカウンタへの atomic_add を
+// ワークグループごとに1回だけ行う。
+__kernel
+void FAST_nonmaxSupression_aggregated(
+    __global const int* kp_in, volatile __global int* kp_out,
+    __global const uchar * _img, int step, int img_offset,
+    int rows, int cols, int counter, int max_keypoints)
+{
+    __local int local_out[3 * MAX_WORKGROUP_SIZE];
+    __local int local_count;
+    __local int global_base;
+
+    const int local_size = (int)get_local_size(0);
+    const int lid = (int)get_local_id(0);
+    if (lid == 0)
+        local_count = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // バリアがあるので、範囲外のスレッドも途中で return しない
+    const int idx = get_global_id(0);
+    if (idx < min(counter, kp_in[0]))
+    {
+        int x = kp_in[1 + 2*idx];
+        int y = kp_in[2 + 2*idx];
+        __global const uchar* img = _img + mad24(y, step, x + img_offset);
+
+        int s;
+        if( isLocalMax(img, step, x, y, rows, cols, &s) )
+        {
+            int local_idx = atomic_inc(&local_count);
+            local_out[3*local_idx] = x;
+            local_out[3*local_idx + 1] = y;
+            local_out[3*local_idx + 2] = s;
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (lid == 0)
+        global_base = local_count > 0 ? atomic_add(kp_out, local_count) : 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // ワークグループのキーポイントは連続した領域に書き込む
+    for (int k = lid; k < 3 * local_count; k += local_size)
+    {
+        if( global_base + k / 3 < max_keypoints )
+            kp_out[1 + 3*global_base + k] = local_out[k];
+    }
+}
@@ -0,0 +1,15 @@
+// FAST_nonmaxSupression を vkCmdDispatchIndirect で実行するための引数
+// (VkDispatchIndirectCommand) を、FAST_findKeypoints のカウンタ (kp_loc[0])
+// から作る。
+// カウンタをホストに読み戻さずに、1つの command buffer の中で
+// 検出 -> 非極大値抑制 を続けて実行できる。
+__attribute__((reqd_work_group_size(1, 1, 1)))
+__kernel void FAST_prepareDispatch(__global const int *kp_loc,
+                                   __global uint *dispatch_args,
+                                   int max_keypoints, int workgroup_size) {
+  // max_keypoints を超えた分はリストに書き込まれていない
+  const int counter = min(kp_loc[0], max_keypoints);
+  dispatch_args[0]  = (uint)((counter + workgroup_size - 1) / workgroup_size);
+  dispatch_args[1]  = 1;
+  dispatch_args[2]  = 1;
+}
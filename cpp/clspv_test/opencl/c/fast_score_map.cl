@@ -0,0 +1,152 @@
+// FAST のスコアマップ版
+//
+// FAST_findKeypoints + FAST_nonmaxSupression は候補のリストを作り、候補ごとに
+// 中心と 8 近傍のスコア (cornerScore) を最大 9 回計算する。
+// ここでは
+//   1. FAST_scoreMap       : 全画素のスコアを score_map に書く
+//                            (コーナーでない画素と端の 3 画素は 0)
+//   2. FAST_nonmaxScoreMap : score_map のタイルをローカルメモリに読み込み、
+//                            3x3 の非極大値抑制をして (x, y, score) を
+//                            kp_out に追加する
+// の 2 パスで、1 画素あたりのスコアの計算を 1 回にする。
+// threshold >= 1 のとき、コーナーのスコアは threshold 以上、コーナーでない
+// 画素のスコアは threshold 未満なので、コーナーでない画素を 0 にしても
+// 非極大値抑制の結果は FAST_nonmaxSupression と一致する。
+//
+// 2 つのカーネルは同じ push constant (POD の引数) を共有する。
+// ワークグループサイズはホスト側から specialization constant
+// (SpecId 0, 1) で与える。
+
+#include "fast_common.h"
+
+// FAST_nonmaxScoreMap のワークグループサイズ (1辺) の上限
+#define MAX_WORKGROUP_SIZE 16
+#define MAX_TILE_SIZE (MAX_WORKGROUP_SIZE + 2)
+// FAST_scoreMap_tiled のタイル (周囲 3 画素を含む) の1辺
+#define MAX_IMG_TILE_SIZE (MAX_WORKGROUP_SIZE + 6)
+
+__kernel void FAST_scoreMap(__global const uchar *_img,
+                            __global uchar *score_map, int step,
+                            int img_offset, int rows, int cols, int threshold,
+                            int max_keypoints) {
+  const int x = (int)get_global_id(0);
+  const int y = (int)get_global_id(1);
+  if (x >= cols || y >= rows) {
+    return;
+  }
+
+  int score = 0;
+  if (3 <= x && x < cols - 3 && 3 <= y && y < rows - 3) {
+    __global const uchar *img = _img + mad24(y, step, x + img_offset);
+    if (isFastCorner(img, step, threshold)) {
+      score = cornerScore(img, step);
+    }
+  }
+  score_map[y * cols + x] = (uchar)score;
+}
+
+// FAST_scoreMap と同じスコアマップを書くが、ワークグループの範囲と周囲
+// 3 画素のタイルを 32bit ずつ読んでローカルメモリに置き、判定とスコアの計算は
+// タイルから行う (fast_find_keypoints.cl の FAST_findKeypoints_tiled と同じ)。
+// _img32 は FAST_scoreMap の _img と同じバッファ (descriptor set は共通)。
+__kernel void FAST_scoreMap_tiled(__global const uint *_img32,
+                                  __global uchar *score_map, int step,
+                                  int img_offset, int rows, int cols,
+                                  int threshold, int max_keypoints) {
+  __local uchar tile[MAX_IMG_TILE_SIZE * MAX_IMG_TILE_SIZE];
+
+  const int local_w = (int)get_local_size(0);
+  const int local_h = (int)get_local_size(1);
+  const int lid =
+      (int)(get_local_id(1) * get_local_size(0) + get_local_id(0));
+  const int tile_w = local_w + 6;
+  loadTile32(_img32, step, img_offset, rows, cols,
+             (int)(get_group_id(0) * local_w) - 3,
+             (int)(get_group_id(1) * local_h) - 3, tile_w, local_h + 6, tile,
+             lid, local_w * local_h);
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  const int x = (int)get_global_id(0);
+  const int y = (int)get_global_id(1);
+  if (x >= cols || y >= rows) {
+    return;
+  }
+
+  int score = 0;
+  if (3 <= x && x < cols - 3 && 3 <= y && y < rows - 3) {
+    __local const uchar *img =
+        tile + ((int)get_local_id(1) + 3) * tile_w + (int)get_local_id(0) + 3;
+    int c[16];
+    LOAD_CIRCLE(c, img, tile_w);
+    if (isFastCornerCircle(img[0], c, threshold)) {
+      score = cornerScoreCircle(img[0], c);
+    }
+  }
+  score_map[y * cols + x] = (uchar)score;
+}
+
+__kernel void FAST_nonmaxScoreMap(__global const uchar *score_map,
+                                  volatile __global int *kp_out, int step,
+                                  int img_offset, int rows, int cols,
+                                  int threshold, int max_keypoints) {
+  __local uchar tile[MAX_TILE_SIZE * MAX_TILE_SIZE];
+  __local int local_out[3 * MAX_WORKGROUP_SIZE * MAX_WORKGROUP_SIZE];
+  __local int local_count;
+  __local int global_base;
+
+  const int local_w    = (int)get_local_size(0);
+  const int local_h    = (int)get_local_size(1);
+  const int local_size = local_w * local_h;
+  const int lid =
+      (int)(get_local_id(1) * get_local_size(0) + get_local_id(0));
+  const int x0 = (int)(get_group_id(0) * get_local_size(0)) - 1;
+  const int y0 = (int)(get_group_id(1) * get_local_size(1)) - 1;
+
+  // ワークグループの範囲 + 周囲 1 画素を読み込む (画像の外は 0)
+  const int tile_w = local_w + 2;
+  const int tile_h = local_h + 2;
+  for (int k = lid; k < tile_w * tile_h; k += local_size) {
+    const int tx = x0 + k % tile_w;
+    const int ty = y0 + k / tile_w;
+    tile[k]      = (0 <= tx && tx < cols && 0 <= ty && ty < rows)
+                       ? score_map[ty * cols + tx]
+                       : 0;
+  }
+  if (lid == 0) {
+    local_count = 0;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  // バリアがあるので、範囲外のスレッドも途中で return しない
+  const int x  = (int)get_global_id(0);
+  const int y  = (int)get_global_id(1);
+  const int lx = (int)get_local_id(0) + 1;
+  const int ly = (int)get_local_id(1) + 1;
+  const int s  = tile[ly * tile_w + lx];
+  if (x < cols && y < rows && s > 0 &&
+      s > tile[(ly - 1) * tile_w + lx - 1] &&
+      s > tile[(ly - 1) * tile_w + lx] &&
+      s > tile[(ly - 1) * tile_w + lx + 1] &&
+      s > tile[ly * tile_w + lx - 1] && s > tile[ly * tile_w + lx + 1] &&
+      s > tile[(ly + 1) * tile_w + lx - 1] &&
+      s > tile[(ly + 1) * tile_w + lx] &&
+      s > tile[(ly + 1) * tile_w + lx + 1]) {
+    const int local_idx          = atomic_inc(&local_count);
+    local_out[3 * local_idx]     = x;
+    local_out[3 * local_idx + 1] = y;
+    local_out[3 * local_idx + 2] = s;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  // グローバルのカウンタへの atomic_add はワークグループごとに 1 回
+  if (lid == 0) {
+    global_base = local_count > 0 ? atomic_add(kp_out, local_count) : 0;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (int k = lid; k < 3 * local_count; k += local_size) {
+    if (global_base + k / 3 < max_keypoints) {
+      kp_out[1 + 3 * global_base + k] = local_out[k];
+    }
+  }
+}
@@ -1,4 +1,15 @@
-#define WORKGROUP_SIZE 32
+// ワークグループサイズはホスト側から specialization constant
+// (SpecId 0, 1, 2) で与えるので reqd_work_group_size は指定しない。
+// MAX_WORKGROUP_SIZE はタイル版のローカルメモリの確保にのみ使う。
+#define MAX_WORKGROUP_SIZE 32
+
+// 半径はループの上限をコンパイル時に確定させて展開できるように
+// マクロで与える。makefile で RADIUS=1..15 の SPIR-V
+// (spirv/c/gaussian_filter_r*.spv) を生成する。
+#ifndef RADIUS
+#define RADIUS 3
+#endif
+#define MAX_TILE_SIZE (MAX_WORKGROUP_SIZE + 2 * RADIUS)
 
 #define IN(x_, y_) (0 <= (x_) && (x_) < (int)w && 0 <= (y_) && (y_) < (int)h)
 
@@ -17,20 +28,10 @@
     }                                                             \
   }
 
-#define ADD_RAW(offset_y) \
-  ADD(-3, (offset_y))     \
-  ADD(-2, (offset_y))     \
-  ADD(-1, (offset_y))     \
-  ADD(-0, (offset_y))     \
-  ADD(1, (offset_y))      \
-  ADD(2, (offset_y))      \
-  ADD(3, (offset_y))
-
-// TODO(anyone): Specify workgroup in host code.
-__attribute__((reqd_work_group_size(WORKGROUP_SIZE, WORKGROUP_SIZE, 1)))
-__kernel void
-gaussian_filter7x7_glayscale(__global uchar *dst, __global const uchar *src,
-                             uint w, uint h, float sigma) {
+// (2 * RADIUS + 1) x (2 * RADIUS + 1) の2次元畳み込み (RADIUS = 3 のとき 7x7)
+__kernel void gaussian_filter_grayscale(__global uchar *dst,
+                                        __global const uchar *src, uint w,
+                                        uint h, float sigma) {
   const uint index_x = get_global_id(0);
   const uint index_y = get_global_id(1);
 
@@ -49,13 +50,152 @@ gaussian_filter7x7_glayscale(__global uchar *dst, __global const uchar *src,
 
   float sum = 0.f;
 
-  ADD_RAW(-3);
-  ADD_RAW(-2);
-  ADD_RAW(-1);
-  ADD_RAW(0);
-  ADD_RAW(1);
-  ADD_RAW(2);
-  ADD_RAW(3);
+#pragma unroll
+  for (int offset_y = -RADIUS; offset_y <= RADIUS; ++offset_y) {
+#pragma unroll
+    for (int offset_x = -RADIUS; offset_x <= RADIUS; ++offset_x) {
+      ADD(offset_x, offset_y)
+    }
+  }
 
   dst[center_idx] = (uchar)(sum);
 }
+
+// ローカルメモリを使ったタイル版
+//
+// gaussian_filter_grayscale では各画素が (2 * RADIUS + 1)^2 回 global memory
+// を読み、同じ画素が最大 (2 * RADIUS + 1)^2 個の work item から読まれる。
+// ここではワークグループ全体で (32 + 2 * RADIUS) x (32 + 2 * RADIUS) の
+// タイル(ハロー込み)を __local memory に一度だけ読み込み、畳み込みは
+// ローカルメモリから行う。
+// 画像外の画素は 0 として読み込むので、2次元版と同じ結果になる。
+// (2 * RADIUS + 1)^2 個の重みもタイルと一緒にワークグループで一度だけ
+// __local memory に計算しておき、畳み込みのループでは exp() を呼ばない
+// (重みは2次元版と同じ式なので結果は変わらない)。
+//
+// ローカルメモリは MAX_WORKGROUP_SIZE で確保するので、
+// ワークグループサイズは MAX_WORKGROUP_SIZE 以下でなければならない。
+
+#define KERNEL_SIZE (2 * RADIUS + 1)
+
+#define ADD_TILE(offset_x, offset_y)                                      \
+  sum += weights[((offset_y) + RADIUS) * KERNEL_SIZE + (offset_x) +       \
+                 RADIUS] *                                                \
+         (float)tile[(local_y + RADIUS + (offset_y)) * tile_w + local_x + \
+                     RADIUS + (offset_x)];
+
+__kernel void gaussian_filter_grayscale_tiled(__global uchar *dst,
+                                              __global const uchar *src,
+                                              uint w, uint h, float sigma) {
+  __local uchar tile[MAX_TILE_SIZE * MAX_TILE_SIZE];
+  __local float weights[KERNEL_SIZE * KERNEL_SIZE];
+
+  __constant const float norm_factor = 0.15915494309189534561f;  // 1 / 2 * pi
+
+  const int local_w  = (int)get_local_size(0);
+  const int local_h  = (int)get_local_size(1);
+  const int tile_w   = local_w + 2 * RADIUS;
+  const int tile_h   = local_h + 2 * RADIUS;
+  const int local_x  = (int)get_local_id(0);
+  const int local_y  = (int)get_local_id(1);
+  const int origin_x = (int)(get_group_id(0) * local_w) - RADIUS;
+  const int origin_y = (int)(get_group_id(1) * local_h) - RADIUS;
+
+  // ワークグループ全体で協調してタイルを読み込む
+  // (画像外の work item も読み込みと barrier には参加させる)
+  for (int i = local_y * local_w + local_x; i < tile_w * tile_h;
+       i += local_w * local_h) {
+    const int x_id = origin_x + i % tile_w;
+    const int y_id = origin_y + i / tile_w;
+    tile[i]        = IN(x_id, y_id) ? src[y_id * (int)w + x_id] : 0;
+  }
+  // 重みも同様に分担して計算する
+  const float inv_sigma       = 1.0f / sigma;
+  const float half_inv_simga2 = 0.5f * inv_sigma * inv_sigma;
+  for (int i = local_y * local_w + local_x; i < KERNEL_SIZE * KERNEL_SIZE;
+       i += local_w * local_h) {
+    const float offset_xf = (float)(i % KERNEL_SIZE - RADIUS);
+    const float offset_yf = (float)(i / KERNEL_SIZE - RADIUS);
+    const float r2        = offset_xf * offset_xf + offset_yf * offset_yf;
+    weights[i] = norm_factor * inv_sigma * exp(-r2 * half_inv_simga2);
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  const uint index_x = get_global_id(0);
+  const uint index_y = get_global_id(1);
+
+  if (index_x >= w || index_y >= h) return;
+
+  float sum = 0.f;
+
+#pragma unroll
+  for (int offset_y = -RADIUS; offset_y <= RADIUS; ++offset_y) {
+#pragma unroll
+    for (int offset_x = -RADIUS; offset_x <= RADIUS; ++offset_x) {
+      ADD_TILE(offset_x, offset_y)
+    }
+  }
+
+  dst[index_y * w + index_x] = (uchar)(sum);
+}
+
+// 分離型 (separable) の実装
+//
+// 2次元のガウス関数は g(x, y) = g1(x) * g1(y) と分解できるので、
+// 水平方向と垂直方向の2回の1次元畳み込みに分けられる。
+// 1次元の重み weights[RADIUS + k] (k = -RADIUS..RADIUS) はホスト側で
+// sigma から一度だけ計算して storage buffer で渡すので、
+// カーネル内で exp() は呼ばない。
+//
+// push constant のレイアウトを gaussian_filter_grayscale と揃えるために
+// sigma も引数に残している(使用しない)。
+
+// 水平方向: src(uchar) -> dst(float)
+__kernel void
+gaussian_filter_horizontal_grayscale(__global float *dst,
+                                     __global const uchar *src,
+                                     __global const float *weights, uint w,
+                                     uint h, float sigma) {
+  (void)sigma;
+  const uint index_x = get_global_id(0);
+  const uint index_y = get_global_id(1);
+
+  if (index_x >= w || index_y >= h) return;
+
+  const int row = (int)(index_y * w);
+
+  float sum = 0.f;
+#pragma unroll
+  for (int k = -RADIUS; k <= RADIUS; ++k) {
+    const int x_id = (int)index_x + k;
+    if (0 <= x_id && x_id < (int)w) {
+      sum += weights[k + RADIUS] * (float)src[row + x_id];
+    }
+  }
+
+  dst[index_y * w + index_x] = sum;
+}
+
+// 垂直方向: src(float) -> dst(uchar)
+__kernel void
+gaussian_filter_vertical_grayscale(__global uchar *dst,
+                                   __global const float *src,
+                                   __global const float *weights, uint w,
+                                   uint h, float sigma) {
+  (void)sigma;
+  const uint index_x = get_global_id(0);
+  const uint index_y = get_global_id(1);
+
+  if (index_x >= w || index_y >= h) return;
+
+  float sum = 0.f;
+#pragma unroll
+  for (int k = -RADIUS; k <= RADIUS; ++k) {
+    const int y_id = (int)index_y + k;
+    if (0 <= y_id && y_id < (int)h) {
+      sum += weights[k + RADIUS] * src[y_id * (int)w + (int)index_x];
+    }
+  }
+
+  dst[index_y * w + index_x] = (uchar)(sum);
+}
@@ -0,0 +1,74 @@
+// ガウシアンピラミッド
+//
+// gaussian_filter.cl の分離型 (gaussian_filter_horizontal_grayscale /
+// gaussian_filter_vertical_grayscale) に縮小を組み込んだもの。
+// 1つ上の段 (src_w x src_h) から縮小した段 (dst_w x dst_h) を
+//   1. gaussian_pyramid_horizontal : 横方向にぼかしながら dst_w に縮小
+//                                    (src_h 行, tmp に float で書く)
+//   2. gaussian_pyramid_vertical   : 縦方向にぼかしながら dst_h に縮小
+// の2パスで作る。縮小後の画素 x は、その中心に最も近い元の画素
+//   sx = (int)((x + 0.5) * src_w / dst_w)
+// を中心に畳み込む (ぼかしてから間引くのと同じ結果を、間引く画素だけ計算する)。
+//
+// 全ての段は1つのバッファ (pyramid) に並べ、各段の先頭を src_offset,
+// dst_offset で指定する。各段の1行の長さ (step) は段の幅と同じなので、
+// FAST のカーネルには step = 幅, img_offset = 段の先頭 を渡せばよい。
+//
+// 重み weights[RADIUS + k] はホスト側で和が 1 になるように正規化して渡す
+// (段を重ねても明るさが変わらないように)。画像外は端の画素を繰り返す。
+// 2つのカーネルは同じ引数 (descriptor set と push constant) を共有する。
+
+#ifndef RADIUS
+#define RADIUS 2
+#endif
+
+// 縮小後の画素 x の中心に最も近い元の画素
+inline int sourceIndex(int x, int src_size, int dst_size) {
+  const float scale = (float)src_size / (float)dst_size;
+  return min((int)(((float)x + 0.5f) * scale), src_size - 1);
+}
+
+// 横方向: pyramid[src_offset] (uchar) -> tmp (float, dst_w x src_h)
+__kernel void gaussian_pyramid_horizontal(__global uchar *pyramid,
+                                          __global float *tmp,
+                                          __global const float *weights,
+                                          int src_offset, int src_w, int src_h,
+                                          int dst_offset, int dst_w,
+                                          int dst_h) {
+  const int x = (int)get_global_id(0);
+  const int y = (int)get_global_id(1);
+  if (x >= dst_w || y >= src_h) return;
+
+  __global const uchar *row = pyramid + src_offset + y * src_w;
+  const int cx              = sourceIndex(x, src_w, dst_w);
+
+  float sum = 0.f;
+#pragma unroll
+  for (int k = -RADIUS; k <= RADIUS; ++k) {
+    sum += weights[k + RADIUS] * (float)row[clamp(cx + k, 0, src_w - 1)];
+  }
+
+  tmp[y * dst_w + x] = sum;
+}
+
+// 縦方向: tmp (float, dst_w x src_h) -> pyramid[dst_offset] (uchar)
+__kernel void gaussian_pyramid_vertical(__global uchar *pyramid,
+                                        __global float *tmp,
+                                        __global const float *weights,
+                                        int src_offset, int src_w, int src_h,
+                                        int dst_offset, int dst_w, int dst_h) {
+  const int x = (int)get_global_id(0);
+  const int y = (int)get_global_id(1);
+  if (x >= dst_w || y >= dst_h) return;
+
+  const int cy = sourceIndex(y, src_h, dst_h);
+
+  float sum = 0.f;
+#pragma unroll
+  for (int k = -RADIUS; k <= RADIUS; ++k) {
+    sum += weights[k + RADIUS] * tmp[clamp(cy + k, 0, src_h - 1) * dst_w + x];
+  }
+
+  // 重みの和が 1 なので 255 を超えるのは丸め誤差の分だけ
+  pyramid[dst_offset + y * dst_w + x] = (uchar)min(sum + 0.5f, 255.f);
+}
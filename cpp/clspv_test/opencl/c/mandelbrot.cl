@@ -22,29 +22,37 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
-#define WIDTH 3200
-#define HEIGHT 2400
-#define WORKGROUP_SIZE 32
+// 画像の大きさ, 表示範囲, 反復回数は push constant で与える。
+// 出力は画像全体ではなくタイル (tile_x, tile_y から tile_w x tile_h) の分
+// だけで、outputs にはタイルの中の位置 (tile_w * y + x) に書く。
+// 画像全体を1回で描く場合はタイル = 画像全体とすればよい。
+//   c = center + ((x, y) / (width, height) - 0.5) * extent
+// 色は RGBA8 (uchar4) に詰めて書くので、ホストは読み戻したバッファをそのまま
+// PNG にできる (8bit の型を使うので storageBuffer8BitAccess が必要)。
 
-typedef struct {
-  float4 value;
-} Pixel;
+#define WORKGROUP_SIZE 32
 
 __attribute__((reqd_work_group_size(WORKGROUP_SIZE, WORKGROUP_SIZE, 1)))
 __kernel void
-mandelbrot (__global Pixel* outputs) {
-  const uint index_x = get_global_id(0);
-  const uint index_y = get_global_id(1);
+mandelbrot (__global uchar4* outputs, int width, int height, int tile_x,
+            int tile_y, int tile_w, int tile_h, float center_x,
+            float center_y, float extent, int max_iterations) {
+  const int local_x = get_global_id(0);
+  const int local_y = get_global_id(1);
+  // 端のタイルはワークグループの大きさで割り切れない
+  if (local_x >= tile_w || local_y >= tile_h) return;
+  const int index_x = tile_x + local_x;
+  const int index_y = tile_y + local_y;
 
-  const float x = (float)index_x / (float)WIDTH;
-  const float y = (float)index_y / (float)HEIGHT;
+  const float x = (float)index_x / (float)width;
+  const float y = (float)index_y / (float)height;
 
   float2 uv = (float2)(x, y);
   float n   = 0.0f;
-  float2 c  = (float2)(-.445f, 0.0f) +
-             (uv - (float2)(0.5f, 0.5f)) * (float2)(2.0f + 1.7f * 0.2f);
+  float2 c  = (float2)(center_x, center_y) +
+             (uv - (float2)(0.5f, 0.5f)) * (float2)(extent);
   float2 z    = (float2)(0.0f);
-  const int M = 128.f;
+  const int M = max_iterations;
   for (int i = 0; i < M; i++) {
     z = (float2)(z.x * z.x - z.y * z.y, 2.f * z.x * z.y) + c;
     if (dot(z, z) > 2.f) break;
@@ -59,5 +67,6 @@ mandelbrot (__global Pixel* outputs) {
 
   float4 color = (float4)(d + e * cos((float3)(6.28318f) * (f * t + g)), 1.0f);
 
-  outputs[WIDTH * index_y + index_x].value = color;
+  // ホスト側で (unsigned char)(255.0f * v) としていたのと同じ 0 方向への丸め
+  outputs[tile_w * local_y + local_x] = convert_uchar4_sat(255.0f * color);
 }
@@ -0,0 +1,1180 @@
+/*
+MIT License
+
+Copyright (c) 2022 kyawakyawa
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "clspv_runtime.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace clspv_test {
+
+namespace {
+
+// Read file into array of uint32_t.
+// The data has been padded, so that it fits into an array uint32_t.
+std::vector<uint32_t> readFile(const std::string& filename) {
+  FILE* fp = fopen(filename.c_str(), "rb");
+  if (fp == NULL) {
+    throw std::runtime_error("Could not find or open file: " + filename);
+  }
+
+  // get file size.
+  fseek(fp, 0, SEEK_END);
+  long filesize = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+
+  // read file contents. (残りは0で埋められる)
+  std::vector<uint32_t> code((filesize + 3) / 4, 0);
+  fread(code.data(), filesize, sizeof(char), fp);
+  fclose(fp);
+
+  return code;
+}
+
+// size byte のハッシュ (FNV-1a 64bit)
+uint64_t hashBytes(const void* data, const size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  uint64_t hash              = 14695981039346656037ull;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// SPIR-Vのハッシュ
+uint64_t hashSpirv(const std::vector<uint32_t>& code) {
+  return hashBytes(code.data(), sizeof(uint32_t) * code.size());
+}
+
+// パイプラインキャッシュのファイルの先頭に置くヘッダ
+// ドライバが変わった場合や SPIR-Vが変わった場合は読み込まない
+struct PipelineCacheHeader {
+  char magic[8];
+  uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+  uint32_t vendor_id;
+  uint32_t device_id;
+  uint32_t driver_version;
+  uint32_t reserved;
+  uint64_t spirv_hash;
+  uint64_t data_size;
+};
+const char kPipelineCacheMagic[8] = {'C', 'L', 'S', 'P', 'V', 'P', 'C', '1'};
+
+PipelineCacheHeader makePipelineCacheHeader(
+    const VkPhysicalDeviceProperties& properties, const uint64_t spirv_hash) {
+  PipelineCacheHeader header = {};
+  memcpy(header.magic, kPipelineCacheMagic, sizeof(header.magic));
+  memcpy(header.pipeline_cache_uuid, properties.pipelineCacheUUID,
+         VK_UUID_SIZE);
+  header.vendor_id      = properties.vendorID;
+  header.device_id      = properties.deviceID;
+  header.driver_version = properties.driverVersion;
+  header.spirv_hash     = spirv_hash;
+  return header;
+}
+
+// filepath から expected と一致するキャッシュを読み込む
+// 一致しない場合やファイルがない場合は空を返す
+std::vector<char> loadPipelineCacheData(const std::string& filepath,
+                                        const PipelineCacheHeader& expected) {
+  std::vector<char> data;
+  FILE* fp = fopen(filepath.c_str(), "rb");
+  if (fp == NULL) {
+    return data;
+  }
+
+  PipelineCacheHeader header;
+  if (fread(&header, sizeof(header), 1, fp) == 1 &&
+      memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0 &&
+      memcmp(header.pipeline_cache_uuid, expected.pipeline_cache_uuid,
+             VK_UUID_SIZE) == 0 &&
+      header.vendor_id == expected.vendor_id &&
+      header.device_id == expected.device_id &&
+      header.driver_version == expected.driver_version &&
+      header.spirv_hash == expected.spirv_hash) {
+    data.resize(header.data_size);
+    if (fread(data.data(), 1, data.size(), fp) != data.size()) {
+      data.clear();
+    }
+  }
+  fclose(fp);
+  return data;
+}
+
+// 書き込み途中のファイルを他のプロセスが読まないように、一時ファイルに
+// 書いてから rename する
+void savePipelineCacheData(const std::string& filepath,
+                           PipelineCacheHeader header,
+                           const std::vector<char>& data) {
+  header.data_size           = data.size();
+  const std::string tmp_path = filepath + ".tmp";
+  FILE* fp                   = fopen(tmp_path.c_str(), "wb");
+  if (fp == NULL) {
+    fprintf(stderr, "Could not write pipeline cache: %s\n", tmp_path.c_str());
+    return;
+  }
+  const bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                  fwrite(data.data(), 1, data.size(), fp) == data.size();
+  fclose(fp);
+  if (!ok || rename(tmp_path.c_str(), filepath.c_str()) != 0) {
+    fprintf(stderr, "Could not write pipeline cache: %s\n", filepath.c_str());
+    remove(tmp_path.c_str());
+  }
+}
+
+}  // namespace
+
+void printLatency(const double context_ms, const double kernel_ms,
+                  const std::vector<double>& dispatch_ms,
+                  const char* pipeline_cache) {
+  const double first_dispatch_ms = dispatch_ms.empty() ? 0.0 : dispatch_ms[0];
+
+  printf("----- Latency -----\n");
+  if (pipeline_cache != nullptr) {
+    printf("     - pipeline cache : %s\n", pipeline_cache);
+  }
+  printf("     - context        : %8.3f ms\n", context_ms);
+  printf("     - kernel         : %8.3f ms\n", kernel_ms);
+  printf("     - first dispatch : %8.3f ms\n", first_dispatch_ms);
+  printf("     - cold start     : %8.3f ms\n",
+         context_ms + kernel_ms + first_dispatch_ms);
+  if (dispatch_ms.size() > 1) {
+    double sum_ms = 0.0;
+    double min_ms = dispatch_ms[1];
+    for (size_t i = 1; i < dispatch_ms.size(); ++i) {
+      sum_ms += dispatch_ms[i];
+      min_ms = std::min(min_ms, dispatch_ms[i]);
+    }
+    printf("     - warm dispatch  : %8.3f ms (min %.3f ms, %zu runs)\n",
+           sum_ms / (dispatch_ms.size() - 1), min_ms, dispatch_ms.size() - 1);
+  }
+}
+
+void printLatencyHistogram(const char* name, std::vector<double> samples_ms) {
+  printf("     - %s : ", name);
+  if (samples_ms.empty()) {
+    printf("no samples\n");
+    return;
+  }
+  std::sort(samples_ms.begin(), samples_ms.end());
+  const auto percentile = [&samples_ms](const double p) {
+    return samples_ms[static_cast<size_t>(p * (samples_ms.size() - 1))];
+  };
+  printf("p50 %.3f, p90 %.3f, p99 %.3f, max %.3f ms (%zu samples)\n",
+         percentile(0.5), percentile(0.9), percentile(0.99), samples_ms.back(),
+         samples_ms.size());
+
+  // [2^(i-1), 2^i) ms ごとに数える (0番目は 1/64 ms 未満)
+  const int kNumBins     = 18;
+  const double kMinBinMs = 1.0 / 64.0;
+  std::vector<size_t> bins(kNumBins, 0);
+  for (const double ms : samples_ms) {
+    int bin             = 0;
+    double bin_upper_ms = kMinBinMs;
+    while (bin + 1 < kNumBins && ms >= bin_upper_ms) {
+      ++bin;
+      bin_upper_ms *= 2.0;
+    }
+    ++bins[bin];
+  }
+  const size_t max_count = *std::max_element(bins.begin(), bins.end());
+  const int kBarWidth    = 40;
+  double upper_ms        = kMinBinMs;
+  for (int bin = 0; bin < kNumBins; ++bin, upper_ms *= 2.0) {
+    if (bins[bin] == 0) {
+      continue;
+    }
+    const int bar_width =
+        std::max<int>(1, static_cast<int>(kBarWidth * bins[bin] / max_count));
+    if (bin + 1 < kNumBins) {
+      printf("         < %9.3f ms %6zu %s\n", upper_ms, bins[bin],
+             std::string(bar_width, '#').c_str());
+    } else {
+      printf("        >= %9.3f ms %6zu %s\n", upper_ms / 2.0, bins[bin],
+             std::string(bar_width, '#').c_str());
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Context
+
+Context::Context(const bool require_int8, const bool use_pipeline_cache)
+    : require_int8_(require_int8), use_pipeline_cache_(use_pipeline_cache) {
+  const auto begin = std::chrono::steady_clock::now();
+
+  // clang-format off
+  device_extensions_ = {
+#if !(__APPLE__) // Molten VKでは対応したいないみたい(2022/03/31現在) ValidationLayerでエラーが出るが問題ない？
+      VK_KHR_SHADER_NON_SEMANTIC_INFO_EXTENSION_NAME,     // Clspvを使う場合に必要
+#endif // 1(__APPLE__)
+      VK_KHR_STORAGE_BUFFER_STORAGE_CLASS_EXTENSION_NAME, // Clspvを使う場合に必要
+  };
+  if (require_int8_) {
+    device_extensions_.insert(device_extensions_.end(), {
+        VK_KHR_VARIABLE_POINTERS_EXTENSION_NAME,   // Clspvを使う場合に必要
+        VK_KHR_8BIT_STORAGE_EXTENSION_NAME,        // shader interfaceに8bitの型用いる
+        VK_KHR_SHADER_FLOAT16_INT8_EXTENSION_NAME  // shader内で8bit intを用いる
+                                                   // (SPIR-Vで OpCapability Int8を使えるようにする)
+    });
+  }
+  // clang-format on
+
+  createInstance();
+  findPhysicalDevice();
+  createDevice();
+  createCommandPool();
+  selectMemoryTypes();
+
+  creation_time_ms_ = elapsedMs(begin);
+}
+
+Context::~Context() {
+  // Kernel はデバイスより先に破棄する
+  kernels_.clear();
+
+  vkDestroyCommandPool(device_, command_pool_, nullptr);
+  vkDestroyDevice(device_, nullptr);
+
+  if (enableValidationLayers) {
+    // destroy callback.
+    auto func = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(
+        instance_, "vkDestroyDebugReportCallbackEXT");
+    if (func != nullptr) {
+      func(instance_, debug_report_callback_, nullptr);
+    }
+  }
+
+  vkDestroyInstance(instance_, nullptr);
+}
+
+VKAPI_ATTR VkBool32 VKAPI_CALL Context::debugReportCallbackFn(
+    VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objectType,
+    uint64_t object, size_t location, int32_t messageCode,
+    const char* pLayerPrefix, const char* pMessage, void* pUserData) {
+  printf("Debug Report: %s: %s\n", pLayerPrefix, pMessage);
+
+  return VK_FALSE;
+}
+
+void Context::createInstance() {
+  std::vector<const char*> enabled_extensions;
+
+  /*
+  By enabling validation layers, Vulkan will emit warnings if the API
+  is used incorrectly. We shall enable the layer VK_LAYER_KHRONOS_validation,
+  which is basically a collection of several useful validation layers.
+  */
+  if (enableValidationLayers) {
+    uint32_t layer_count;
+    vkEnumerateInstanceLayerProperties(&layer_count, NULL);
+
+    std::vector<VkLayerProperties> layer_properties(layer_count);
+    vkEnumerateInstanceLayerProperties(&layer_count, layer_properties.data());
+
+    bool found_layer = false;
+    for (const VkLayerProperties& prop : layer_properties) {
+      if (strcmp("VK_LAYER_KHRONOS_validation", prop.layerName) == 0) {
+        found_layer = true;
+        break;
+      }
+    }
+
+    if (!found_layer) {
+      throw std::runtime_error(
+          "Layer VK_LAYER_KHRONOS_validation not supported\n");
+    }
+    enabled_layers_.push_back("VK_LAYER_KHRONOS_validation");
+
+    /*
+    We need to enable an extension named VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
+    in order to be able to print the warnings emitted by the validation layer.
+    */
+    uint32_t extension_count;
+    vkEnumerateInstanceExtensionProperties(NULL, &extension_count, NULL);
+    std::vector<VkExtensionProperties> extension_properties(extension_count);
+    vkEnumerateInstanceExtensionProperties(NULL, &extension_count,
+                                           extension_properties.data());
+
+    bool found_extension = false;
+    for (const VkExtensionProperties& prop : extension_properties) {
+      if (strcmp(VK_EXT_DEBUG_REPORT_EXTENSION_NAME, prop.extensionName) ==
+          0) {
+        found_extension = true;
+        break;
+      }
+    }
+
+    if (!found_extension) {
+      throw std::runtime_error(
+          "Extension VK_EXT_DEBUG_REPORT_EXTENSION_NAME not supported\n");
+    }
+    enabled_extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+  }
+
+  VkApplicationInfo application_info  = {};
+  application_info.sType              = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+  application_info.pApplicationName   = "clspv_test";
+  application_info.applicationVersion = 0;
+  application_info.pEngineName        = "clspv_runtime";
+  application_info.engineVersion      = 0;
+  application_info.apiVersion =
+      VK_API_VERSION_1_1;  // VkPhysicalDeviceFeatures2の利用のため
+
+  VkInstanceCreateInfo create_info = {};
+  create_info.sType                = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+  create_info.flags                = 0;
+  create_info.pApplicationInfo     = &application_info;
+
+  // Give our desired layers and extensions to vulkan.
+  create_info.enabledLayerCount       = enabled_layers_.size();
+  create_info.ppEnabledLayerNames     = enabled_layers_.data();
+  create_info.enabledExtensionCount   = enabled_extensions.size();
+  create_info.ppEnabledExtensionNames = enabled_extensions.data();
+
+  VK_CHECK_RESULT(vkCreateInstance(&create_info, NULL, &instance_));
+
+  /*
+  Register a callback function for the extension
+  VK_EXT_DEBUG_REPORT_EXTENSION_NAME, so that warnings emitted from the
+  validation layer are actually printed.
+  */
+  if (enableValidationLayers) {
+    VkDebugReportCallbackCreateInfoEXT callback_create_info = {};
+    callback_create_info.sType =
+        VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
+    callback_create_info.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT |
+                                 VK_DEBUG_REPORT_WARNING_BIT_EXT |
+                                 VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT;
+    callback_create_info.pfnCallback = &debugReportCallbackFn;
+
+    // We have to explicitly load this function.
+    auto vkCreateDebugReportCallbackEXT =
+        (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(
+            instance_, "vkCreateDebugReportCallbackEXT");
+    if (vkCreateDebugReportCallbackEXT == nullptr) {
+      throw std::runtime_error("Could not load vkCreateDebugReportCallbackEXT");
+    }
+
+    // Create and register callback.
+    VK_CHECK_RESULT(vkCreateDebugReportCallbackEXT(
+        instance_, &callback_create_info, NULL, &debug_report_callback_));
+  }
+}
+
+void Context::findPhysicalDevice() {
+  uint32_t device_count;
+  vkEnumeratePhysicalDevices(instance_, &device_count, NULL);
+  if (device_count == 0) {
+    throw std::runtime_error("could not find a device with vulkan support");
+  }
+
+  std::vector<VkPhysicalDevice> devices(device_count);
+  vkEnumeratePhysicalDevices(instance_, &device_count, devices.data());
+
+  // GPUを優先し、見つからなければ lavapipe などのソフトウェア実装(CPU)を使う
+  for (const bool allow_cpu : {false, true}) {
+    for (VkPhysicalDevice device : devices) {
+      // 一番最初に条件を満たすデバイスを見つけたらそれを選択
+      if (isDeviceSuitable(device, allow_cpu)) {
+        physical_device_ = device;
+        vkGetPhysicalDeviceProperties(physical_device_, &properties_);
+        return;
+      }
+    }
+  }
+  throw std::runtime_error("Physical Device not found\n");
+}
+
+bool Context::isDeviceSuitable(VkPhysicalDevice device,
+                               const bool allow_cpu) {
+  VkPhysicalDeviceProperties device_properties;
+  vkGetPhysicalDeviceProperties(device, &device_properties);
+
+  // グラフィックカードか？
+  const bool condition0 =
+      /* グラフィックカード */
+      device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU ||
+      /* 統合GPU */
+      device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ||
+      /* ソフトウェア実装 (lavapipe, SwiftShader など) */
+      (allow_cpu &&
+       device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU);
+
+#ifndef NDEBUG
+  if (device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
+    printf("グラフィックカードが検出されました\n");
+  } else if (device_properties.deviceType ==
+             VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU) {
+    printf("統合GPUが検出されました\n");
+  } else if (device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU) {
+    printf("ソフトウェア実装(CPU)が検出されました\n");
+  }
+#endif
+
+  // 拡張機能に対応しているか
+  return condition0 && checkDeviceExtensionSupport(device);
+}
+
+bool Context::checkDeviceExtensionSupport(const VkPhysicalDevice device) {
+  uint32_t extension_count;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
+                                       nullptr);
+
+  std::vector<VkExtensionProperties> available_extensions(extension_count);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
+                                       available_extensions.data());
+
+  std::unordered_set<std::string> required_extensions(
+      device_extensions_.begin(), device_extensions_.end());
+
+#ifndef NDEBUG
+  printf("----- Available Extensions -----\n");
+  for (const auto& extension : available_extensions) {
+    printf("     -- %s\n", extension.extensionName);
+  }
+#endif
+
+  for (const auto& extension : available_extensions) {
+    required_extensions.erase(extension.extensionName);
+  }
+
+  for (const auto& extension_name : required_extensions) {
+    fprintf(stderr, "not find Extension : %s\n", extension_name.c_str());
+  }
+
+  return required_extensions.empty();
+}
+
+bool Context::hasDeviceExtension(const VkPhysicalDevice device,
+                                 const char* extension_name) {
+  uint32_t extension_count;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
+                                       nullptr);
+
+  std::vector<VkExtensionProperties> available_extensions(extension_count);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
+                                       available_extensions.data());
+  for (const auto& extension : available_extensions) {
+    if (strcmp(extension.extensionName, extension_name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the index of a queue family that supports compute operations.
+uint32_t Context::getComputeQueueFamilyIndex() {
+  uint32_t queue_family_count;
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device_,
+                                           &queue_family_count, NULL);
+
+  // Retrieve all queue families.
+  std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(
+      physical_device_, &queue_family_count, queue_families.data());
+
+  // Now find a family that supports compute.
+  for (uint32_t i = 0; i < queue_families.size(); ++i) {
+    const VkQueueFamilyProperties& props = queue_families[i];
+    if (props.queueCount > 0 && (props.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+      return i;
+    }
+  }
+
+  throw std::runtime_error(
+      "could not find a queue family that supports operations");
+}
+
+void Context::createDevice() {
+  /*
+  When creating the device, we also specify what queues it has.
+  */
+  queue_family_index_ = getComputeQueueFamilyIndex();
+
+  VkDeviceQueueCreateInfo queue_create_info = {};
+  queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+  queue_create_info.queueFamilyIndex = queue_family_index_;
+  queue_create_info.queueCount       = 1;
+  float queue_priorities             = 1.0;
+  queue_create_info.pQueuePriorities = &queue_priorities;
+
+  // Device Feature を指定する
+  //
+  // 8bitのshader interfaceに対応するために
+  // VkPhysicalDevice8BitStorageFeaturesを使う
+  // さらに、SPIR-Vで OpCapability Int8 に対応するために
+  // VkPhysicalDeviceShaderFloat16Int8Features を使う
+  VkPhysicalDevice8BitStorageFeatures device_8bit_storage_features = {};
+  device_8bit_storage_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_8BIT_STORAGE_FEATURES;
+  VkPhysicalDeviceShaderFloat16Int8Features
+      device_shader_float16_int8_features = {};
+  device_shader_float16_int8_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_FLOAT16_INT8_FEATURES;
+  device_8bit_storage_features.pNext =
+      reinterpret_cast<void*>(&(device_shader_float16_int8_features));
+
+  // timeline semaphore は任意 (使えない場合は fence で同期する)
+  VkPhysicalDeviceTimelineSemaphoreFeatures timeline_semaphore_features = {};
+  timeline_semaphore_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+  timeline_semaphore_supported_ = hasDeviceExtension(
+      physical_device_, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+
+  VkPhysicalDeviceFeatures2 device_features2 = {};
+  device_features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  if (require_int8_) {
+    device_features2.pNext =
+        reinterpret_cast<void*>(&device_8bit_storage_features);
+  }
+  if (timeline_semaphore_supported_) {
+    timeline_semaphore_features.pNext = device_features2.pNext;
+    device_features2.pNext =
+        reinterpret_cast<void*>(&timeline_semaphore_features);
+  }
+
+  // Featureの情報を得る
+  vkGetPhysicalDeviceFeatures2(physical_device_, &device_features2);
+
+  if (require_int8_) {
+    // 8bitのstrage bufferが利用できない場合、例外を投げる
+    if (!device_8bit_storage_features.storageBuffer8BitAccess) {
+      throw std::runtime_error("Cannot use 8bit strage Buffer\n");
+    }
+    // SPIR-Vで OpCapability Int8が利用できない場合、例外を投げる
+    if (!device_shader_float16_int8_features.shaderInt8) {
+      throw std::runtime_error("Cannot use OpCapability Int8\n");
+    }
+  }
+  if (timeline_semaphore_supported_) {
+    if (timeline_semaphore_features.timelineSemaphore) {
+      device_extensions_.emplace_back(
+          VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    } else {
+      // 拡張はあっても feature がない場合は chain から外す
+      timeline_semaphore_supported_ = false;
+      device_features2.pNext        = timeline_semaphore_features.pNext;
+    }
+  }
+
+  VkDeviceCreateInfo device_create_info = {};
+  device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  // need to specify validation layers here as well.
+  device_create_info.enabledLayerCount    = enabled_layers_.size();
+  device_create_info.ppEnabledLayerNames  = enabled_layers_.data();
+  device_create_info.pQueueCreateInfos    = &queue_create_info;
+  device_create_info.queueCreateInfoCount = 1;
+  device_create_info.pEnabledFeatures     = &(device_features2.features);
+  // VkPhysicalDevice8BitStorageFeatures (とその pNext) も vkCreateDevice
+  // に渡される
+  device_create_info.pNext = device_features2.pNext;
+
+  // 拡張を指定
+  device_create_info.enabledExtensionCount =
+      static_cast<uint32_t>(device_extensions_.size());
+  device_create_info.ppEnabledExtensionNames = device_extensions_.data();
+
+  VK_CHECK_RESULT(
+      vkCreateDevice(physical_device_, &device_create_info, NULL, &device_));
+
+  // Get a handle to the only member of the queue family.
+  vkGetDeviceQueue(device_, queue_family_index_, 0, &queue_);
+
+  // 拡張の関数はデバイスから取得する
+  wait_semaphores_ = nullptr;
+  if (timeline_semaphore_supported_) {
+    wait_semaphores_ = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(
+        vkGetDeviceProcAddr(device_, "vkWaitSemaphoresKHR"));
+    timeline_semaphore_supported_ = wait_semaphores_ != nullptr;
+  }
+}
+
+void Context::createCommandPool() {
+  VkCommandPoolCreateInfo command_pool_create_info = {};
+  command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  // command buffer を個別にリセットして再記録できるようにする
+  command_pool_create_info.flags =
+      VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  command_pool_create_info.queueFamilyIndex = queue_family_index_;
+  VK_CHECK_RESULT(vkCreateCommandPool(device_, &command_pool_create_info,
+                                      nullptr, &command_pool_));
+}
+
+void Context::selectMemoryTypes() {
+  vkGetPhysicalDeviceMemoryProperties(physical_device_, &memory_properties_);
+
+  // 統合GPUやソフトウェア実装で、DEVICE_LOCAL かつ HOST_VISIBLE な
+  // メモリがあれば staging を使わない
+  // (外付けGPUの DEVICE_LOCAL | HOST_VISIBLE は BAR の小さな領域のことが
+  //  多いので使わない)
+  const VkMemoryPropertyFlags host_properties =
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  const VkMemoryPropertyFlags unified_properties =
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | host_properties;
+  const bool integrated =
+      properties_.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ||
+      properties_.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU;
+  unified_memory_ =
+      integrated && findMemoryType(~0u, unified_properties) != uint32_t(-1);
+
+  const auto print_memory_type = [this](const char* name,
+                                        const uint32_t index) {
+    if (index == uint32_t(-1)) {
+      printf("     - %-7s : not found\n", name);
+      return;
+    }
+    const VkMemoryPropertyFlags flags =
+        memory_properties_.memoryTypes[index].propertyFlags;
+    printf("     - %-7s : type %u (heap %u)%s%s%s%s\n", name, index,
+           memory_properties_.memoryTypes[index].heapIndex,
+           (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? " DEVICE_LOCAL" : "",
+           (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ? " HOST_VISIBLE" : "",
+           (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ? " HOST_COHERENT"
+                                                          : "",
+           (flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) ? " HOST_CACHED" : "");
+  };
+  printf("----- Memory (%s) -----\n",
+         unified_memory_ ? "unified, no staging" : "discrete, staging");
+  if (unified_memory_) {
+    print_memory_type("kernel", findMemoryType(~0u, unified_properties));
+  } else {
+    print_memory_type(
+        "kernel", findMemoryType(~0u, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+    print_memory_type("staging", findMemoryType(~0u, host_properties));
+  }
+}
+
+uint32_t Context::findMemoryType(uint32_t memory_type_bits,
+                                 VkMemoryPropertyFlags properties) const {
+  for (uint32_t i = 0; i < memory_properties_.memoryTypeCount; ++i) {
+    if ((memory_type_bits & (1 << i)) &&
+        ((memory_properties_.memoryTypes[i].propertyFlags & properties) ==
+         properties))
+      return i;
+  }
+  return -1;
+}
+
+Buffer Context::createBuffer(const VkDeviceSize size, VkBufferUsageFlags usage,
+                             VkMemoryPropertyFlags properties) const {
+  Buffer buffer;
+  buffer.size = size;
+
+  // どのバッファも storage buffer として使い、staging とのコピーもできる
+  // ようにする
+  usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+           VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+  VkBufferCreateInfo buffer_create_info = {};
+  buffer_create_info.sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_create_info.size        = size;
+  buffer_create_info.usage       = usage;
+  buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  VK_CHECK_RESULT(
+      vkCreateBuffer(device_, &buffer_create_info, NULL, &buffer.buffer));
+
+  //バッファ自身でメモリを確保しないので、手動で確保する必要がある
+  VkMemoryRequirements memory_requirements;
+  vkGetBufferMemoryRequirements(device_, buffer.buffer, &memory_requirements);
+
+  VkMemoryAllocateInfo allocate_info = {};
+  allocate_info.sType                = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocate_info.allocationSize       = memory_requirements.size;
+  allocate_info.memoryTypeIndex =
+      findMemoryType(memory_requirements.memoryTypeBits, properties);
+  if (allocate_info.memoryTypeIndex == uint32_t(-1)) {
+    vkDestroyBuffer(device_, buffer.buffer, nullptr);
+    throw std::runtime_error("Could not find a suitable memory type.");
+  }
+  VK_CHECK_RESULT(
+      vkAllocateMemory(device_, &allocate_info, nullptr, &buffer.memory));
+
+  // 確保したメモリとバッファを関連付ける
+  VK_CHECK_RESULT(
+      vkBindBufferMemory(device_, buffer.buffer, buffer.memory, 0));
+
+  return buffer;
+}
+
+Buffer Context::createHostVisibleBuffer(const VkDeviceSize size) const {
+  // vkMapMemoryを使ってCPUとGPUの間でバッファメモリを読み書きできるように
+  // HOST_VISIBLE を、フラッシュなしで書き込みが見えるように HOST_COHERENT
+  // を指定する
+  return createBuffer(size, 0,
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+}
+
+Buffer Context::createDeviceLocalBuffer(const VkDeviceSize size) const {
+  return createBuffer(size, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
+
+StagedBuffer Context::createStagedBuffer(const VkDeviceSize size) const {
+  StagedBuffer buffer;
+  if (unified_memory_) {
+    buffer.device = createBuffer(size, 0,
+                                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    VK_CHECK_RESULT(vkMapMemory(device_, buffer.device.memory, 0, size, 0,
+                                &buffer.mapped));
+  } else {
+    buffer.device  = createDeviceLocalBuffer(size);
+    buffer.staging = createHostVisibleBuffer(size);
+    VK_CHECK_RESULT(vkMapMemory(device_, buffer.staging.memory, 0, size, 0,
+                                &buffer.mapped));
+  }
+  return buffer;
+}
+
+void Context::destroyStagedBuffer(StagedBuffer& buffer) const {
+  if (buffer.device.buffer == VK_NULL_HANDLE) {
+    return;
+  }
+  if (buffer.staged()) {
+    vkUnmapMemory(device_, buffer.staging.memory);
+    destroyBuffer(buffer.staging);
+  } else {
+    vkUnmapMemory(device_, buffer.device.memory);
+  }
+  destroyBuffer(buffer.device);
+  buffer.mapped = nullptr;
+}
+
+void Context::recordUpload(VkCommandBuffer command_buffer,
+                           const StagedBuffer& buffer,
+                           const VkDeviceSize size) const {
+  // staging を使わない場合は、vkQueueSubmit によってホストの書き込みが
+  // 見えるようになるので何もしない
+  if (!buffer.staged()) {
+    return;
+  }
+
+  VkBufferCopy region = {};
+  region.size         = size;
+  vkCmdCopyBuffer(command_buffer, buffer.staging.buffer, buffer.device.buffer,
+                  1, &region);
+
+  // コピーが終わってからカーネルが読む
+  VkMemoryBarrier memory_barrier = {};
+  memory_barrier.sType           = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memory_barrier.srcAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+  memory_barrier.dstAccessMask =
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                       &memory_barrier, 0, nullptr, 0, nullptr);
+}
+
+void Context::recordDownload(VkCommandBuffer command_buffer,
+                             const StagedBuffer& buffer,
+                             const VkDeviceSize size) const {
+  VkMemoryBarrier memory_barrier = {};
+  memory_barrier.sType           = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memory_barrier.srcAccessMask   = VK_ACCESS_SHADER_WRITE_BIT;
+  if (!buffer.staged()) {
+    // カーネルの書き込みをホストから見えるようにする
+    memory_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memory_barrier, 0,
+                         nullptr, 0, nullptr);
+    return;
+  }
+
+  // カーネルの書き込みが終わってからコピーする
+  memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memory_barrier,
+                       0, nullptr, 0, nullptr);
+
+  VkBufferCopy region = {};
+  region.size         = size;
+  vkCmdCopyBuffer(command_buffer, buffer.device.buffer, buffer.staging.buffer,
+                  1, &region);
+
+  // コピーの結果をホストから見えるようにする
+  memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  memory_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memory_barrier, 0,
+                       nullptr, 0, nullptr);
+}
+
+void Context::destroyBuffer(Buffer& buffer) const {
+  vkFreeMemory(device_, buffer.memory, nullptr);
+  vkDestroyBuffer(device_, buffer.buffer, nullptr);
+  buffer = Buffer();
+}
+
+VkDescriptorPool Context::createDescriptorPool(
+    const uint32_t max_sets, const uint32_t num_buffers) const {
+  VkDescriptorPoolSize descriptor_pool_size = {};
+  descriptor_pool_size.type            = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptor_pool_size.descriptorCount = max_sets * num_buffers;
+
+  VkDescriptorPoolCreateInfo descriptor_pool_create_info = {};
+  descriptor_pool_create_info.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  descriptor_pool_create_info.maxSets       = max_sets;
+  descriptor_pool_create_info.poolSizeCount = 1;
+  descriptor_pool_create_info.pPoolSizes    = &descriptor_pool_size;
+
+  VkDescriptorPool descriptor_pool;
+  VK_CHECK_RESULT(vkCreateDescriptorPool(device_, &descriptor_pool_create_info,
+                                         nullptr, &descriptor_pool));
+  return descriptor_pool;
+}
+
+void Context::writeDescriptorSet(
+    VkDescriptorSet descriptor_set,
+    const std::vector<VkDescriptorBufferInfo>& buffers) const {
+  std::vector<VkWriteDescriptorSet> write_descriptor_sets(buffers.size());
+  for (uint32_t binding = 0; binding < buffers.size(); ++binding) {
+    VkWriteDescriptorSet& write_descriptor_set =
+        write_descriptor_sets[binding];
+    write_descriptor_set       = {};
+    write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set.dstSet          = descriptor_set;
+    write_descriptor_set.dstBinding      = binding;
+    write_descriptor_set.descriptorCount = 1;
+    write_descriptor_set.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_descriptor_set.pBufferInfo     = &buffers[binding];
+  }
+
+  vkUpdateDescriptorSets(device_, write_descriptor_sets.size(),
+                         write_descriptor_sets.data(), 0, nullptr);
+}
+
+VkCommandBuffer Context::allocateCommandBuffer() const {
+  VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+  command_buffer_allocate_info.sType =
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  command_buffer_allocate_info.commandPool = command_pool_;
+  command_buffer_allocate_info.level       = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  command_buffer_allocate_info.commandBufferCount = 1;
+
+  VkCommandBuffer command_buffer;
+  VK_CHECK_RESULT(vkAllocateCommandBuffers(
+      device_, &command_buffer_allocate_info, &command_buffer));
+  return command_buffer;
+}
+
+void Context::submitAndWait(VkCommandBuffer command_buffer) const {
+  VkSubmitInfo submit_info       = {};
+  submit_info.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers    = &command_buffer;
+
+  VkFence fence;
+  VkFenceCreateInfo fence_create_info = {};
+  fence_create_info.sType             = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  VK_CHECK_RESULT(vkCreateFence(device_, &fence_create_info, nullptr, &fence));
+
+  // fence が signal されるまでコマンドの実行は終わっていない
+  VK_CHECK_RESULT(vkQueueSubmit(queue_, 1, &submit_info, fence));
+  VK_CHECK_RESULT(vkWaitForFences(device_, 1, &fence, VK_TRUE, 100000000000));
+
+  vkDestroyFence(device_, fence, nullptr);
+}
+
+VkSemaphore Context::createTimelineSemaphore(
+    const uint64_t initial_value) const {
+  if (!timeline_semaphore_supported_) {
+    throw std::runtime_error("Timeline semaphore is not supported.");
+  }
+  VkSemaphoreTypeCreateInfo semaphore_type_create_info = {};
+  semaphore_type_create_info.sType =
+      VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  semaphore_type_create_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  semaphore_type_create_info.initialValue  = initial_value;
+
+  VkSemaphoreCreateInfo semaphore_create_info = {};
+  semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphore_create_info.pNext = &semaphore_type_create_info;
+
+  VkSemaphore semaphore;
+  VK_CHECK_RESULT(vkCreateSemaphore(device_, &semaphore_create_info, nullptr,
+                                    &semaphore));
+  return semaphore;
+}
+
+void Context::waitTimelineSemaphore(VkSemaphore semaphore,
+                                    const uint64_t value) const {
+  VkSemaphoreWaitInfo semaphore_wait_info = {};
+  semaphore_wait_info.sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  semaphore_wait_info.semaphoreCount = 1;
+  semaphore_wait_info.pSemaphores    = &semaphore;
+  semaphore_wait_info.pValues        = &value;
+  VK_CHECK_RESULT(wait_semaphores_(device_, &semaphore_wait_info,
+                                   100000000000));
+}
+
+Kernel& Context::getKernel(const std::string& spirv_filepath,
+                           const uint32_t num_buffers,
+                           const uint32_t push_constant_size) {
+  auto it = kernels_.find(spirv_filepath);
+  if (it != kernels_.end()) {
+    if (it->second->numBuffers() != num_buffers ||
+        it->second->pushConstantSize() != push_constant_size) {
+      throw std::runtime_error("Kernel layout mismatch: " + spirv_filepath);
+    }
+    return *it->second;
+  }
+
+  std::unique_ptr<Kernel> kernel(
+      new Kernel(*this, spirv_filepath, num_buffers, push_constant_size));
+  Kernel& ref = *kernel;
+  kernels_.emplace(spirv_filepath, std::move(kernel));
+  return ref;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Kernel
+
+Kernel::Kernel(const Context& context, const std::string& spirv_filepath,
+               const uint32_t num_buffers, const uint32_t push_constant_size)
+    : context_(context),
+      num_buffers_(num_buffers),
+      push_constant_size_(push_constant_size) {
+  const auto begin      = std::chrono::steady_clock::now();
+  const VkDevice device = context_.device();
+
+  // shader module を作る
+  const std::vector<uint32_t> code = readFile(spirv_filepath);
+  VkShaderModuleCreateInfo shader_module_create_info = {};
+  shader_module_create_info.sType =
+      VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  shader_module_create_info.pCode    = code.data();
+  shader_module_create_info.codeSize = sizeof(uint32_t) * code.size();
+  VK_CHECK_RESULT(vkCreateShaderModule(device, &shader_module_create_info,
+                                       nullptr, &shader_module_));
+
+  pipeline_cache_filepath_ = spirv_filepath + ".cache";
+  createPipelineCache(code);
+
+  // binding = 0, 1, ..., num_buffers - 1 に storage buffer を紐付ける
+  std::vector<VkDescriptorSetLayoutBinding> bindings(num_buffers_);
+  for (uint32_t i = 0; i < num_buffers_; ++i) {
+    bindings[i]                 = {};
+    bindings[i].binding         = i;
+    bindings[i].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {};
+  descriptor_set_layout_create_info.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  descriptor_set_layout_create_info.bindingCount = bindings.size();
+  descriptor_set_layout_create_info.pBindings    = bindings.data();
+  VK_CHECK_RESULT(vkCreateDescriptorSetLayout(
+      device, &descriptor_set_layout_create_info, nullptr,
+      &descriptor_set_layout_));
+
+  // __globalでない引数は push constants を用いて与える
+  VkPushConstantRange push_constant_range = {};
+  push_constant_range.offset              = 0;
+  push_constant_range.size                = push_constant_size_;
+  push_constant_range.stageFlags          = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkPipelineLayoutCreateInfo pipeline_layout_create_info = {};
+  pipeline_layout_create_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipeline_layout_create_info.setLayoutCount = 1;
+  pipeline_layout_create_info.pSetLayouts    = &descriptor_set_layout_;
+  if (push_constant_size_ > 0) {
+    pipeline_layout_create_info.pushConstantRangeCount = 1;
+    pipeline_layout_create_info.pPushConstantRanges    = &push_constant_range;
+  }
+  VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipeline_layout_create_info,
+                                         nullptr, &pipeline_layout_));
+
+  load_time_ms_ = elapsedMs(begin);
+}
+
+Kernel::~Kernel() {
+  const VkDevice device = context_.device();
+  if (pipeline_cache_ != VK_NULL_HANDLE) {
+    if (pipeline_cache_dirty_) {
+      savePipelineCache();
+    }
+    vkDestroyPipelineCache(device, pipeline_cache_, nullptr);
+  }
+  for (const auto& pipeline : pipelines_) {
+    vkDestroyPipeline(device, pipeline.second, nullptr);
+  }
+  vkDestroyPipelineLayout(device, pipeline_layout_, nullptr);
+  vkDestroyDescriptorSetLayout(device, descriptor_set_layout_, nullptr);
+  vkDestroyShaderModule(device, shader_module_, nullptr);
+}
+
+void Kernel::createPipelineCache(const std::vector<uint32_t>& code) {
+  pipeline_cache_       = VK_NULL_HANDLE;
+  pipeline_cache_dirty_ = false;
+  pipeline_cache_state_ = "disabled";
+  spirv_hash_           = hashSpirv(code);
+  loaded_cache_size_    = 0;
+  loaded_cache_hash_    = 0;
+  if (!context_.usePipelineCache()) {
+    return;
+  }
+
+  const std::vector<char> data = loadPipelineCacheData(
+      pipeline_cache_filepath_,
+      makePipelineCacheHeader(context_.properties(), spirv_hash_));
+  pipeline_cache_state_ = data.empty() ? "cold" : "warm";
+  loaded_cache_size_    = data.size();
+  loaded_cache_hash_    = hashBytes(data.data(), data.size());
+
+  // 初期データが壊れている場合でもドライバは空のキャッシュとして扱う
+  VkPipelineCacheCreateInfo pipeline_cache_create_info = {};
+  pipeline_cache_create_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  pipeline_cache_create_info.initialDataSize = data.size();
+  pipeline_cache_create_info.pInitialData    = data.data();
+  VK_CHECK_RESULT(vkCreatePipelineCache(context_.device(),
+                                        &pipeline_cache_create_info, nullptr,
+                                        &pipeline_cache_));
+}
+
+void Kernel::savePipelineCache() {
+  size_t data_size = 0;
+  VK_CHECK_RESULT(vkGetPipelineCacheData(context_.device(), pipeline_cache_,
+                                         &data_size, nullptr));
+  std::vector<char> data(data_size);
+  VK_CHECK_RESULT(vkGetPipelineCacheData(context_.device(), pipeline_cache_,
+                                         &data_size, data.data()));
+  data.resize(data_size);
+
+  // キャッシュに当たった場合はドライバが同じデータを返すので、書き直さない
+  if (data.size() == loaded_cache_size_ &&
+      hashBytes(data.data(), data.size()) == loaded_cache_hash_) {
+    return;
+  }
+
+  savePipelineCacheData(
+      pipeline_cache_filepath_,
+      makePipelineCacheHeader(context_.properties(), spirv_hash_), data);
+}
+
+VkPipeline Kernel::getPipeline(const std::string& entry_point,
+                               const std::vector<uint32_t>& spec_constants) {
+  const auto key = std::make_pair(entry_point, spec_constants);
+  auto it        = pipelines_.find(key);
+  if (it != pipelines_.end()) {
+    return it->second;
+  }
+
+  std::vector<VkSpecializationMapEntry> specialization_map_entries(
+      spec_constants.size());
+  for (uint32_t i = 0; i < spec_constants.size(); ++i) {
+    specialization_map_entries[i].constantID = i;  // SpecId
+    specialization_map_entries[i].offset     = sizeof(uint32_t) * i;
+    specialization_map_entries[i].size       = sizeof(uint32_t);
+  }
+  VkSpecializationInfo specialization_info = {};
+  specialization_info.mapEntryCount = specialization_map_entries.size();
+  specialization_info.pMapEntries   = specialization_map_entries.data();
+  specialization_info.dataSize = sizeof(uint32_t) * spec_constants.size();
+  specialization_info.pData    = spec_constants.data();
+
+  VkPipelineShaderStageCreateInfo shader_stage_create_info = {};
+  shader_stage_create_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  shader_stage_create_info.stage  = VK_SHADER_STAGE_COMPUTE_BIT;
+  shader_stage_create_info.module = shader_module_;
+  shader_stage_create_info.pName  = entry_point.c_str();
+  if (!spec_constants.empty()) {
+    shader_stage_create_info.pSpecializationInfo = &specialization_info;
+  }
+
+  VkComputePipelineCreateInfo pipeline_create_info = {};
+  pipeline_create_info.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipeline_create_info.stage  = shader_stage_create_info;
+  pipeline_create_info.layout = pipeline_layout_;
+
+  VkPipeline pipeline;
+  VK_CHECK_RESULT(vkCreateComputePipelines(context_.device(), pipeline_cache_,
+                                           1, &pipeline_create_info, nullptr,
+                                           &pipeline));
+  pipeline_cache_dirty_ = true;
+
+  pipelines_.emplace(key, pipeline);
+  return pipeline;
+}
+
+VkDescriptorSet Kernel::allocateDescriptorSet(VkDescriptorPool pool) const {
+  VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {};
+  descriptor_set_allocate_info.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  descriptor_set_allocate_info.descriptorPool     = pool;
+  descriptor_set_allocate_info.descriptorSetCount = 1;
+  descriptor_set_allocate_info.pSetLayouts        = &descriptor_set_layout_;
+
+  VkDescriptorSet descriptor_set;
+  VK_CHECK_RESULT(vkAllocateDescriptorSets(
+      context_.device(), &descriptor_set_allocate_info, &descriptor_set));
+  return descriptor_set;
+}
+
+void Kernel::bind(VkCommandBuffer command_buffer, VkPipeline pipeline,
+                  VkDescriptorSet descriptor_set,
+                  const void* push_constants) const {
+  // ディスパッチする前にパイプラインと descriptor set をバインドする
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          pipeline_layout_, 0, 1, &descriptor_set, 0, nullptr);
+  if (push_constant_size_ > 0) {
+    vkCmdPushConstants(command_buffer, pipeline_layout_,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, push_constant_size_,
+                       push_constants);
+  }
+}
+
+void Kernel::dispatch(VkCommandBuffer command_buffer, VkPipeline pipeline,
+                      VkDescriptorSet descriptor_set,
+                      const void* push_constants,
+                      const uint32_t group_count_x,
+                      const uint32_t group_count_y,
+                      const uint32_t group_count_z) const {
+  bind(command_buffer, pipeline, descriptor_set, push_constants);
+  vkCmdDispatch(command_buffer, group_count_x, group_count_y, group_count_z);
+}
+
+void Kernel::dispatchIndirect(VkCommandBuffer command_buffer,
+                              VkPipeline pipeline,
+                              VkDescriptorSet descriptor_set,
+                              const void* push_constants,
+                              VkBuffer indirect_buffer,
+                              const VkDeviceSize offset) const {
+  bind(command_buffer, pipeline, descriptor_set, push_constants);
+  vkCmdDispatchIndirect(command_buffer, indirect_buffer, offset);
+}
+
+}  // namespace clspv_test
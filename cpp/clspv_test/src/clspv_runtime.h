@@ -0,0 +1,332 @@
+/*
+MIT License
+
+Copyright (c) 2022 kyawakyawa
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef CLSPV_TEST_CLSPV_RUNTIME_H_
+#define CLSPV_TEST_CLSPV_RUNTIME_H_
+
+#include <assert.h>
+#include <stdio.h>
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef NDEBUG
+const bool enableValidationLayers = false;
+#else
+const bool enableValidationLayers = true;
+#endif
+
+// Used for validating return values of Vulkan API calls.
+#define VK_CHECK_RESULT(f)                                               \
+  {                                                                      \
+    VkResult res = (f);                                                  \
+    if (res != VK_SUCCESS) {                                             \
+      printf("Fatal : VkResult is %d in %s at line %d\n", res, __FILE__, \
+             __LINE__);                                                  \
+      assert(res == VK_SUCCESS);                                         \
+    }                                                                    \
+  }
+
+namespace clspv_test {
+
+// begin からの経過時間 [ms]
+inline double elapsedMs(const std::chrono::steady_clock::time_point begin) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - begin)
+      .count();
+}
+
+// コールドスタート (コンテキスト作成 + カーネル読み込み + 初回ディスパッチ)
+// と、2回目以降 (ウォーム) のディスパッチのレイテンシを表示する
+// dispatch_ms[0] が初回、それ以降がウォームのディスパッチ
+// pipeline_cache を与えた場合はパイプラインキャッシュの状態も表示する
+void printLatency(const double context_ms, const double kernel_ms,
+                  const std::vector<double>& dispatch_ms,
+                  const char* pipeline_cache = nullptr);
+
+// samples_ms の分布 (パーセンタイルと 2 のべき乗ごとのヒストグラム) を表示する
+void printLatencyHistogram(const char* name, std::vector<double> samples_ms);
+
+// ストレージバッファとそれを支えるメモリ
+struct Buffer {
+  VkBuffer buffer       = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize size     = 0;
+};
+
+/*
+カーネルが読み書きするバッファと、ホストから読み書きするための map された
+メモリ
+
+unified memory のデバイス (統合GPU, ソフトウェア実装) では DEVICE_LOCAL かつ
+HOST_VISIBLE なメモリを直接 map し、コピーはしない。
+それ以外 (外付けGPU) では DEVICE_LOCAL なバッファとは別に HOST_VISIBLE な
+staging バッファを持ち、vkCmdCopyBuffer でコピーする。
+*/
+struct StagedBuffer {
+  Buffer device;   // カーネルが使う
+  Buffer staging;  // staging を使わない場合は空
+  void* mapped = nullptr;  // 常に map しておく
+
+  bool staged() const { return staging.buffer != VK_NULL_HANDLE; }
+};
+
+class Kernel;
+
+/*
+Vulkan のインスタンス, 物理デバイス, 論理デバイス, compute キュー,
+コマンドプールをまとめて持つ。
+
+これらの作成はディスパッチ1回よりも重いので、プロセスの中で1度だけ作って
+使い回す。読み込んだSPIR-Vも getKernel() でキャッシュする。
+*/
+class Context {
+public:
+  // require_int8 が true の場合は 8bit の型 (uchar など) を shader interface
+  // で使えるデバイスだけを選ぶ
+  // use_pipeline_cache が true の場合は、パイプラインキャッシュを
+  // SPIR-Vファイルの隣 (<spv>.cache) に保存し、次回の起動時に読み込む
+  explicit Context(const bool require_int8       = true,
+                   const bool use_pipeline_cache = true);
+  ~Context();
+
+  Context(const Context&) = delete;
+  Context& operator=(const Context&) = delete;
+
+  VkPhysicalDevice physicalDevice() const { return physical_device_; }
+  VkDevice device() const { return device_; }
+  VkQueue queue() const { return queue_; }
+  uint32_t queueFamilyIndex() const { return queue_family_index_; }
+  VkCommandPool commandPool() const { return command_pool_; }
+  const VkPhysicalDeviceProperties& properties() const { return properties_; }
+  bool usePipelineCache() const { return use_pipeline_cache_; }
+  // DEVICE_LOCAL なメモリをホストから直接 map できるか
+  // (できる場合は StagedBuffer で staging を使わない)
+  bool unifiedMemory() const { return unified_memory_; }
+  // VK_KHR_timeline_semaphore が使えるか
+  bool timelineSemaphoreSupported() const {
+    return timeline_semaphore_supported_;
+  }
+  // コンストラクタ (インスタンスとデバイスの作成) にかかった時間 [ms]
+  double creationTimeMs() const { return creation_time_ms_; }
+  // 初回の呼び出しでは creationTimeMs() を、2回目以降は 0 を返す
+  // (使い回したコンテキストの作成時間をコールドスタートに数えないため)
+  double takeCreationTimeMs() {
+    const double ms   = creation_time_ms_;
+    creation_time_ms_ = 0.0;
+    return ms;
+  }
+
+  // find memory type with desired properties.
+  uint32_t findMemoryType(uint32_t memory_type_bits,
+                          VkMemoryPropertyFlags properties) const;
+
+  // usage (STORAGE_BUFFER と TRANSFER_SRC/DST は常に付ける) のバッファを
+  // properties を満たすメモリに作る
+  Buffer createBuffer(const VkDeviceSize size, VkBufferUsageFlags usage,
+                      VkMemoryPropertyFlags properties) const;
+  // HOST_VISIBLE | HOST_COHERENT なメモリを持つストレージバッファを作る
+  Buffer createHostVisibleBuffer(const VkDeviceSize size) const;
+  // DEVICE_LOCAL なメモリを持つストレージバッファを作る
+  // (ホストから読み書きしない中間バッファ用)
+  Buffer createDeviceLocalBuffer(const VkDeviceSize size) const;
+  void destroyBuffer(Buffer& buffer) const;
+
+  // ホストとやり取りするストレージバッファを作る (map した状態で返す)
+  StagedBuffer createStagedBuffer(const VkDeviceSize size) const;
+  void destroyStagedBuffer(StagedBuffer& buffer) const;
+  // mapped に書いた先頭 size byte をカーネルから読めるようにするコマンドを
+  // 記録する (staging を使う場合は staging -> device のコピー)
+  void recordUpload(VkCommandBuffer command_buffer, const StagedBuffer& buffer,
+                    const VkDeviceSize size) const;
+  // カーネルが書いた先頭 size byte を mapped から読めるようにするコマンドを
+  // 記録する (staging を使う場合は device -> staging のコピー)
+  void recordDownload(VkCommandBuffer command_buffer,
+                      const StagedBuffer& buffer,
+                      const VkDeviceSize size) const;
+
+  // storage buffer を num_buffers 個持つ descriptor set を max_sets
+  // 個確保できる descriptor pool を作る
+  VkDescriptorPool createDescriptorPool(const uint32_t max_sets,
+                                        const uint32_t num_buffers) const;
+  // binding = i に buffers[i] を紐付ける
+  void writeDescriptorSet(VkDescriptorSet descriptor_set,
+                          const std::vector<VkDescriptorBufferInfo>& buffers)
+      const;
+
+  VkCommandBuffer allocateCommandBuffer() const;
+  // command_buffer を投入して完了まで待つ
+  void submitAndWait(VkCommandBuffer command_buffer) const;
+
+  // timeline semaphore を作る (timelineSemaphoreSupported() の場合のみ)
+  VkSemaphore createTimelineSemaphore(const uint64_t initial_value) const;
+  // semaphore の値が value 以上になるまで待つ
+  void waitTimelineSemaphore(VkSemaphore semaphore, const uint64_t value) const;
+
+  // spirv_filepath のSPIR-Vを読み込んだ Kernel を返す
+  // 同じファイルは2回目以降キャッシュしたものを返す
+  Kernel& getKernel(const std::string& spirv_filepath,
+                    const uint32_t num_buffers,
+                    const uint32_t push_constant_size);
+
+private:
+  static VKAPI_ATTR VkBool32 VKAPI_CALL debugReportCallbackFn(
+      VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objectType,
+      uint64_t object, size_t location, int32_t messageCode,
+      const char* pLayerPrefix, const char* pMessage, void* pUserData);
+
+  void createInstance();
+  void findPhysicalDevice();
+  bool isDeviceSuitable(VkPhysicalDevice device, const bool allow_cpu);
+  bool checkDeviceExtensionSupport(const VkPhysicalDevice device);
+  // 任意の拡張 (device_extensions_ にないもの) に対応しているか
+  bool hasDeviceExtension(const VkPhysicalDevice device,
+                          const char* extension_name);
+  uint32_t getComputeQueueFamilyIndex();
+  void createDevice();
+  void createCommandPool();
+  // unified memory かどうかを判定し、選んだメモリタイプを表示する
+  void selectMemoryTypes();
+
+  const bool require_int8_;
+  const bool use_pipeline_cache_;
+  std::vector<const char*> device_extensions_;
+  std::vector<const char*> enabled_layers_;
+
+  VkInstance instance_;
+  VkDebugReportCallbackEXT debug_report_callback_;
+  VkPhysicalDevice physical_device_;
+  VkPhysicalDeviceProperties properties_;
+  VkDevice device_;
+  VkQueue queue_;  // a queue supporting compute operations.
+  uint32_t queue_family_index_;
+  VkCommandPool command_pool_;
+
+  VkPhysicalDeviceMemoryProperties memory_properties_;
+  bool unified_memory_;
+
+  bool timeline_semaphore_supported_;
+  PFN_vkWaitSemaphoresKHR wait_semaphores_;
+
+  double creation_time_ms_;
+
+  std::map<std::string, std::unique_ptr<Kernel>> kernels_;
+};
+
+/*
+1つのSPIR-Vモジュール
+
+clspv の規約に従い、__global の引数は binding 0, 1, ... の storage buffer,
+それ以外の引数は push constant で与える。
+モジュール内のカーネルは全て同じ descriptor set layout と pipeline layout を
+共有し、(エントリーポイント, specialization constant) ごとのパイプラインを
+キャッシュする。
+*/
+class Kernel {
+public:
+  Kernel(const Context& context, const std::string& spirv_filepath,
+         const uint32_t num_buffers, const uint32_t push_constant_size);
+  ~Kernel();
+
+  Kernel(const Kernel&) = delete;
+  Kernel& operator=(const Kernel&) = delete;
+
+  VkDescriptorSetLayout descriptorSetLayout() const {
+    return descriptor_set_layout_;
+  }
+  VkPipelineLayout pipelineLayout() const { return pipeline_layout_; }
+  uint32_t numBuffers() const { return num_buffers_; }
+  uint32_t pushConstantSize() const { return push_constant_size_; }
+  // SPIR-Vの読み込みと layout の作成にかかった時間 [ms]
+  double loadTimeMs() const { return load_time_ms_; }
+  // パイプラインキャッシュの状態
+  // "disabled": 使わない, "cold": 保存されたものがない (または無効),
+  // "warm": 保存されたものを読み込んだ
+  const char* pipelineCacheState() const { return pipeline_cache_state_; }
+
+  // spec_constants[i] を SpecId i に与えたパイプラインを返す
+  // (clspv は reqd_work_group_size のないカーネルのワークグループサイズを
+  //  SpecId 0, 1, 2 にする)
+  VkPipeline getPipeline(const std::string& entry_point,
+                         const std::vector<uint32_t>& spec_constants = {});
+
+  // pool から このカーネル用の descriptor set を確保する
+  VkDescriptorSet allocateDescriptorSet(VkDescriptorPool pool) const;
+
+  // パイプラインと descriptor set をバインドし、push constant を与えて
+  // ディスパッチする
+  void dispatch(VkCommandBuffer command_buffer, VkPipeline pipeline,
+                VkDescriptorSet descriptor_set, const void* push_constants,
+                const uint32_t group_count_x, const uint32_t group_count_y,
+                const uint32_t group_count_z = 1) const;
+  // dispatch() と同じだが、ワークグループ数を indirect_buffer の offset に
+  // ある VkDispatchIndirectCommand から読む (デバイス側で決めた数で実行する)
+  void dispatchIndirect(VkCommandBuffer command_buffer, VkPipeline pipeline,
+                        VkDescriptorSet descriptor_set,
+                        const void* push_constants, VkBuffer indirect_buffer,
+                        const VkDeviceSize offset = 0) const;
+
+private:
+  // パイプラインと descriptor set をバインドし、push constant を与える
+  void bind(VkCommandBuffer command_buffer, VkPipeline pipeline,
+            VkDescriptorSet descriptor_set, const void* push_constants) const;
+
+  void createPipelineCache(const std::vector<uint32_t>& code);
+  void savePipelineCache();
+
+  const Context& context_;
+  const uint32_t num_buffers_;
+  const uint32_t push_constant_size_;
+
+  VkShaderModule shader_module_;
+
+  // パイプラインキャッシュ
+  // ファイルはドライバ (pipelineCacheUUID など) と SPIR-Vのハッシュが
+  // 一致する場合だけ使う
+  VkPipelineCache pipeline_cache_;
+  std::string pipeline_cache_filepath_;
+  uint64_t spirv_hash_;
+  bool pipeline_cache_dirty_;  // 新しいパイプラインを作ったか
+  // ファイルから読み込んだデータの大きさとハッシュ
+  // (終了時のデータと同じならファイルを書き直さない)
+  size_t loaded_cache_size_;
+  uint64_t loaded_cache_hash_;
+  const char* pipeline_cache_state_;
+
+  VkDescriptorSetLayout descriptor_set_layout_;
+  VkPipelineLayout pipeline_layout_;
+  std::map<std::pair<std::string, std::vector<uint32_t>>, VkPipeline>
+      pipelines_;
+
+  double load_time_ms_;
+};
+
+}  // namespace clspv_test
+
+#endif  // CLSPV_TEST_CLSPV_RUNTIME_H_
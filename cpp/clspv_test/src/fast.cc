@@ -22,876 +22,2192 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
-
-#include <assert.h>
 #include <string.h>
-#include <vulkan/vulkan.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <random>
 #include <stdexcept>
+#include <string>
+#include <thread>
 #include <vector>
 
-#include "lodepng.h"  //Used for png encoding.
-
-const int WIDTH          = 3200;  // Size of rendered mandelbrot set.
-const int HEIGHT         = 2400;  // Size of renderered mandelbrot set.
-const int WORKGROUP_SIZE = 32;    // Workgroup size in compute shader.
-
-#ifdef NDEBUG
-const bool enableValidationLayers = false;
-#else
-const bool enableValidationLayers = true;
-#endif
+#include "clspv_runtime.h"
+#include "fast_cpu.h"
+#include "gaussian_filter_cpu.h"
+#include "grayscale.h"
+#include "lodepng.h"  //Used for png decoding.
+
+// FAST_findKeypoints のワークグループサイズ (2次元, SpecId 0, 1)
+// FIND_WORKGROUP_SIZE^2 と NMS_WORKGROUP_SIZE は *_aggregated のカーネルの
+// MAX_WORKGROUP_SIZE (256) 以下にする
+const uint32_t FIND_WORKGROUP_SIZE = 16;
+// FAST_nonmaxSupression のワークグループサイズ (1次元, SpecId 0)
+const uint32_t NMS_WORKGROUP_SIZE = 64;
+// FAST_findKeypoints は周囲 3 画素を読むので、端の 3 画素は調べない
+const int FAST_BORDER = 3;
+// fast_grid_topk.cl のセルの大きさの範囲 (上限は MAX_CELL_SIZE)
+const int MIN_GRID_CELL_SIZE = 8;
+const int MAX_GRID_CELL_SIZE = 64;
+// ピラミッドの段の数の上限
+const int MAX_PYRAMID_LEVELS = 16;
+// gaussian_pyramid.cl の RADIUS と同じ
+const int PYRAMID_RADIUS    = 2;
+const float PYRAMID_SIGMA   = 1.0f;
+
+struct FastOptions {
+  int threshold     = 20;      // 中心画素との輝度差のしきい値
+  int max_keypoints = 100000;  // 候補と出力のリストの長さ
+  int repeat        = 10;      // 計測のために command buffer を投入する回数
+  // パイプラインキャッシュをファイルに保存し、次回の起動時に読み込む
+  bool pipeline_cache = true;
+  // 候補の数をホストに読み戻してから非極大値抑制を投入する (比較用)
+  // false の場合は間接ディスパッチで1つの command buffer にまとめる
+  bool roundtrip = false;
+  // 候補とキーポイントをワークグループの中でまとめてから、グローバルの
+  // カウンタに atomic_add する (*_aggregated のカーネル)
+  bool aggregated = false;
+  // 全画素のスコアマップを作ってから、タイルで非極大値抑制をする
+  // (fast_score_map.cl, roundtrip と aggregated は使わない)
+  bool score_map = false;
+  // 0 以外の場合は grid_cell x grid_cell のセルごとにスコアの高い per_cell 個
+  // を選ぶ (fast_grid_topk.cl)。出力はセルの順、セルの中はスコアの降順。
+  int grid_cell = 0;
+  int per_cell  = 5;
+  // 円周の画素を 1 byte ずつ __global から読む代わりに、タイルを 32bit ずつ
+  // ローカルメモリに読んでから判定する (*_tiled のカーネル, aggregated とは
+  // 組み合わせない)
+  bool tiled = false;
+  // ピラミッドの段の数と、1段ごとの縮小率 (FastPyramidDetector のみ)
+  int levels         = 8;
+  float scale_factor = 1.2f;
+  // Vulkan を使わずに CPU (fast_cpu.h) で検出する
+  bool cpu        = false;
+  int num_threads = 0;  // CPU 版のスレッド数 (0 の場合は論理コア数)
+};
 
-// Used for validating return values of Vulkan API calls.
-#define VK_CHECK_RESULT(f)                                               \
-  {                                                                      \
-    VkResult res = (f);                                                  \
-    if (res != VK_SUCCESS) {                                             \
-      printf("Fatal : VkResult is %d in %s at line %d\n", res, __FILE__, \
-             __LINE__);                                                  \
-      assert(res == VK_SUCCESS);                                         \
-    }                                                                    \
+inline size_t numCpuThreads(const FastOptions& options) {
+  if (options.num_threads > 0) {
+    return options.num_threads;
   }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
 
-/*
-The application launches a compute shader that renders the mandelbrot set,
-by rendering it into a storage buffer.
-The storage buffer is then read from the GPU, and saved as .png.
-*/
-class ComputeApplication {
-private:
-  // The pixels of the rendered mandelbrot set are in this format:
-  struct Pixel {
-    float r, g, b, a;
-  };
-
-  /*
-  In order to use Vulkan, you must create an instance.
-  */
-  VkInstance instance;
-
-  VkDebugReportCallbackEXT debugReportCallback;
-  /*
-  The physical device is some device on the system that supports usage of
-  Vulkan. Often, it is simply a graphics card that supports Vulkan.
-  */
-  VkPhysicalDevice physicalDevice;
-  /*
-  Then we have the logical device VkDevice, which basically allows
-  us to interact with the physical device.
-  */
-  VkDevice device;
-
-  /*
-  The pipeline specifies the pipeline that all graphics and compute commands
-  pass though in Vulkan.
-
-  We will be creating a simple compute pipeline in this application.
-  */
-  VkPipeline pipeline;
-  VkPipelineLayout pipelineLayout;
-  VkShaderModule computeShaderModule;
-
-  /*
-  The command buffer is used to record commands, that will be submitted to a
-  queue.
+inline const char* fastModeName(const FastOptions& options) {
+  if (options.score_map) {
+    return options.tiled ? "score-map, tiled" : "score-map";
+  }
+  if (options.roundtrip) {
+    if (options.tiled) {
+      return "roundtrip, tiled";
+    }
+    return options.aggregated ? "roundtrip, aggregated" : "roundtrip";
+  }
+  if (options.tiled) {
+    return "indirect, tiled";
+  }
+  return options.aggregated ? "indirect, aggregated" : "indirect";
+}
 
-  To allocate such command buffers, we use a command pool.
-  */
-  VkCommandPool commandPool;
-  VkCommandBuffer commandBuffer;
+// FAST_nonmaxSupression の出力 (kp_out[1 + 3 * i] から x, y, score)
+// CPU 版 (fast_cpu.h) と同じ型
+typedef clspv_test::FastKeypoint Keypoint;
+
+// 各パスの実行時間を計測するための timestamp query を query_count 個作る
+// queue family が timestamp に対応していない場合は VK_NULL_HANDLE を返す
+VkQueryPool createTimestampQueryPool(clspv_test::Context& context,
+                                     const uint32_t query_count) {
+  uint32_t queue_family_count;
+  vkGetPhysicalDeviceQueueFamilyProperties(context.physicalDevice(),
+                                           &queue_family_count, NULL);
+  std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(
+      context.physicalDevice(), &queue_family_count, queue_families.data());
+  if (queue_families[context.queueFamilyIndex()].timestampValidBits == 0) {
+    printf("Timestamp queries are not supported on this queue.\n");
+    return VK_NULL_HANDLE;
+  }
 
-  /*
+  VkQueryPool query_pool;
+  VkQueryPoolCreateInfo query_pool_create_info = {};
+  query_pool_create_info.sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  query_pool_create_info.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+  query_pool_create_info.queryCount = query_count;
+  VK_CHECK_RESULT(vkCreateQueryPool(context.device(), &query_pool_create_info,
+                                    nullptr, &query_pool));
+  return query_pool;
+}
 
-  Descriptors represent resources in shaders. They allow us to use things like
-  uniform buffers, storage buffers and images in GLSL.
+// query_pool が VK_NULL_HANDLE (timestamp 非対応) の場合は何もしない
+void writeTimestamp(VkCommandBuffer command_buffer, VkQueryPool query_pool,
+                    const uint32_t query,
+                    const VkPipelineStageFlagBits stage =
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT) {
+  if (query_pool != VK_NULL_HANDLE) {
+    vkCmdWriteTimestamp(command_buffer, stage, query_pool, query);
+  }
+}
 
-  A single descriptor represents a single resource, and several descriptors are
-  organized into descriptor sets, which are basically just collections of
-  descriptors.
-  */
-  VkDescriptorPool descriptorPool;
-  VkDescriptorSet descriptorSet;
-  VkDescriptorSetLayout descriptorSetLayout;
+// 直前のカーネルの書き込みを、後のカーネル (とディスパッチの引数) から
+// 読めるようにする
+void recordComputeBarrier(VkCommandBuffer command_buffer,
+                          const bool indirect_command_read = false) {
+  VkMemoryBarrier memory_barrier = {};
+  memory_barrier.sType           = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memory_barrier.srcAccessMask   = VK_ACCESS_SHADER_WRITE_BIT;
+  memory_barrier.dstAccessMask   = VK_ACCESS_SHADER_READ_BIT;
+  VkPipelineStageFlags dst_stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  if (indirect_command_read) {
+    // ディスパッチの引数は DRAW_INDIRECT ステージで読まれる
+    memory_barrier.dstAccessMask |= VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    dst_stage |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+  }
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       dst_stage, 0, 1, &memory_barrier, 0, nullptr, 0,
+                       nullptr);
+}
 
-  /*
-  The mandelbrot set will be rendered to this buffer.
+// vkCmdFillBuffer, vkCmdCopyBuffer の書き込みをカーネルから読み書きできる
+// ようにする
+void recordTransferToComputeBarrier(VkCommandBuffer command_buffer) {
+  VkMemoryBarrier memory_barrier = {};
+  memory_barrier.sType           = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memory_barrier.srcAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+  memory_barrier.dstAccessMask =
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                       &memory_barrier, 0, nullptr, 0, nullptr);
+}
 
-  The memory that backs the buffer is bufferMemory.
-  */
-  VkBuffer buffer;
-  VkDeviceMemory bufferMemory;
+void beginCommandBuffer(VkCommandBuffer command_buffer,
+                        const VkCommandBufferUsageFlags flags) {
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = flags;
+  VK_CHECK_RESULT(
+      vkBeginCommandBuffer(command_buffer, &beginInfo));  // start recording
+}
 
-  uint32_t bufferSize;  // size of `buffer` in bytes.
+// clspv は POD の引数を宣言順に push constant に並べる
+// (FastDetector と FastPyramidDetector で共通)
+struct FindPushConstant {
+  int step;
+  int img_offset;
+  int img_rows;
+  int img_cols;
+  int max_keypoints;
+  int threshold;
+};
+struct PreparePushConstant {
+  int max_keypoints;
+  int workgroup_size;
+};
+struct NmsPushConstant {
+  int step;
+  int img_offset;
+  int rows;
+  int cols;
+  int counter;
+  int max_keypoints;
+};
 
-  std::vector<const char*> enabledLayers;
+/*
+FAST コーナー検出
+
+1つの command buffer に
+  1. FAST_findKeypoints     : 候補 (x, y) を kp_loc に追加する
+  2. FAST_prepareDispatch   : kp_loc[0] (候補の数) から 3. のワークグループ数を
+                              作る
+  3. FAST_nonmaxSupression  : 3x3 の非極大値抑制をして (x, y, score) を
+                              kp_out に追加する
+を記録する。3. は vkCmdDispatchIndirect で実行するので、候補の数をホストに
+読み戻すための待ちは入らない。
+比較用の roundtrip では 1. の後に候補の数を読み戻し、その数で 3. を直接
+ディスパッチする command buffer を記録して投入する (2. は実行しない)。
+score_map の場合は候補のリストを作らずに
+  1. FAST_scoreMap          : 全画素のスコアを score_map に書く
+  3. FAST_nonmaxScoreMap    : score_map のタイルで非極大値抑制をする
+を記録する。
+grid_cell を指定した場合は、最後に fast_grid_topk.cl でセルごとの上位
+per_cell 個を選び、その結果だけを読み戻す。
+
+インスタンスやデバイスは clspv_test::Context が持つので、ここではバッファと
+descriptor set, command buffer だけを作る。入力の大きさは固定で、フレームごと
+に imageData() に書き込んで detect() を呼ぶ。
+*/
+class FastDetector {
+private:
+  clspv_test::Context& context_;
+  const FastOptions options_;
+  const uint32_t width_;
+  const uint32_t height_;
 
   /*
-  In order to execute commands on a device(GPU), the commands must be submitted
-  to a queue. The commands are stored in a command buffer, and this command
-  buffer is given to the queue.
-
-  There will be different kinds of queues on the device. Not all queues support
-  graphics operations, for instance. For this application, we at least want a
-  queue that supports compute operations.
+  SPIR-Vモジュールとパイプライン (Context がキャッシュする)
   */
-  VkQueue queue;  // a queue supporting compute operations.
-
-  /*
-  Groups of queues that have the same capabilities(for instance, they all
-  supports graphics and computer operations), are grouped into queue families.
+  clspv_test::Kernel* find_kernel_;
+  clspv_test::Kernel* prepare_kernel_;
+  clspv_test::Kernel* nms_kernel_;
+  clspv_test::Kernel* score_map_kernel_;
+  VkPipeline find_pipeline_;
+  VkPipeline prepare_pipeline_;
+  VkPipeline nms_pipeline_;
+  VkPipeline score_map_pipeline_;
+  VkPipeline score_map_nms_pipeline_;
+  clspv_test::Kernel* grid_kernel_;
+  VkPipeline grid_count_pipeline_;
+  VkPipeline grid_scan_pipeline_;
+  VkPipeline grid_scatter_pipeline_;
+  VkPipeline grid_select_pipeline_;
+  VkPipeline grid_prepare_pipeline_;
+
+  // roundtrip でない場合は、検出から読み戻しまでの全てを記録する
+  // roundtrip の場合は、候補の数の読み戻しまでを記録する
+  VkCommandBuffer command_buffer_;
+  // roundtrip の場合の非極大値抑制 (フレームごとに記録し直す)
+  VkCommandBuffer nms_command_buffer_ = VK_NULL_HANDLE;
+
+  VkDescriptorPool descriptor_pool_;
+  VkDescriptorSet find_descriptor_set_;
+  VkDescriptorSet prepare_descriptor_set_;
+  VkDescriptorSet nms_descriptor_set_;
+  VkDescriptorSet score_map_descriptor_set_;
+  VkDescriptorSet score_map_nms_descriptor_set_;
+  VkDescriptorSet grid_descriptor_set_;
+  // kp_out[0] から FAST_gridCount, FAST_gridScatter の引数を作る
+  VkDescriptorSet grid_prepare_descriptor_set_;
+
+  // 入力画像 (グレースケール, 1画素1byte)
+  clspv_test::StagedBuffer img_buffer_;
+  // [0]: 候補の数, [1 + 2 * i], [2 + 2 * i]: 候補の x, y
+  // 候補の数だけをホストに読み戻す
+  clspv_test::StagedBuffer kp_loc_buffer_;
+  // [0]: キーポイントの数, [1 + 3 * i] ...: x, y, score
+  clspv_test::StagedBuffer kp_out_buffer_;
+  // FAST_nonmaxSupression の VkDispatchIndirectCommand
+  clspv_test::Buffer dispatch_args_buffer_;
+  // 全画素のスコア (1画素1byte, score_map の場合のみ)
+  clspv_test::Buffer score_map_buffer_;
+  // 以下は grid_cell を指定した場合のみ
+  uint32_t grid_cols_ = 0;
+  uint32_t grid_rows_ = 0;
+  // セルごとの数と書き込み位置 (2 * セルの数)
+  clspv_test::Buffer cells_buffer_;
+  // セルごとに並べたキーポイントの番号 (max_keypoints)
+  clspv_test::Buffer items_buffer_;
+  // セルごとの上位 per_cell 個の (x, y, score)
+  clspv_test::StagedBuffer grid_out_buffer_;
+  // FAST_gridCount, FAST_gridScatter の VkDispatchIndirectCommand
+  clspv_test::Buffer grid_dispatch_args_buffer_;
+
+  // 各パスの実行時間を計測するための timestamp query
+  VkQueryPool query_pool_;
+  bool timestamp_supported_;
+  float timestamp_period_;  // 1 tick あたりのナノ秒
+  uint32_t num_timestamps_;  // 開始時刻 + パスの数
+  std::vector<double> pass_times_ms_;  // detect() ごとに加算する
+  int num_detections_;
+
+  double kernel_ms_;
+
+  // clspv は POD の引数を宣言順に push constant に並べる
+  // fast_grid_topk.cl の 4 つのカーネルで共通
+  struct GridPushConstant {
+    int cell_size;
+    int grid_cols;
+    int grid_rows;
+    int per_cell;
+    int max_keypoints;
+  };
+  // fast_score_map.cl の 2 つのカーネルで共通
+  struct ScoreMapPushConstant {
+    int step;
+    int img_offset;
+    int rows;
+    int cols;
+    int threshold;
+    int max_keypoints;
+  };
 
-  When submitting a command buffer, you must specify to which queue in the
-  family you are submitting to. This variable keeps track of the index of that
-  queue in its family.
-  */
-  uint32_t queueFamilyIndex;
+  // 3つのパスの名前 (roundtrip の場合の2番目は読み戻しの待ち時間,
+  // score_map の場合は2番目のパスはない)
+  // grid_cell を指定した場合は4番目にセルごとの選択 ("topk") がある
+  static const char* const kPassNames[3];
+  static const char* const kRoundTripPassNames[3];
+  static const char* const kScoreMapPassNames[3];
 
 public:
-  void run() {
-    // Buffer size of the storage buffer that will contain the rendered
-    // mandelbrot set.
-    bufferSize = sizeof(Pixel) * WIDTH * HEIGHT;
-
-    // Initialize vulkan:
-    createInstance();
-    findPhysicalDevice();
-    createDevice();
-    createBuffer();
-    createDescriptorSetLayout();
-    createDescriptorSet();
-    createComputePipeline();
-    createCommandBuffer();
-
-    // Finally, run the recorded command buffer.
-    runCommandBuffer();
-
-    // The former command rendered a mandelbrot set to a buffer.
-    // Save that buffer as a png on disk.
-    saveRenderedImage();
-
-    // Clean up all vulkan resources.
-    cleanup();
+  FastDetector(clspv_test::Context& context, const uint32_t width,
+               const uint32_t height, const FastOptions& options)
+      : context_(context),
+        options_(options),
+        width_(width),
+        height_(height),
+        num_timestamps_(options.grid_cell > 0 ? 5 : 4),
+        pass_times_ms_(num_timestamps_ - 1, 0.0),
+        num_detections_(0) {
+    if (width_ <= 2 * FAST_BORDER || height_ <= 2 * FAST_BORDER) {
+      throw std::runtime_error("Image is too small for FAST.");
+    }
+    if (options_.tiled && options_.aggregated) {
+      throw std::runtime_error("tiled cannot be combined with aggregated.");
+    }
+    if (options_.grid_cell > 0) {
+      if (options_.grid_cell < MIN_GRID_CELL_SIZE ||
+          options_.grid_cell > MAX_GRID_CELL_SIZE || options_.per_cell < 1) {
+        throw std::runtime_error("Invalid grid cell size or per_cell.");
+      }
+      grid_cols_ = (width_ + options_.grid_cell - 1) / options_.grid_cell;
+      grid_rows_ = (height_ + options_.grid_cell - 1) / options_.grid_cell;
+    }
+    createBuffers();
+    createComputePipelines();
+    createDescriptorSets();
+    createQueryPool();
+    createCommandBuffers();
   }
 
-  void saveRenderedImage() {
-    void* mappedMemory = NULL;
-    // Map the buffer memory, so that we can read from it on the CPU.
-    vkMapMemory(device, bufferMemory, 0, bufferSize, 0, &mappedMemory);
-    Pixel* pmappedMemory = (Pixel*)mappedMemory;
-
-    // Get the color data from the buffer, and cast it to bytes.
-    // We save the data to a vector.
-    std::vector<unsigned char> image;
-    image.reserve(WIDTH * HEIGHT * 4);
-    for (int i = 0; i < WIDTH * HEIGHT; i += 1) {
-      image.push_back((unsigned char)(255.0f * (pmappedMemory[i].r)));
-      image.push_back((unsigned char)(255.0f * (pmappedMemory[i].g)));
-      image.push_back((unsigned char)(255.0f * (pmappedMemory[i].b)));
-      image.push_back((unsigned char)(255.0f * (pmappedMemory[i].a)));
+  ~FastDetector() {
+    /*
+    Clean up the Vulkan resources owned by this detector.
+    The device and the kernels are kept alive by the context.
+    */
+    const VkDevice device = context_.device();
+    if (query_pool_ != VK_NULL_HANDLE) {
+      vkDestroyQueryPool(device, query_pool_, NULL);
+    }
+    vkFreeCommandBuffers(device, context_.commandPool(), 1, &command_buffer_);
+    if (nms_command_buffer_ != VK_NULL_HANDLE) {
+      vkFreeCommandBuffers(device, context_.commandPool(), 1,
+                           &nms_command_buffer_);
+    }
+    vkDestroyDescriptorPool(device, descriptor_pool_, NULL);
+    context_.destroyStagedBuffer(img_buffer_);
+    context_.destroyStagedBuffer(kp_loc_buffer_);
+    context_.destroyStagedBuffer(kp_out_buffer_);
+    context_.destroyBuffer(dispatch_args_buffer_);
+    if (options_.score_map) {
+      context_.destroyBuffer(score_map_buffer_);
+    }
+    if (options_.grid_cell > 0) {
+      context_.destroyBuffer(cells_buffer_);
+      context_.destroyBuffer(items_buffer_);
+      context_.destroyStagedBuffer(grid_out_buffer_);
+      context_.destroyBuffer(grid_dispatch_args_buffer_);
     }
-    // Done reading, so unmap.
-    vkUnmapMemory(device, bufferMemory);
-
-    // Now we save the acquired color data to a .png.
-    unsigned error = lodepng::encode("mandelbrot.png", image, WIDTH, HEIGHT);
-    if (error) printf("encoder error %d: %s", error, lodepng_error_text(error));
   }
 
-  static VKAPI_ATTR VkBool32 VKAPI_CALL debugReportCallbackFn(
-      VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objectType,
-      uint64_t object, size_t location, int32_t messageCode,
-      const char* pLayerPrefix, const char* pMessage, void* pUserData) {
-    printf("Debug Report: %s: %s\n", pLayerPrefix, pMessage);
+  FastDetector(const FastDetector&) = delete;
+  FastDetector& operator=(const FastDetector&) = delete;
 
-    return VK_FALSE;
+  uint32_t width() const { return width_; }
+  uint32_t height() const { return height_; }
+  // SPIR-Vの読み込みとパイプラインの作成にかかった時間 [ms]
+  double kernelMs() const { return kernel_ms_; }
+  const char* pipelineCacheState() const {
+    return find_kernel_->pipelineCacheState();
   }
+  const char* modeName() const { return fastModeName(options_); }
 
-  void createInstance() {
-    std::vector<const char*> enabledExtensions;
+  // 入力画像を書き込む先 (width() * height() byte, map したメモリ)
+  unsigned char* imageData() {
+    return reinterpret_cast<unsigned char*>(img_buffer_.mapped);
+  }
 
-    /*
-    By enabling validation layers, Vulkan will emit warnings if the API
-    is used incorrectly. We shall enable the layer VK_LAYER_KHRONOS_validation,
-    which is basically a collection of several useful validation layers.
-    */
-    if (enableValidationLayers) {
-      /*
-      We get all supported layers with vkEnumerateInstanceLayerProperties.
-      */
-      uint32_t layerCount;
-      vkEnumerateInstanceLayerProperties(&layerCount, NULL);
-
-      std::vector<VkLayerProperties> layerProperties(layerCount);
-      vkEnumerateInstanceLayerProperties(&layerCount, layerProperties.data());
-
-      /*
-      And then we simply check if VK_LAYER_KHRONOS_validation is among the
-      supported layers.
-      */
-      bool foundLayer = false;
-      for (VkLayerProperties prop : layerProperties) {
-        if (strcmp("VK_LAYER_KHRONOS_validation", prop.layerName) == 0) {
-          foundLayer = true;
-          break;
-        }
-      }
+  // imageData() の画像からキーポイントを検出する
+  // 順序は実行ごとに異なる (atomic_inc で追加するため)
+  // grid_cell を指定した場合は、セルの順、セルの中はスコアの降順で決定的
+  // num_candidates には FAST_findKeypoints の候補の数を返す
+  // (max_keypoints を超えた場合は超えた分が捨てられている。
+  //  候補のリストを作らない score_map の場合は 0)
+  void detect(std::vector<Keypoint>* keypoints, int* num_candidates = nullptr) {
+    const int* kp_loc = reinterpret_cast<const int*>(kp_loc_buffer_.mapped);
+    const int* kp_out = reinterpret_cast<const int*>(kp_out_buffer_.mapped);
+
+    context_.submitAndWait(command_buffer_);
+    if (nms_command_buffer_ != VK_NULL_HANDLE) {
+      // roundtrip: 候補の数をホストで読んでから非極大値抑制を投入する
+      recordNmsCommandBuffer(std::min(kp_loc[0], options_.max_keypoints));
+      context_.submitAndWait(nms_command_buffer_);
+    }
+    accumulatePassTimes();
 
-      if (!foundLayer) {
-        throw std::runtime_error(
-            "Layer VK_LAYER_KHRONOS_validation not supported\n");
-      }
-      enabledLayers.push_back(
-          "VK_LAYER_KHRONOS_validation");  // Alright, we can use this layer.
-
-      /*
-      We need to enable an extension named VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
-      in order to be able to print the warnings emitted by the validation layer.
-
-      So again, we just check if the extension is among the supported
-      extensions.
-      */
-
-      uint32_t extensionCount;
-
-      vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, NULL);
-      std::vector<VkExtensionProperties> extensionProperties(extensionCount);
-      vkEnumerateInstanceExtensionProperties(NULL, &extensionCount,
-                                             extensionProperties.data());
-
-      bool foundExtension = false;
-      for (VkExtensionProperties prop : extensionProperties) {
-        if (strcmp(VK_EXT_DEBUG_REPORT_EXTENSION_NAME, prop.extensionName) ==
-            0) {
-          foundExtension = true;
-          break;
+    if (num_candidates != nullptr) {
+      *num_candidates = options_.score_map ? 0 : kp_loc[0];
+    }
+    if (options_.grid_cell > 0) {
+      // セルの順に、空いている所 (-1) を飛ばして詰める
+      const Keypoint* grid_out =
+          reinterpret_cast<const Keypoint*>(grid_out_buffer_.mapped);
+      const size_t num_slots = size_t(grid_cols_) * grid_rows_ *
+                               options_.per_cell;
+      keypoints->clear();
+      for (size_t i = 0; i < num_slots; ++i) {
+        if (grid_out[i].score >= 0) {
+          keypoints->push_back(grid_out[i]);
         }
       }
+      return;
+    }
+    const int count = std::min(kp_out[0], options_.max_keypoints);
+    keypoints->resize(count);
+    memcpy(keypoints->data(), kp_out + 1, sizeof(Keypoint) * count);
+  }
 
-      if (!foundExtension) {
-        throw std::runtime_error(
-            "Extension VK_EXT_DEBUG_REPORT_EXTENSION_NAME not supported\n");
-      }
-      enabledExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+  // i 番目のパスの平均の実行時間 [ms] (timestamp query が使えない場合は 0)
+  double passTimeMs(const size_t i) const {
+    if (!timestamp_supported_ || num_detections_ == 0) {
+      return 0.0;
     }
+    return pass_times_ms_[i] / num_detections_;
+  }
+  // 計測した実行時間を捨てる (ウォームアップの後に呼ぶ)
+  void resetPassTimes(void) {
+    std::fill(pass_times_ms_.begin(), pass_times_ms_.end(), 0.0);
+    num_detections_ = 0;
+  }
 
-    /*
-    Next, we actually create the instance.
+  void printPassTimes(void) const {
+    if (!timestamp_supported_ || num_detections_ == 0) {
+      return;
+    }
+    const double num_pixels = double(width_) * double(height_);
+    printf("----- Pass Times (%s, %ux%u, average of %d runs) -----\n",
+           modeName(), width_, height_, num_detections_);
+    const char* const* pass_names =
+        options_.score_map ? kScoreMapPassNames
+                           : (options_.roundtrip ? kRoundTripPassNames
+                                                 : kPassNames);
+    double total_ms = 0.0;
+    for (size_t i = 0; i < pass_times_ms_.size(); ++i) {
+      const char* name = i < 3 ? pass_names[i] : "topk";
+      if (name == nullptr) {
+        continue;
+      }
+      const double ms = pass_times_ms_[i] / num_detections_;
+      printf("     - %-10s : %8.3f ms\n", name, ms);
+      total_ms += ms;
+    }
+    printf("     - %-10s : %8.3f ms (%8.1f Mpix/s)\n", "total", total_ms,
+           num_pixels / (total_ms * 1e3));
+  }
 
-    */
+private:
+  void createBuffers() {
+    const VkDeviceSize num_pixels = VkDeviceSize(width_) * height_;
+    const VkDeviceSize max_keypoints = options_.max_keypoints;
+    // *_tiled のカーネルは画像を 32bit ずつ読むので、最後の語が収まるように
+    // 4 byte の倍数にする
+    img_buffer_    = context_.createStagedBuffer((num_pixels + 3) & ~3);
+    kp_loc_buffer_ =
+        context_.createStagedBuffer(sizeof(int) * (1 + 2 * max_keypoints));
+    kp_out_buffer_ =
+        context_.createStagedBuffer(sizeof(int) * (1 + 3 * max_keypoints));
+    dispatch_args_buffer_ = context_.createBuffer(
+        sizeof(VkDispatchIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (options_.score_map) {
+      score_map_buffer_ = context_.createDeviceLocalBuffer(num_pixels);
+    }
+    if (options_.grid_cell > 0) {
+      const VkDeviceSize num_cells = VkDeviceSize(grid_cols_) * grid_rows_;
+      cells_buffer_ =
+          context_.createDeviceLocalBuffer(sizeof(int) * 2 * num_cells);
+      items_buffer_ =
+          context_.createDeviceLocalBuffer(sizeof(int) * max_keypoints);
+      grid_out_buffer_ = context_.createStagedBuffer(
+          sizeof(int) * 3 * options_.per_cell * num_cells);
+      grid_dispatch_args_buffer_ = context_.createBuffer(
+          sizeof(VkDispatchIndirectCommand),
+          VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    }
+  }
 
+  void createComputePipelines() {
     /*
-    Contains application info. This is actually not that important.
-    The only real important field is apiVersion.
+    clspv は __global の引数を binding 0, 1, ... に、それ以外の引数を
+    push constant にする。
+    reqd_work_group_size のないカーネルのワークグループサイズは
+    SpecId 0, 1, 2 で与える。
     */
-    VkApplicationInfo applicationInfo  = {};
-    applicationInfo.sType              = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-    applicationInfo.pApplicationName   = "Hello world app";
-    applicationInfo.applicationVersion = 0;
-    applicationInfo.pEngineName        = "awesomeengine";
-    applicationInfo.engineVersion      = 0;
-    applicationInfo.apiVersion         = VK_API_VERSION_1_0;
-    ;
-
-    VkInstanceCreateInfo createInfo = {};
-    createInfo.sType                = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-    createInfo.flags                = 0;
-    createInfo.pApplicationInfo     = &applicationInfo;
-
-    // Give our desired layers and extensions to vulkan.
-    createInfo.enabledLayerCount       = enabledLayers.size();
-    createInfo.ppEnabledLayerNames     = enabledLayers.data();
-    createInfo.enabledExtensionCount   = enabledExtensions.size();
-    createInfo.ppEnabledExtensionNames = enabledExtensions.data();
+    const auto begin = std::chrono::steady_clock::now();
+    find_kernel_     = &context_.getKernel("./spirv/c/fast_find_keypoints.spv",
+                                       2, sizeof(FindPushConstant));
+    prepare_kernel_ = &context_.getKernel(
+        "./spirv/c/fast_prepare_dispatch.spv", 2, sizeof(PreparePushConstant));
+    nms_kernel_ = &context_.getKernel("./spirv/c/fast_nonmax_supression.spv",
+                                      3, sizeof(NmsPushConstant));
+    score_map_kernel_ = &context_.getKernel("./spirv/c/fast_score_map.spv", 2,
+                                            sizeof(ScoreMapPushConstant));
+    grid_kernel_ = &context_.getKernel("./spirv/c/fast_grid_topk.spv", 4,
+                                       sizeof(GridPushConstant));
+    const std::string suffix = options_.aggregated ? "_aggregated" : "";
+    const std::string find_suffix = options_.tiled ? "_tiled" : suffix;
+    find_pipeline_                = find_kernel_->getPipeline(
+        "FAST_findKeypoints" + find_suffix,
+        {FIND_WORKGROUP_SIZE, FIND_WORKGROUP_SIZE, 1});
+    prepare_pipeline_ = prepare_kernel_->getPipeline("FAST_prepareDispatch");
+    nms_pipeline_     = nms_kernel_->getPipeline(
+        "FAST_nonmaxSupression" + suffix, {NMS_WORKGROUP_SIZE, 1, 1});
+    score_map_pipeline_ = score_map_kernel_->getPipeline(
+        std::string("FAST_scoreMap") + (options_.tiled ? "_tiled" : ""),
+        {FIND_WORKGROUP_SIZE, FIND_WORKGROUP_SIZE, 1});
+    score_map_nms_pipeline_ = score_map_kernel_->getPipeline(
+        "FAST_nonmaxScoreMap", {FIND_WORKGROUP_SIZE, FIND_WORKGROUP_SIZE, 1});
+    if (options_.grid_cell > 0) {
+      grid_count_pipeline_ = grid_kernel_->getPipeline(
+          "FAST_gridCount", {NMS_WORKGROUP_SIZE, 1, 1});
+      grid_scan_pipeline_    = grid_kernel_->getPipeline("FAST_gridScan");
+      grid_scatter_pipeline_ = grid_kernel_->getPipeline(
+          "FAST_gridScatter", {NMS_WORKGROUP_SIZE, 1, 1});
+      grid_select_pipeline_ = grid_kernel_->getPipeline(
+          "FAST_gridSelect", {NMS_WORKGROUP_SIZE, 1, 1});
+    }
+    kernel_ms_ = clspv_test::elapsedMs(begin);
+  }
 
-    /*
-    Actually create the instance.
-    Having created the instance, we can actually start using vulkan.
-    */
-    VK_CHECK_RESULT(vkCreateInstance(&createInfo, NULL, &instance));
+  void createDescriptorSets() {
+    // 7つの descriptor set (buffer は最大 4 個)
+    descriptor_pool_ = context_.createDescriptorPool(7, 4);
+    find_descriptor_set_ =
+        find_kernel_->allocateDescriptorSet(descriptor_pool_);
+    prepare_descriptor_set_ =
+        prepare_kernel_->allocateDescriptorSet(descriptor_pool_);
+    nms_descriptor_set_ = nms_kernel_->allocateDescriptorSet(descriptor_pool_);
+    score_map_descriptor_set_ =
+        score_map_kernel_->allocateDescriptorSet(descriptor_pool_);
+    score_map_nms_descriptor_set_ =
+        score_map_kernel_->allocateDescriptorSet(descriptor_pool_);
+    grid_descriptor_set_ =
+        grid_kernel_->allocateDescriptorSet(descriptor_pool_);
+    grid_prepare_descriptor_set_ =
+        prepare_kernel_->allocateDescriptorSet(descriptor_pool_);
+
+    const VkDescriptorBufferInfo img = {img_buffer_.device.buffer, 0,
+                                        img_buffer_.device.size};
+    const VkDescriptorBufferInfo kp_loc = {kp_loc_buffer_.device.buffer, 0,
+                                           kp_loc_buffer_.device.size};
+    const VkDescriptorBufferInfo kp_out = {kp_out_buffer_.device.buffer, 0,
+                                           kp_out_buffer_.device.size};
+    const VkDescriptorBufferInfo dispatch_args = {
+        dispatch_args_buffer_.buffer, 0, dispatch_args_buffer_.size};
+
+    // FAST_findKeypoints(_img, kp_loc, ...)
+    context_.writeDescriptorSet(find_descriptor_set_, {img, kp_loc});
+    // FAST_prepareDispatch(kp_loc, dispatch_args, ...)
+    context_.writeDescriptorSet(prepare_descriptor_set_,
+                                {kp_loc, dispatch_args});
+    // FAST_nonmaxSupression(kp_in, kp_out, _img, ...)
+    context_.writeDescriptorSet(nms_descriptor_set_, {kp_loc, kp_out, img});
+    if (options_.score_map) {
+      const VkDescriptorBufferInfo score_map = {score_map_buffer_.buffer, 0,
+                                                score_map_buffer_.size};
+      // FAST_scoreMap(_img, score_map, ...)
+      context_.writeDescriptorSet(score_map_descriptor_set_, {img, score_map});
+      // FAST_nonmaxScoreMap(score_map, kp_out, ...)
+      context_.writeDescriptorSet(score_map_nms_descriptor_set_,
+                                  {score_map, kp_out});
+    }
+    if (options_.grid_cell > 0) {
+      // FAST_grid*(kp_out, cells, items, grid_out, ...)
+      context_.writeDescriptorSet(
+          grid_descriptor_set_,
+          {kp_out,
+           {cells_buffer_.buffer, 0, cells_buffer_.size},
+           {items_buffer_.buffer, 0, items_buffer_.size},
+           {grid_out_buffer_.device.buffer, 0, grid_out_buffer_.device.size}});
+      // FAST_prepareDispatch(kp_out, grid_dispatch_args, ...)
+      context_.writeDescriptorSet(
+          grid_prepare_descriptor_set_,
+          {kp_out,
+           {grid_dispatch_args_buffer_.buffer, 0,
+            grid_dispatch_args_buffer_.size}});
+    }
+  }
 
-    /*
-    Register a callback function for the extension
-    VK_EXT_DEBUG_REPORT_EXTENSION_NAME, so that warnings emitted from the
-    validation layer are actually printed.
-    */
-    if (enableValidationLayers) {
-      VkDebugReportCallbackCreateInfoEXT createInfo = {};
-      createInfo.sType =
-          VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
-      createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT |
-                         VK_DEBUG_REPORT_WARNING_BIT_EXT |
-                         VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT;
-      createInfo.pfnCallback = &debugReportCallbackFn;
-
-      // We have to explicitly load this function.
-      auto vkCreateDebugReportCallbackEXT =
-          (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(
-              instance, "vkCreateDebugReportCallbackEXT");
-      if (vkCreateDebugReportCallbackEXT == nullptr) {
-        throw std::runtime_error(
-            "Could not load vkCreateDebugReportCallbackEXT");
-      }
+  void createQueryPool() {
+    // 開始時刻 + 各パスの終了時刻
+    query_pool_ = createTimestampQueryPool(context_, num_timestamps_);
+    timestamp_supported_ = query_pool_ != VK_NULL_HANDLE;
+    timestamp_period_    = context_.properties().limits.timestampPeriod;
+  }
 
-      // Create and register callback.
-      VK_CHECK_RESULT(vkCreateDebugReportCallbackEXT(
-          instance, &createInfo, NULL, &debugReportCallback));
-    }
+  void writeTimestamp(VkCommandBuffer command_buffer, const uint32_t query,
+                      const VkPipelineStageFlagBits stage =
+                          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT) {
+    ::writeTimestamp(command_buffer, query_pool_, query, stage);
   }
 
-  void findPhysicalDevice() {
-    /*
-    In this function, we find a physical device that can be used with Vulkan.
-    */
+  // counter は FAST_nonmaxSupression の scalar 引数 (読み戻した候補の数)
+  NmsPushConstant makeNmsPushConstant(const int counter) const {
+    NmsPushConstant nms_push_constant;
+    nms_push_constant.step          = width_;
+    nms_push_constant.img_offset    = 0;
+    nms_push_constant.rows          = height_;
+    nms_push_constant.cols          = width_;
+    nms_push_constant.counter       = counter;
+    nms_push_constant.max_keypoints = options_.max_keypoints;
+    return nms_push_constant;
+  }
 
-    /*
-    So, first we will list all physical devices on the system with
-    vkEnumeratePhysicalDevices .
-    */
-    uint32_t deviceCount;
-    vkEnumeratePhysicalDevices(instance, &deviceCount, NULL);
-    if (deviceCount == 0) {
-      throw std::runtime_error("could not find a device with vulkan support");
+  void createCommandBuffers() {
+    command_buffer_ = context_.allocateCommandBuffer();
+    beginCommandBuffer(command_buffer_, 0);  // フレームごとに投入する
+
+    // 入力画像を staging から DEVICE_LOCAL なバッファにコピーする
+    context_.recordUpload(command_buffer_, img_buffer_,
+                          img_buffer_.device.size);
+
+    // 2つのカウンタ (kp_loc[0], kp_out[0]) を 0 にする
+    vkCmdFillBuffer(command_buffer_, kp_loc_buffer_.device.buffer, 0,
+                    sizeof(int), 0);
+    vkCmdFillBuffer(command_buffer_, kp_out_buffer_.device.buffer, 0,
+                    sizeof(int), 0);
+    if (options_.grid_cell > 0) {
+      vkCmdFillBuffer(command_buffer_, cells_buffer_.buffer, 0, VK_WHOLE_SIZE,
+                      0);
     }
+    recordTransferToComputeBarrier(command_buffer_);
 
-    std::vector<VkPhysicalDevice> devices(deviceCount);
-    vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+    if (timestamp_supported_) {
+      vkCmdResetQueryPool(command_buffer_, query_pool_, 0, num_timestamps_);
+    }
+    writeTimestamp(command_buffer_, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
 
-    /*
-    Next, we choose a device that can be used for our purposes.
-
-    With VkPhysicalDeviceFeatures(), we can retrieve a fine-grained list of
-    physical features supported by the device. However, in this demo, we are
-    simply launching a simple compute shader, and there are no special physical
-    features demanded for this task.
-
-    With VkPhysicalDeviceProperties(), we can obtain a list of physical device
-    properties. Most importantly, we obtain a list of physical device
-    limitations. For this application, we launch a compute shader, and the
-    maximum size of the workgroups and total number of compute shader
-    invocations is limited by the physical device, and we should ensure that the
-    limitations named maxComputeWorkGroupCount, maxComputeWorkGroupInvocations
-    and maxComputeWorkGroupSize are not exceeded by our application.  Moreover,
-    we are using a storage buffer in the compute shader, and we should ensure
-    that it is not larger than the device can handle, by checking the limitation
-    maxStorageBufferRange.
-
-    However, in our application, the workgroup size and total number of shader
-    invocations is relatively small, and the storage buffer is not that large,
-    and thus a vast majority of devices will be able to handle it. This can be
-    verified by looking at some devices at_ http://vulkan.gpuinfo.org/
-
-    Therefore, to keep things simple and clean, we will not perform any such
-    checks here, and just pick the first physical device in the list. But in a
-    real and serious application, those limitations should certainly be taken
-    into account.
+    if (options_.score_map) {
+      recordScoreMap();
+      VK_CHECK_RESULT(
+          vkEndCommandBuffer(command_buffer_));  // end recording commands.
+      return;
+    }
 
-    */
-    for (VkPhysicalDevice device : devices) {
-      if (true) {  // As above stated, we do no feature checks, so just accept.
-        physicalDevice = device;
-        break;
-      }
+    // 1. 候補の検出 (端の FAST_BORDER 画素を除く)
+    FindPushConstant find_push_constant;
+    find_push_constant.step          = width_;
+    find_push_constant.img_offset    = 0;
+    find_push_constant.img_rows      = height_;
+    find_push_constant.img_cols      = width_;
+    find_push_constant.max_keypoints = options_.max_keypoints;
+    find_push_constant.threshold     = options_.threshold;
+    find_kernel_->dispatch(
+        command_buffer_, find_pipeline_, find_descriptor_set_,
+        &find_push_constant,
+        (width_ - 2 * FAST_BORDER + FIND_WORKGROUP_SIZE - 1) /
+            FIND_WORKGROUP_SIZE,
+        (height_ - 2 * FAST_BORDER + FIND_WORKGROUP_SIZE - 1) /
+            FIND_WORKGROUP_SIZE);
+    writeTimestamp(command_buffer_, 1);
+
+    if (options_.roundtrip) {
+      // 候補の数だけを読み戻して終わる
+      // 非極大値抑制は detect() で候補の数を読んでから記録する
+      context_.recordDownload(command_buffer_, kp_loc_buffer_, sizeof(int));
+      VK_CHECK_RESULT(
+          vkEndCommandBuffer(command_buffer_));  // end recording commands.
+      nms_command_buffer_ = context_.allocateCommandBuffer();
+      return;
     }
-  }
 
-  // Returns the index of a queue family that supports compute operations.
-  uint32_t getComputeQueueFamilyIndex() {
-    uint32_t queueFamilyCount;
+    // 2. 候補の数からディスパッチの引数を作る
+    recordComputeBarrier(command_buffer_);
+    PreparePushConstant prepare_push_constant;
+    prepare_push_constant.max_keypoints  = options_.max_keypoints;
+    prepare_push_constant.workgroup_size = NMS_WORKGROUP_SIZE;
+    prepare_kernel_->dispatch(command_buffer_, prepare_pipeline_,
+                              prepare_descriptor_set_, &prepare_push_constant,
+                              1, 1);
+    writeTimestamp(command_buffer_, 2);
+
+    // 3. 非極大値抑制
+    // 候補の数はデバイス上のカウンタ (kp_in[0]) で制限されるので、
+    // counter には上限 (max_keypoints) を与える
+    recordComputeBarrier(command_buffer_, /*indirect_command_read=*/true);
+    const NmsPushConstant nms_push_constant =
+        makeNmsPushConstant(options_.max_keypoints);
+    nms_kernel_->dispatchIndirect(command_buffer_, nms_pipeline_,
+                                  nms_descriptor_set_, &nms_push_constant,
+                                  dispatch_args_buffer_.buffer);
+    writeTimestamp(command_buffer_, 3);
+
+    // 候補の数とキーポイントをホストから読めるようにする
+    context_.recordDownload(command_buffer_, kp_loc_buffer_, sizeof(int));
+    recordResults(command_buffer_);
 
-    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
-                                             NULL);
+    VK_CHECK_RESULT(
+        vkEndCommandBuffer(command_buffer_));  // end recording commands.
+  }
 
-    // Retrieve all queue families.
-    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
-                                             queueFamilies.data());
+  // スコアマップを作り、タイルで非極大値抑制をする (score_map のみ)
+  void recordScoreMap() {
+    ScoreMapPushConstant push_constant;
+    push_constant.step          = width_;
+    push_constant.img_offset    = 0;
+    push_constant.rows          = height_;
+    push_constant.cols          = width_;
+    push_constant.threshold     = options_.threshold;
+    push_constant.max_keypoints = options_.max_keypoints;
+    const uint32_t group_count_x =
+        (width_ + FIND_WORKGROUP_SIZE - 1) / FIND_WORKGROUP_SIZE;
+    const uint32_t group_count_y =
+        (height_ + FIND_WORKGROUP_SIZE - 1) / FIND_WORKGROUP_SIZE;
+
+    // 1. 全画素のスコア
+    score_map_kernel_->dispatch(command_buffer_, score_map_pipeline_,
+                                score_map_descriptor_set_, &push_constant,
+                                group_count_x, group_count_y);
+    writeTimestamp(command_buffer_, 1);
+    writeTimestamp(command_buffer_, 2);
+
+    // 3. タイルで非極大値抑制
+    recordComputeBarrier(command_buffer_);
+    score_map_kernel_->dispatch(command_buffer_, score_map_nms_pipeline_,
+                                score_map_nms_descriptor_set_, &push_constant,
+                                group_count_x, group_count_y);
+    writeTimestamp(command_buffer_, 3);
+
+    recordResults(command_buffer_);
+  }
 
-    // Now find a family that supports compute.
-    uint32_t i = 0;
-    for (; i < queueFamilies.size(); ++i) {
-      VkQueueFamilyProperties props = queueFamilies[i];
+  // 読み戻した候補の数 counter で非極大値抑制を直接ディスパッチする
+  // command buffer を記録し直す (roundtrip のみ)
+  void recordNmsCommandBuffer(const int counter) {
+    VK_CHECK_RESULT(vkResetCommandBuffer(nms_command_buffer_, 0));
+    beginCommandBuffer(nms_command_buffer_,
+                       VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    writeTimestamp(nms_command_buffer_, 2, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+
+    // 前の投入で書いた候補のリストを読めるようにする
+    recordComputeBarrier(nms_command_buffer_);
+    const NmsPushConstant nms_push_constant = makeNmsPushConstant(counter);
+    nms_kernel_->dispatch(
+        nms_command_buffer_, nms_pipeline_, nms_descriptor_set_,
+        &nms_push_constant,
+        (counter + NMS_WORKGROUP_SIZE - 1) / NMS_WORKGROUP_SIZE, 1);
+    writeTimestamp(nms_command_buffer_, 3);
+
+    recordResults(nms_command_buffer_);
+    VK_CHECK_RESULT(vkEndCommandBuffer(nms_command_buffer_));
+  }
 
-      if (props.queueCount > 0 && (props.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
-        // found a queue with compute. We're done!
-        break;
-      }
+  // 非極大値抑制の後: grid_cell を指定した場合はセルごとの選択をして結果を、
+  // それ以外は kp_out をホストから読めるようにする
+  void recordResults(VkCommandBuffer command_buffer) {
+    if (options_.grid_cell <= 0) {
+      context_.recordDownload(command_buffer, kp_out_buffer_,
+                              kp_out_buffer_.device.size);
+      return;
     }
 
-    if (i == queueFamilies.size()) {
-      throw std::runtime_error(
-          "could not find a queue family that supports operations");
+    GridPushConstant push_constant;
+    push_constant.cell_size     = options_.grid_cell;
+    push_constant.grid_cols     = grid_cols_;
+    push_constant.grid_rows     = grid_rows_;
+    push_constant.per_cell      = options_.per_cell;
+    push_constant.max_keypoints = options_.max_keypoints;
+    const uint32_t num_cells    = grid_cols_ * grid_rows_;
+
+    // キーポイントの数 (kp_out[0]) からディスパッチの引数を作る
+    recordComputeBarrier(command_buffer);
+    PreparePushConstant prepare_push_constant;
+    prepare_push_constant.max_keypoints  = options_.max_keypoints;
+    prepare_push_constant.workgroup_size = NMS_WORKGROUP_SIZE;
+    prepare_kernel_->dispatch(command_buffer, prepare_pipeline_,
+                              grid_prepare_descriptor_set_,
+                              &prepare_push_constant, 1, 1);
+
+    // 1. セルごとに数える
+    recordComputeBarrier(command_buffer, /*indirect_command_read=*/true);
+    grid_kernel_->dispatchIndirect(command_buffer, grid_count_pipeline_,
+                                   grid_descriptor_set_, &push_constant,
+                                   grid_dispatch_args_buffer_.buffer);
+    // 2. 累積和 (1つのワークグループ)
+    recordComputeBarrier(command_buffer);
+    grid_kernel_->dispatch(command_buffer, grid_scan_pipeline_,
+                           grid_descriptor_set_, &push_constant, 1, 1);
+    // 3. セルごとに並べる
+    recordComputeBarrier(command_buffer);
+    grid_kernel_->dispatchIndirect(command_buffer, grid_scatter_pipeline_,
+                                   grid_descriptor_set_, &push_constant,
+                                   grid_dispatch_args_buffer_.buffer);
+    // 4. セルごとに上位 per_cell 個を選ぶ
+    recordComputeBarrier(command_buffer);
+    const uint32_t num_groups =
+        (num_cells + NMS_WORKGROUP_SIZE - 1) / NMS_WORKGROUP_SIZE;
+    grid_kernel_->dispatch(command_buffer, grid_select_pipeline_,
+                           grid_descriptor_set_, &push_constant, num_groups, 1);
+    writeTimestamp(command_buffer, 4);
+
+    // キーポイントの数 (溢れたかどうか) と選んだキーポイント
+    context_.recordDownload(command_buffer, kp_out_buffer_, sizeof(int));
+    context_.recordDownload(command_buffer, grid_out_buffer_,
+                            grid_out_buffer_.device.size);
+  }
+
+  void accumulatePassTimes(void) {
+    ++num_detections_;
+    if (!timestamp_supported_) {
+      return;
     }
 
-    return i;
+    // 開始時刻 + 各パスの終了時刻
+    uint64_t timestamps[5];
+    VK_CHECK_RESULT(vkGetQueryPoolResults(
+        context_.device(), query_pool_, 0, num_timestamps_,
+        sizeof(uint64_t) * num_timestamps_, timestamps, sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+    for (size_t i = 0; i < pass_times_ms_.size(); ++i) {
+      pass_times_ms_[i] += double(timestamps[i + 1] - timestamps[i]) *
+                           timestamp_period_ * 1e-6;
+    }
   }
+};
 
-  void createDevice() {
-    /*
-    We create the logical device in this function.
-    */
+const char* const FastDetector::kPassNames[3] = {"detect", "prepare", "nms"};
+const char* const FastDetector::kRoundTripPassNames[3] = {"detect", "readback",
+                                                          "nms"};
+const char* const FastDetector::kScoreMapPassNames[3] = {"score", nullptr,
+                                                         "nms"};
+
+// ピラミッドの段で検出したキーポイント
+// x, y は段 0 (入力画像) の座標に戻したもの
+struct ScaledKeypoint {
+  float x;
+  float y;
+  int score;
+  int level;
+};
 
-    /*
-    When creating the device, we also specify what queues it has.
-    */
-    VkDeviceQueueCreateInfo queueCreateInfo = {};
-    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queueFamilyIndex = getComputeQueueFamilyIndex();  // find queue family with
-                                                      // compute capability.
-    queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
-    queueCreateInfo.queueCount =
-        1;  // create one queue in this family. We don't need more.
-    float queuePriorities =
-        1.0;  // we only have one queue, so this is not that imporant.
-    queueCreateInfo.pQueuePriorities = &queuePriorities;
+/*
+ピラミッドの各段での FAST コーナー検出
+
+1つの command buffer に
+  1. gaussian_pyramid.cl で段 0 (入力画像) から段 1, 2, ... を順に作る
+     (分離型のガウシアンフィルタに縮小を組み込んだもの)
+  2. 各段で FAST_findKeypoints, FAST_prepareDispatch,
+     FAST_nonmaxSupression (間接ディスパッチ) を実行する
+を記録する。
+全ての段は1つのバッファ (pyramid) に並べ、FAST のカーネルには段の先頭
+(img_offset) と幅 (step) を渡す。段ごとの候補とキーポイントのリストも
+1つのバッファの区間に分け、区間ごとの descriptor set (オフセット付き) で
+渡す。区間の長さは段の面積に比例させる。
+*/
+class FastPyramidDetector {
+private:
+  struct Level {
+    uint32_t width;
+    uint32_t height;
+    // 段の座標から段 0 の座標への倍率 (横, 縦)
+    float scale_x;
+    float scale_y;
+    VkDeviceSize img_offset;  // pyramid の中の先頭
+    int max_keypoints;
+    // kp_loc, kp_out, dispatch_args の中の区間の先頭 [byte]
+    VkDeviceSize kp_loc_offset;
+    VkDeviceSize kp_out_offset;
+    VkDeviceSize dispatch_args_offset;
+    VkDescriptorSet find_descriptor_set;
+    VkDescriptorSet prepare_descriptor_set;
+    VkDescriptorSet nms_descriptor_set;
+  };
 
-    /*
-    Now we create the logical device. The logical device allows us to interact
-    with the physical device.
-    */
-    VkDeviceCreateInfo deviceCreateInfo = {};
+  clspv_test::Context& context_;
+  const FastOptions options_;
+  std::vector<Level> levels_;
+
+  clspv_test::Kernel* pyramid_kernel_;
+  clspv_test::Kernel* find_kernel_;
+  clspv_test::Kernel* prepare_kernel_;
+  clspv_test::Kernel* nms_kernel_;
+  VkPipeline horizontal_pipeline_;
+  VkPipeline vertical_pipeline_;
+  VkPipeline find_pipeline_;
+  VkPipeline prepare_pipeline_;
+  VkPipeline nms_pipeline_;
+
+  VkCommandBuffer command_buffer_;
+  VkDescriptorPool descriptor_pool_;
+  // gaussian_pyramid_horizontal, gaussian_pyramid_vertical で共通
+  VkDescriptorSet pyramid_descriptor_set_;
+
+  // 全ての段 (1画素1byte)。ホストからは段 0 だけを書き込む
+  clspv_test::StagedBuffer pyramid_buffer_;
+  // 横方向のパスの結果 (float, 段 1 の幅 x 段 0 の高さ)
+  clspv_test::Buffer tmp_buffer_;
+  // 正規化したガウス関数の重み (2 * PYRAMID_RADIUS + 1 個)
+  clspv_test::StagedBuffer weights_buffer_;
+  // 段ごとの区間に分けた候補とキーポイント (FastDetector と同じ形式)
+  clspv_test::Buffer kp_loc_buffer_;
+  clspv_test::StagedBuffer kp_out_buffer_;
+  clspv_test::Buffer dispatch_args_buffer_;
+
+  // 開始時刻, ピラミッドの終了時刻, 検出の終了時刻
+  VkQueryPool query_pool_;
+  float timestamp_period_;
+  double pass_times_ms_[2] = {0.0, 0.0};
+  int num_detections_      = 0;
+
+  // gaussian_pyramid.cl の2つのカーネルで共通
+  struct PyramidPushConstant {
+    int src_offset;
+    int src_w;
+    int src_h;
+    int dst_offset;
+    int dst_w;
+    int dst_h;
+  };
 
-    // Specify any desired device features here. We do not need any for this
-    // application, though.
-    VkPhysicalDeviceFeatures deviceFeatures = {};
+public:
+  FastPyramidDetector(clspv_test::Context& context, const uint32_t width,
+                      const uint32_t height, const FastOptions& options)
+      : context_(context), options_(options) {
+    if (options_.levels < 1 || options_.levels > MAX_PYRAMID_LEVELS ||
+        !(options_.scale_factor > 1.0f)) {
+      throw std::runtime_error("Invalid pyramid levels or scale factor.");
+    }
+    createLevels(width, height);
+    createBuffers();
+    createComputePipelines();
+    createDescriptorSets();
+    query_pool_       = createTimestampQueryPool(context_, 3);
+    timestamp_period_ = context_.properties().limits.timestampPeriod;
+    createCommandBuffer();
+  }
 
-    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceCreateInfo.enabledLayerCount =
-        enabledLayers
-            .size();  // need to specify validation layers here as well.
-    deviceCreateInfo.ppEnabledLayerNames = enabledLayers.data();
-    deviceCreateInfo.pQueueCreateInfos =
-        &queueCreateInfo;  // when creating the logical device, we also specify
-                           // what queues it has.
-    deviceCreateInfo.queueCreateInfoCount = 1;
-    deviceCreateInfo.pEnabledFeatures     = &deviceFeatures;
+  ~FastPyramidDetector() {
+    const VkDevice device = context_.device();
+    if (query_pool_ != VK_NULL_HANDLE) {
+      vkDestroyQueryPool(device, query_pool_, NULL);
+    }
+    vkFreeCommandBuffers(device, context_.commandPool(), 1, &command_buffer_);
+    vkDestroyDescriptorPool(device, descriptor_pool_, NULL);
+    context_.destroyStagedBuffer(pyramid_buffer_);
+    context_.destroyBuffer(tmp_buffer_);
+    context_.destroyStagedBuffer(weights_buffer_);
+    context_.destroyBuffer(kp_loc_buffer_);
+    context_.destroyStagedBuffer(kp_out_buffer_);
+    context_.destroyBuffer(dispatch_args_buffer_);
+  }
 
-    VK_CHECK_RESULT(vkCreateDevice(physicalDevice, &deviceCreateInfo, NULL,
-                                   &device));  // create logical device.
+  FastPyramidDetector(const FastPyramidDetector&) = delete;
+  FastPyramidDetector& operator=(const FastPyramidDetector&) = delete;
 
-    // Get a handle to the only member of the queue family.
-    vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
+  size_t numLevels() const { return levels_.size(); }
+  uint32_t levelWidth(const size_t level) const {
+    return levels_[level].width;
+  }
+  uint32_t levelHeight(const size_t level) const {
+    return levels_[level].height;
   }
 
-  // find memory type with desired properties.
-  uint32_t findMemoryType(uint32_t memoryTypeBits,
-                          VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memoryProperties;
+  // 入力画像 (段 0) を書き込む先 (levelWidth(0) * levelHeight(0) byte)
+  unsigned char* imageData() {
+    return reinterpret_cast<unsigned char*>(pyramid_buffer_.mapped);
+  }
 
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+  // imageData() の画像のピラミッドを作り、全ての段からキーポイントを検出する
+  // keypoints は段の順 (段の中の順序は実行ごとに異なる)
+  void detect(std::vector<ScaledKeypoint>* keypoints) {
+    context_.submitAndWait(command_buffer_);
+    accumulatePassTimes();
+
+    keypoints->clear();
+    const unsigned char* kp_out_base =
+        reinterpret_cast<const unsigned char*>(kp_out_buffer_.mapped);
+    for (size_t l = 0; l < levels_.size(); ++l) {
+      const Level& level = levels_[l];
+      const int* kp_out =
+          reinterpret_cast<const int*>(kp_out_base + level.kp_out_offset);
+      const int count = std::min(kp_out[0], level.max_keypoints);
+      for (int i = 0; i < count; ++i) {
+        // 段の画素の中心を段 0 の座標に戻す (gaussian_pyramid.cl と同じ対応)
+        ScaledKeypoint keypoint;
+        keypoint.x     = (kp_out[1 + 3 * i] + 0.5f) * level.scale_x - 0.5f;
+        keypoint.y     = (kp_out[2 + 3 * i] + 0.5f) * level.scale_y - 0.5f;
+        keypoint.score = kp_out[3 + 3 * i];
+        keypoint.level = int(l);
+        keypoints->push_back(keypoint);
+      }
+    }
+  }
 
-    /*
-    How does this search work?
-    See the documentation of VkPhysicalDeviceMemoryProperties for a detailed
-    description.
-    */
-    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
-      if ((memoryTypeBits & (1 << i)) &&
-          ((memoryProperties.memoryTypes[i].propertyFlags & properties) ==
-           properties))
-        return i;
+  // ピラミッドの作成 (0) と全ての段の検出 (1) の平均の実行時間 [ms]
+  double passTimeMs(const size_t i) const {
+    if (query_pool_ == VK_NULL_HANDLE || num_detections_ == 0) {
+      return 0.0;
     }
-    return -1;
+    return pass_times_ms_[i] / num_detections_;
+  }
+  void resetPassTimes(void) {
+    pass_times_ms_[0] = pass_times_ms_[1] = 0.0;
+    num_detections_                       = 0;
   }
 
-  void createBuffer() {
-    /*
-    We will now create a buffer. We will render the mandelbrot set into this
-    buffer in a computer shade later.
-    */
+private:
+  void createLevels(const uint32_t width, const uint32_t height) {
+    const VkDeviceSize alignment = std::max<VkDeviceSize>(
+        context_.properties().limits.minStorageBufferOffsetAlignment,
+        sizeof(int));
+    auto align = [alignment](const VkDeviceSize size) {
+      return (size + alignment - 1) / alignment * alignment;
+    };
+
+    VkDeviceSize img_offset = 0, kp_loc_offset = 0, kp_out_offset = 0;
+    VkDeviceSize dispatch_args_offset = 0;
+    float scale                       = 1.0f;
+    for (int l = 0; l < options_.levels; ++l) {
+      Level level;
+      level.width  = uint32_t(std::lround(width / scale));
+      level.height = uint32_t(std::lround(height / scale));
+      if (level.width <= 2 * FAST_BORDER || level.height <= 2 * FAST_BORDER) {
+        throw std::runtime_error("Image is too small for the pyramid levels.");
+      }
+      level.scale_x       = float(width) / float(level.width);
+      level.scale_y       = float(height) / float(level.height);
+      level.img_offset    = img_offset;
+      level.max_keypoints = std::max(
+          1, int(double(options_.max_keypoints) * level.width * level.height /
+                 (double(width) * height)));
+      level.kp_loc_offset        = kp_loc_offset;
+      level.kp_out_offset        = kp_out_offset;
+      level.dispatch_args_offset = dispatch_args_offset;
+      levels_.push_back(level);
+
+      img_offset += VkDeviceSize(level.width) * level.height;
+      kp_loc_offset +=
+          align(sizeof(int) * (1 + 2 * VkDeviceSize(level.max_keypoints)));
+      kp_out_offset +=
+          align(sizeof(int) * (1 + 3 * VkDeviceSize(level.max_keypoints)));
+      dispatch_args_offset += align(sizeof(VkDispatchIndirectCommand));
+      scale *= options_.scale_factor;
+    }
+  }
 
-    VkBufferCreateInfo bufferCreateInfo = {};
-    bufferCreateInfo.sType              = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferCreateInfo.size               = bufferSize;  // buffer size in bytes.
-    bufferCreateInfo.usage =
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;  // buffer is used as a storage
-                                             // buffer.
-    bufferCreateInfo.sharingMode =
-        VK_SHARING_MODE_EXCLUSIVE;  // buffer is exclusive to a single queue
-                                    // family at a time.
+  void createBuffers() {
+    const Level& last = levels_.back();
+    pyramid_buffer_   = context_.createStagedBuffer(
+        last.img_offset + VkDeviceSize(last.width) * last.height);
+    const VkDeviceSize tmp_size =
+        levels_.size() > 1 ? VkDeviceSize(levels_[1].width) * levels_[0].height
+                           : 1;
+    tmp_buffer_ = context_.createDeviceLocalBuffer(sizeof(float) * tmp_size);
+
+    // gaussian_filter と同じ重みを、和が 1 になるように正規化する
+    std::vector<float> weights =
+        clspv_test::computeGaussianWeights(PYRAMID_SIGMA, PYRAMID_RADIUS);
+    float sum = 0.f;
+    for (const float w : weights) {
+      sum += w;
+    }
+    for (float& w : weights) {
+      w /= sum;
+    }
+    weights_buffer_ =
+        context_.createStagedBuffer(sizeof(float) * weights.size());
+    memcpy(weights_buffer_.mapped, weights.data(),
+           sizeof(float) * weights.size());
+
+    // 最後の段の区間の終わり
+    const VkDeviceSize alignment = std::max<VkDeviceSize>(
+        context_.properties().limits.minStorageBufferOffsetAlignment,
+        sizeof(int));
+    kp_loc_buffer_ = context_.createDeviceLocalBuffer(
+        last.kp_loc_offset +
+        sizeof(int) * (1 + 2 * VkDeviceSize(last.max_keypoints)));
+    kp_out_buffer_ = context_.createStagedBuffer(
+        last.kp_out_offset +
+        sizeof(int) * (1 + 3 * VkDeviceSize(last.max_keypoints)));
+    dispatch_args_buffer_ = context_.createBuffer(
+        last.dispatch_args_offset + alignment,
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  }
 
-    VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, NULL,
-                                   &buffer));  // create buffer.
+  void createComputePipelines() {
+    pyramid_kernel_ = &context_.getKernel("./spirv/c/gaussian_pyramid.spv", 3,
+                                          sizeof(PyramidPushConstant));
+    find_kernel_    = &context_.getKernel("./spirv/c/fast_find_keypoints.spv",
+                                       2, sizeof(FindPushConstant));
+    prepare_kernel_ = &context_.getKernel(
+        "./spirv/c/fast_prepare_dispatch.spv", 2, sizeof(PreparePushConstant));
+    nms_kernel_ = &context_.getKernel("./spirv/c/fast_nonmax_supression.spv",
+                                      3, sizeof(NmsPushConstant));
+    const std::string suffix = options_.aggregated ? "_aggregated" : "";
+    horizontal_pipeline_     = pyramid_kernel_->getPipeline(
+        "gaussian_pyramid_horizontal",
+        {FIND_WORKGROUP_SIZE, FIND_WORKGROUP_SIZE, 1});
+    vertical_pipeline_ = pyramid_kernel_->getPipeline(
+        "gaussian_pyramid_vertical",
+        {FIND_WORKGROUP_SIZE, FIND_WORKGROUP_SIZE, 1});
+    find_pipeline_ = find_kernel_->getPipeline(
+        "FAST_findKeypoints" + suffix,
+        {FIND_WORKGROUP_SIZE, FIND_WORKGROUP_SIZE, 1});
+    prepare_pipeline_ = prepare_kernel_->getPipeline("FAST_prepareDispatch");
+    nms_pipeline_     = nms_kernel_->getPipeline(
+        "FAST_nonmaxSupression" + suffix, {NMS_WORKGROUP_SIZE, 1, 1});
+  }
 
-    /*
-    But the buffer doesn't allocate memory for itself, so we must do that
-    manually.
-    */
+  void createDescriptorSets() {
+    // 段ごとに3つ + ピラミッドの1つ (buffer は最大 3 個)
+    const uint32_t num_sets = 3 * uint32_t(levels_.size()) + 1;
+    descriptor_pool_        = context_.createDescriptorPool(num_sets, 3);
+
+    const VkDescriptorBufferInfo pyramid = {pyramid_buffer_.device.buffer, 0,
+                                            pyramid_buffer_.device.size};
+    // gaussian_pyramid_*(pyramid, tmp, weights, ...)
+    pyramid_descriptor_set_ =
+        pyramid_kernel_->allocateDescriptorSet(descriptor_pool_);
+    context_.writeDescriptorSet(
+        pyramid_descriptor_set_,
+        {pyramid,
+         {tmp_buffer_.buffer, 0, tmp_buffer_.size},
+         {weights_buffer_.device.buffer, 0, weights_buffer_.device.size}});
+
+    for (Level& level : levels_) {
+      const VkDescriptorBufferInfo kp_loc = {
+          kp_loc_buffer_.buffer, level.kp_loc_offset,
+          sizeof(int) * (1 + 2 * VkDeviceSize(level.max_keypoints))};
+      const VkDescriptorBufferInfo kp_out = {
+          kp_out_buffer_.device.buffer, level.kp_out_offset,
+          sizeof(int) * (1 + 3 * VkDeviceSize(level.max_keypoints))};
+      const VkDescriptorBufferInfo dispatch_args = {
+          dispatch_args_buffer_.buffer, level.dispatch_args_offset,
+          sizeof(VkDispatchIndirectCommand)};
+
+      level.find_descriptor_set =
+          find_kernel_->allocateDescriptorSet(descriptor_pool_);
+      level.prepare_descriptor_set =
+          prepare_kernel_->allocateDescriptorSet(descriptor_pool_);
+      level.nms_descriptor_set =
+          nms_kernel_->allocateDescriptorSet(descriptor_pool_);
+      // FAST_findKeypoints(_img, kp_loc, ...)
+      context_.writeDescriptorSet(level.find_descriptor_set,
+                                  {pyramid, kp_loc});
+      // FAST_prepareDispatch(kp_loc, dispatch_args, ...)
+      context_.writeDescriptorSet(level.prepare_descriptor_set,
+                                  {kp_loc, dispatch_args});
+      // FAST_nonmaxSupression(kp_in, kp_out, _img, ...)
+      context_.writeDescriptorSet(level.nms_descriptor_set,
+                                  {kp_loc, kp_out, pyramid});
+    }
+  }
 
-    /*
-    First, we find the memory requirements for the buffer.
-    */
-    VkMemoryRequirements memoryRequirements;
-    vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
+  void createCommandBuffer() {
+    command_buffer_ = context_.allocateCommandBuffer();
+    beginCommandBuffer(command_buffer_, 0);  // フレームごとに投入する
+
+    // 段 0 と重みをアップロードし、段ごとの2つのカウンタを 0 にする
+    context_.recordUpload(command_buffer_, pyramid_buffer_,
+                          VkDeviceSize(levels_[0].width) * levels_[0].height);
+    context_.recordUpload(command_buffer_, weights_buffer_,
+                          weights_buffer_.device.size);
+    for (const Level& level : levels_) {
+      vkCmdFillBuffer(command_buffer_, kp_loc_buffer_.buffer,
+                      level.kp_loc_offset, sizeof(int), 0);
+      vkCmdFillBuffer(command_buffer_, kp_out_buffer_.device.buffer,
+                      level.kp_out_offset, sizeof(int), 0);
+    }
+    recordTransferToComputeBarrier(command_buffer_);
 
-    /*
-    Now use obtained memory requirements info to allocate the memory for the
-    buffer.
-    */
-    VkMemoryAllocateInfo allocateInfo = {};
-    allocateInfo.sType                = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocateInfo.allocationSize =
-        memoryRequirements.size;  // specify required memory.
-    /*
-    There are several types of memory that can be allocated, and we must choose
-    a memory type that:
-
-    1) Satisfies the memory requirements(memoryRequirements.memoryTypeBits).
-    2) Satifies our own usage requirements. We want to be able to read the
-    buffer memory from the GPU to the CPU with vkMapMemory, so we set
-    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT. Also, by setting
-    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, memory written by the device(GPU) will
-    be easily visible to the host(CPU), without having to call any extra
-    flushing commands. So mainly for convenience, we set this flag.
-    */
-    allocateInfo.memoryTypeIndex =
-        findMemoryType(memoryRequirements.memoryTypeBits,
-                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
-                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    if (query_pool_ != VK_NULL_HANDLE) {
+      vkCmdResetQueryPool(command_buffer_, query_pool_, 0, 3);
+    }
+    writeTimestamp(command_buffer_, query_pool_, 0,
+                   VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+
+    // 1. ピラミッド (段 l - 1 から段 l を作る)
+    for (size_t l = 1; l < levels_.size(); ++l) {
+      const Level& src = levels_[l - 1];
+      const Level& dst = levels_[l];
+      PyramidPushConstant push_constant;
+      push_constant.src_offset = int(src.img_offset);
+      push_constant.src_w      = src.width;
+      push_constant.src_h      = src.height;
+      push_constant.dst_offset = int(dst.img_offset);
+      push_constant.dst_w      = dst.width;
+      push_constant.dst_h      = dst.height;
+      const uint32_t group_count_x =
+          (dst.width + FIND_WORKGROUP_SIZE - 1) / FIND_WORKGROUP_SIZE;
+
+      // 前の段 (と tmp) の書き込みが終わってから読む
+      recordComputeBarrier(command_buffer_);
+      pyramid_kernel_->dispatch(
+          command_buffer_, horizontal_pipeline_, pyramid_descriptor_set_,
+          &push_constant, group_count_x,
+          (src.height + FIND_WORKGROUP_SIZE - 1) / FIND_WORKGROUP_SIZE);
+      recordComputeBarrier(command_buffer_);
+      pyramid_kernel_->dispatch(
+          command_buffer_, vertical_pipeline_, pyramid_descriptor_set_,
+          &push_constant, group_count_x,
+          (dst.height + FIND_WORKGROUP_SIZE - 1) / FIND_WORKGROUP_SIZE);
+    }
+    writeTimestamp(command_buffer_, query_pool_, 1);
+
+    // 2. 段ごとの検出 (FastDetector の間接ディスパッチと同じ)
+    // 段どうしは依存しないので、同じパスを全ての段で続けて記録し、
+    // パスの間にだけバリアを入れる
+    recordComputeBarrier(command_buffer_);
+    for (const Level& level : levels_) {
+      FindPushConstant find_push_constant;
+      find_push_constant.step          = level.width;
+      find_push_constant.img_offset    = int(level.img_offset);
+      find_push_constant.img_rows      = level.height;
+      find_push_constant.img_cols      = level.width;
+      find_push_constant.max_keypoints = level.max_keypoints;
+      find_push_constant.threshold     = options_.threshold;
+      find_kernel_->dispatch(
+          command_buffer_, find_pipeline_, level.find_descriptor_set,
+          &find_push_constant,
+          (level.width - 2 * FAST_BORDER + FIND_WORKGROUP_SIZE - 1) /
+              FIND_WORKGROUP_SIZE,
+          (level.height - 2 * FAST_BORDER + FIND_WORKGROUP_SIZE - 1) /
+              FIND_WORKGROUP_SIZE);
+    }
+    recordComputeBarrier(command_buffer_);
+    for (const Level& level : levels_) {
+      PreparePushConstant prepare_push_constant;
+      prepare_push_constant.max_keypoints  = level.max_keypoints;
+      prepare_push_constant.workgroup_size = NMS_WORKGROUP_SIZE;
+      prepare_kernel_->dispatch(command_buffer_, prepare_pipeline_,
+                                level.prepare_descriptor_set,
+                                &prepare_push_constant, 1, 1);
+    }
+    recordComputeBarrier(command_buffer_, /*indirect_command_read=*/true);
+    for (const Level& level : levels_) {
+      NmsPushConstant nms_push_constant;
+      nms_push_constant.step          = level.width;
+      nms_push_constant.img_offset    = int(level.img_offset);
+      nms_push_constant.rows          = level.height;
+      nms_push_constant.cols          = level.width;
+      nms_push_constant.counter       = level.max_keypoints;
+      nms_push_constant.max_keypoints = level.max_keypoints;
+      nms_kernel_->dispatchIndirect(
+          command_buffer_, nms_pipeline_, level.nms_descriptor_set,
+          &nms_push_constant, dispatch_args_buffer_.buffer,
+          level.dispatch_args_offset);
+    }
+    writeTimestamp(command_buffer_, query_pool_, 2);
 
+    context_.recordDownload(command_buffer_, kp_out_buffer_,
+                            kp_out_buffer_.device.size);
     VK_CHECK_RESULT(
-        vkAllocateMemory(device, &allocateInfo, NULL,
-                         &bufferMemory));  // allocate memory on device.
-
-    // Now associate that allocated memory with the buffer. With that, the
-    // buffer is backed by actual memory.
-    VK_CHECK_RESULT(vkBindBufferMemory(device, buffer, bufferMemory, 0));
+        vkEndCommandBuffer(command_buffer_));  // end recording commands.
   }
 
-  void createDescriptorSetLayout() {
-    /*
-    Here we specify a descriptor set layout. This allows us to bind our
-    descriptors to resources in the shader.
-
-    */
-
-    /*
-    Here we specify a binding of type VK_DESCRIPTOR_TYPE_STORAGE_BUFFER to the
-    binding point 0. This binds to
-
-      layout(std140, binding = 0) buffer buf
-
-    in the compute shader.
-    */
-    VkDescriptorSetLayoutBinding descriptorSetLayoutBinding = {};
-    descriptorSetLayoutBinding.binding                      = 0;  // binding = 0
-    descriptorSetLayoutBinding.descriptorType =
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    descriptorSetLayoutBinding.descriptorCount = 1;
-    descriptorSetLayoutBinding.stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
-
-    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {};
-    descriptorSetLayoutCreateInfo.sType =
-        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    descriptorSetLayoutCreateInfo.bindingCount =
-        1;  // only a single binding in this descriptor set layout.
-    descriptorSetLayoutCreateInfo.pBindings = &descriptorSetLayoutBinding;
-
-    // Create the descriptor set layout.
-    VK_CHECK_RESULT(vkCreateDescriptorSetLayout(
-        device, &descriptorSetLayoutCreateInfo, NULL, &descriptorSetLayout));
-  }
-
-  void createDescriptorSet() {
-    /*
-    So we will allocate a descriptor set here.
-    But we need to first create a descriptor pool to do that.
-    */
+  void accumulatePassTimes(void) {
+    ++num_detections_;
+    if (query_pool_ == VK_NULL_HANDLE) {
+      return;
+    }
+    uint64_t timestamps[3];
+    VK_CHECK_RESULT(vkGetQueryPoolResults(
+        context_.device(), query_pool_, 0, 3, sizeof(timestamps), timestamps,
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+    for (size_t i = 0; i < 2; ++i) {
+      pass_times_ms_[i] += double(timestamps[i + 1] - timestamps[i]) *
+                           timestamp_period_ * 1e-6;
+    }
+  }
+};
 
-    /*
-    Our descriptor pool can only allocate a single storage buffer.
-    */
-    VkDescriptorPoolSize descriptorPoolSize = {};
-    descriptorPoolSize.type                 = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    descriptorPoolSize.descriptorCount      = 1;
-
-    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
-    descriptorPoolCreateInfo.sType =
-        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    descriptorPoolCreateInfo.maxSets =
-        1;  // we only need to allocate one descriptor set from the pool.
-    descriptorPoolCreateInfo.poolSizeCount = 1;
-    descriptorPoolCreateInfo.pPoolSizes    = &descriptorPoolSize;
-
-    // create descriptor pool.
-    VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolCreateInfo,
-                                           NULL, &descriptorPool));
+// キーポイントを (y, x) の順に並べる (GPU の出力の順序は実行ごとに異なる)
+void sortKeypoints(std::vector<Keypoint>* keypoints) {
+  std::sort(keypoints->begin(), keypoints->end(),
+            [](const Keypoint& a, const Keypoint& b) {
+              return a.y != b.y ? a.y < b.y : a.x < b.x;
+            });
+}
 
-    /*
-    With the pool allocated, we can now allocate the descriptor set.
-    */
-    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
-    descriptorSetAllocateInfo.sType =
-        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    descriptorSetAllocateInfo.descriptorPool =
-        descriptorPool;  // pool to allocate from.
-    descriptorSetAllocateInfo.descriptorSetCount =
-        1;  // allocate a single descriptor set.
-    descriptorSetAllocateInfo.pSetLayouts = &descriptorSetLayout;
-
-    // allocate descriptor set.
-    VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo,
-                                             &descriptorSet));
+// 順序を除いて a と b が一致するか (x, y, score の集合として比較する)
+bool sameKeypoints(std::vector<Keypoint> a, std::vector<Keypoint> b) {
+  sortKeypoints(&a);
+  sortKeypoints(&b);
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(),
+                    [](const Keypoint& lhs, const Keypoint& rhs) {
+                      return lhs.x == rhs.x && lhs.y == rhs.y &&
+                             lhs.score == rhs.score;
+                    });
+}
 
-    /*
-    Next, we need to connect our actual storage buffer with the descrptor.
-    We use vkUpdateDescriptorSets() to update the descriptor set.
-    */
+// 順序も含めて a と b が一致するか
+bool equalKeypoints(const std::vector<Keypoint>& a,
+                    const std::vector<Keypoint>& b) {
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(),
+                    [](const Keypoint& lhs, const Keypoint& rhs) {
+                      return lhs.x == rhs.x && lhs.y == rhs.y &&
+                             lhs.score == rhs.score;
+                    });
+}
 
-    // Specify the buffer to bind to the descriptor.
-    VkDescriptorBufferInfo descriptorBufferInfo = {};
-    descriptorBufferInfo.buffer                 = buffer;
-    descriptorBufferInfo.offset                 = 0;
-    descriptorBufferInfo.range                  = bufferSize;
+// fast_grid_topk.cl と同じ選択をホストで行う (比較用)
+// セルの順に、セルの中は (score の降順, セル内の位置の昇順) で per_cell 個
+std::vector<Keypoint> gridTopKReference(const std::vector<Keypoint>& keypoints,
+                                        const uint32_t width,
+                                        const uint32_t height,
+                                        const int cell_size,
+                                        const int per_cell) {
+  const uint32_t grid_cols = (width + cell_size - 1) / cell_size;
+  const uint32_t grid_rows = (height + cell_size - 1) / cell_size;
+  std::vector<std::vector<Keypoint>> cells(size_t(grid_cols) * grid_rows);
+  for (const Keypoint& keypoint : keypoints) {
+    cells[(keypoint.y / cell_size) * grid_cols + keypoint.x / cell_size]
+        .push_back(keypoint);
+  }
 
-    VkWriteDescriptorSet writeDescriptorSet = {};
-    writeDescriptorSet.sType  = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writeDescriptorSet.dstSet = descriptorSet;  // write to this descriptor set.
-    writeDescriptorSet.dstBinding = 0;  // write to the first, and only binding.
-    writeDescriptorSet.descriptorCount = 1;  // update a single descriptor.
-    writeDescriptorSet.descriptorType =
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;  // storage buffer.
-    writeDescriptorSet.pBufferInfo = &descriptorBufferInfo;
+  std::vector<Keypoint> selected;
+  for (auto& cell : cells) {
+    auto pos = [cell_size](const Keypoint& k) {
+      return (k.y % cell_size) * cell_size + k.x % cell_size;
+    };
+    std::sort(cell.begin(), cell.end(),
+              [&pos](const Keypoint& a, const Keypoint& b) {
+                return a.score != b.score ? a.score > b.score
+                                          : pos(a) < pos(b);
+              });
+    const size_t n = std::min(cell.size(), size_t(per_cell));
+    selected.insert(selected.end(), cell.begin(), cell.begin() + n);
+  }
+  return selected;
+}
 
-    // perform the update of the descriptor set.
-    vkUpdateDescriptorSets(device, 1, &writeDescriptorSet, 0, NULL);
+// キーポイントを (y, x) の順に並べて "x y score" の行で保存する
+bool saveKeypoints(const std::string& filepath,
+                   std::vector<Keypoint> keypoints) {
+  sortKeypoints(&keypoints);
+  std::ofstream ofs(filepath);
+  if (!ofs) {
+    printf("Failed to open [%s].\n", filepath.c_str());
+    return false;
   }
+  for (const Keypoint& keypoint : keypoints) {
+    ofs << keypoint.x << " " << keypoint.y << " " << keypoint.score << "\n";
+  }
+  return true;
+}
 
-  // Read file into array of bytes, and cast to uint32_t*, then return.
-  // The data has been padded, so that it fits into an array uint32_t.
-  uint32_t* readFile(uint32_t& length, const char* filename) {
-    FILE* fp = fopen(filename, "rb");
-    if (fp == NULL) {
-      printf("Could not find or open file: %s\n", filename);
+// ベンチマーク用の画像 (灰色の背景にランダムな輝度の矩形を重ねたもの)
+// 矩形の角がコーナーになる
+std::vector<unsigned char> makeSyntheticImage(const uint32_t width,
+                                              const uint32_t height) {
+  std::vector<unsigned char> image(size_t(width) * height, 128);
+  std::mt19937 engine(0);
+  const size_t num_rects = size_t(width) * height / 4000;
+  for (size_t i = 0; i < num_rects; ++i) {
+    const uint32_t w  = 8 + engine() % 64;
+    const uint32_t h  = 8 + engine() % 64;
+    const uint32_t x0 = engine() % width;
+    const uint32_t y0 = engine() % height;
+    const unsigned char v = static_cast<unsigned char>(engine());
+    for (uint32_t y = y0; y < std::min(y0 + h, height); ++y) {
+      memset(image.data() + size_t(y) * width + x0, v,
+             std::min(w, width - x0));
     }
+  }
+  return image;
+}
 
-    // get file size.
-    fseek(fp, 0, SEEK_END);
-    long filesize = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+// makeSyntheticImage に ±16 のノイズを加えたもの
+// (矩形の角の他に、閾値が小さいときにノイズからもコーナーが検出される)
+std::vector<unsigned char> makeNoisySyntheticImage(const uint32_t width,
+                                                   const uint32_t height) {
+  std::vector<unsigned char> image = makeSyntheticImage(width, height);
+  std::mt19937 engine(1);
+  for (auto& v : image) {
+    const int noise = int(engine() % 33) - 16;
+    v = static_cast<unsigned char>(std::min(255, std::max(0, v + noise)));
+  }
+  return image;
+}
 
-    long filesizepadded = long(ceil(filesize / 4.0)) * 4;
+// ベンチマーク用のコーナーの多い画像 (一様乱数のノイズ)
+std::vector<unsigned char> makeNoiseImage(const uint32_t width,
+                                          const uint32_t height) {
+  std::vector<unsigned char> image(size_t(width) * height);
+  std::mt19937 engine(0);
+  for (auto& v : image) {
+    v = static_cast<unsigned char>(engine());
+  }
+  return image;
+}
 
-    // read file contents.
-    char* str = new char[filesizepadded];
-    fread(str, filesize, sizeof(char), fp);
-    fclose(fp);
+// input_filepath の画像からキーポイントを検出し、output_filepath に保存する
+int runDetection(const std::string& input_filepath,
+                 const std::string& output_filepath,
+                 const FastOptions& options) {
+  std::vector<unsigned char> rgba;
+  unsigned width, height;
+  const unsigned error = lodepng::decode(rgba, width, height, input_filepath);
+  if (error) {
+    printf("decoder error %u: %s\n", error, lodepng_error_text(error));
+    return EXIT_FAILURE;
+  }
 
-    // data padding.
-    for (int i = filesize; i < filesizepadded; i++) {
-      str[i] = 0;
+  if (options.cpu) {
+    // Vulkan のデバイスがなくても検出できるように、CPU 版では Context を
+    // 作らない
+    std::vector<unsigned char> gray(size_t(width) * height);
+    clspv_test::convertToGrayscale(rgba.data(), 4, gray.size(), gray.data());
+    clspv_test::ThreadPool pool(numCpuThreads(options));
+    std::vector<Keypoint> keypoints;
+    std::vector<double> detect_ms;
+    for (int i = 0; i < options.repeat; ++i) {
+      const auto begin = std::chrono::steady_clock::now();
+      clspv_test::detectFastCpu(gray.data(), width, height, options.threshold,
+                                pool, &keypoints);
+      detect_ms.emplace_back(clspv_test::elapsedMs(begin));
+    }
+    clspv_test::printLatencyHistogram("cpu", detect_ms);
+
+    printf("----- FAST (cpu, %s, %zu threads, %ux%u, threshold %d) -----\n",
+           clspv_test::fastCpuIsaName(), pool.numThreads(), width, height,
+           options.threshold);
+    printf("     - keypoints  : %zu\n", keypoints.size());
+    if (!saveKeypoints(output_filepath, keypoints)) {
+      return EXIT_FAILURE;
     }
+    printf("Save keypoints (x y score) as [%s].\n", output_filepath.c_str());
+    return EXIT_SUCCESS;
+  }
 
-    length = filesizepadded;
-    return (uint32_t*)str;
+  try {
+    clspv_test::Context context(/*require_int8=*/true, options.pipeline_cache);
+    FastDetector detector(context, width, height, options);
+    clspv_test::convertToGrayscale(rgba.data(), 4, size_t(width) * height,
+                                   detector.imageData());
+
+    std::vector<Keypoint> keypoints;
+    int num_candidates = 0;
+    std::vector<double> dispatch_ms;
+    for (int i = 0; i < options.repeat; ++i) {
+      const auto begin = std::chrono::steady_clock::now();
+      detector.detect(&keypoints, &num_candidates);
+      dispatch_ms.emplace_back(clspv_test::elapsedMs(begin));
+    }
+    clspv_test::printLatency(context.takeCreationTimeMs(), detector.kernelMs(),
+                             dispatch_ms, detector.pipelineCacheState());
+    detector.printPassTimes();
+
+    printf("----- FAST (%s, %ux%u, threshold %d) -----\n",
+           detector.modeName(), width, height, options.threshold);
+    if (!options.score_map) {
+      printf("     - candidates : %d%s\n", num_candidates,
+             num_candidates > options.max_keypoints ? " (overflowed)" : "");
+    }
+    printf("     - keypoints  : %zu\n", keypoints.size());
+    if (!saveKeypoints(output_filepath, keypoints)) {
+      return EXIT_FAILURE;
+    }
+    printf("Save keypoints (x y score) as [%s].\n", output_filepath.c_str());
+  } catch (const std::runtime_error& e) {
+    printf("%s\n", e.what());
+    return EXIT_FAILURE;
   }
+  return EXIT_SUCCESS;
+}
 
-  void createComputePipeline() {
-    /*
-    We create a compute pipeline here.
-    */
+// 720p から 4K の合成画像で、1フレーム (アップロード + 検出 + 読み戻し) の
+// スループットを計測する
+int runBenchmark(const FastOptions& options) {
+  const uint32_t sizes[][2] = {
+      {1280, 720}, {1920, 1080}, {2560, 1440}, {3840, 2160}};
 
-    /*
-    Create a shader module. A shader module basically just encapsulates some
-    shader code.
-    */
-    uint32_t filelength;
-    // the code in mandelbrot.spv was created by running the command:
-    // glslangValidator.exe -V shader.comp
-    uint32_t* code = readFile(filelength, "spirv/c/mandelbrot.spv");
-    VkShaderModuleCreateInfo createInfo = {};
-    createInfo.sType    = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.pCode    = code;
-    createInfo.codeSize = filelength;
+  try {
+    clspv_test::Context context(/*require_int8=*/true, options.pipeline_cache);
+    printf("----- FAST throughput (%s, threshold %d, %d frames) -----\n",
+           fastModeName(options), options.threshold, options.repeat);
+    for (const auto& size : sizes) {
+      const uint32_t width = size[0], height = size[1];
+      const std::vector<unsigned char> image =
+          makeSyntheticImage(width, height);
+      FastDetector detector(context, width, height, options);
+
+      // 初回 (パイプラインの作成直後) は計測しない
+      std::vector<Keypoint> keypoints;
+      memcpy(detector.imageData(), image.data(), image.size());
+      detector.detect(&keypoints);
+
+      const auto begin = std::chrono::steady_clock::now();
+      for (int i = 0; i < options.repeat; ++i) {
+        memcpy(detector.imageData(), image.data(), image.size());
+        detector.detect(&keypoints);
+      }
+      const double ms = clspv_test::elapsedMs(begin) / options.repeat;
+      printf("     - %4ux%4u : %8.3f ms/frame (%7.1f fps), %zu keypoints\n",
+             width, height, ms, 1e3 / ms, keypoints.size());
+    }
+  } catch (const std::runtime_error& e) {
+    printf("%s\n", e.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
 
-    VK_CHECK_RESULT(
-        vkCreateShaderModule(device, &createInfo, NULL, &computeShaderModule));
-    delete[] code;
+// 候補の数を読み戻す (roundtrip) 場合と読み戻さない (indirect) 場合の
+// 1フレームの検出のレイテンシ (アップロードを除く) を 720p から 4K の合成画像で
+// 比較する
+int runLatencyComparison(const FastOptions& options) {
+  const uint32_t sizes[][2] = {
+      {1280, 720}, {1920, 1080}, {2560, 1440}, {3840, 2160}};
+  const auto median = [](std::vector<double> samples_ms) {
+    std::sort(samples_ms.begin(), samples_ms.end());
+    return samples_ms[samples_ms.size() / 2];
+  };
 
-    /*
-    Now let us actually create the compute pipeline.
-    A compute pipeline is very simple compared to a graphics pipeline.
-    It only consists of a single stage with a compute shader.
+  try {
+    clspv_test::Context context(/*require_int8=*/true, options.pipeline_cache);
+    for (const auto& size : sizes) {
+      const uint32_t width = size[0], height = size[1];
+      const std::vector<unsigned char> image =
+          makeSyntheticImage(width, height);
+
+      printf("----- Per-frame latency (%ux%u, threshold %d, %d frames) -----\n",
+             width, height, options.threshold, options.repeat);
+      std::vector<double> samples_ms[2];
+      size_t num_keypoints[2];
+      for (int roundtrip = 0; roundtrip < 2; ++roundtrip) {
+        FastOptions mode_options = options;
+        mode_options.roundtrip   = roundtrip;
+        FastDetector detector(context, width, height, mode_options);
+        memcpy(detector.imageData(), image.data(), image.size());
+
+        // 初回 (パイプラインの作成直後) は計測しない
+        std::vector<Keypoint> keypoints;
+        detector.detect(&keypoints);
+        for (int i = 0; i < options.repeat; ++i) {
+          const auto begin = std::chrono::steady_clock::now();
+          detector.detect(&keypoints);
+          samples_ms[roundtrip].emplace_back(clspv_test::elapsedMs(begin));
+        }
+        num_keypoints[roundtrip] = keypoints.size();
+        clspv_test::printLatencyHistogram(
+            roundtrip ? "roundtrip" : "indirect ", samples_ms[roundtrip]);
+      }
+      const double indirect_ms  = median(samples_ms[0]);
+      const double roundtrip_ms = median(samples_ms[1]);
+      printf("     - round-trip cost (p50) : %+.3f ms (%.2fx)\n",
+             roundtrip_ms - indirect_ms, roundtrip_ms / indirect_ms);
+      if (num_keypoints[0] != num_keypoints[1]) {
+        printf("     - keypoints differ : %zu (indirect) vs %zu (roundtrip)\n",
+               num_keypoints[0], num_keypoints[1]);
+      }
+    }
+  } catch (const std::runtime_error& e) {
+    printf("%s\n", e.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
 
-    So first we specify the compute shader stage, and it's entry point(main).
-    */
-    VkPipelineShaderStageCreateInfo shaderStageCreateInfo = {};
-    shaderStageCreateInfo.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    shaderStageCreateInfo.stage  = VK_SHADER_STAGE_COMPUTE_BIT;
-    shaderStageCreateInfo.module = computeShaderModule;
-    shaderStageCreateInfo.pName  = "main";
+// 1画素ごとの atomic_inc (FAST_findKeypoints, FAST_nonmaxSupression) と
+// ワークグループごとの atomic_add (*_aggregated) を、コーナーの多いノイズ画像
+// で比較する。候補が溢れないように max_keypoints は画素数の 1/4 にする。
+int runAtomicsComparison(const FastOptions& options) {
+  const uint32_t sizes[][2] = {
+      {1280, 720}, {1920, 1080}, {2560, 1440}, {3840, 2160}};
+  const char* const mode_names[2] = {"per-pixel ", "aggregated"};
 
-    /*
-    The pipeline layout allows the pipeline to access descriptor sets.
-    So we just specify the descriptor set layout we created earlier.
-    */
-    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
-    pipelineLayoutCreateInfo.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutCreateInfo.setLayoutCount = 1;
-    pipelineLayoutCreateInfo.pSetLayouts    = &descriptorSetLayout;
-    VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo,
-                                           NULL, &pipelineLayout));
-
-    VkComputePipelineCreateInfo pipelineCreateInfo = {};
-    pipelineCreateInfo.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-    pipelineCreateInfo.stage  = shaderStageCreateInfo;
-    pipelineCreateInfo.layout = pipelineLayout;
+  try {
+    clspv_test::Context context(/*require_int8=*/true, options.pipeline_cache);
+    printf("----- FAST atomics (noise, threshold %d, %d frames) -----\n",
+           options.threshold, options.repeat);
+    for (const auto& size : sizes) {
+      const uint32_t width = size[0], height = size[1];
+      const std::vector<unsigned char> image = makeNoiseImage(width, height);
+
+      FastOptions mode_options   = options;
+      mode_options.max_keypoints = int(size_t(width) * height / 4);
+      std::vector<Keypoint> keypoints[2];
+      double detect_ms[2];
+      for (int aggregated = 0; aggregated < 2; ++aggregated) {
+        mode_options.aggregated = aggregated;
+        FastDetector detector(context, width, height, mode_options);
+        memcpy(detector.imageData(), image.data(), image.size());
+
+        // 初回 (パイプラインの作成直後) は計測しない
+        int num_candidates = 0;
+        detector.detect(&keypoints[aggregated], &num_candidates);
+        detector.resetPassTimes();
+        const auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < options.repeat; ++i) {
+          detector.detect(&keypoints[aggregated]);
+        }
+        const double frame_ms = clspv_test::elapsedMs(begin) / options.repeat;
+        detect_ms[aggregated] = detector.passTimeMs(0);
+        printf(
+            "     - %4ux%4u %s : detect %8.3f ms, nms %8.3f ms, frame %8.3f "
+            "ms, %d candidates%s, %zu keypoints\n",
+            width, height, mode_names[aggregated], detector.passTimeMs(0),
+            detector.passTimeMs(2), frame_ms, num_candidates,
+            num_candidates > mode_options.max_keypoints ? " (overflowed)" : "",
+            keypoints[aggregated].size());
+      }
 
-    /*
-    Now, we finally create the compute pipeline.
-    */
-    VK_CHECK_RESULT(vkCreateComputePipelines(
-        device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, NULL, &pipeline));
+      const bool match = sameKeypoints(keypoints[0], keypoints[1]);
+      if (detect_ms[1] > 0.0) {
+        printf("       detect speedup x%.2f, ", detect_ms[0] / detect_ms[1]);
+      } else {
+        printf("       ");
+      }
+      printf("keypoints %s\n", match ? "match" : "DIFFER");
+    }
+  } catch (const std::runtime_error& e) {
+    printf("%s\n", e.what());
+    return EXIT_FAILURE;
   }
+  return EXIT_SUCCESS;
+}
 
-  void createCommandBuffer() {
-    /*
-    We are getting closer to the end. In order to send commands to the
-    device(GPU), we must first record commands into a command buffer. To
-    allocate a command buffer, we must first create a command pool. So let us do
-    that.
-    */
-    VkCommandPoolCreateInfo commandPoolCreateInfo = {};
-    commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    commandPoolCreateInfo.flags = 0;
-    // the queue family of this command pool. All command buffers allocated from
-    // this command pool, must be submitted to queues of this family ONLY.
-    commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
-    VK_CHECK_RESULT(vkCreateCommandPool(device, &commandPoolCreateInfo, NULL,
-                                        &commandPool));
+// 候補のリストを使う場合 (FAST_findKeypoints + FAST_nonmaxSupression) と
+// スコアマップを使う場合 (score_map) を、しきい値を変えながら比較する
+// 画像は合成画像 (矩形) にノイズを加えたもので、しきい値が低いほどコーナーが
+// 多くなる。候補が溢れないように max_keypoints は画素数の 1/4 にする。
+int runThresholdComparison(const FastOptions& options) {
+  const uint32_t sizes[][2] = {{1920, 1080}, {3840, 2160}};
+  const int thresholds[]    = {5, 10, 20, 40, 80};
+  const char* const mode_names[2] = {"list     ", "score-map"};
 
-    /*
-    Now allocate a command buffer from the command pool.
-    */
-    VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
-    commandBufferAllocateInfo.sType =
-        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    commandBufferAllocateInfo.commandPool =
-        commandPool;  // specify the command pool to allocate from.
-    // if the command buffer is primary, it can be directly submitted to queues.
-    // A secondary buffer has to be called from some primary command buffer, and
-    // cannot be directly submitted to a queue. To keep things simple, we use a
-    // primary command buffer.
-    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    commandBufferAllocateInfo.commandBufferCount =
-        1;  // allocate a single command buffer.
-    VK_CHECK_RESULT(
-        vkAllocateCommandBuffers(device, &commandBufferAllocateInfo,
-                                 &commandBuffer));  // allocate command buffer.
-
-    /*
-    Now we shall start recording commands into the newly allocated command
-    buffer.
-    */
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags =
-        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;  // the buffer is only
-                                                      // submitted and used once
-                                                      // in this application.
-    VK_CHECK_RESULT(vkBeginCommandBuffer(
-        commandBuffer, &beginInfo));  // start recording commands.
+  try {
+    clspv_test::Context context(/*require_int8=*/true, options.pipeline_cache);
+    printf("----- FAST list vs score map (%d frames) -----\n", options.repeat);
+    for (const auto& size : sizes) {
+      const uint32_t width = size[0], height = size[1];
+      const std::vector<unsigned char> image =
+          makeNoisySyntheticImage(width, height);
+
+      for (const int threshold : thresholds) {
+        FastOptions mode_options   = options;
+        mode_options.threshold     = threshold;
+        mode_options.max_keypoints = int(size_t(width) * height / 4);
+        std::vector<Keypoint> keypoints[2];
+        double gpu_ms[2];
+        for (int score_map = 0; score_map < 2; ++score_map) {
+          mode_options.score_map = score_map;
+          FastDetector detector(context, width, height, mode_options);
+          memcpy(detector.imageData(), image.data(), image.size());
+
+          // 初回 (パイプラインの作成直後) は計測しない
+          detector.detect(&keypoints[score_map]);
+          detector.resetPassTimes();
+          const auto begin = std::chrono::steady_clock::now();
+          for (int i = 0; i < options.repeat; ++i) {
+            detector.detect(&keypoints[score_map]);
+          }
+          const double frame_ms =
+              clspv_test::elapsedMs(begin) / options.repeat;
+          gpu_ms[score_map] = detector.passTimeMs(0) +
+                              detector.passTimeMs(1) + detector.passTimeMs(2);
+          printf(
+              "     - %4ux%4u t=%2d %s : gpu %8.3f ms, frame %8.3f ms, "
+              "%zu keypoints\n",
+              width, height, threshold, mode_names[score_map],
+              gpu_ms[score_map], frame_ms, keypoints[score_map].size());
+        }
 
-    /*
-    We need to bind a pipeline, AND a descriptor set before we dispatch.
+        const bool match = sameKeypoints(keypoints[0], keypoints[1]);
+        if (gpu_ms[1] > 0.0) {
+          printf("       gpu speedup x%.2f, ", gpu_ms[0] / gpu_ms[1]);
+        } else {
+          printf("       ");
+        }
+        printf("keypoints %s\n", match ? "match" : "DIFFER");
+      }
+    }
+  } catch (const std::runtime_error& e) {
+    printf("%s\n", e.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
 
-    The validation layer will NOT give warnings if you forget these, so be very
-    careful not to forget them.
-    */
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-                            pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+// 格子ごとの上位 K 個の選択 (grid_cell) をデバイスで行う場合を、
+// 全キーポイントを読み戻してホストで選ぶ場合と比較する
+// 毎フレームの結果が1フレーム目と順序まで一致すること (決定的であること) と、
+// ホストでの選択と一致することを確かめる。
+int runGridComparison(const FastOptions& options) {
+  const uint32_t sizes[][2] = {{1920, 1080}, {3840, 2160}};
 
-    /*
-    Calling vkCmdDispatch basically starts the compute pipeline, and executes
-    the compute shader. The number of workgroups is specified in the arguments.
-    If you are already familiar with compute shaders from OpenGL, this should be
-    nothing new to you.
-    */
-    vkCmdDispatch(commandBuffer, (uint32_t)ceil(WIDTH / float(WORKGROUP_SIZE)),
-                  (uint32_t)ceil(HEIGHT / float(WORKGROUP_SIZE)), 1);
+  try {
+    clspv_test::Context context(/*require_int8=*/true, options.pipeline_cache);
+    FastOptions grid_options = options;
+    if (grid_options.grid_cell <= 0) {
+      grid_options.grid_cell = 32;
+    }
+    FastOptions list_options = options;
+    list_options.grid_cell   = 0;
+    printf("----- FAST grid top-%d (cell %d, %s, %d frames) -----\n",
+           grid_options.per_cell, grid_options.grid_cell,
+           fastModeName(options), options.repeat);
+    for (const auto& size : sizes) {
+      const uint32_t width = size[0], height = size[1];
+      const std::vector<unsigned char> image =
+          makeNoisySyntheticImage(width, height);
+      // 溢れると残るキーポイントが決定的でなくなるので、十分に大きくする
+      list_options.max_keypoints = int(size_t(width) * height / 4);
+      grid_options.max_keypoints = list_options.max_keypoints;
+
+      // 全キーポイントを読み戻してホストで選ぶ
+      std::vector<Keypoint> keypoints;
+      double list_frame_ms;
+      {
+        FastDetector detector(context, width, height, list_options);
+        memcpy(detector.imageData(), image.data(), image.size());
+        detector.detect(&keypoints);
+        const auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < options.repeat; ++i) {
+          detector.detect(&keypoints);
+          keypoints = gridTopKReference(keypoints, width, height,
+                                        grid_options.grid_cell,
+                                        grid_options.per_cell);
+        }
+        list_frame_ms = clspv_test::elapsedMs(begin) / options.repeat;
+      }
 
-    VK_CHECK_RESULT(
-        vkEndCommandBuffer(commandBuffer));  // end recording commands.
+      // デバイスで選ぶ
+      FastDetector detector(context, width, height, grid_options);
+      memcpy(detector.imageData(), image.data(), image.size());
+      std::vector<Keypoint> first, selected;
+      detector.detect(&first);
+      detector.resetPassTimes();
+      bool deterministic = true;
+      const auto begin   = std::chrono::steady_clock::now();
+      for (int i = 0; i < options.repeat; ++i) {
+        detector.detect(&selected);
+        deterministic = deterministic && equalKeypoints(first, selected);
+      }
+      const double grid_frame_ms =
+          clspv_test::elapsedMs(begin) / options.repeat;
+
+      printf(
+          "     - %4ux%4u : host select frame %8.3f ms, device select frame "
+          "%8.3f ms (topk %8.3f ms), %zu keypoints\n",
+          width, height, list_frame_ms, grid_frame_ms, detector.passTimeMs(3),
+          selected.size());
+      printf("       %s, reference %s\n",
+             deterministic ? "deterministic" : "NOT DETERMINISTIC",
+             equalKeypoints(first, keypoints) ? "match" : "DIFFER");
+    }
+  } catch (const std::runtime_error& e) {
+    printf("%s\n", e.what());
+    return EXIT_FAILURE;
   }
+  return EXIT_SUCCESS;
+}
 
-  void runCommandBuffer() {
-    /*
-    Now we shall finally submit the recorded command buffer to a queue.
-    */
-
-    VkSubmitInfo submitInfo       = {};
-    submitInfo.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;  // submit a single command buffer
-    submitInfo.pCommandBuffers =
-        &commandBuffer;  // the command buffer to submit.
-
-    /*
-      We create a fence.
-    */
-    VkFence fence;
-    VkFenceCreateInfo fenceCreateInfo = {};
-    fenceCreateInfo.sType             = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceCreateInfo.flags             = 0;
-    VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, NULL, &fence));
+// levels 段のピラミッドの作成と全ての段での検出を、720p から 4K の合成画像で
+// 計測する。比較のために段 0 だけで検出する場合 (FastDetector) も計測する。
+int runPyramidBenchmark(const FastOptions& options) {
+  const uint32_t sizes[][2] = {
+      {1280, 720}, {1920, 1080}, {2560, 1440}, {3840, 2160}};
 
-    /*
-    We submit the command buffer on the queue, at the same time giving a fence.
-    */
-    VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
-    /*
-    The command will not have finished executing until the fence is signalled.
-    So we wait here.
-    We will directly after this read our buffer from the GPU,
-    and we will not be sure that the command has finished executing unless we
-    wait for the fence. Hence, we use a fence here.
-    */
-    VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, 100000000000));
+  try {
+    clspv_test::Context context(/*require_int8=*/true, options.pipeline_cache);
+    printf(
+        "----- FAST pyramid (%d levels, scale %.2f, threshold %d, %d frames) "
+        "-----\n",
+        options.levels, options.scale_factor, options.threshold,
+        options.repeat);
+    for (const auto& size : sizes) {
+      const uint32_t width = size[0], height = size[1];
+      const std::vector<unsigned char> image =
+          makeSyntheticImage(width, height);
+
+      // 段 0 だけ
+      double single_ms;
+      {
+        FastDetector detector(context, width, height, options);
+        std::vector<Keypoint> keypoints;
+        memcpy(detector.imageData(), image.data(), image.size());
+        detector.detect(&keypoints);
+        const auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < options.repeat; ++i) {
+          memcpy(detector.imageData(), image.data(), image.size());
+          detector.detect(&keypoints);
+        }
+        single_ms = clspv_test::elapsedMs(begin) / options.repeat;
+      }
 
-    vkDestroyFence(device, fence, NULL);
+      FastPyramidDetector detector(context, width, height, options);
+      std::vector<ScaledKeypoint> keypoints;
+      memcpy(detector.imageData(), image.data(), image.size());
+      // 初回 (パイプラインの作成直後) は計測しない
+      detector.detect(&keypoints);
+      detector.resetPassTimes();
+      const auto begin = std::chrono::steady_clock::now();
+      for (int i = 0; i < options.repeat; ++i) {
+        memcpy(detector.imageData(), image.data(), image.size());
+        detector.detect(&keypoints);
+      }
+      const double frame_ms = clspv_test::elapsedMs(begin) / options.repeat;
+
+      printf(
+          "     - %4ux%4u : pyramid %8.3f ms, detect %8.3f ms, frame %8.3f "
+          "ms (%7.1f fps, level 0 only %8.3f ms), %zu keypoints\n",
+          width, height, detector.passTimeMs(0), detector.passTimeMs(1),
+          frame_ms, 1e3 / frame_ms, single_ms, keypoints.size());
+      std::vector<size_t> per_level(detector.numLevels(), 0);
+      for (const ScaledKeypoint& keypoint : keypoints) {
+        ++per_level[keypoint.level];
+      }
+      printf("       levels :");
+      for (size_t l = 0; l < per_level.size(); ++l) {
+        printf(" %ux%u (%zu)", detector.levelWidth(l), detector.levelHeight(l),
+               per_level[l]);
+      }
+      printf("\n");
+    }
+  } catch (const std::runtime_error& e) {
+    printf("%s\n", e.what());
+    return EXIT_FAILURE;
   }
+  return EXIT_SUCCESS;
+}
 
-  void cleanup() {
-    /*
-    Clean up all Vulkan Resources.
-    */
+// CPU 版 (fast_cpu.h) の 1 コアあたりのスループットを、720p から 4K の
+// ノイズを加えた合成画像で計測する
+// SIMD 版の結果がスカラー版 (カーネルをそのまま移植したもの) と順序まで一致
+// することを確かめ、Vulkan のデバイスがあれば GPU の結果とも比較する。
+int runCpuBenchmark(const FastOptions& options) {
+  const uint32_t sizes[][2] = {
+      {1280, 720}, {1920, 1080}, {2560, 1440}, {3840, 2160}};
+
+  clspv_test::ThreadPool single(1);
+  clspv_test::ThreadPool pool(numCpuThreads(options));
+  // GPU との比較 (デバイスがない場合は CPU だけで計測する)
+  std::unique_ptr<clspv_test::Context> context;
+  try {
+    context.reset(
+        new clspv_test::Context(/*require_int8=*/true, options.pipeline_cache));
+  } catch (const std::runtime_error& e) {
+    printf("GPU comparison is skipped: %s\n", e.what());
+  }
 
-    if (enableValidationLayers) {
-      // destroy callback.
-      auto func = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(
-          instance, "vkDestroyDebugReportCallbackEXT");
-      if (func == nullptr) {
-        throw std::runtime_error(
-            "Could not load vkDestroyDebugReportCallbackEXT");
+  printf("----- FAST cpu (%s, threshold %d, %d frames) -----\n",
+         clspv_test::fastCpuIsaName(), options.threshold, options.repeat);
+  for (const auto& size : sizes) {
+    const uint32_t width = size[0], height = size[1];
+    const std::vector<unsigned char> image =
+        makeNoisySyntheticImage(width, height);
+    const double mpix = double(width) * height * 1e-6;
+
+    std::vector<Keypoint> reference, keypoints;
+    auto begin = std::chrono::steady_clock::now();
+    clspv_test::detectFastCpuScalar(image.data(), width, height,
+                                    options.threshold, &reference);
+    const double scalar_ms = clspv_test::elapsedMs(begin);
+
+    // 1 スレッドと pool の全スレッド
+    double ms[2];
+    clspv_test::ThreadPool* pools[2] = {&single, &pool};
+    for (int i = 0; i < 2; ++i) {
+      clspv_test::detectFastCpu(image.data(), width, height,
+                                options.threshold, *pools[i], &keypoints);
+      begin = std::chrono::steady_clock::now();
+      for (int r = 0; r < options.repeat; ++r) {
+        clspv_test::detectFastCpu(image.data(), width, height,
+                                  options.threshold, *pools[i], &keypoints);
       }
-      func(instance, debugReportCallback, NULL);
+      ms[i] = clspv_test::elapsedMs(begin) / options.repeat;
     }
+    const size_t num_threads = pool.numThreads();
+    printf(
+        "     - %4ux%4u : scalar %7.1f Mpix/s, simd %7.1f Mpix/s/core, "
+        "%zu threads %7.1f Mpix/s (%6.1f Mpix/s/core), %zu keypoints\n",
+        width, height, mpix * 1e3 / scalar_ms, mpix * 1e3 / ms[0],
+        num_threads, mpix * 1e3 / ms[1],
+        mpix * 1e3 / ms[1] / num_threads, keypoints.size());
+    printf("       simd vs scalar %s",
+           equalKeypoints(keypoints, reference) ? "match" : "DIFFER");
+
+    if (context) {
+      // 候補が溢れると GPU の結果が欠けるので、十分に大きくする
+      FastOptions gpu_options   = options;
+      gpu_options.max_keypoints = int(size_t(width) * height / 4);
+      try {
+        FastDetector detector(*context, width, height, gpu_options);
+        memcpy(detector.imageData(), image.data(), image.size());
+        std::vector<Keypoint> gpu_keypoints;
+        detector.detect(&gpu_keypoints);
+        printf(", cpu vs gpu (%s) %s", detector.modeName(),
+               sameKeypoints(keypoints, gpu_keypoints) ? "match" : "DIFFER");
+      } catch (const std::runtime_error& e) {
+        printf(", gpu: %s", e.what());
+      }
+    }
+    printf("\n");
+  }
+  return EXIT_SUCCESS;
+}
 
-    vkFreeMemory(device, bufferMemory, NULL);
-    vkDestroyBuffer(device, buffer, NULL);
-    vkDestroyShaderModule(device, computeShaderModule, NULL);
-    vkDestroyDescriptorPool(device, descriptorPool, NULL);
-    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, NULL);
-    vkDestroyPipelineLayout(device, pipelineLayout, NULL);
-    vkDestroyPipeline(device, pipeline, NULL);
-    vkDestroyCommandPool(device, commandPool, NULL);
-    vkDestroyDevice(device, NULL);
-    vkDestroyInstance(instance, NULL);
+// *_tiled のカーネルがワークグループごとのタイルを読む 32bit の語の数
+// (x, y) = (group * FIND_WORKGROUP_SIZE - origin) がタイルの左上で、
+// タイルは周囲 3 画素を含めて (FIND_WORKGROUP_SIZE + 6) 画素四方
+size_t tiledWordLoads(const uint32_t width, const uint32_t height,
+                      const uint32_t group_count_x,
+                      const uint32_t group_count_y, const int origin) {
+  const int tile_size = int(FIND_WORKGROUP_SIZE) + 6;
+  size_t words        = 0;
+  for (uint32_t gy = 0; gy < group_count_y; ++gy) {
+    for (uint32_t gx = 0; gx < group_count_x; ++gx) {
+      const int x0      = int(gx * FIND_WORKGROUP_SIZE) - origin;
+      const int y0      = int(gy * FIND_WORKGROUP_SIZE) - origin;
+      const int begin_x = std::max(x0, 0);
+      const int end_x   = std::min(x0 + tile_size, int(width));
+      for (int y = std::max(y0, 0); y < std::min(y0 + tile_size, int(height));
+           ++y) {
+        const size_t row = size_t(y) * width;
+        words += (row + end_x - 1) / 4 - (row + begin_x) / 4 + 1;
+      }
+    }
   }
-};
+  return words;
+}
 
-int main() {
-  ComputeApplication app;
+// 円周の画素を 1 byte ずつ __global から読むカーネルと、タイルを 32bit ずつ
+// ローカルメモリに読む *_tiled のカーネルを、720p から 4K のノイズを加えた
+// 合成画像で比較する (候補のリスト, スコアマップのそれぞれ)
+// メモリトランザクションは Vulkan で移植性のあるカウンタがないので、
+// __global からの読み込み命令の数をカーネルと同じ早期棄却をホストで辿って
+// 数える (1 画素あたり, 1 byte または 4 byte の読み込み)。
+int runTileComparison(const FastOptions& options) {
+  const uint32_t sizes[][2] = {
+      {1280, 720}, {1920, 1080}, {2560, 1440}, {3840, 2160}};
+  const char* const mode_names[2] = {"byte ", "tiled"};
 
   try {
-    app.run();
+    clspv_test::Context context(/*require_int8=*/true, options.pipeline_cache);
+    printf("----- FAST byte loads vs 32bit tiles (threshold %d, %d frames) "
+           "-----\n",
+           options.threshold, options.repeat);
+    for (const auto& size : sizes) {
+      const uint32_t width = size[0], height = size[1];
+      const std::vector<unsigned char> image =
+          makeNoisySyntheticImage(width, height);
+      const double num_pixels = double(width) * height;
+
+      // byte 単位のカーネルの読み込みの数
+      size_t find_loads = 0, score_loads = 0;
+      for (uint32_t y = FAST_BORDER; y < height - FAST_BORDER; ++y) {
+        for (uint32_t x = FAST_BORDER; x < width - FAST_BORDER; ++x) {
+          int loads;
+          const bool corner = clspv_test::isFastCorner(
+              image.data() + size_t(y) * width + x, int(width),
+              options.threshold, &loads);
+          find_loads += loads;
+          // FAST_scoreMap はコーナーでは cornerScore で 17 画素を読む
+          score_loads += loads + (corner ? 17 : 0);
+        }
+      }
+      // タイルの読み込みの数 (FAST_findKeypoints_tiled は端の 3 画素から)
+      const uint32_t find_groups_x =
+          (width - 2 * FAST_BORDER + FIND_WORKGROUP_SIZE - 1) /
+          FIND_WORKGROUP_SIZE;
+      const uint32_t find_groups_y =
+          (height - 2 * FAST_BORDER + FIND_WORKGROUP_SIZE - 1) /
+          FIND_WORKGROUP_SIZE;
+      const size_t find_tiled_loads =
+          tiledWordLoads(width, height, find_groups_x, find_groups_y, 0);
+      const size_t score_tiled_loads = tiledWordLoads(
+          width, height,
+          (width + FIND_WORKGROUP_SIZE - 1) / FIND_WORKGROUP_SIZE,
+          (height + FIND_WORKGROUP_SIZE - 1) / FIND_WORKGROUP_SIZE,
+          FAST_BORDER);
+
+      for (int score_map = 0; score_map < 2; ++score_map) {
+        const size_t loads[2][2] = {{find_loads, find_tiled_loads},
+                                    {score_loads, score_tiled_loads}};
+        FastOptions mode_options   = options;
+        mode_options.score_map     = score_map;
+        mode_options.aggregated    = false;
+        mode_options.max_keypoints = int(size_t(width) * height / 4);
+        std::vector<Keypoint> keypoints[2];
+        for (int tiled = 0; tiled < 2; ++tiled) {
+          mode_options.tiled = tiled;
+          FastDetector detector(context, width, height, mode_options);
+          memcpy(detector.imageData(), image.data(), image.size());
+
+          // 初回 (パイプラインの作成直後) は計測しない
+          detector.detect(&keypoints[tiled]);
+          detector.resetPassTimes();
+          for (int i = 0; i < options.repeat; ++i) {
+            detector.detect(&keypoints[tiled]);
+          }
+          // 1 番目のパス (FAST_findKeypoints または FAST_scoreMap)
+          const double ms = detector.passTimeMs(0);
+          printf(
+              "     - %4ux%4u %-9s %s : %8.3f ms (%8.1f Mpix/s), "
+              "%6.2f loads/pixel (%d byte), %zu keypoints\n",
+              width, height, score_map ? "score-map" : "list",
+              mode_names[tiled], ms, ms > 0.0 ? num_pixels / (ms * 1e3) : 0.0,
+              loads[score_map][tiled] / num_pixels, tiled ? 4 : 1,
+              keypoints[tiled].size());
+        }
+        printf("       keypoints %s\n",
+               sameKeypoints(keypoints[0], keypoints[1]) ? "match" : "DIFFER");
+      }
+    }
   } catch (const std::runtime_error& e) {
     printf("%s\n", e.what());
     return EXIT_FAILURE;
   }
-
   return EXIT_SUCCESS;
 }
+
+// usage: fast [input.png] [output.txt] [--threshold T] [--max-keypoints N]
+//             [--repeat N] [--roundtrip] [--aggregated] [--score-map]
+//             [--grid CELL] [--per-cell K] [--no-pipeline-cache]
+//             [--tiled] [--cpu] [--threads N]
+//        fast bench [--threshold T] [--repeat N] [--roundtrip] [--aggregated]
+//                   [--score-map] [--grid CELL] [--per-cell K]
+//                   [--no-pipeline-cache]
+//        fast latency [--threshold T] [--repeat N] [--no-pipeline-cache]
+//        fast atomics [--threshold T] [--repeat N] [--roundtrip]
+//                     [--no-pipeline-cache]
+//        fast thresholds [--repeat N] [--no-pipeline-cache]
+//        fast grid [--threshold T] [--repeat N] [--roundtrip] [--aggregated]
+//                  [--score-map] [--grid CELL] [--per-cell K]
+//                  [--no-pipeline-cache]
+//        fast pyramid [--levels N] [--scale-factor S] [--threshold T]
+//                     [--max-keypoints N] [--repeat N] [--aggregated]
+//                     [--no-pipeline-cache]
+//        fast tiles [--threshold T] [--repeat N] [--no-pipeline-cache]
+//        fast cpu [--threshold T] [--repeat N] [--threads N] [--roundtrip]
+//                 [--aggregated] [--score-map] [--no-pipeline-cache]
+int main(int argc, char** argv) {
+  std::string input_filepath  = "src.png";
+  std::string output_filepath = "keypoints.txt";
+
+  FastOptions options;
+  bool bench      = false;
+  bool latency    = false;
+  bool atomics    = false;
+  bool thresholds = false;
+  bool grid       = false;
+  bool pyramid    = false;
+  bool cpu_bench  = false;
+  bool tiles      = false;
+  std::vector<std::string> positional_args;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--threshold" && i + 1 < argc) {
+      options.threshold = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--max-keypoints" && i + 1 < argc) {
+      options.max_keypoints = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--repeat" && i + 1 < argc) {
+      options.repeat = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--roundtrip") {
+      options.roundtrip = true;
+    } else if (arg == "--aggregated") {
+      options.aggregated = true;
+    } else if (arg == "--score-map") {
+      options.score_map = true;
+    } else if (arg == "--grid" && i + 1 < argc) {
+      options.grid_cell = std::atoi(argv[++i]);
+    } else if (arg == "--per-cell" && i + 1 < argc) {
+      options.per_cell = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--levels" && i + 1 < argc) {
+      options.levels = std::atoi(argv[++i]);
+    } else if (arg == "--scale-factor" && i + 1 < argc) {
+      options.scale_factor = float(std::atof(argv[++i]));
+    } else if (arg == "--tiled") {
+      options.tiled = true;
+    } else if (arg == "--cpu") {
+      options.cpu = true;
+    } else if (arg == "--threads" && i + 1 < argc) {
+      options.num_threads = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--no-pipeline-cache") {
+      options.pipeline_cache = false;
+    } else if (arg == "bench") {
+      bench = true;
+    } else if (arg == "latency") {
+      latency = true;
+    } else if (arg == "atomics") {
+      atomics = true;
+    } else if (arg == "thresholds") {
+      thresholds = true;
+    } else if (arg == "grid") {
+      grid = true;
+    } else if (arg == "pyramid") {
+      pyramid = true;
+    } else if (arg == "cpu") {
+      cpu_bench = true;
+    } else if (arg == "tiles") {
+      tiles = true;
+    } else if (!arg.empty() && arg[0] != '-') {
+      positional_args.emplace_back(arg);
+    } else {
+      printf(
+          "usage: %s [input.png] [output.txt] [--threshold T] "
+          "[--max-keypoints N] [--repeat N] [--roundtrip] [--aggregated] "
+          "[--score-map] [--grid CELL] [--per-cell K] "
+          "[--no-pipeline-cache] [--tiled] [--cpu] [--threads N]\n",
+          argv[0]);
+      printf("       %s bench [--threshold T] [--repeat N] [--roundtrip] "
+             "[--aggregated] [--score-map] [--grid CELL] [--per-cell K] "
+             "[--no-pipeline-cache]\n",
+             argv[0]);
+      printf("       %s latency [--threshold T] [--repeat N] "
+             "[--no-pipeline-cache]\n",
+             argv[0]);
+      printf("       %s atomics [--threshold T] [--repeat N] [--roundtrip] "
+             "[--no-pipeline-cache]\n",
+             argv[0]);
+      printf("       %s thresholds [--repeat N] [--no-pipeline-cache]\n",
+             argv[0]);
+      printf("       %s grid [--threshold T] [--repeat N] [--roundtrip] "
+             "[--aggregated] [--score-map] [--grid CELL] [--per-cell K] "
+             "[--no-pipeline-cache]\n",
+             argv[0]);
+      printf("       %s pyramid [--levels N] [--scale-factor S] "
+             "[--threshold T] [--max-keypoints N] [--repeat N] [--aggregated] "
+             "[--no-pipeline-cache]\n",
+             argv[0]);
+      printf("       %s tiles [--threshold T] [--repeat N] "
+             "[--no-pipeline-cache]\n",
+             argv[0]);
+      printf("       %s cpu [--threshold T] [--repeat N] [--threads N] "
+             "[--roundtrip] [--aggregated] [--score-map] "
+             "[--no-pipeline-cache]\n",
+             argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (bench) {
+    return runBenchmark(options);
+  }
+  if (latency) {
+    return runLatencyComparison(options);
+  }
+  if (atomics) {
+    return runAtomicsComparison(options);
+  }
+  if (thresholds) {
+    return runThresholdComparison(options);
+  }
+  if (grid) {
+    return runGridComparison(options);
+  }
+  if (pyramid) {
+    return runPyramidBenchmark(options);
+  }
+  if (cpu_bench) {
+    return runCpuBenchmark(options);
+  }
+  if (tiles) {
+    return runTileComparison(options);
+  }
+  if (positional_args.size() > 0) {
+    input_filepath = positional_args[0];
+  }
+  if (positional_args.size() > 1) {
+    output_filepath = positional_args[1];
+  }
+  return runDetection(input_filepath, output_filepath, options);
+}
@@ -0,0 +1,487 @@
+/*
+MIT License
+
+Copyright (c) 2022 kyawakyawa
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "fast_cpu.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#define CLSPV_TEST_FAST_CPU_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__)  // GCC, Clang (target 属性と __builtin_cpu_supports)
+#define CLSPV_TEST_FAST_CPU_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+namespace clspv_test {
+
+// fast_common.h の isFastCorner のスカラー版
+// (__global を外し、読んだ画素の数を num_loads に書くようにしたもの)
+int isFastCorner(const unsigned char* img, int step, int threshold,
+                 int* num_loads) {
+  int ignored_loads;
+  int& loads = num_loads ? *num_loads : ignored_loads;
+  loads      = 1;  // 中心の画素
+  int v = img[0], t0 = v - threshold, t1 = v + threshold;
+  int tofs, v0, v1;
+  int m0 = 0, m1 = 0;
+
+#define UPDATE_MASK(idx, ofs)                           \
+  tofs = ofs;                                           \
+  v0   = img[tofs];                                     \
+  v1   = img[-tofs];                                    \
+  m0 |= ((v0 < t0) << idx) | ((v1 < t0) << (8 + idx)); \
+  m1 |= ((v0 > t1) << idx) | ((v1 > t1) << (8 + idx)); \
+  loads += 2
+
+  UPDATE_MASK(0, 3);
+  if ((m0 | m1) == 0) return 0;
+
+  UPDATE_MASK(2, -step * 2 + 2);
+  UPDATE_MASK(4, -step * 3);
+  UPDATE_MASK(6, -step * 2 - 2);
+
+#define EVEN_MASK (1 + 4 + 16 + 64)
+
+  if (((m0 | (m0 >> 8)) & EVEN_MASK) != EVEN_MASK &&
+      ((m1 | (m1 >> 8)) & EVEN_MASK) != EVEN_MASK)
+    return 0;
+
+  UPDATE_MASK(1, -step + 3);
+  UPDATE_MASK(3, -step * 3 + 1);
+  UPDATE_MASK(5, -step * 3 - 1);
+  UPDATE_MASK(7, -step - 3);
+  if (((m0 | (m0 >> 8)) & 255) != 255 && ((m1 | (m1 >> 8)) & 255) != 255)
+    return 0;
+
+#undef EVEN_MASK
+#undef UPDATE_MASK
+
+  m0 |= m0 << 16;
+  m1 |= m1 << 16;
+
+  // 円周上で 9 画素以上連続して暗い (明るい) か
+  for (int i = 0; i < 16; ++i) {
+    if ((m0 & (511 << i)) == (511 << i) || (m1 & (511 << i)) == (511 << i)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+namespace {
+
+// 1つのタスクで処理する行数
+// 帯の上下 1 行のスコアは隣の帯と重複して計算する
+const int kBandRows = 16;
+// FAST_findKeypoints と同じく、端の 3 画素は調べない
+const int kBorder = 3;
+
+// 円周上の 16 画素の中心からのオフセット
+// (fast_common.h の UPDATE_MASK, LOAD2 の idx の順。idx + 8 は反対側)
+void circleOffsets(const int step, int ofs[16]) {
+  const int half[8] = {3,           -step + 3,     -step * 2 + 2,
+                       -step * 3 + 1, -step * 3,   -step * 3 - 1,
+                       -step * 2 - 2, -step - 3};
+  for (int k = 0; k < 8; ++k) {
+    ofs[k]     = half[k];
+    ofs[k + 8] = -half[k];
+  }
+}
+
+/*
+fast_common.h と fast_nonmax_supression.cl のスカラー版
+(__global を外し、min, max を std::min, std::max にしたもの)
+*/
+int cornerScore(const unsigned char* img, int step) {
+  int ofs[16];
+  circleOffsets(step, ofs);
+  int v = img[0], a0 = 0, b0;
+  int d[16];
+  for (int k = 0; k < 16; ++k) {
+    d[k] = (short)(v - img[ofs[k]]);
+  }
+
+  for (int k = 0; k < 16; k += 2) {
+    int a = std::min(d[(k + 1) & 15], d[(k + 2) & 15]);
+    a     = std::min(a, d[(k + 3) & 15]);
+    a     = std::min(a, d[(k + 4) & 15]);
+    a     = std::min(a, d[(k + 5) & 15]);
+    a     = std::min(a, d[(k + 6) & 15]);
+    a     = std::min(a, d[(k + 7) & 15]);
+    a     = std::min(a, d[(k + 8) & 15]);
+    a0    = std::max(a0, std::min(a, d[k & 15]));
+    a0    = std::max(a0, std::min(a, d[(k + 9) & 15]));
+  }
+
+  b0 = -a0;
+  for (int k = 0; k < 16; k += 2) {
+    int b = std::max(d[(k + 1) & 15], d[(k + 2) & 15]);
+    b     = std::max(b, d[(k + 3) & 15]);
+    b     = std::max(b, d[(k + 4) & 15]);
+    b     = std::max(b, d[(k + 5) & 15]);
+    b     = std::max(b, d[(k + 6) & 15]);
+    b     = std::max(b, d[(k + 7) & 15]);
+    b     = std::max(b, d[(k + 8) & 15]);
+    b0    = std::min(b0, std::max(b, d[k]));
+    b0    = std::min(b0, std::max(b, d[(k + 9) & 15]));
+  }
+
+  return -b0 - 1;
+}
+
+int isLocalMax(const unsigned char* img, int step, int x, int y, int rows,
+               int cols, int* score) {
+  int s = cornerScore(img, step);
+
+  if ((x < 4 || s > cornerScore(img - 1, step)) +
+          (y < 4 || s > cornerScore(img - step, step)) !=
+      2)
+    return 0;
+  if ((x >= cols - 4 || s > cornerScore(img + 1, step)) +
+          (y >= rows - 4 || s > cornerScore(img + step, step)) +
+          (x < 4 || y < 4 || s > cornerScore(img - step - 1, step)) +
+          (x >= cols - 4 || y < 4 || s > cornerScore(img - step + 1, step)) +
+          (x < 4 || y >= rows - 4 || s > cornerScore(img + step - 1, step)) +
+          (x >= cols - 4 || y >= rows - 4 ||
+           s > cornerScore(img + step + 1, step)) !=
+      6)
+    return 0;
+
+  *score = s;
+  return 1;
+}
+
+/*
+SIMD 版ではスコアマップ (1画素1byte, コーナーでない画素は 0) を作ってから
+非極大値抑制をする。threshold >= 1 のとき
+  isFastCorner(t) <=> cornerScore >= t
+なので、
+  - コーナーの判定はスコアを threshold と比べるだけでよい
+  - コーナーのスコアは threshold 以上、コーナーでない画素のスコアは
+    threshold 未満なので、非極大値抑制で隣の画素のスコアを 0 としても
+    s > (隣のスコア) の結果は変わらない
+UPDATE_MASK, EVEN_MASK の判定はコーナーの必要条件なので、16画素の全てが
+棄却された場合はスコアを計算しない。
+*/
+
+// y 行目の [x, x_end) のスコアを scores[x] ... に書く (1画素ずつ)
+void scoreRowScalar(const unsigned char* row, const int step, int x,
+                    const int x_end, const int threshold,
+                    unsigned char* scores) {
+  for (; x < x_end; ++x) {
+    scores[x] = isFastCorner(row + x, step, threshold)
+                    ? static_cast<unsigned char>(cornerScore(row + x, step))
+                    : 0;
+  }
+}
+
+#ifdef CLSPV_TEST_FAST_CPU_SSE2
+inline __m128i loadU8x16(const unsigned char* p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+// 符号なしの比較を符号付きの比較 (_mm_cmpgt_epi8) でするために反転する
+inline __m128i flipSign(const __m128i v) {
+  return _mm_xor_si128(v, _mm_set1_epi8(char(0x80)));
+}
+
+// p から始まる 16画素のうち、コーナーの可能性がある画素があれば true を返す
+// (isFastCorner の UPDATE_MASK, EVEN_MASK による早期棄却を 16画素まとめて行う)
+// dark, bright は (中心 -+ threshold) を飽和演算して flipSign したもの
+inline bool mayHaveCornerSse2(const unsigned char* p, const int* ofs,
+                              const __m128i dark, const __m128i bright) {
+  // 円周上の idx と idx + 8 の少なくとも一方が暗い (明るい)
+  __m128i pair_dark[8], pair_bright[8];
+  const int order[8] = {0, 2, 4, 6, 1, 3, 5, 7};
+  __m128i all_dark = _mm_set1_epi8(char(0xff)), all_bright = all_dark;
+  for (int i = 0; i < 8; ++i) {
+    const int k     = order[i];
+    const __m128i a = flipSign(loadU8x16(p + ofs[k]));
+    const __m128i b = flipSign(loadU8x16(p + ofs[k + 8]));
+    pair_dark[k] =
+        _mm_or_si128(_mm_cmpgt_epi8(dark, a), _mm_cmpgt_epi8(dark, b));
+    pair_bright[k] =
+        _mm_or_si128(_mm_cmpgt_epi8(a, bright), _mm_cmpgt_epi8(b, bright));
+    all_dark   = _mm_and_si128(all_dark, pair_dark[k]);
+    all_bright = _mm_and_si128(all_bright, pair_bright[k]);
+    // UPDATE_MASK(0, 3) の後, EVEN_MASK, 全ての対 の順に棄却する
+    if (i == 0 || i == 3 || i == 7) {
+      if (_mm_movemask_epi8(_mm_or_si128(all_dark, all_bright)) == 0) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// スコア (int16) を 0..255 に飽和させ、threshold 未満を 0 にして書き込む
+inline void storeScoresSse2(unsigned char* dst, const __m128i lo,
+                            const __m128i hi, const __m128i threshold) {
+  const __m128i s      = _mm_packus_epi16(lo, hi);
+  const __m128i corner = _mm_cmpeq_epi8(_mm_max_epu8(s, threshold), s);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_and_si128(s, corner));
+}
+
+// cornerScore を 8画素 (int16) まとめて計算する
+// d[k] は円周上の k 番目の画素との差 (中心 - 画素)
+inline __m128i cornerScore8Sse2(const __m128i* d) {
+  __m128i a0 = _mm_setzero_si128();
+  for (int k = 0; k < 16; k += 2) {
+    __m128i a = _mm_min_epi16(d[(k + 1) & 15], d[(k + 2) & 15]);
+    for (int j = 3; j <= 8; ++j) {
+      a = _mm_min_epi16(a, d[(k + j) & 15]);
+    }
+    a0 = _mm_max_epi16(a0, _mm_min_epi16(a, d[k]));
+    a0 = _mm_max_epi16(a0, _mm_min_epi16(a, d[(k + 9) & 15]));
+  }
+
+  __m128i b0 = _mm_sub_epi16(_mm_setzero_si128(), a0);
+  for (int k = 0; k < 16; k += 2) {
+    __m128i b = _mm_max_epi16(d[(k + 1) & 15], d[(k + 2) & 15]);
+    for (int j = 3; j <= 8; ++j) {
+      b = _mm_max_epi16(b, d[(k + j) & 15]);
+    }
+    b0 = _mm_min_epi16(b0, _mm_max_epi16(b, d[k]));
+    b0 = _mm_min_epi16(b0, _mm_max_epi16(b, d[(k + 9) & 15]));
+  }
+
+  // -b0 - 1
+  return _mm_sub_epi16(_mm_set1_epi16(-1), b0);
+}
+
+// y 行目の [x, x_end) を 16画素ずつ処理し、処理した画素の終わりを返す
+int scoreRowSse2(const unsigned char* row, const int step, int x,
+                 const int x_end, const int threshold, unsigned char* scores) {
+  int ofs[16];
+  circleOffsets(step, ofs);
+  // threshold > 255 の場合はコーナーがないので、255 としても結果は同じ
+  const __m128i t = _mm_set1_epi8(char(std::min(threshold, 255)));
+  const __m128i zero = _mm_setzero_si128();
+  for (; x + 16 <= x_end; x += 16) {
+    const unsigned char* p = row + x;
+    const __m128i c        = loadU8x16(p);
+    const __m128i dark     = flipSign(_mm_subs_epu8(c, t));
+    const __m128i bright   = flipSign(_mm_adds_epu8(c, t));
+    if (!mayHaveCornerSse2(p, ofs, dark, bright)) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(scores + x), zero);
+      continue;
+    }
+
+    const __m128i c_lo = _mm_unpacklo_epi8(c, zero);
+    const __m128i c_hi = _mm_unpackhi_epi8(c, zero);
+    __m128i d_lo[16], d_hi[16];
+    for (int k = 0; k < 16; ++k) {
+      const __m128i v = loadU8x16(p + ofs[k]);
+      d_lo[k]         = _mm_sub_epi16(c_lo, _mm_unpacklo_epi8(v, zero));
+      d_hi[k]         = _mm_sub_epi16(c_hi, _mm_unpackhi_epi8(v, zero));
+    }
+    storeScoresSse2(scores + x, cornerScore8Sse2(d_lo),
+                    cornerScore8Sse2(d_hi), t);
+  }
+  return x;
+}
+#endif  // CLSPV_TEST_FAST_CPU_SSE2
+
+#ifdef CLSPV_TEST_FAST_CPU_AVX2
+// cornerScore を 16画素 (int16) まとめて計算する (cornerScore8Sse2 と同じ)
+__attribute__((target("avx2"))) inline __m256i cornerScore16Avx2(
+    const __m256i* d) {
+  __m256i a0 = _mm256_setzero_si256();
+  for (int k = 0; k < 16; k += 2) {
+    __m256i a = _mm256_min_epi16(d[(k + 1) & 15], d[(k + 2) & 15]);
+    for (int j = 3; j <= 8; ++j) {
+      a = _mm256_min_epi16(a, d[(k + j) & 15]);
+    }
+    a0 = _mm256_max_epi16(a0, _mm256_min_epi16(a, d[k]));
+    a0 = _mm256_max_epi16(a0, _mm256_min_epi16(a, d[(k + 9) & 15]));
+  }
+
+  __m256i b0 = _mm256_sub_epi16(_mm256_setzero_si256(), a0);
+  for (int k = 0; k < 16; k += 2) {
+    __m256i b = _mm256_max_epi16(d[(k + 1) & 15], d[(k + 2) & 15]);
+    for (int j = 3; j <= 8; ++j) {
+      b = _mm256_max_epi16(b, d[(k + j) & 15]);
+    }
+    b0 = _mm256_min_epi16(b0, _mm256_max_epi16(b, d[k]));
+    b0 = _mm256_min_epi16(b0, _mm256_max_epi16(b, d[(k + 9) & 15]));
+  }
+
+  return _mm256_sub_epi16(_mm256_set1_epi16(-1), b0);
+}
+
+// scoreRowSse2 と同じだが、スコアを 16画素まとめて AVX2 で計算する
+__attribute__((target("avx2"))) int scoreRowAvx2(
+    const unsigned char* row, const int step, int x, const int x_end,
+    const int threshold, unsigned char* scores) {
+  int ofs[16];
+  circleOffsets(step, ofs);
+  const __m128i t    = _mm_set1_epi8(char(std::min(threshold, 255)));
+  const __m128i zero = _mm_setzero_si128();
+  for (; x + 16 <= x_end; x += 16) {
+    const unsigned char* p = row + x;
+    const __m128i c        = loadU8x16(p);
+    const __m128i dark     = flipSign(_mm_subs_epu8(c, t));
+    const __m128i bright   = flipSign(_mm_adds_epu8(c, t));
+    if (!mayHaveCornerSse2(p, ofs, dark, bright)) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(scores + x), zero);
+      continue;
+    }
+
+    const __m256i c16 = _mm256_cvtepu8_epi16(c);
+    __m256i d[16];
+    for (int k = 0; k < 16; ++k) {
+      d[k] = _mm256_sub_epi16(c16, _mm256_cvtepu8_epi16(loadU8x16(p + ofs[k])));
+    }
+    const __m256i s = cornerScore16Avx2(d);
+    storeScoresSse2(scores + x, _mm256_castsi256_si128(s),
+                    _mm256_extracti128_si256(s, 1), t);
+  }
+  return x;
+}
+
+bool hasAvx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+#endif  // CLSPV_TEST_FAST_CPU_AVX2
+
+// y 行目のスコアマップ (x が [kBorder, w - kBorder) の範囲) を scores に書く
+void scoreRow(const unsigned char* src, const int w, const int y,
+              const int threshold, unsigned char* scores) {
+  const unsigned char* row = src + size_t(y) * w;
+  int x                    = kBorder;
+#if defined(CLSPV_TEST_FAST_CPU_AVX2)
+  x = hasAvx2() ? scoreRowAvx2(row, w, x, w - kBorder, threshold, scores)
+                : scoreRowSse2(row, w, x, w - kBorder, threshold, scores);
+#elif defined(CLSPV_TEST_FAST_CPU_SSE2)
+  x = scoreRowSse2(row, w, x, w - kBorder, threshold, scores);
+#endif
+  scoreRowScalar(row, w, x, w - kBorder, threshold, scores);
+}
+
+// y 行目の非極大値抑制 (isLocalMax と同じ端の扱い)
+// up, center, down は y - 1, y, y + 1 行目のスコア
+void nonmaxRow(const unsigned char* up, const unsigned char* center,
+               const unsigned char* down, const int w, const int h,
+               const int y, std::vector<FastKeypoint>* keypoints) {
+  for (int x = kBorder; x < w - kBorder; ++x) {
+    // コーナーのない 8画素はまとめて飛ばす
+    uint64_t block;
+    if (x + 8 <= w - kBorder) {
+      memcpy(&block, center + x, sizeof(block));
+      if (block == 0) {
+        x += 7;
+        continue;
+      }
+    }
+    const int s = center[x];
+    if (s == 0) {
+      continue;
+    }
+    if ((x < 4 || s > center[x - 1]) && (y < 4 || s > up[x]) &&
+        (x >= w - 4 || s > center[x + 1]) && (y >= h - 4 || s > down[x]) &&
+        (x < 4 || y < 4 || s > up[x - 1]) &&
+        (x >= w - 4 || y < 4 || s > up[x + 1]) &&
+        (x < 4 || y >= h - 4 || s > down[x - 1]) &&
+        (x >= w - 4 || y >= h - 4 || s > down[x + 1])) {
+      keypoints->push_back({x, y, s});
+    }
+  }
+}
+
+}  // namespace
+
+void detectFastCpu(const unsigned char* src, const uint32_t w,
+                   const uint32_t h, const int threshold, ThreadPool& pool,
+                   std::vector<FastKeypoint>* keypoints) {
+  keypoints->clear();
+  if (w <= 2 * kBorder || h <= 2 * kBorder) {
+    return;
+  }
+  const int width = int(w), height = int(h);
+  const int rows      = height - 2 * kBorder;
+  const size_t num_bands = (rows + kBandRows - 1) / kBandRows;
+  std::vector<std::vector<FastKeypoint>> band_keypoints(num_bands);
+
+  pool.parallelFor(num_bands, [&](const size_t band) {
+    const int y_begin = kBorder + int(band) * kBandRows;
+    const int y_end   = std::min(height - kBorder, y_begin + kBandRows);
+
+    // 帯の上下 1 行も含めたスコアマップ (調べない端の画素と行は 0)
+    thread_local std::vector<unsigned char> scores;
+    scores.assign(size_t(y_end - y_begin + 2) * width, 0);
+    for (int y = std::max(kBorder, y_begin - 1);
+         y < std::min(height - kBorder, y_end + 1); ++y) {
+      scoreRow(src, width, y, threshold,
+               scores.data() + size_t(y - y_begin + 1) * width);
+    }
+
+    std::vector<FastKeypoint>& out = band_keypoints[band];
+    for (int y = y_begin; y < y_end; ++y) {
+      const unsigned char* center =
+          scores.data() + size_t(y - y_begin + 1) * width;
+      nonmaxRow(center - width, center, center + width, width, height, y,
+                &out);
+    }
+  });
+
+  // 帯の順に並べると (y, x) の昇順になる
+  for (const auto& out : band_keypoints) {
+    keypoints->insert(keypoints->end(), out.begin(), out.end());
+  }
+}
+
+void detectFastCpuScalar(const unsigned char* src, const uint32_t w,
+                         const uint32_t h, const int threshold,
+                         std::vector<FastKeypoint>* keypoints) {
+  keypoints->clear();
+  const int step = int(w);
+  for (int y = kBorder; y < int(h) - kBorder; ++y) {
+    for (int x = kBorder; x < int(w) - kBorder; ++x) {
+      const unsigned char* img = src + size_t(y) * w + x;
+      int s;
+      if (isFastCorner(img, step, threshold) &&
+          isLocalMax(img, step, x, y, int(h), int(w), &s)) {
+        keypoints->push_back({x, y, s});
+      }
+    }
+  }
+}
+
+const char* fastCpuIsaName() {
+#if defined(CLSPV_TEST_FAST_CPU_AVX2)
+  return hasAvx2() ? "avx2" : "sse2";
+#elif defined(CLSPV_TEST_FAST_CPU_SSE2)
+  return "sse2";
+#else
+  return "scalar";
+#endif
+}
+
+}  // namespace clspv_test
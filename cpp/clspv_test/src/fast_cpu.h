@@ -0,0 +1,74 @@
+/*
+MIT License
+
+Copyright (c) 2022 kyawakyawa
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifndef CLSPV_TEST_FAST_CPU_H_
+#define CLSPV_TEST_FAST_CPU_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace clspv_test {
+
+// FAST_nonmaxSupression の出力と同じ (x, y, score)
+struct FastKeypoint {
+  int x;
+  int y;
+  int score;
+};
+
+// CPU で FAST のキーポイントを検出する (src はグレースケール, 1行 w byte)
+//
+// FAST_findKeypoints (fast_find_keypoints.cl) と FAST_nonmaxSupression
+// (fast_nonmax_supression.cl) を続けて実行した場合と同じキーポイントと
+// スコアを、(y, x) の昇順で keypoints に返す。
+// (threshold >= 1 で、GPU 側のリストが max_keypoints で溢れない場合)
+// 画像を行の帯に分け、帯ごとに pool のスレッドで処理する。各帯の中では
+// 16画素ずつ SIMD で早期棄却 (UPDATE_MASK, EVEN_MASK) とスコアの計算をする。
+void detectFastCpu(const unsigned char* src, const uint32_t w,
+                   const uint32_t h, const int threshold, ThreadPool& pool,
+                   std::vector<FastKeypoint>* keypoints);
+
+// 比較用のスカラー版 (1スレッド)
+// fast_common.h の isFastCorner, cornerScore と isLocalMax をそのまま
+// 1画素ずつ実行する
+void detectFastCpuScalar(const unsigned char* src, const uint32_t w,
+                         const uint32_t h, const int threshold,
+                         std::vector<FastKeypoint>* keypoints);
+
+// 画素 img がコーナーなら 1 を返す (fast_common.h の isFastCorner と同じ判定)
+// num_loads が nullptr でなければ、判定のために読んだ画素の数 (早期棄却の
+// 段階ごとに 3, 9, 17) を書く。GPU のカーネルが __global から読む数と同じ。
+int isFastCorner(const unsigned char* img, int step, int threshold,
+                 int* num_loads = nullptr);
+
+// detectFastCpu() が使う命令セットの名前
+const char* fastCpuIsaName();
+
+}  // namespace clspv_test
+
+#endif  // CLSPV_TEST_FAST_CPU_H_
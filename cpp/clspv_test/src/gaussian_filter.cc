@@ -22,41 +22,206 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
-#include <assert.h>
 #include <string.h>
-#include <vulkan/vulkan.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
 #include <stdexcept>
-#include <unordered_set>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "clspv_runtime.h"
+#include "gaussian_filter_cpu.h"
+#include "grayscale.h"
 #include "lodepng.h"  //Used for png encoding.
+#include "png_encoder.h"
 
-const int WORKGROUP_SIZE = 32;  // Workgroup size in compute shader.
-
-#ifdef NDEBUG
-const bool enableValidationLayers = false;
-#else
-const bool enableValidationLayers = true;
-#endif
-
-// Used for validating return values of Vulkan API calls.
-#define VK_CHECK_RESULT(f)                                               \
-  {                                                                      \
-    VkResult res = (f);                                                  \
-    if (res != VK_SUCCESS) {                                             \
-      printf("Fatal : VkResult is %d in %s at line %d\n", res, __FILE__, \
-             __LINE__);                                                  \
-      assert(res == VK_SUCCESS);                                         \
-    }                                                                    \
-  }
+const int WORKGROUP_SIZE = 32;  // Default workgroup size in compute shader.
+// gaussian_filter.cl の MAX_WORKGROUP_SIZE と一致させる (タイル版の上限)
+const int MAX_WORKGROUP_SIZE = 32;
+// makefile で生成する spirv/c/gaussian_filter_r*.spv の半径の範囲
+const int MIN_GAUSSIAN_RADIUS = 1;
+const int MAX_GAUSSIAN_RADIUS = 15;
 
 /*
 The application launches a compute shader that renders the mandelbrot set,
 by rendering it into a storage buffer.
 The storage buffer is then read from the GPU, and saved as .png.
 */
+enum class FilterMode {
+  k2D,         // gaussian_filter_grayscale (exp() を伴う2次元畳み込み)
+  kSeparable,  // 水平 + 垂直の2パス
+  kTiled,      // ローカルメモリにタイルを読み込む2次元畳み込み
+};
+
+inline const char* filterModeName(const FilterMode mode) {
+  switch (mode) {
+    case FilterMode::k2D:
+      return "2d";
+    case FilterMode::kSeparable:
+      return "separable";
+    case FilterMode::kTiled:
+      return "tiled";
+  }
+  return "unknown";
+}
+
+struct FilterOptions {
+  FilterMode mode = FilterMode::k2D;
+  bool compare    = false;  // 2次元版も実行して結果を比較する
+  float sigma     = 10.0f;
+  int radius      = 3;  // カーネルの半径 (3 のとき 7x7)
+  uint32_t workgroup_x = WORKGROUP_SIZE;
+  uint32_t workgroup_y = WORKGROUP_SIZE;
+  int repeat           = 1;  // 計測のために command buffer を投入する回数
+  // パイプラインキャッシュをファイルに保存し、次回の起動時に読み込む
+  bool pipeline_cache = true;
+  bool cpu            = false;  // Vulkan を使わず CPU で分離型を実行する
+  int num_threads     = 0;      // CPU で使うスレッド数 (0 のときはコア数)
+};
+
+// CPU で使うスレッド数
+inline size_t numCpuThreads(const FilterOptions& options) {
+  if (options.num_threads > 0) {
+    return options.num_threads;
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Vulkan と CPU のどの経路でも必要なフィルタの引数の検査
+// (重みを作る前に行う。不正なら std::runtime_error を投げる)
+void validateFilterOptions(const FilterOptions& options) {
+  if (options.radius < MIN_GAUSSIAN_RADIUS ||
+      options.radius > MAX_GAUSSIAN_RADIUS) {
+    throw std::runtime_error("radius must be in [" +
+                             std::to_string(MIN_GAUSSIAN_RADIUS) + ", " +
+                             std::to_string(MAX_GAUSSIAN_RADIUS) + "]");
+  }
+  // 0, 負, NaN, 無限大では重みが正しく作れない
+  if (!std::isfinite(options.sigma) || options.sigma <= 0.0f) {
+    throw std::runtime_error("sigma must be a positive finite number");
+  }
+}
+
+// a と b を比較し、一致しない画素数と差の最大値を表示する
+void printDiff(const std::string& title, const unsigned char* a,
+               const unsigned char* b, const size_t num_pixels) {
+  size_t num_mismatches = 0;
+  int max_diff          = 0;
+  for (size_t i = 0; i < num_pixels; ++i) {
+    const int diff = std::abs(int(a[i]) - int(b[i]));
+    if (diff != 0) {
+      ++num_mismatches;
+      max_diff = std::max(max_diff, diff);
+    }
+  }
+
+  printf("----- %s -----\n", title.c_str());
+  printf("     - mismatched pixels : %zu / %zu\n", num_mismatches, num_pixels);
+  printf("     - max abs diff      : %d\n", max_diff);
+}
+
+// 画像 (1画素 channels byte)
+// デコード直後は PNG の画素 (RGBA) のままで、グレースケールへの変換は
+// アップロードのときに行う。フィルタの結果はグレースケール (channels = 1)。
+struct Image {
+  std::string name;
+  uint32_t width    = 0;
+  uint32_t height   = 0;
+  uint32_t channels = 1;
+  std::vector<unsigned char> pixels;
+};
+
+// スレッド間で画像を受け渡すための上限付きキュー
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(const size_t capacity) : capacity_(capacity) {}
+
+  void push(T value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this] { return queue_.size() < capacity_; });
+    queue_.push_back(std::move(value));
+    not_empty_.notify_one();
+  }
+
+  // close() された後にキューが空になると false を返す
+  bool pop(T& value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return !queue_.empty() || closed_; });
+    if (queue_.empty()) {
+      return false;
+    }
+    value = std::move(queue_.front());
+    queue_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+private:
+  const size_t capacity_;
+  std::deque<T> queue_;
+  bool closed_ = false;
+  std::mutex mutex_;
+  std::condition_variable not_full_, not_empty_;
+};
+
+// PNGを読み込む (グレースケールへの変換はアップロードのときに行う)
+bool decodePng(const std::string& filepath, Image* image) {
+  unsigned width, height;
+  unsigned error = lodepng::decode(image->pixels, width, height, filepath);
+  if (error) {
+    fprintf(stderr, "Faild to load image. (%s): %s\n", filepath.c_str(),
+            lodepng_error_text(error));
+    return false;
+  }
+  image->name     = filepath;
+  image->width    = width;
+  image->height   = height;
+  image->channels = image->pixels.size() / (size_t(width) * height);
+  if (image->channels != 1 && image->channels != 3 && image->channels != 4) {
+    fprintf(stderr, "Image is broken. (%s)\n", filepath.c_str());
+    return false;
+  }
+  return true;
+}
+
+// グレースケール画像を RGBA の PNG として保存する
+// (行の帯に分けて pool のスレッドで符号化する)
+void encodeGrayscalePng(const std::string& filepath,
+                        const unsigned char* pixels, const uint32_t width,
+                        const uint32_t height, clspv_test::ThreadPool& pool) {
+  std::vector<unsigned char> output_img_buf(size_t(width) * height * 4);
+  for (size_t i = 0; i < size_t(width) * height; ++i) {
+    const unsigned char v     = pixels[i];
+    output_img_buf[i * 4 + 0] = v;
+    output_img_buf[i * 4 + 1] = v;
+    output_img_buf[i * 4 + 2] = v;
+    output_img_buf[i * 4 + 3] = 255;
+  }
+
+  // Now we save the acquired color data to a .png.
+  unsigned error = clspv_test::encodePngParallel(
+      filepath, output_img_buf.data(), width, height, pool);
+  if (error) printf("encoder error %d: %s", error, lodepng_error_text(error));
+}
+
 class ComputeApplication {
 private:
   // The pixels of the rendered mandelbrot set are in this format:
@@ -65,53 +230,26 @@ private:
   };
 
   /*
-  In order to use Vulkan, you must create an instance.
-  */
-  VkInstance instance;
-
-  VkDebugReportCallbackEXT debugReportCallback;
-  /*
-  The physical device is some device on the system that supports usage of
-  Vulkan. Often, it is simply a graphics card that supports Vulkan.
-  */
-  VkPhysicalDevice physical_device_;
-  /*
-  Then we have the logical device VkDevice, which basically allows
-  us to interact with the physical device.
+  インスタンス, デバイス, キューは clspv_test::Context が持ち、
+  複数の ComputeApplication で使い回す
   */
-  VkDevice device;
-
-  // clang-format off
-  const std::vector<const char*> device_extensions_ = {
-      VK_KHR_VARIABLE_POINTERS_EXTENSION_NAME,            // Clspvを使う場合に必要
-#if !(__APPLE__) // Molten VKでは対応したいないみたい(2022/03/31現在) ValidationLayerでエラーが出るが問題ない？
-       VK_KHR_SHADER_NON_SEMANTIC_INFO_EXTENSION_NAME,     // Clspvを使う場合に必要
-#endif // 1(__APPLE__)
-      VK_KHR_STORAGE_BUFFER_STORAGE_CLASS_EXTENSION_NAME, // Clspvを使う場合に必要
-
-      VK_KHR_8BIT_STORAGE_EXTENSION_NAME,  // shader interfaceに8bitの型用いる
-      VK_KHR_SHADER_FLOAT16_INT8_EXTENSION_NAME  // shader内で8bit intを用いる 
-                                                 // (SPIR-Vで OpCapability Int8を使えるようにする)
-  };
-  // clang-format on
+  clspv_test::Context& context_;
+  VkDevice device;  // context_.device()
+  VkQueue queue;    // context_.queue()
 
   /*
-  The pipeline specifies the pipeline that all graphics and compute commands
-  pass though in Vulkan.
-
-  We will be creating a simple compute pipeline in this application.
+  半径ごとに別のSPIR-V (gaussian_filter_r<半径>.spv) を読み込む。
+  ワークグループサイズは specialization constant で与え、パイプラインは
+  Kernel がキャッシュする。
   */
-  VkPipeline pipeline_;
-  VkPipelineLayout pipeline_layout_;
-  VkShaderModule compute_shader_module_;
+  clspv_test::Kernel* kernel_;
 
   /*
   The command buffer is used to record commands, that will be submitted to a
   queue.
 
-  To allocate such command buffers, we use a command pool.
+  To allocate such command buffers, we use a command pool. (Contextが持つ)
   */
-  VkCommandPool commandPool;
   VkCommandBuffer commandBuffer;
 
   /*
@@ -124,50 +262,73 @@ private:
   descriptors.
   */
   VkDescriptorPool descriptor_pool_;
-  VkDescriptorSet descriptor_set_;
-  VkDescriptorSetLayout descriptor_set_layout_;
+  VkDescriptorSet descriptor_set_;            // src -> dst
+  VkDescriptorSet reference_descriptor_set_;  // src -> ref (比較用)
+  VkDescriptorSet horizontal_descriptor_set_, vertical_descriptor_set_;
 
   /*
   buffer
 
-  The memory that backs the buffer is bufferMemory.
+  カーネルが読み書きするバッファは DEVICE_LOCAL なメモリに置き、ホストとは
+  staging バッファを介してやり取りする (unified memory の場合は直接 map する)
   */
-  VkBuffer src_buffer_, dst_buffer_;
+  clspv_test::StagedBuffer src_buffer_, dst_buffer_;
   VkDeviceSize src_buffer_size_, dst_buffer_size_;
-  VkDeviceMemory src_buffer_memory_, dst_buffer_memory_;
 
-  uint32_t bufferSize;  // size of `buffer` in bytes.
+  // 分離型で使うバッファ
+  // tmp     : 水平方向の結果 (float, ホストからは読み書きしない)
+  // weights : 1次元の重み (float * (2 * MAX_GAUSSIAN_RADIUS + 1))
+  clspv_test::Buffer tmp_buffer_;
+  clspv_test::StagedBuffer weights_buffer_;
+  VkDeviceSize tmp_buffer_size_, weights_buffer_size_;
 
-  std::vector<const char*> enabledLayers;
+  // 比較するときに2次元版の結果を書き込むバッファ
+  clspv_test::StagedBuffer ref_buffer_;
 
-  /*
-  In order to execute commands on a device(GPU), the commands must be submitted
-  to a queue. The commands are stored in a command buffer, and this command
-  buffer is given to the queue.
-
-  There will be different kinds of queues on the device. Not all queues support
-  graphics operations, for instance. For this application, we at least want a
-  queue that supports compute operations.
-  */
-  VkQueue queue;  // a queue supporting compute operations.
+  // 各パスの実行時間を計測するための timestamp query
+  VkQueryPool query_pool_;
+  bool timestamp_supported_;
+  float timestamp_period_;  // 1 tick あたりのナノ秒
+  std::vector<std::string> pass_names_;
+  std::vector<double> pass_times_ms_;  // repeat 回分の合計
 
   /*
-  Groups of queues that have the same capabilities(for instance, they all
-  supports graphics and computer operations), are grouped into queue families.
+  バッチモードで使うリングの1要素
 
-  When submitting a command buffer, you must specify to which queue in the
-  family you are submitting to. This variable keeps track of the index of that
-  queue in its family.
+  画像ごとに src/dst/tmp のバッファと descriptor set, command buffer, fence
+  を持ち、GPU がある画像を処理している間に、次の画像のアップロードや
+  前の画像のダウンロードを行えるようにする。
+  src/dst (staging を使う場合はその staging) は常に map したままにしておく。
   */
-  uint32_t queueFamilyIndex;
+  struct BatchSlot {
+    clspv_test::StagedBuffer src_buffer, dst_buffer;
+    clspv_test::Buffer tmp_buffer;
+    size_t capacity = 0;             // 確保済みの画素数
+    VkDescriptorSet descriptor_set;  // src -> dst
+    VkDescriptorSet horizontal_descriptor_set, vertical_descriptor_set;
+    VkCommandBuffer command_buffer;
+    VkFence fence;                // timeline semaphore がない場合に使う
+    uint64_t timeline_value = 0;  // 完了時に timeline semaphore が取る値
+    std::chrono::steady_clock::time_point submit_time;
+    Image image;
+  };
+  std::vector<BatchSlot> batch_slots_;
+  // 全スロットで共有する timeline semaphore (フレーム n の完了で n + 1)
+  VkSemaphore batch_timeline_semaphore_ = VK_NULL_HANDLE;
+
+  // 起動時間とディスパッチのレイテンシ
+  double kernel_ms_;
+  std::vector<double> dispatch_ms_;
 
   // other ////////////
   const std::string input_filepath_;
   const std::string output_filepath_;
+  const FilterOptions options_;
 
-  std::vector<unsigned char> input_img_buf_;
+  std::vector<unsigned char> input_img_buf_;  // デコードした画素 (RGBA など)
   uint32_t input_img_width_;
   uint32_t input_img_height_;
+  uint32_t input_img_channels_ = 1;
 
   struct MyPushConstant {
     uint32_t w;
@@ -177,36 +338,60 @@ private:
 
 public:
   ComputeApplication() = delete;
-  ComputeApplication(const std::string input_filepath,
-                     const std::string output_filepath);
+  // バッチモード用: 入出力は runBatch() に渡す
+  ComputeApplication(clspv_test::Context& context,
+                     const FilterOptions& options);
+  ComputeApplication(clspv_test::Context& context,
+                     const std::string input_filepath,
+                     const std::string output_filepath,
+                     const FilterOptions& options = FilterOptions());
+  // ベンチマーク用: 指定サイズのランダムな画像を入力とし、結果は保存しない
+  ComputeApplication(clspv_test::Context& context, const uint32_t width,
+                     const uint32_t height,
+                     const FilterOptions& options = FilterOptions());
   void run() {
-    loadSrcPng();
+    validateOptions();
 
-    glayscaleSrcImg();
+    if (input_filepath_.empty()) {
+      generateSrcImg();
+    } else {
+      loadSrcPng();
+    }
 
     // Initialize vulkan:
-    createInstance();
-    findPhysicalDevice();
-    createDevice();
     createBuffer();
     printf("Create Buffer.\n");
-    createDescriptorSetLayout();
-    printf("Create DescriptorSetLayout.\n");
-    createDescriptorSet();
-    printf("Create DescriptorSet.\n");
     createComputePipeline();
     printf("Create Pipeline.\n");
+    createDescriptorSet();
+    printf("Create DescriptorSet.\n");
+    createQueryPool();
     createCommandBuffer();
     printf("Create Command Buffer\n");
     uploadSrcImgToDevice();
     printf("Upload source image to GPU\n");
+    uploadWeightsToDevice();
 
     // Finally, run the recorded command buffer.
-    runCommandBuffer();
+    pass_times_ms_.assign(pass_names_.size(), 0.0);
+    dispatch_ms_.clear();
+    for (int i = 0; i < options_.repeat; ++i) {
+      runCommandBuffer();
+      accumulatePassTimes();
+    }
     printf("Computation is finished\n");
 
-    saveFilterdImage();
-    printf("Save filtered image as [%s].\n", output_filepath_.c_str());
+    printPassTimes();
+    clspv_test::printLatency(context_.takeCreationTimeMs(), kernel_ms_,
+                             dispatch_ms_, kernel_->pipelineCacheState());
+    if (options_.compare) {
+      compareWithReference();
+    }
+
+    if (!output_filepath_.empty()) {
+      saveFilterdImage();
+      printf("Save filtered image as [%s].\n", output_filepath_.c_str());
+    }
 
     // Clean up all vulkan resources.
     cleanup();
@@ -223,34 +408,22 @@ public:
 #ifndef NDEBUG
     printf("Input image is loaded. (%s)\n", input_filepath_.c_str());
 #endif
-    input_img_width_  = width;
-    input_img_height_ = height;
-  }
-
-  void glayscaleSrcImg(void) {
-    uint32_t ch =
-        input_img_buf_.size() / (input_img_width_ * input_img_height_);
+    input_img_width_    = width;
+    input_img_height_   = height;
+    input_img_channels_ = input_img_buf_.size() / (size_t(width) * height);
 #ifndef NDEBUG
-    printf("number of channnel: %u\n", ch);
+    printf("number of channnel: %u\n", input_img_channels_);
 #endif
-    if (ch == 1) {
-      return;
-    }
-    if (ch == 2) {
-      throw std::runtime_error("Image is broken.");
-    }
-    std::vector<unsigned char> tmp(input_img_buf_.begin(),
-                                   input_img_buf_.end());
+  }
+
+  void generateSrcImg(void) {
+    // input_img_width_ x input_img_height_ のグレースケール画像を乱数で作る
+    std::mt19937 engine(0);
+    std::uniform_int_distribution<int> dist(0, 255);
     input_img_buf_.resize(input_img_width_ * input_img_height_);
-    for (int y = 0; y < input_img_height_; ++y) {
-      for (int x = 0; x < input_img_width_; ++x) {
-        float vf = 0.f;
-        vf += 0.3f * float(tmp[y * input_img_width_ * ch + x * ch + 0]);
-        vf += 0.59f * float(tmp[y * input_img_width_ * ch + x * ch + 1]);
-        vf += 0.11f * float(tmp[y * input_img_width_ * ch + x * ch + 2]);
-        input_img_buf_[y * input_img_width_ + x] =
-            static_cast<unsigned char>(vf);
-      }
+    input_img_channels_ = 1;
+    for (auto& v : input_img_buf_) {
+      v = static_cast<unsigned char>(dist(engine));
     }
   }
 
@@ -258,1050 +431,1087 @@ public:
     std::vector<decltype(input_img_buf_)::value_type> tmp(input_img_width_ *
                                                           input_img_height_);
 
-    void* mapped_memory = nullptr;
-    // Map the buffer memory, so that we can read from it on the CPU.
-    vkMapMemory(device, dst_buffer_memory_, 0, dst_buffer_size_, 0,
-                &mapped_memory);
-
-    decltype(input_img_buf_)::value_type* pmapped_memory =
-        reinterpret_cast<typename decltype(input_img_buf_)::value_type*>(
-            mapped_memory);
-
-    memcpy(tmp.data(), pmapped_memory,
+    // dst_buffer_ は map したままなので、そのまま CPU から読める
+    // (staging へのコピーは command buffer に記録してある)
+    memcpy(tmp.data(), dst_buffer_.mapped,
            sizeof(decltype(tmp)::value_type) * tmp.size());
 
-    vkUnmapMemory(device, dst_buffer_memory_);
-
     printf("Download dst image from GPU\n");
 
-    std::vector<decltype(input_img_buf_)::value_type> output_img_buf(
-        input_img_width_ * input_img_height_ * 4);
-    for (int i = 0; i < input_img_width_ * input_img_height_; ++i) {
-      decltype(input_img_buf_)::value_type v = tmp[i];
-      output_img_buf[i * 4 + 0]              = v;
-      output_img_buf[i * 4 + 1]              = v;
-      output_img_buf[i * 4 + 2]              = v;
-      output_img_buf[i * 4 + 3]              = 255;
-    }
-
-    // Now we save the acquired color data to a .png.
-    unsigned error = lodepng::encode(output_filepath_.c_str(), output_img_buf,
-                                     input_img_width_, input_img_height_);
-    if (error) printf("encoder error %d: %s", error, lodepng_error_text(error));
+    clspv_test::ThreadPool pool(numCpuThreads(options_));
+    encodeGrayscalePng(output_filepath_, tmp.data(), input_img_width_,
+                       input_img_height_, pool);
   }
 
-  static VKAPI_ATTR VkBool32 VKAPI_CALL debugReportCallbackFn(
-      VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objectType,
-      uint64_t object, size_t location, int32_t messageCode,
-      const char* pLayerPrefix, const char* pMessage, void* pUserData) {
-    printf("Debug Report: %s: %s\n", pLayerPrefix, pMessage);
-
-    return VK_FALSE;
-  }
-
-  void createInstance() {
-    std::vector<const char*> enabledExtensions;
-
+  void createBuffer() {
     /*
-    By enabling validation layers, Vulkan will emit warnings if the API
-    is used incorrectly. We shall enable the layer VK_LAYER_KHRONOS_validation,
-    which is basically a collection of several useful validation layers.
+    We will now create a buffer.
     */
-    if (enableValidationLayers) {
-      /*
-      We get all supported layers with vkEnumerateInstanceLayerProperties.
-      */
-      uint32_t layerCount;
-      vkEnumerateInstanceLayerProperties(&layerCount, NULL);
-
-      std::vector<VkLayerProperties> layerProperties(layerCount);
-      vkEnumerateInstanceLayerProperties(&layerCount, layerProperties.data());
-
-      /*
-      And then we simply check if VK_LAYER_KHRONOS_validation is among the
-      supported layers.
-      */
-      bool foundLayer = false;
-      for (VkLayerProperties prop : layerProperties) {
-        if (strcmp("VK_LAYER_KHRONOS_validation", prop.layerName) == 0) {
-          foundLayer = true;
-          break;
-        }
-      }
-
-      if (!foundLayer) {
-        throw std::runtime_error(
-            "Layer VK_LAYER_KHRONOS_validation not supported\n");
-      }
-      enabledLayers.push_back(
-          "VK_LAYER_KHRONOS_validation");  // Alright, we can use this layer.
-
-      /*
-      We need to enable an extension named VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
-      in order to be able to print the warnings emitted by the validation layer.
-
-      So again, we just check if the extension is among the supported
-      extensions.
-      */
-
-      uint32_t extensionCount;
-
-      vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, NULL);
-      std::vector<VkExtensionProperties> extensionProperties(extensionCount);
-      vkEnumerateInstanceExtensionProperties(NULL, &extensionCount,
-                                             extensionProperties.data());
-
-      bool foundExtension = false;
-      for (VkExtensionProperties prop : extensionProperties) {
-        if (strcmp(VK_EXT_DEBUG_REPORT_EXTENSION_NAME, prop.extensionName) ==
-            0) {
-          foundExtension = true;
-          break;
-        }
-      }
 
-      if (!foundExtension) {
-        throw std::runtime_error(
-            "Extension VK_EXT_DEBUG_REPORT_EXTENSION_NAME not supported\n");
-      }
-      enabledExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
-    }
+    // デバイスにはグレースケール (1画素1byte) でアップロードする
+    const size_t num_pixels = size_t(input_img_width_) * input_img_height_;
 
-    /*
-    Next, we actually create the instance.
+    /////////////////// src(input) buffer ////////////////////////////////////
+    src_buffer_size_ = num_pixels;
+    src_buffer_      = context_.createStagedBuffer(src_buffer_size_);
 
-    */
+    /////////////////// dst(output) buffer ///////////////////////////////////
+    dst_buffer_size_ = num_pixels;  // Output is the same size as input.
+    dst_buffer_      = context_.createStagedBuffer(dst_buffer_size_);
 
-    /*
-    Contains application info. This is actually not that important.
-    The only real important field is apiVersion.
-    */
-    VkApplicationInfo applicationInfo  = {};
-    applicationInfo.sType              = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-    applicationInfo.pApplicationName   = "Hello world app";
-    applicationInfo.applicationVersion = 0;
-    applicationInfo.pEngineName        = "awesomeengine";
-    applicationInfo.engineVersion      = 0;
-    applicationInfo.apiVersion =
-        VK_API_VERSION_1_1;  // VkPhysicalDeviceFeatures2の利用のため
-
-    VkInstanceCreateInfo createInfo = {};
-    createInfo.sType                = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-    createInfo.flags                = 0;
-    createInfo.pApplicationInfo     = &applicationInfo;
-
-    // Give our desired layers and extensions to vulkan.
-    createInfo.enabledLayerCount       = enabledLayers.size();
-    createInfo.ppEnabledLayerNames     = enabledLayers.data();
-    createInfo.enabledExtensionCount   = enabledExtensions.size();
-    createInfo.ppEnabledExtensionNames = enabledExtensions.data();
+    /////////////////// tmp buffer (水平方向の結果) //////////////////////////
+    tmp_buffer_size_ = sizeof(float) * num_pixels;
+    tmp_buffer_      = context_.createDeviceLocalBuffer(tmp_buffer_size_);
 
-    /*
-    Actually create the instance.
-    Having created the instance, we can actually start using vulkan.
-    */
-    VK_CHECK_RESULT(vkCreateInstance(&createInfo, NULL, &instance));
+    /////////////////// weights buffer (1次元の重み) /////////////////////////
+    weights_buffer_size_ = sizeof(float) * (2 * MAX_GAUSSIAN_RADIUS + 1);
+    weights_buffer_      = context_.createStagedBuffer(weights_buffer_size_);
 
-    /*
-    Register a callback function for the extension
-    VK_EXT_DEBUG_REPORT_EXTENSION_NAME, so that warnings emitted from the
-    validation layer are actually printed.
-    */
-    if (enableValidationLayers) {
-      VkDebugReportCallbackCreateInfoEXT createInfo = {};
-      createInfo.sType =
-          VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
-      createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT |
-                         VK_DEBUG_REPORT_WARNING_BIT_EXT |
-                         VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT;
-      createInfo.pfnCallback = &debugReportCallbackFn;
-
-      // We have to explicitly load this function.
-      auto vkCreateDebugReportCallbackEXT =
-          (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(
-              instance, "vkCreateDebugReportCallbackEXT");
-      if (vkCreateDebugReportCallbackEXT == nullptr) {
-        throw std::runtime_error(
-            "Could not load vkCreateDebugReportCallbackEXT");
-      }
+    /////////////////// ref buffer (比較用の2次元版の結果) ///////////////////
+    if (options_.compare) {
+      ref_buffer_ = context_.createStagedBuffer(dst_buffer_size_);
+    }
+  }
 
-      // Create and register callback.
-      VK_CHECK_RESULT(vkCreateDebugReportCallbackEXT(
-          instance, &createInfo, NULL, &debugReportCallback));
+  void createDescriptorSet() {
+    // src->dst, src->ref, 水平方向, 垂直方向 の4つのdescriptor setを確保する
+    // それぞれ dst, src, weights の3つのstorage bufferを持つ
+    const uint32_t num_sets = 4;
+    descriptor_pool_        = context_.createDescriptorPool(num_sets, 3);
+    descriptor_set_         = kernel_->allocateDescriptorSet(descriptor_pool_);
+    reference_descriptor_set_ =
+        kernel_->allocateDescriptorSet(descriptor_pool_);
+    horizontal_descriptor_set_ =
+        kernel_->allocateDescriptorSet(descriptor_pool_);
+    vertical_descriptor_set_ =
+        kernel_->allocateDescriptorSet(descriptor_pool_);
+
+    // 2次元版, タイル版: src -> dst
+    writeDescriptorSet(descriptor_set_, dst_buffer_.device.buffer,
+                       dst_buffer_size_, src_buffer_.device.buffer,
+                       src_buffer_size_);
+    // 比較用の2次元版: src -> ref
+    if (options_.compare) {
+      writeDescriptorSet(reference_descriptor_set_, ref_buffer_.device.buffer,
+                         dst_buffer_size_, src_buffer_.device.buffer,
+                         src_buffer_size_);
     }
+    // 水平方向: src -> tmp
+    writeDescriptorSet(horizontal_descriptor_set_, tmp_buffer_.buffer,
+                       tmp_buffer_size_, src_buffer_.device.buffer,
+                       src_buffer_size_);
+    // 垂直方向: tmp -> dst
+    writeDescriptorSet(vertical_descriptor_set_, dst_buffer_.device.buffer,
+                       dst_buffer_size_, tmp_buffer_.buffer, tmp_buffer_size_);
   }
 
-  void findPhysicalDevice() {
-    /*
-    In this function, we find a physical device that can be used with Vulkan.
-    */
+  void writeDescriptorSet(VkDescriptorSet descriptor_set, VkBuffer dst_buffer,
+                          VkDeviceSize dst_buffer_size, VkBuffer src_buffer,
+                          VkDeviceSize src_buffer_size) {
+    // binding=0 に dst、binding=1 に src、binding=2 に weights を紐付ける
+    context_.writeDescriptorSet(descriptor_set,
+                                {
+                                    {dst_buffer, 0, dst_buffer_size},
+                                    {src_buffer, 0, src_buffer_size},
+                                    {weights_buffer_.device.buffer, 0,
+                                     weights_buffer_size_},
+                                });
+  }
 
-    /*
-    So, first we will list all physical devices on the system with
-    vkEnumeratePhysicalDevices .
-    */
-    uint32_t deviceCount;
-    vkEnumeratePhysicalDevices(instance, &deviceCount, NULL);
-    if (deviceCount == 0) {
-      throw std::runtime_error("could not find a device with vulkan support");
+  void validateOptions() {
+    validateFilterOptions(options_);
+    if (options_.workgroup_x == 0 || options_.workgroup_y == 0) {
+      throw std::runtime_error("workgroup size must not be 0");
     }
+    // タイル版のローカルメモリは MAX_WORKGROUP_SIZE で確保している
+    if (options_.mode == FilterMode::kTiled &&
+        (options_.workgroup_x > MAX_WORKGROUP_SIZE ||
+         options_.workgroup_y > MAX_WORKGROUP_SIZE)) {
+      throw std::runtime_error("workgroup size of tiled mode must be <= " +
+                               std::to_string(MAX_WORKGROUP_SIZE));
+    }
+  }
 
-    std::vector<VkPhysicalDevice> devices(deviceCount);
-    vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+  void createComputePipeline() {
+    // ワークグループサイズがデバイスの制限を超えていないか調べる
+    const VkPhysicalDeviceLimits& limits = context_.properties().limits;
+    if (options_.workgroup_x > limits.maxComputeWorkGroupSize[0] ||
+        options_.workgroup_y > limits.maxComputeWorkGroupSize[1] ||
+        options_.workgroup_x * options_.workgroup_y >
+            limits.maxComputeWorkGroupInvocations) {
+      throw std::runtime_error("workgroup size exceeds device limits");
+    }
 
-    /*
-    Next, we choose a device that can be used for our purposes.
-
-    With VkPhysicalDeviceFeatures(), we can retrieve a fine-grained list of
-    physical features supported by the device. However, in this demo, we are
-    simply launching a simple compute shader, and there are no special physical
-    features demanded for this task.
-
-    With VkPhysicalDeviceProperties(), we can obtain a list of physical device
-    properties. Most importantly, we obtain a list of physical device
-    limitations. For this application, we launch a compute shader, and the
-    maximum size of the workgroups and total number of compute shader
-    invocations is limited by the physical device, and we should ensure that the
-    limitations named maxComputeWorkGroupCount, maxComputeWorkGroupInvocations
-    and maxComputeWorkGroupSize are not exceeded by our application.  Moreover,
-    we are using a storage buffer in the compute shader, and we should ensure
-    that it is not larger than the device can handle, by checking the limitation
-    maxStorageBufferRange.
-
-    However, in our application, the workgroup size and total number of shader
-    invocations is relatively small, and the storage buffer is not that large,
-    and thus a vast majority of devices will be able to handle it. This can be
-    verified by looking at some devices at_ http://vulkan.gpuinfo.org/
-
-    Therefore, to keep things simple and clean, we will not perform any such
-    checks here, and just pick the first physical device in the list. But in a
-    real and serious application, those limitations should certainly be taken
-    into account.
+    const auto begin = std::chrono::steady_clock::now();
 
-    */
+    // dst, src, weights の3つの storage buffer と、
+    // __globalでない引数 (w, h, sigma) の push constant を持つ
+    // (全てのエントリーポイントで同じレイアウトを共有する)
+    kernel_ = &context_.getKernel("./spirv/c/gaussian_filter_r" +
+                                      std::to_string(options_.radius) + ".spv",
+                                  3, sizeof(MyPushConstant));
 
-    bool found_device = false;
-    for (VkPhysicalDevice device : devices) {
-      if (IsDeviceSuitable(
-              device)) {  // 一番最初に条件を満たすデバイスを見つけたらそれを選択
-        physical_device_ = device;
-        found_device     = true;
-        break;
-      }
+    // 使うエントリーポイントのパイプラインを先に作っておく
+    if (options_.mode == FilterMode::k2D || options_.compare) {
+      getPipeline("gaussian_filter_grayscale");
     }
-    if (!found_device) {
-      throw std::runtime_error("Physical Device not found\n");
+    if (options_.mode == FilterMode::kSeparable) {
+      getPipeline("gaussian_filter_horizontal_grayscale");
+      getPipeline("gaussian_filter_vertical_grayscale");
+    }
+    if (options_.mode == FilterMode::kTiled) {
+      getPipeline("gaussian_filter_grayscale_tiled");
     }
-  }
-
-  bool IsDeviceSuitable(VkPhysicalDevice device) {
-    VkPhysicalDeviceProperties device_properties;
-    VkPhysicalDeviceFeatures device_features;
 
-    vkGetPhysicalDeviceProperties(device, &device_properties);
-    vkGetPhysicalDeviceFeatures(device, &device_features);
+    kernel_ms_ = clspv_test::elapsedMs(begin);
+  }
 
-    // グラフィックカードか？
-    const bool condition0 =
-        /* グラフィックカード */
-        device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU ||
-        /* 統合GPU */
-        device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU;
+  // 現在のワークグループサイズで特殊化したパイプラインを返す
+  //
+  // clspv は reqd_work_group_size が指定されていないカーネルの
+  // ワークグループサイズを SpecId 0, 1, 2 の specialization constant
+  // にするので、ここで与える
+  VkPipeline getPipeline(const char* entry_point) {
+    return kernel_->getPipeline(
+        entry_point, {options_.workgroup_x, options_.workgroup_y, 1});
+  }
 
-#ifndef NDEBUG
-    if (device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-      printf("グラフィックカードが検出されました\n");
-    } else if (device_properties.deviceType ==
-               VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU) {
-      printf("統合GPUが検出されました\n");
+  void createQueryPool() {
+    // 各パスの実行時間を計測するために timestamp query を使う
+    // queue familyが timestamp に対応していない場合は計測しない
+    uint32_t queue_family_count;
+    vkGetPhysicalDeviceQueueFamilyProperties(context_.physicalDevice(),
+                                             &queue_family_count, NULL);
+    std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(context_.physicalDevice(),
+                                             &queue_family_count,
+                                             queue_families.data());
+
+    timestamp_supported_ =
+        queue_families[context_.queueFamilyIndex()].timestampValidBits > 0;
+    timestamp_period_ = context_.properties().limits.timestampPeriod;
+    query_pool_       = VK_NULL_HANDLE;
+    if (!timestamp_supported_) {
+      printf("Timestamp queries are not supported on this queue.\n");
+      return;
     }
-#endif
 
-    // 拡張機能に対応しているか
-    const bool extensions_supported = CheckDeviceExtensionSupport(device);
-
-    return condition0 && extensions_supported;
+    // 最大で 比較用の2次元版 + 水平 + 垂直 の3パス分 (+1 は開始時刻)
+    VkQueryPoolCreateInfo query_pool_create_info = {};
+    query_pool_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_pool_create_info.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+    query_pool_create_info.queryCount = 4;
+    VK_CHECK_RESULT(vkCreateQueryPool(device, &query_pool_create_info, nullptr,
+                                      &query_pool_));
   }
-  bool CheckDeviceExtensionSupport(const VkPhysicalDevice device) {
-    uint32_t extension_count;
-    vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
-                                         nullptr);
 
-    std::vector<VkExtensionProperties> available_extensions(extension_count);
-    vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
-                                         available_extensions.data());
+  void createCommandBuffer() {
+    /*
+    Now allocate a command buffer from the command pool of the context.
+    */
+    commandBuffer = context_.allocateCommandBuffer();
+
+    /*
+    Now we shall start recording commands into the newly allocated command
+    buffer.
+    */
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = 0;  // 計測のために複数回投入することがある
+    VK_CHECK_RESULT(vkBeginCommandBuffer(
+        commandBuffer, &beginInfo));  // start recording commands.
 
-    std::unordered_set<std::string> required_extensions(
-        device_extensions_.begin(), device_extensions_.end());
+    // 入力画像を staging から DEVICE_LOCAL なバッファにコピーする
+    // (パスの計測には含めない)
+    context_.recordUpload(commandBuffer, src_buffer_, src_buffer_size_);
 
-#ifndef NDEBUG
-    printf("----- Available Extensions -----\n");
-    for (const auto& extension : available_extensions) {
-      printf("     -- %s\n", extension.extensionName);
+    pass_names_.clear();
+    if (timestamp_supported_) {
+      vkCmdResetQueryPool(commandBuffer, query_pool_, 0, 4);
+      vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                          query_pool_, 0);
     }
-#endif
 
-    for (const auto& extension : available_extensions) {
-      required_extensions.erase(extension.extensionName);
+    if (options_.compare) {
+      recordPass(commandBuffer, "2d (ref)",
+                 getPipeline("gaussian_filter_grayscale"),
+                 reference_descriptor_set_, input_img_width_,
+                 input_img_height_, true);
     }
-
-    for (const auto& extension_name : required_extensions) {
-      fprintf(stderr, "not find Extension : %s\n", extension_name.c_str());
+    recordFilter(commandBuffer, input_img_width_, input_img_height_,
+                 descriptor_set_, horizontal_descriptor_set_,
+                 vertical_descriptor_set_, true);
+
+    // 結果をホストから読めるようにする
+    context_.recordDownload(commandBuffer, dst_buffer_, dst_buffer_size_);
+    if (options_.compare) {
+      context_.recordDownload(commandBuffer, ref_buffer_, dst_buffer_size_);
     }
 
-    return required_extensions.empty();
+    VK_CHECK_RESULT(
+        vkEndCommandBuffer(commandBuffer));  // end recording commands.
   }
 
-  // Returns the index of a queue family that supports compute operations.
-  uint32_t getComputeQueueFamilyIndex() {
-    uint32_t queueFamilyCount;
-
-    vkGetPhysicalDeviceQueueFamilyProperties(physical_device_,
-                                             &queueFamilyCount, NULL);
-
-    // Retrieve all queue families.
-    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(
-        physical_device_, &queueFamilyCount, queueFamilies.data());
-
-    // Now find a family that supports compute.
-    uint32_t i = 0;
-    for (; i < queueFamilies.size(); ++i) {
-      VkQueueFamilyProperties props = queueFamilies[i];
+  // 選択したモードのパスを command_buffer に記録する
+  void recordFilter(VkCommandBuffer command_buffer, const uint32_t width,
+                    const uint32_t height, VkDescriptorSet descriptor_set,
+                    VkDescriptorSet horizontal_descriptor_set,
+                    VkDescriptorSet vertical_descriptor_set,
+                    const bool write_timestamps) {
+    if (options_.mode == FilterMode::k2D) {
+      recordPass(command_buffer, "2d",
+                 getPipeline("gaussian_filter_grayscale"), descriptor_set,
+                 width, height, write_timestamps);
+    } else if (options_.mode == FilterMode::kTiled) {
+      recordPass(command_buffer, "tiled",
+                 getPipeline("gaussian_filter_grayscale_tiled"),
+                 descriptor_set, width, height, write_timestamps);
+    } else if (options_.mode == FilterMode::kSeparable) {
+      recordPass(command_buffer, "horizontal",
+                 getPipeline("gaussian_filter_horizontal_grayscale"),
+                 horizontal_descriptor_set, width, height, write_timestamps);
+
+      // 垂直方向のパスは水平方向のパスの結果(tmp)を読むので、
+      // 書き込みが完了して見えるようになるまで待つ
+      VkMemoryBarrier memory_barrier = {};
+      memory_barrier.sType           = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      memory_barrier.srcAccessMask   = VK_ACCESS_SHADER_WRITE_BIT;
+      memory_barrier.dstAccessMask   = VK_ACCESS_SHADER_READ_BIT;
+      vkCmdPipelineBarrier(command_buffer,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                           &memory_barrier, 0, nullptr, 0, nullptr);
+
+      recordPass(command_buffer, "vertical",
+                 getPipeline("gaussian_filter_vertical_grayscale"),
+                 vertical_descriptor_set, width, height, write_timestamps);
+    }
+  }
 
-      if (props.queueCount > 0 && (props.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
-        // found a queue with compute. We're done!
-        break;
+  void recordPass(VkCommandBuffer command_buffer, const char* name,
+                  VkPipeline pipeline, VkDescriptorSet descriptor_set,
+                  const uint32_t width, const uint32_t height,
+                  const bool write_timestamps) {
+    MyPushConstant my_push_constant;
+    my_push_constant.w     = width;
+    my_push_constant.h     = height;
+    my_push_constant.sigma = options_.sigma;
+
+    // パイプラインと descriptor set をバインドし、Push Constantの値を
+    // セットしてからディスパッチする
+    kernel_->dispatch(command_buffer, pipeline, descriptor_set,
+                      &my_push_constant,
+                      (uint32_t)ceil(width / float(options_.workgroup_x)),
+                      (uint32_t)ceil(height / float(options_.workgroup_y)));
+
+    // このパスが終わった時刻を記録する
+    if (write_timestamps) {
+      pass_names_.emplace_back(name);
+      if (timestamp_supported_) {
+        vkCmdWriteTimestamp(command_buffer,
+                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, query_pool_,
+                            pass_names_.size());
       }
     }
+  }
 
-    if (i == queueFamilies.size()) {
-      throw std::runtime_error(
-          "could not find a queue family that supports operations");
+  void uploadSrcImgToDevice(void) {
+    // デコードした画素をグレースケールに変換しながら、map したバッファ
+    // (staging を使う場合は staging) に直接書き込む
+    // DEVICE_LOCAL なバッファへのコピーは command buffer に記録してある
+    const size_t num_pixels = size_t(input_img_width_) * input_img_height_;
+    const auto begin        = std::chrono::steady_clock::now();
+    if (!clspv_test::convertToGrayscale(
+            input_img_buf_.data(), input_img_channels_, num_pixels,
+            reinterpret_cast<unsigned char*>(src_buffer_.mapped))) {
+      throw std::runtime_error("Image is broken.");
     }
+    const double ms = clspv_test::elapsedMs(begin);
+    printf("Host upload: %.3f ms (%.3f ms/MP, %s)\n", ms,
+           ms / (num_pixels * 1e-6), clspv_test::grayscaleIsaName());
+  }
 
-    return i;
+  void uploadWeightsToDevice(void) {
+    // 1次元のガウス関数の重み (CPU 版と同じもの)
+    const std::vector<float> weights =
+        clspv_test::computeGaussianWeights(options_.sigma, options_.radius);
+    memcpy(weights_buffer_.mapped, weights.data(),
+           sizeof(float) * weights.size());
+
+    // 重みは1度だけ DEVICE_LOCAL なバッファにコピーする
+    if (weights_buffer_.staged()) {
+      VkCommandBuffer command_buffer = context_.allocateCommandBuffer();
+
+      VkCommandBufferBeginInfo begin_info = {};
+      begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+      VK_CHECK_RESULT(vkBeginCommandBuffer(command_buffer, &begin_info));
+      context_.recordUpload(command_buffer, weights_buffer_,
+                            weights_buffer_size_);
+      VK_CHECK_RESULT(vkEndCommandBuffer(command_buffer));
+      context_.submitAndWait(command_buffer);
+      vkFreeCommandBuffers(device, context_.commandPool(), 1,
+                           &command_buffer);
+    }
   }
 
-  void createDevice() {
-    /*
-    We create the logical device in this function.
-    */
+  void accumulatePassTimes(void) {
+    if (!timestamp_supported_) {
+      return;
+    }
 
-    /*
-    When creating the device, we also specify what queues it has.
-    */
-    VkDeviceQueueCreateInfo queueCreateInfo = {};
-    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queueFamilyIndex = getComputeQueueFamilyIndex();  // find queue family with
-                                                      // compute capability.
-    queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
-    queueCreateInfo.queueCount =
-        1;  // create one queue in this family. We don't need more.
-    float queuePriorities =
-        1.0;  // we only have one queue, so this is not that imporant.
-    queueCreateInfo.pQueuePriorities = &queuePriorities;
-
-    // Device Feature を指定する
-    //
-    // 8bitのshader interfaceに対応するために
-    // VkPhysicalDevice8BitStorageFeaturesを使う
-    VkPhysicalDevice8BitStorageFeatures device_8bit_storage_features = {};
-    device_8bit_storage_features.sType =
-        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_8BIT_STORAGE_FEATURES;
-
-    // さらに、SPIR-Vで OpCapability Int8 に対応するために
-    // VkPhysicalDeviceShaderFloat16Int8Features を使う
-    VkPhysicalDeviceShaderFloat16Int8Features
-        device_shader_float16_int8_features = {};
-    device_shader_float16_int8_features.sType =
-        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_FLOAT16_INT8_FEATURES;
-
-    // VkPhysicalDevice8BitStorageFeaturesとVkPhysicalDeviceShaderFloat16Int8Features
-    // を調べるためにVkPhysicalDeviceFeatures2を作成
-    // VkPhysicalDeviceFeatures2とVkPhysicalDeviceFeaturesの違いpNextが使えるか使えないか
-    // 既存のVkPhysicalDeviceFeaturesはメンバにある
-    // pNextにVkPhysicalDevice8BitStorageFeaturesを指定
-    // さらにそのpNextにVkPhysicalDeviceShaderFloat16Int8Featuresを指定
-    VkPhysicalDeviceFeatures2 device_features2 = {};
-    device_features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
-    device_features2.pNext =
-        reinterpret_cast<void*>(&device_8bit_storage_features);
-    device_8bit_storage_features.pNext =
-        reinterpret_cast<void*>(&(device_shader_float16_int8_features));
-
-    // Featureの情報を得る
-    vkGetPhysicalDeviceFeatures2(physical_device_, &device_features2);
+    // 開始時刻 + 各パスの終了時刻
+    std::vector<uint64_t> timestamps(pass_names_.size() + 1);
+    VK_CHECK_RESULT(vkGetQueryPoolResults(
+        device, query_pool_, 0, timestamps.size(),
+        sizeof(uint64_t) * timestamps.size(), timestamps.data(),
+        sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+    for (size_t i = 0; i < pass_names_.size(); ++i) {
+      pass_times_ms_[i] += double(timestamps[i + 1] - timestamps[i]) *
+                           timestamp_period_ * 1e-6;
+    }
+  }
 
-#ifndef NDEBUG
-    printf("----- VkPhysicalDevice8BitStorageFeatures -----\n");
-    printf("     - storageBuffer8BitAccess           -> %s.\n",
-           device_8bit_storage_features.storageBuffer8BitAccess ? "OK" : "NO");
-    printf("     - uniformAndStorageBuffer8BitAccess -> %s.\n",
-           device_8bit_storage_features.uniformAndStorageBuffer8BitAccess
-               ? "OK"
-               : "NO");
-    printf("     - storagePushConstant8              -> %s.\n",
-           device_8bit_storage_features.storagePushConstant8 ? "OK" : "NO");
-#endif
-    // 8bitのstrage bufferが利用できない場合、例外を投げる
-    if (!device_8bit_storage_features.storageBuffer8BitAccess) {
-      throw std::runtime_error("Cannot use 8bit strage Buffer\n");
+  void printPassTimes(void) {
+    if (!timestamp_supported_) {
+      return;
     }
 
-#ifndef NDEBUG
-    printf("----- VkPhysicalDeviceShaderFloat16Int8Features -----\n");
-    printf("     - shaderFloat16 -> %s.\n",
-           device_shader_float16_int8_features.shaderFloat16 ? "OK" : "NO");
-    printf("     - shaderInt8    -> %s.\n",
-           device_shader_float16_int8_features.shaderInt8 ? "OK" : "NO");
-#endif
-    // SPIR-Vで OpCapability Int8が利用できない場合、例外を投げる
-    if (!device_shader_float16_int8_features.shaderInt8) {
-      throw std::runtime_error("Cannot use OpCapability Int8\n");
+    const double num_pixels =
+        double(input_img_width_) * double(input_img_height_);
+
+    printf("----- Pass Times (%ux%u, average of %d runs) -----\n",
+           input_img_width_, input_img_height_, options_.repeat);
+    double total_ms = 0.0;
+    for (size_t i = 0; i < pass_names_.size(); ++i) {
+      const double ms = pass_times_ms_[i] / options_.repeat;
+      printf("     - %-10s : %8.3f ms (%8.1f Mpix/s)\n",
+             pass_names_[i].c_str(), ms, num_pixels / (ms * 1e3));
+      if (!options_.compare || i > 0) {
+        total_ms += ms;
+      }
+    }
+    if (options_.mode == FilterMode::kSeparable) {
+      // 水平 + 垂直 の合計
+      printf("     - %-10s : %8.3f ms (%8.1f Mpix/s)\n", "separable",
+             total_ms, num_pixels / (total_ms * 1e3));
     }
+  }
+
+  void compareWithReference(void) {
+    // 2次元版(ref)と選択したモード(dst)の結果を比較する
+    // 分離型は浮動小数点の加算順序が異なるため、丸めで 1 ずれる画素がありうる
+    const unsigned char* ref =
+        reinterpret_cast<const unsigned char*>(ref_buffer_.mapped);
+    const unsigned char* dst =
+        reinterpret_cast<const unsigned char*>(dst_buffer_.mapped);
+    printDiff(std::string("2d vs ") + filterModeName(options_.mode), ref, dst,
+              dst_buffer_size_);
+
+    // CPU 版 (分離型) とも比較する
+    // 入力はアップロードしたグレースケール画像 (src_buffer_ は map したまま)
+    std::vector<unsigned char> cpu_dst(dst_buffer_size_);
+    clspv_test::ThreadPool pool(numCpuThreads(options_));
+    clspv_test::gaussianFilterCpu(
+        reinterpret_cast<const unsigned char*>(src_buffer_.mapped),
+        cpu_dst.data(), input_img_width_, input_img_height_, options_.sigma,
+        options_.radius, pool);
+    printDiff(std::string("cpu vs ") + filterModeName(options_.mode),
+              cpu_dst.data(), dst, dst_buffer_size_);
+  }
 
+  void runCommandBuffer() {
     /*
-    Now we create the logical device. The logical device allows us to interact
-    with the physical device.
+    Now we shall finally submit the recorded command buffer to a queue,
+    and wait for the fence.
     */
-    VkDeviceCreateInfo device_create_info = {};
-
-    device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    device_create_info.enabledLayerCount =
-        enabledLayers
-            .size();  // need to specify validation layers here as well.
-    device_create_info.ppEnabledLayerNames = enabledLayers.data();
-    device_create_info.pQueueCreateInfos =
-        &queueCreateInfo;  // when creating the logical device, we also specify
-                           // what queues it has.
-    device_create_info.queueCreateInfoCount = 1;
-    device_create_info.pEnabledFeatures     = &(device_features2.features);
-
-    device_create_info.pNext = &(
-        device_8bit_storage_features);  // VkPhysicalDevice8BitStorageFeaturesはpNextに指定する
-                                        // 先程、VkPhysicalDevice8BitStorageFeaturesの
-                                        // pNextにVkPhysicalDeviceShaderFloat16Int8Featuresも渡したので、
-                                        // そちらもvkCreateDeviceに渡される
-
-    // 拡張を指定
-    device_create_info.enabledExtensionCount =
-        static_cast<uint32_t>(device_extensions_.size());
-    device_create_info.ppEnabledExtensionNames = device_extensions_.data();
-
-    VK_CHECK_RESULT(vkCreateDevice(physical_device_, &device_create_info, NULL,
-                                   &device));  // create logical device.
-
-    // Get a handle to the only member of the queue family.
-    vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
+    const auto begin = std::chrono::steady_clock::now();
+    context_.submitAndWait(commandBuffer);
+    dispatch_ms_.emplace_back(clspv_test::elapsedMs(begin));
   }
 
-  // find memory type with desired properties.
-  uint32_t findMemoryType(uint32_t memoryTypeBits,
-                          VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memoryProperties;
+  // バッチモード:
+  // Vulkan の初期化は1度だけ行い、ring_size 個のスロットを使い回す。
+  // デコード, アップロードと投入, 完了待ちとダウンロード, エンコード を
+  // それぞれ別のスレッドで行い、フレーム n + 1 のアップロード中に
+  // フレーム n を計算し、フレーム n - 1 をダウンロードする。
+  void runBatch(const std::vector<std::string>& input_filepaths,
+                const std::string& output_dirpath, const size_t ring_size) {
+    validateOptions();
 
-    vkGetPhysicalDeviceMemoryProperties(physical_device_, &memoryProperties);
+    const auto setup_begin = std::chrono::steady_clock::now();
+    createComputePipeline();
+    timestamp_supported_ = false;  // バッチモードではパスごとの計測はしない
+
+    weights_buffer_size_ = sizeof(float) * (2 * MAX_GAUSSIAN_RADIUS + 1);
+    weights_buffer_      = context_.createStagedBuffer(weights_buffer_size_);
+    uploadWeightsToDevice();
+    createBatchSlots(ring_size);
+    const auto setup_end = std::chrono::steady_clock::now();
+
+    BoundedQueue<Image> decoded_images(ring_size);
+    BoundedQueue<Image> filtered_images(ring_size);
+    // 空いているスロットと、投入済みで完了を待っているスロットの番号
+    BoundedQueue<size_t> free_slots(ring_size);
+    BoundedQueue<size_t> submitted_slots(ring_size);
+    for (size_t i = 0; i < ring_size; ++i) {
+      free_slots.push(i);
+    }
 
-    /*
-    How does this search work?
-    See the documentation of VkPhysicalDeviceMemoryProperties for a detailed
-    description.
-    */
-    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
-      if ((memoryTypeBits & (1 << i)) &&
-          ((memoryProperties.memoryTypes[i].propertyFlags & properties) ==
-           properties))
-        return i;
+    // ステージごとのレイテンシ [ms] (それぞれ1つのスレッドだけが書き込む)
+    std::vector<double> decode_ms, slot_wait_ms, upload_ms, gpu_ms,
+        download_ms, encode_ms;
+
+    std::thread decoder([&] {
+      for (const auto& input_filepath : input_filepaths) {
+        const auto begin = std::chrono::steady_clock::now();
+        Image image;
+        if (decodePng(input_filepath, &image)) {
+          decode_ms.emplace_back(clspv_test::elapsedMs(begin));
+          decoded_images.push(std::move(image));
+        }
+      }
+      decoded_images.close();
+    });
+
+    // 投入した順に完了を待ち、結果を取り出してスロットを空ける
+    std::thread collector([&] {
+      size_t index;
+      while (submitted_slots.pop(index)) {
+        BatchSlot& slot = batch_slots_[index];
+        waitBatchSlot(slot);
+        gpu_ms.emplace_back(clspv_test::elapsedMs(slot.submit_time));
+
+        const auto begin = std::chrono::steady_clock::now();
+        Image image  = downloadBatchSlot(slot);
+        download_ms.emplace_back(clspv_test::elapsedMs(begin));
+
+        free_slots.push(index);
+        filtered_images.push(std::move(image));
+      }
+      filtered_images.close();
+    });
+
+    std::thread encoder([&] {
+      // 符号化はこのスレッドと pool のスレッドで行う
+      clspv_test::ThreadPool pool(numCpuThreads(options_));
+      Image image;
+      while (filtered_images.pop(image)) {
+        const auto begin = std::chrono::steady_clock::now();
+        const std::string output_filepath =
+            (std::filesystem::path(output_dirpath) /
+             std::filesystem::path(image.name).filename())
+                .string();
+        encodeGrayscalePng(output_filepath, image.pixels.data(), image.width,
+                           image.height, pool);
+        encode_ms.emplace_back(clspv_test::elapsedMs(begin));
+      }
+    });
+
+    // 空いたスロットにアップロードして投入する
+    // (キューへの投入はこのスレッドだけが行う)
+    size_t num_frames = 0;
+    Image image;
+    while (decoded_images.pop(image)) {
+      auto begin = std::chrono::steady_clock::now();
+      size_t index;
+      free_slots.pop(index);
+      slot_wait_ms.emplace_back(clspv_test::elapsedMs(begin));
+
+      begin = std::chrono::steady_clock::now();
+      submitBatchSlot(batch_slots_[index], std::move(image), num_frames + 1);
+      upload_ms.emplace_back(clspv_test::elapsedMs(begin));
+
+      submitted_slots.push(index);
+      ++num_frames;
     }
-    return -1;
+    submitted_slots.close();
+
+    decoder.join();
+    collector.join();
+    encoder.join();
+    const auto batch_end = std::chrono::steady_clock::now();
+
+    // コンテキストの作成も準備に含める
+    const double setup_ms =
+        context_.takeCreationTimeMs() +
+        std::chrono::duration<double, std::milli>(setup_end - setup_begin)
+            .count();
+    const double batch_s =
+        std::chrono::duration<double>(batch_end - setup_end).count();
+    printf("----- Batch (%s, ring %zu) -----\n", filterModeName(options_.mode),
+           ring_size);
+    printf("     - setup  : %8.3f ms (pipeline cache : %s)\n", setup_ms,
+           kernel_->pipelineCacheState());
+    const char* sync_name = batch_timeline_semaphore_ != VK_NULL_HANDLE
+                                ? "timeline semaphore"
+                                : "fence per slot";
+    printf("     - sync   : %s\n", sync_name);
+    printf("     - frames : %zu in %.3f s (%.2f fps)\n", num_frames, batch_s,
+           num_frames / batch_s);
+    printf("----- Stage latency -----\n");
+    clspv_test::printLatencyHistogram("decode   ", decode_ms);
+    clspv_test::printLatencyHistogram("slot wait", slot_wait_ms);
+    clspv_test::printLatencyHistogram("upload   ", upload_ms);
+    clspv_test::printLatencyHistogram("gpu      ", gpu_ms);
+    clspv_test::printLatencyHistogram("download ", download_ms);
+    clspv_test::printLatencyHistogram("encode   ", encode_ms);
+
+    cleanupBatch();
   }
 
-  void createBuffer() {
-    /*
-    We will now create a buffer.
-    */
-
-    /////////////////// src(input) buffer ////////////////////////////////////
-    VkBufferCreateInfo src_buffer_create_info = {};
-    src_buffer_size_ =
-        sizeof(decltype(input_img_buf_)::value_type) * input_img_buf_.size();
-    src_buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    src_buffer_create_info.size  = src_buffer_size_;
-    src_buffer_create_info.usage =
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;  // buffer is used as a storage
-                                             // buffer.
-    src_buffer_create_info.sharingMode =
-        VK_SHARING_MODE_EXCLUSIVE;  // buffer is exclusive to a single queue
-                                    // family at a time.
-                                    //
-    VK_CHECK_RESULT(vkCreateBuffer(device, &src_buffer_create_info, NULL,
-                                   &src_buffer_));  // create buffer.
-
-    //バッファ自身でメモリを確保しないので、手動で確保する必要がある
-
-    // まずバッファが要求するメモリ要件を調べる
-    VkMemoryRequirements src_memory_requirements;
-    vkGetBufferMemoryRequirements(
-        /*VkDevice device                          =*/device,
-        /*VkBuffer buffer                          =*/src_buffer_,
-        /*VkMemoryRequirements *pMemoryRequirements=*/&src_memory_requirements);
-
-    // バッファのためメモリ確保のためにメモリ要件を用いる
-    VkMemoryAllocateInfo src_allocate_info = {};
-    src_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    src_allocate_info.allocationSize =
-        src_memory_requirements.size;  // 要求されたメモリを指定する
-
-    // 確保できるメモリにはいくつか種類があり、選択する必要がある
-    //
-    // 1) メモリ要件を満たすもの(memory_requirements.memoryTypeBit)
-    // 2) このプログラムの用途を満たすもの
-    //
-    //  (vkMapMemoryを使ってCPUからGPUにバッファメモリを読み込めるようするため、
-    //   VK_MEMORY_PROPERTY_HOST_VISIBLE_BITを設定する)
-    src_allocate_info.memoryTypeIndex =
-        findMemoryType(src_memory_requirements.memoryTypeBits,
-                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-
-    // デバイス上のメモリを確保する
-    VK_CHECK_RESULT(vkAllocateMemory(
-        /*VkDevice device                          =*/device,
-        /*const VkMemoryAllocateInfo *pAllocateInfo=*/&src_allocate_info,
-        /*const VkAllocationCallbacks *pAllocator  =*/
-        nullptr,  // ここにアロケータを渡すとCPUメモリも確保できる
-        /*VkDeviceMemory *pMemory                  =*/&src_buffer_memory_));
-
-    // 確保したメモリとバッファを関連付ける
-    // これによって実際のメモリによってバッファが使えるようになる
-    VK_CHECK_RESULT(
-        vkBindBufferMemory(/*VkDevice device          =*/device,
-                           /*VkBuffer buffer          =*/src_buffer_,
-                           /*VkDeviceMemory memory    =*/src_buffer_memory_,
-                           /*VkDeviceSize memoryOffset=*/0))
-    /////////////////// dst(output) buffer ///////////////////////////////////
-    VkBufferCreateInfo dst_buffer_create_info = {};
-    dst_buffer_size_ =
-        sizeof(decltype(input_img_buf_)::value_type) *
-        input_img_buf_.size();  // Output is the same size as input.
-
-    dst_buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    dst_buffer_create_info.size  = dst_buffer_size_,
-    dst_buffer_create_info.usage =
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;  // buffer is used as a storage
-                                             // buffer.
-    dst_buffer_create_info.sharingMode =
-        VK_SHARING_MODE_EXCLUSIVE;  // buffer is exclusive to a single queue
-                                    // family at a time.
-
-    VK_CHECK_RESULT(vkCreateBuffer(device, &dst_buffer_create_info, NULL,
-                                   &dst_buffer_));  // create buffer.
-
-    //バッファ自身でメモリを確保しないので、手動で確保する必要がある
-
-    // まずバッファが要求するメモリ要件を調べる
-    VkMemoryRequirements dst_memory_requirements;
-    vkGetBufferMemoryRequirements(
-        /*VkDevice device                          =*/device,
-        /*VkBuffer buffer                          =*/dst_buffer_,
-        /*VkMemoryRequirements *pMemoryRequirements=*/&dst_memory_requirements);
-
-    // バッファのためメモリ確保のためにメモリ要件を用いる
-    VkMemoryAllocateInfo dst_allocate_info = {};
-    dst_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    dst_allocate_info.allocationSize =
-        dst_memory_requirements.size;  // 要求されたメモリを指定する
-
-    // 確保できるメモリにはいくつか種類があり、選択する必要がある
-    //
-    // 1) メモリ要件を満たすもの(memory_requirements.memoryTypeBit)
-    // 2) このプログラムの用途を満たすもの
-    //
-    //  (vkMapMemoryを使ってGPUからCPUにバッファメモリを読み込めるようするため、
-    //   VK_MEMORY_PROPERTY_HOST_VISIBLE_BITを設定する)
-    //
-    // また、VK_MEMORY_PROPERTY_HOST_COHERENT_BITを設定しておくと、
-    // デバイス（GPU）によって書き込まれたメモリは、余分なフラッシュコマンドを呼び出さなくても、
-    // ホスト（CPU）から簡単に見えるようになる
-    // 従って、便利なので、このフラグを設定する。
-    dst_allocate_info.memoryTypeIndex =
-        findMemoryType(dst_memory_requirements.memoryTypeBits,
-                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
-                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-
-    // デバイス上のメモリを確保する
-    VK_CHECK_RESULT(vkAllocateMemory(
-        /*VkDevice device                          =*/device,
-        /*const VkMemoryAllocateInfo *pAllocateInfo=*/&dst_allocate_info,
-        /*const VkAllocationCallbacks *pAllocator  =*/
-        nullptr,  // ここにアロケータを渡すとCPUメモリも確保できる
-        /*VkDeviceMemory *pMemory                  =*/&dst_buffer_memory_));
+  void createBatchSlots(const size_t ring_size) {
+    // スロットごとに src->dst, 水平方向, 垂直方向 の3つの descriptor set
+    descriptor_pool_ = context_.createDescriptorPool(3 * ring_size, 3);
+
+    batch_slots_.resize(ring_size);
+    for (size_t i = 0; i < ring_size; ++i) {
+      BatchSlot& slot     = batch_slots_[i];
+      slot.descriptor_set = kernel_->allocateDescriptorSet(descriptor_pool_);
+      slot.horizontal_descriptor_set =
+          kernel_->allocateDescriptorSet(descriptor_pool_);
+      slot.vertical_descriptor_set =
+          kernel_->allocateDescriptorSet(descriptor_pool_);
+      slot.command_buffer = context_.allocateCommandBuffer();
+
+      slot.fence = VK_NULL_HANDLE;
+      if (!context_.timelineSemaphoreSupported()) {
+        VkFenceCreateInfo fence_create_info = {};
+        fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VK_CHECK_RESULT(
+            vkCreateFence(device, &fence_create_info, nullptr, &slot.fence));
+      }
+    }
 
-    VK_CHECK_RESULT(
-        vkBindBufferMemory(/*VkDevice device          =*/device,
-                           /*VkBuffer buffer          =*/dst_buffer_,
-                           /*VkDeviceMemory memory    =*/dst_buffer_memory_,
-                           /*VkDeviceSize memoryOffset=*/0))
+    batch_timeline_semaphore_ = VK_NULL_HANDLE;
+    if (context_.timelineSemaphoreSupported()) {
+      batch_timeline_semaphore_ = context_.createTimelineSemaphore(0);
+    }
   }
 
-  void createDescriptorSetLayout() {
-    // この関数で  descriptor setのレイアウトを指定する
-    // これは descriptorとシェーダーのリソースを結びつけることを可能にする
-
-    // binding point 0と1に紐付けるVK_DESCRIPTOR_TYPE_STORAGE_BUFFERを指定する
-    // これはcompute shader の
-    //
-    // layout(set=*, binding = 0) buffer buf
-    //
-    // に結び付けられる
-    //
-    // dst -> 0
-    // src -> 1
-
-    std::vector<VkDescriptorSetLayoutBinding>
-        bindings;  // ここにVkDescriptorSetLayoutBindingを入れてVkDescriptorSetLayoutCreateInfo
-                   // に渡す
-
-    VkDescriptorSetLayoutBinding dst_descriptor_set_layout_binding = {};
-    dst_descriptor_set_layout_binding.binding = 0;  // binding = 0
-    dst_descriptor_set_layout_binding.descriptorType =
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    dst_descriptor_set_layout_binding.descriptorCount = 1;
-    dst_descriptor_set_layout_binding.stageFlags =
-        VK_SHADER_STAGE_COMPUTE_BIT;  // Computeシェーダーで利用できるようにする
-    bindings.emplace_back(dst_descriptor_set_layout_binding);
-
-    VkDescriptorSetLayoutBinding src_descriptor_set_layout_binding = {};
-    src_descriptor_set_layout_binding.binding = 1;  // binding = 1
-    src_descriptor_set_layout_binding.descriptorType =
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    src_descriptor_set_layout_binding.descriptorCount = 1;
-    src_descriptor_set_layout_binding.stageFlags =
-        VK_SHADER_STAGE_COMPUTE_BIT;  // Computeシェーダーで利用できるようにする
-    bindings.emplace_back(src_descriptor_set_layout_binding);
-
-    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {};
-    descriptorSetLayoutCreateInfo.sType =
-        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    descriptorSetLayoutCreateInfo.bindingCount =
-        bindings.size();  // VkDescriptorSetLayoutBindingの数
-    descriptorSetLayoutCreateInfo.pBindings = bindings.data();
-
-    // Descriptor setを作成する
-    VK_CHECK_RESULT(vkCreateDescriptorSetLayout(
-        device, &descriptorSetLayoutCreateInfo, NULL, &descriptor_set_layout_));
+  void destroyBatchSlotBuffers(BatchSlot& slot) {
+    if (slot.capacity == 0) {
+      return;
+    }
+    context_.destroyStagedBuffer(slot.src_buffer);
+    context_.destroyStagedBuffer(slot.dst_buffer);
+    context_.destroyBuffer(slot.tmp_buffer);
+    slot.capacity = 0;
   }
 
-  void createDescriptorSet() {
-    // この関数でdescriptor setを確保する
-    // まずdescriptor poolを作る
-    //
-    // bindingするbufferの数以上のpool sizeを作る
-    std::vector<VkDescriptorPoolSize> pool_sizes;
-
-    // dst
-    pool_sizes.emplace_back();  // 追加
-    VkDescriptorPoolSize& dst_descriptor_pool_size =
-        pool_sizes.back();  // 追加したものへの参照
-    dst_descriptor_pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    dst_descriptor_pool_size.descriptorCount = 1;
-
-    // src
-    pool_sizes.emplace_back();  //追加
-    VkDescriptorPoolSize& src_descriptor_pool_size =
-        pool_sizes.back();  // 追加したものへの参照
-    src_descriptor_pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    src_descriptor_pool_size.descriptorCount = 1;
-
-    // Pool作成の情報
-    VkDescriptorPoolCreateInfo descriptor_pool_create_info = {};
-    descriptor_pool_create_info.sType =
-        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    descriptor_pool_create_info.maxSets =
-        1;  //  // poolから1つのdescriptor setを確保すれば良い
-    descriptor_pool_create_info.poolSizeCount = pool_sizes.size();
-    descriptor_pool_create_info.pPoolSizes    = pool_sizes.data();
-
-    // Descriptor poolを作成する
-    VK_CHECK_RESULT(vkCreateDescriptorPool(
-        /*VkDevice device                              =*/device,
-        /*const VkDescriptorPoolCreateInfo *pCreateInfo=*/
-        &descriptor_pool_create_info,
-        /*const VkAllocationCallbacks *pAllocator      =*/nullptr,
-        /*VkDescriptorPool *pDescriptorPool            =*/&descriptor_pool_));
-
-    // Poolが確保されたら、descriptor setをallocateする
-    VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {};
-    descriptor_set_allocate_info.sType =
-        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    descriptor_set_allocate_info.descriptorPool =
-        descriptor_pool_;  // どのプールから確保するか
-    descriptor_set_allocate_info.descriptorSetCount =
-        1;  // 一つのdescriptor setを確保する
-    descriptor_set_allocate_info.pSetLayouts =
-        &descriptor_set_layout_;  // レイアウトを指定
-
-    // allocate descriptor set.
-    VK_CHECK_RESULT(vkAllocateDescriptorSets(
-        /*VkDevice device                                 =*/device,
-        /*const VkDescriptorSetAllocateInfo *pAllocateInfo=*/
-        &descriptor_set_allocate_info,
-        /*VkDescriptorSet *pDescriptorSets                =*/&descriptor_set_));
-
-    //  descriptorとストレージバッファを紐付ける
-    //  descriptorのsetを更新するために vkUpdateDescriptorSets()関数を用いる
-
-    // descriptor setに書き込むものをセットしていく
-    std::vector<VkWriteDescriptorSet> write_descriptor_sets;
-
-    // descriptorに結びつけるバッファを指定する(dst)
-    write_descriptor_sets.emplace_back();             //追加
-    VkWriteDescriptorSet& dst_write_descriptor_set =  //追加したものへの参照
-        write_descriptor_sets.back();
-
-    VkDescriptorBufferInfo dst_descriptor_buffer_info = {};
-    dst_descriptor_buffer_info.buffer                 = dst_buffer_;
-    dst_descriptor_buffer_info.offset = 0;  // オフセットはなし
-    dst_descriptor_buffer_info.range  = dst_buffer_size_;
-
-    dst_write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    dst_write_descriptor_set.dstSet =
-        descriptor_set_;  //  書き込むdescriptor set
-    dst_write_descriptor_set.dstBinding      = 0;  // binding=0に紐付ける
-    dst_write_descriptor_set.descriptorCount = 1;
-    dst_write_descriptor_set.descriptorType =
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;  // storage buffer.
-    dst_write_descriptor_set.pBufferInfo = &dst_descriptor_buffer_info;
-
-    // descriptorに結びつけるバッファを指定する(src)
-    write_descriptor_sets.emplace_back();             //追加
-    VkWriteDescriptorSet& src_write_descriptor_set =  // 追加したものへの参照
-        write_descriptor_sets.back();
-
-    VkDescriptorBufferInfo src_descriptor_buffer_info = {};
-    src_descriptor_buffer_info.buffer                 = src_buffer_;
-    src_descriptor_buffer_info.offset = 0;  // オフセットはなし
-    src_descriptor_buffer_info.range  = src_buffer_size_;
-
-    src_write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    src_write_descriptor_set.dstSet =
-        descriptor_set_;  //  書き込むdescriptor set
-    src_write_descriptor_set.dstBinding      = 1;  // binding=1に紐付ける
-    src_write_descriptor_set.descriptorCount = 1;
-    src_write_descriptor_set.descriptorType =
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;  // storage buffer.
-    src_write_descriptor_set.pBufferInfo = &src_descriptor_buffer_info;
-
-    // descriptor setの更新を行う
-    vkUpdateDescriptorSets(
-        /*VkDevice device                              =*/device,
-        /*uint32_t descriptorWriteCount                =*/
-        write_descriptor_sets.size(),
-        /*const VkWriteDescriptorSet *pDescriptorWrites=*/
-        write_descriptor_sets.data(),
-        /*uint32_t descriptorCopyCount                 =*/0,  // コピーはしない
-        /*const VkCopyDescriptorSet *pDescriptorCopies =*/nullptr);
+  // num_pixels 画素の画像を処理できるようにスロットのバッファを確保する
+  // (スロットは処理中でないこと)
+  void reserveBatchSlot(BatchSlot& slot, const size_t num_pixels) {
+    if (num_pixels <= slot.capacity) {
+      return;
+    }
+    destroyBatchSlotBuffers(slot);
+
+    const VkDeviceSize img_size = num_pixels;
+    const VkDeviceSize tmp_size = sizeof(float) * num_pixels;
+    slot.src_buffer = context_.createStagedBuffer(img_size);
+    slot.dst_buffer = context_.createStagedBuffer(img_size);
+    slot.tmp_buffer = context_.createDeviceLocalBuffer(tmp_size);
+    slot.capacity   = num_pixels;
+
+    writeDescriptorSet(slot.descriptor_set, slot.dst_buffer.device.buffer,
+                       img_size, slot.src_buffer.device.buffer, img_size);
+    writeDescriptorSet(slot.horizontal_descriptor_set, slot.tmp_buffer.buffer,
+                       tmp_size, slot.src_buffer.device.buffer, img_size);
+    writeDescriptorSet(slot.vertical_descriptor_set,
+                       slot.dst_buffer.device.buffer, img_size,
+                       slot.tmp_buffer.buffer, tmp_size);
   }
 
-  // Read file into array of bytes, and cast to uint32_t*, then return.
-  // The data has been padded, so that it fits into an array uint32_t.
-  uint32_t* readFile(uint32_t& length, const char* filename) {
-    FILE* fp = fopen(filename, "rb");
-    if (fp == NULL) {
-      printf("Could not find or open file: %s\n", filename);
+  // 画像をアップロードし、コマンドを記録して投入する (完了は待たない)
+  // グレースケールへの変換は map したバッファに直接書き込みながら行う
+  // timeline semaphore を使う場合は完了時に timeline_value を signal する
+  void submitBatchSlot(BatchSlot& slot, Image image,
+                       const uint64_t timeline_value) {
+    const size_t num_pixels = size_t(image.width) * image.height;
+    reserveBatchSlot(slot, num_pixels);
+    clspv_test::convertToGrayscale(
+        image.pixels.data(), image.channels, num_pixels,
+        reinterpret_cast<unsigned char*>(slot.src_buffer.mapped));
+
+    VK_CHECK_RESULT(vkResetCommandBuffer(slot.command_buffer, 0));
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK_RESULT(vkBeginCommandBuffer(slot.command_buffer, &begin_info));
+    context_.recordUpload(slot.command_buffer, slot.src_buffer, num_pixels);
+    recordFilter(slot.command_buffer, image.width, image.height,
+                 slot.descriptor_set, slot.horizontal_descriptor_set,
+                 slot.vertical_descriptor_set, false);
+    context_.recordDownload(slot.command_buffer, slot.dst_buffer, num_pixels);
+    VK_CHECK_RESULT(vkEndCommandBuffer(slot.command_buffer));
+
+    VkSubmitInfo submit_info       = {};
+    submit_info.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers    = &slot.command_buffer;
+
+    VkTimelineSemaphoreSubmitInfo timeline_submit_info = {};
+    if (batch_timeline_semaphore_ != VK_NULL_HANDLE) {
+      timeline_submit_info.sType =
+          VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+      timeline_submit_info.signalSemaphoreValueCount = 1;
+      timeline_submit_info.pSignalSemaphoreValues    = &timeline_value;
+
+      submit_info.pNext                = &timeline_submit_info;
+      submit_info.signalSemaphoreCount = 1;
+      submit_info.pSignalSemaphores    = &batch_timeline_semaphore_;
     }
 
-    // get file size.
-    fseek(fp, 0, SEEK_END);
-    long filesize = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    long filesizepadded = long(ceil(filesize / 4.0)) * 4;
-
-    // read file contents.
-    char* str = new char[filesizepadded];
-    fread(str, filesize, sizeof(char), fp);
-    fclose(fp);
+    slot.image          = std::move(image);
+    slot.timeline_value = timeline_value;
+    slot.submit_time    = std::chrono::steady_clock::now();
+    VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submit_info, slot.fence));
+  }
 
-    // data padding.
-    for (int i = filesize; i < filesizepadded; i++) {
-      str[i] = 0;
+  // スロットの処理の完了を待つ
+  void waitBatchSlot(BatchSlot& slot) {
+    if (batch_timeline_semaphore_ != VK_NULL_HANDLE) {
+      context_.waitTimelineSemaphore(batch_timeline_semaphore_,
+                                     slot.timeline_value);
+    } else {
+      VK_CHECK_RESULT(
+          vkWaitForFences(device, 1, &slot.fence, VK_TRUE, 100000000000));
+      VK_CHECK_RESULT(vkResetFences(device, 1, &slot.fence));
     }
-
-    length = filesizepadded;
-    return (uint32_t*)str;
   }
 
-  void createComputePipeline() {
-    // この関数でcompute pipeline を作る
-
-    // まずSPIR-Vからshader modelを作成する
-    uint32_t file_length;
-    uint32_t* code = readFile(file_length, "./spirv/c/gaussian_filter.spv");
-
-    VkShaderModuleCreateInfo create_info = {};
-    create_info.sType    = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    create_info.pCode    = code;
-    create_info.codeSize = file_length;
-    VK_CHECK_RESULT(vkCreateShaderModule(device, &create_info, nullptr,
-                                         &compute_shader_module_));
-    delete[] code;
-
-    // 次にcomputeパイプラインを作る
-    // graphicsパイプラインよりcomputeパイプラインはシンプルである
-    // compute shaderは一つのステージのみである
-    //
-    // まずcomputeシェーダーのステージを指定する
-    // エントリーポイントは gaussian_filter7x7_glayscale
-    VkPipelineShaderStageCreateInfo shader_stage_create_info = {};
-    shader_stage_create_info.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    shader_stage_create_info.stage  = VK_SHADER_STAGE_COMPUTE_BIT;
-    shader_stage_create_info.module = compute_shader_module_;
-    shader_stage_create_info.pName  = "gaussian_filter7x7_glayscale";
-
-    // PipelineLayoutはPipelineがdescriptor setにアクセスすることを可能にする
-    // よって先に作ったdescriptor set layoutを指定する
-    VkPipelineLayoutCreateInfo pipeline_layout_create_info = {};
-    pipeline_layout_create_info.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipeline_layout_create_info.setLayoutCount = 1;
-    pipeline_layout_create_info.pSetLayouts    = &descriptor_set_layout_;
-
-    // 更に __globalでない引数は push constantsを用いて与えるのでその設定を行う
-
-    // PipelineLayoutで使用されるpush constantsのrangeを定義。
-    // 仕様では128 bitまでの大きさに対応となっているので、
-    // それより大きい場合はBufferを使うべき
-    //
-    // 具体的な値を指定する必要はない(Command Bufferの作成時に行う)
-    MyPushConstant my_push_constant = {};
-
-    VkPushConstantRange push_constant;
-    push_constant.offset = 0;  // オフセット
-    push_constant.size   = sizeof(MyPushConstant);
-    push_constant.stageFlags =
-        VK_SHADER_STAGE_COMPUTE_BIT;  // Compute shaderで利用
-
-    pipeline_layout_create_info.pPushConstantRanges    = &push_constant;
-    pipeline_layout_create_info.pushConstantRangeCount = 1;
-
-    // PipelineLayoutを作成する
-    VK_CHECK_RESULT(vkCreatePipelineLayout(
-        /*VkDevice device                              =*/device,
-        /*const VkPipelineLayoutCreateInfo *pCreateInfo=*/
-        &pipeline_layout_create_info,
-        /*const VkAllocationCallbacks *pAllocator      =*/nullptr,
-        /*VkPipelineLayout *pPipelineLayout            =*/&pipeline_layout_));
-
-    VkComputePipelineCreateInfo pipeline_create_info = {};
-    pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-    pipeline_create_info.stage = shader_stage_create_info;
-    pipeline_create_info.layout = pipeline_layout_;
-
-    // 最後にcomputeパイプラインを作成する
-    VK_CHECK_RESULT(vkCreateComputePipelines(
-        /*VkDevice device                                */ device,
-        /*VkPipelineCache pipelineCache                  */ VK_NULL_HANDLE,
-        /*uint32_t createInfoCount                       */ 1,
-        /*const VkComputePipelineCreateInfo *pCreateInfos*/
-        &pipeline_create_info,
-        /*const VkAllocationCallbacks *pAllocator        */ nullptr,
-        /*VkPipeline *pPipelines                         */ &pipeline_));
+  // 完了したスロットから結果を画像として取り出す
+  Image downloadBatchSlot(BatchSlot& slot) {
+    // 入力画像のバッファをそのまま出力に使う (グレースケールなので縮める)
+    Image image = std::move(slot.image);
+    image.pixels.resize(size_t(image.width) * image.height);
+    image.channels = 1;
+    memcpy(image.pixels.data(), slot.dst_buffer.mapped, image.pixels.size());
+    return image;
   }
 
-  void createCommandBuffer() {
-    /*
-    We are getting closer to the end. In order to send commands to the
-    device(GPU), we must first record commands into a command buffer. To
-    allocate a command buffer, we must first create a command pool. So let us do
-    that.
-    */
-    VkCommandPoolCreateInfo commandPoolCreateInfo = {};
-    commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    commandPoolCreateInfo.flags = 0;
-    // the queue family of this command pool. All command buffers allocated from
-    // this command pool, must be submitted to queues of this family ONLY.
-    commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
-    VK_CHECK_RESULT(vkCreateCommandPool(device, &commandPoolCreateInfo, NULL,
-                                        &commandPool));
+  void cleanupBatch() {
+    for (auto& slot : batch_slots_) {
+      destroyBatchSlotBuffers(slot);
+      if (slot.fence != VK_NULL_HANDLE) {
+        vkDestroyFence(device, slot.fence, nullptr);
+      }
+      vkFreeCommandBuffers(device, context_.commandPool(), 1,
+                           &slot.command_buffer);
+    }
+    batch_slots_.clear();
+    if (batch_timeline_semaphore_ != VK_NULL_HANDLE) {
+      vkDestroySemaphore(device, batch_timeline_semaphore_, nullptr);
+      batch_timeline_semaphore_ = VK_NULL_HANDLE;
+    }
 
-    /*
-    Now allocate a command buffer from the command pool.
-    */
-    VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
-    commandBufferAllocateInfo.sType =
-        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    commandBufferAllocateInfo.commandPool =
-        commandPool;  // specify the command pool to allocate from.
-    // if the command buffer is primary, it can be directly submitted to queues.
-    // A secondary buffer has to be called from some primary command buffer, and
-    // cannot be directly submitted to a queue. To keep things simple, we use a
-    // primary command buffer.
-    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    commandBufferAllocateInfo.commandBufferCount =
-        1;  // allocate a single command buffer.
-    VK_CHECK_RESULT(
-        vkAllocateCommandBuffers(device, &commandBufferAllocateInfo,
-                                 &commandBuffer));  // allocate command buffer.
+    context_.destroyStagedBuffer(weights_buffer_);
 
-    /*
-    Now we shall start recording commands into the newly allocated command
-    buffer.
-    */
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags =
-        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;  // the buffer is only
-                                                      // submitted and used once
-                                                      // in this application.
-    VK_CHECK_RESULT(vkBeginCommandBuffer(
-        commandBuffer, &beginInfo));  // start recording commands.
+    vkDestroyDescriptorPool(device, descriptor_pool_, nullptr);
+  }
 
+  void cleanup() {
     /*
-    We need to bind a pipeline, AND a descriptor set before we dispatch.
-
-    The validation layer will NOT give warnings if you forget these, so be very
-    careful not to forget them.
+    Clean up all Vulkan Resources.
     */
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-                            pipeline_layout_, 0, 1, &descriptor_set_, 0, NULL);
 
-    MyPushConstant my_push_constant;
-    my_push_constant.w     = input_img_width_;
-    my_push_constant.h     = input_img_height_;
-    my_push_constant.sigma = 10.0f;
+    // Buffer Memory
+    // // src buffer
+    context_.destroyStagedBuffer(src_buffer_);
+    // // dst buffer
+    context_.destroyStagedBuffer(dst_buffer_);
+    // // tmp buffer
+    context_.destroyBuffer(tmp_buffer_);
+    // // weights buffer
+    context_.destroyStagedBuffer(weights_buffer_);
+    // // ref buffer
+    if (options_.compare) {
+      context_.destroyStagedBuffer(ref_buffer_);
+    }
 
-    // Push Constantの値をセットするコマンドをBufferに渡す
-    vkCmdPushConstants(commandBuffer, pipeline_layout_,
-                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MyPushConstant),
-                       &my_push_constant);
+    // query pool
+    if (timestamp_supported_) {
+      vkDestroyQueryPool(device, query_pool_, nullptr);
+    }
 
-    /*
-    Calling vkCmdDispatch basically starts the compute pipeline, and executes
-    the compute shader. The number of workgroups is specified in the arguments.
-    If you are already familiar with compute shaders from OpenGL, this should be
-    nothing new to you.
-    */
-    vkCmdDispatch(commandBuffer,
-                  (uint32_t)ceil(input_img_width_ / float(WORKGROUP_SIZE)),
-                  (uint32_t)ceil(input_img_height_ / float(WORKGROUP_SIZE)), 1);
+    // descriptor
+    vkDestroyDescriptorPool(device, descriptor_pool_, nullptr);
 
-    VK_CHECK_RESULT(
-        vkEndCommandBuffer(commandBuffer));  // end recording commands.
+    // command buffer
+    // (command pool, pipeline, device は context_ が持つので解放しない)
+    vkFreeCommandBuffers(device, context_.commandPool(), 1, &commandBuffer);
   }
+};
 
-  void uploadSrcImgToDevice(void) {
-    void* mapped_memory = nullptr;
-    vkMapMemory(device, src_buffer_memory_, 0, src_buffer_size_, 0,
-                &mapped_memory);
-    decltype(input_img_buf_)::value_type* pmapped_memory =
-        reinterpret_cast<typename decltype(input_img_buf_)::value_type*>(
-            mapped_memory);
-
-    for (size_t i = 0; i < input_img_buf_.size(); ++i) {
-      pmapped_memory[i] = input_img_buf_[i];
+ComputeApplication::ComputeApplication(clspv_test::Context& context,
+                                       const std::string input_filepath,
+                                       const std::string output_filepath,
+                                       const FilterOptions& options)
+    : context_(context),
+      device(context.device()),
+      queue(context.queue()),
+      input_filepath_(input_filepath),
+      output_filepath_(output_filepath),
+      options_(options) {}
+
+ComputeApplication::ComputeApplication(clspv_test::Context& context,
+                                       const FilterOptions& options)
+    : context_(context),
+      device(context.device()),
+      queue(context.queue()),
+      options_(options) {}
+
+ComputeApplication::ComputeApplication(clspv_test::Context& context,
+                                       const uint32_t width,
+                                       const uint32_t height,
+                                       const FilterOptions& options)
+    : context_(context),
+      device(context.device()),
+      queue(context.queue()),
+      options_(options),
+      input_img_width_(width),
+      input_img_height_(height) {}
+
+// デコードした RGBA をアップロード用の map したバッファに書き込むまでの
+// ホスト側の時間を比較する
+//   before : RGBA をコピーしてスカラーで変換し、1byte ずつ map したバッファに
+//            コピーする (以前の実装)
+//   after  : map したバッファに SIMD で直接変換する
+void runHostUploadBenchmark(clspv_test::Context& context, const int repeat) {
+  const uint32_t sizes[][2] = {{1920, 1080}, {3840, 2160}, {7680, 4320}};
+  printf("----- Host upload (RGBA -> gray, %s, best of %d runs) -----\n",
+         clspv_test::grayscaleIsaName(), repeat);
+  for (const auto& size : sizes) {
+    const size_t num_pixels = size_t(size[0]) * size[1];
+    std::vector<unsigned char> rgba(4 * num_pixels);
+    std::mt19937 engine(0);
+    for (auto& v : rgba) {
+      v = static_cast<unsigned char>(engine());
     }
-    vkUnmapMemory(device, src_buffer_memory_);
-  }
-
-  void runCommandBuffer() {
-    /*
-    Now we shall finally submit the recorded command buffer to a queue.
-    */
+    clspv_test::StagedBuffer upload_buffer =
+        context.createStagedBuffer(num_pixels);
+    unsigned char* mapped =
+        reinterpret_cast<unsigned char*>(upload_buffer.mapped);
+
+    double before_ms = 1e30, after_ms = 1e30;
+    for (int i = 0; i < repeat; ++i) {
+      auto begin = std::chrono::steady_clock::now();
+      {
+        std::vector<unsigned char> tmp(rgba.begin(), rgba.end());
+        std::vector<unsigned char> gray(num_pixels);
+        clspv_test::convertToGrayscaleScalar(tmp.data(), 4, num_pixels,
+                                             gray.data());
+        for (size_t j = 0; j < num_pixels; ++j) {
+          mapped[j] = gray[j];
+        }
+      }
+      before_ms = std::min(before_ms, clspv_test::elapsedMs(begin));
 
-    VkSubmitInfo submitInfo       = {};
-    submitInfo.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;  // submit a single command buffer
-    submitInfo.pCommandBuffers =
-        &commandBuffer;  // the command buffer to submit.
+      begin = std::chrono::steady_clock::now();
+      clspv_test::convertToGrayscale(rgba.data(), 4, num_pixels, mapped);
+      after_ms = std::min(after_ms, clspv_test::elapsedMs(begin));
+    }
+    context.destroyStagedBuffer(upload_buffer);
+
+    const double mega_pixels = num_pixels * 1e-6;
+    printf(
+        "     - %4ux%-4u : before %8.3f ms (%.3f ms/MP), after %8.3f ms "
+        "(%.3f ms/MP)\n",
+        size[0], size[1], before_ms, before_ms / mega_pixels, after_ms,
+        after_ms / mega_pixels);
+  }
+}
 
-    /*
-      We create a fence.
-    */
-    VkFence fence;
-    VkFenceCreateInfo fenceCreateInfo = {};
-    fenceCreateInfo.sType             = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceCreateInfo.flags             = 0;
-    VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, NULL, &fence));
+// Vulkan を使わずに CPU でフィルタをかける (Vulkan の ICD がない環境用)
+int runCpu(const std::string& input_filepath,
+           const std::string& output_filepath, const FilterOptions& options) {
+  Image image;
+  if (!decodePng(input_filepath, &image)) {
+    return EXIT_FAILURE;
+  }
+  const size_t num_pixels = size_t(image.width) * image.height;
+  std::vector<unsigned char> gray(num_pixels), dst(num_pixels);
+  clspv_test::convertToGrayscale(image.pixels.data(), image.channels,
+                                 num_pixels, gray.data());
+
+  clspv_test::ThreadPool pool(numCpuThreads(options));
+  const auto begin = std::chrono::steady_clock::now();
+  clspv_test::gaussianFilterCpu(gray.data(), dst.data(), image.width,
+                                image.height, options.sigma, options.radius,
+                                pool);
+  const double ms = clspv_test::elapsedMs(begin);
+  printf("----- cpu (separable, %s, %zu threads) -----\n",
+         clspv_test::gaussianFilterCpuIsaName(), pool.numThreads());
+  printf("     - %ux%u : %8.3f ms (%8.1f Mpix/s)\n", image.width, image.height,
+         ms, num_pixels / (ms * 1e3));
+
+  encodeGrayscalePng(output_filepath, dst.data(), image.width, image.height,
+                     pool);
+  printf("Save filtered image as [%s].\n", output_filepath.c_str());
+  return EXIT_SUCCESS;
+}
 
-    /*
-    We submit the command buffer on the queue, at the same time giving a fence.
-    */
-    VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
-    /*
-    The command will not have finished executing until the fence is signalled.
-    So we wait here.
-    We will directly after this read our buffer from the GPU,
-    and we will not be sure that the command has finished executing unless we
-    wait for the fence. Hence, we use a fence here.
-    */
-    VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, 100000000000));
+// CPU 版のスレッド数に対するスケーリングを 4K のランダム画像で計測する
+// (1, 2, 4, ... スレッドと、options.num_threads (またはコア数))
+int runCpuBenchmark(const FilterOptions& options, const int repeat) {
+  const uint32_t width = 3840, height = 2160;
+  const size_t num_pixels = size_t(width) * height;
+  std::vector<unsigned char> src(num_pixels), dst(num_pixels);
+  std::mt19937 engine(0);
+  for (auto& v : src) {
+    v = static_cast<unsigned char>(engine());
+  }
 
-    vkDestroyFence(device, fence, NULL);
+  const size_t max_threads = numCpuThreads(options);
+  std::vector<size_t> thread_counts;
+  for (size_t n = 1; n < max_threads; n *= 2) {
+    thread_counts.emplace_back(n);
+  }
+  thread_counts.emplace_back(max_threads);
+
+  printf("----- cpu (separable, %s, radius %d, %ux%u, best of %d runs) -----\n",
+         clspv_test::gaussianFilterCpuIsaName(), options.radius, width, height,
+         repeat);
+  double single_thread_ms = 0.0;
+  for (const size_t num_threads : thread_counts) {
+    clspv_test::ThreadPool pool(num_threads);
+    double best_ms = 1e30;
+    for (int i = 0; i < repeat; ++i) {
+      const auto begin = std::chrono::steady_clock::now();
+      clspv_test::gaussianFilterCpu(src.data(), dst.data(), width, height,
+                                    options.sigma, options.radius, pool);
+      best_ms = std::min(best_ms, clspv_test::elapsedMs(begin));
+    }
+    if (num_threads == 1) {
+      single_thread_ms = best_ms;
+    }
+    const double speedup = single_thread_ms / best_ms;
+    printf(
+        "     - %3zu threads : %8.3f ms (%8.1f Mpix/s, x%.2f, efficiency "
+        "%3.0f%%)\n",
+        num_threads, best_ms, num_pixels / (best_ms * 1e3), speedup,
+        100.0 * speedup / num_threads);
   }
+  return EXIT_SUCCESS;
+}
 
-  void cleanup() {
-    /*
-    Clean up all Vulkan Resources.
-    */
+// 1080p, 4K, 8K のランダム画像で、2次元版と各モードのスループットを比較する
+// コンテキストは全ての実行で使い回す
+int runBenchmark(const int repeat, const bool use_pipeline_cache) {
+  const uint32_t sizes[][2] = {{1920, 1080}, {3840, 2160}, {7680, 4320}};
+  try {
+    clspv_test::Context context(/*require_int8=*/true, use_pipeline_cache);
+    runHostUploadBenchmark(context, repeat);
+    for (const FilterMode mode :
+         {FilterMode::kTiled, FilterMode::kSeparable}) {
+      for (const auto& size : sizes) {
+        FilterOptions options;
+        options.mode    = mode;
+        options.compare = true;
+        options.repeat         = repeat;
+        options.pipeline_cache = use_pipeline_cache;
+        ComputeApplication app(context, size[0], size[1], options);
+        app.run();
+      }
+    }
+  } catch (const std::runtime_error& e) {
+    printf("%s\n", e.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
 
-    if (enableValidationLayers) {
-      // destroy callback.
-      auto func = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(
-          instance, "vkDestroyDebugReportCallbackEXT");
-      if (func == nullptr) {
-        throw std::runtime_error(
-            "Could not load vkDestroyDebugReportCallbackEXT");
+// input がディレクトリならその中の *.png を、ファイルなら1行1パスの
+// リストとして読み込む
+// 出力は出力先ディレクトリに入力と同じファイル名で保存するので、
+// ファイル名が重複する (a/img.png と b/img.png など) 場合はエラーにする
+std::vector<std::string> listInputFiles(const std::string& input) {
+  std::vector<std::string> filepaths;
+  if (std::filesystem::is_directory(input)) {
+    for (const auto& entry : std::filesystem::directory_iterator(input)) {
+      if (entry.is_regular_file() && entry.path().extension() == ".png") {
+        filepaths.emplace_back(entry.path().string());
       }
-      func(instance, debugReportCallback, NULL);
     }
+    std::sort(filepaths.begin(), filepaths.end());
+  } else {
+    std::ifstream ifs(input);
+    if (!ifs) {
+      throw std::runtime_error("Faild to open file list. (" + input + ")");
+    }
+    std::string line;
+    while (std::getline(ifs, line)) {
+      if (!line.empty()) {
+        filepaths.emplace_back(line);
+      }
+    }
+  }
 
-    // Buffer Memory
-    // // src buffer
-    vkFreeMemory(device, src_buffer_memory_, nullptr);
-    vkDestroyBuffer(device, src_buffer_, nullptr);
-    // // dst buffer
-    vkFreeMemory(device, dst_buffer_memory_, nullptr);
-    vkDestroyBuffer(device, dst_buffer_, nullptr);
+  std::map<std::string, std::string> filepath_by_name;
+  for (const auto& filepath : filepaths) {
+    const std::string name =
+        std::filesystem::path(filepath).filename().string();
+    const auto inserted = filepath_by_name.emplace(name, filepath);
+    if (!inserted.second) {
+      throw std::runtime_error("Duplicate output file name " + name +
+                               ". (" + inserted.first->second + ", " +
+                               filepath + ")");
+    }
+  }
+  return filepaths;
+}
 
-    // shader module
-    vkDestroyShaderModule(device, compute_shader_module_, NULL);
+// 複数の画像をまとめて処理する
+// oneshot が true の場合は、比較のために1枚ごとにコンテキストと
+// ComputeApplication を作る
+int runBatch(const std::string& input, const std::string& output_dirpath,
+             const FilterOptions& options, const size_t ring_size,
+             const bool oneshot) {
+  try {
+    const std::vector<std::string> input_filepaths = listInputFiles(input);
+    std::filesystem::create_directories(output_dirpath);
+
+    if (!oneshot) {
+      clspv_test::Context context(/*require_int8=*/true,
+                                  options.pipeline_cache);
+      ComputeApplication app(context, options);
+      app.runBatch(input_filepaths, output_dirpath, ring_size);
+      return EXIT_SUCCESS;
+    }
 
-    // descriptor
-    vkDestroyDescriptorPool(device, descriptor_pool_, nullptr);
-    vkDestroyDescriptorSetLayout(device, descriptor_set_layout_, nullptr);
-
-    // pipeline
-    vkDestroyPipelineLayout(device, pipeline_layout_, NULL);
-    vkDestroyPipeline(device, pipeline_, NULL);
-
-    // command pool
-    vkDestroyCommandPool(device, commandPool, NULL);
-#if 0
-    vkDestroyShaderModule(device, computeShaderModule, NULL);
-    vkDestroyDescriptorPool(device, descriptorPool, NULL);
-    vkDestroyDescriptorSetLayout(device, descriptor_set_layout_, nullptr);
-    vkDestroyPipelineLayout(device, pipelineLayout, NULL);
-    vkDestroyPipeline(device, pipeline, NULL);
-    vkDestroyCommandPool(device, commandPool, NULL);
-#endif
-    vkDestroyDevice(device, NULL);
-    vkDestroyInstance(instance, NULL);
+    const auto begin = std::chrono::steady_clock::now();
+    for (const auto& input_filepath : input_filepaths) {
+      const std::string output_filepath =
+          (std::filesystem::path(output_dirpath) /
+           std::filesystem::path(input_filepath).filename())
+              .string();
+      clspv_test::Context context(/*require_int8=*/true,
+                                  options.pipeline_cache);
+      ComputeApplication app(context, input_filepath, output_filepath,
+                             options);
+      app.run();
+    }
+    const double elapsed_s = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - begin)
+                                 .count();
+    printf("----- One-shot (%s) -----\n", filterModeName(options.mode));
+    printf("     - frames : %zu in %.3f s (%.2f fps)\n",
+           input_filepaths.size(), elapsed_s,
+           input_filepaths.size() / elapsed_s);
+  } catch (const std::exception& e) {
+    printf("%s\n", e.what());
+    return EXIT_FAILURE;
   }
-};
-
-ComputeApplication::ComputeApplication(const std::string input_filepath,
-                                       const std::string output_filepath)
-    : input_filepath_(input_filepath), output_filepath_(output_filepath) {}
+  return EXIT_SUCCESS;
+}
 
-int main() {
+// usage: gaussian_filter [2d|separable|tiled] [--compare] [--radius R]
+//                        [--sigma S] [--workgroup WxH] [--no-pipeline-cache]
+//        gaussian_filter --cpu [--threads N] [--radius R] [--sigma S]
+//        gaussian_filter bench [--no-pipeline-cache]
+//        gaussian_filter bench-cpu [--threads N] [--radius R] [--sigma S]
+//        gaussian_filter batch <input dir|file list> <output dir> [--ring N]
+//                        [--oneshot] [2d|separable|tiled] [--radius R] ...
+int main(int argc, char** argv) {
   const std::string input_filepath  = "src.png";
   const std::string output_filepath = "dst.png";
-  ComputeApplication app(input_filepath, output_filepath);
+
+  FilterOptions options;
+  bool batch     = false;
+  bool oneshot   = false;
+  bool bench     = false;
+  bool bench_cpu = false;
+  int ring       = 3;
+  std::vector<std::string> positional_args;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "2d") {
+      options.mode = FilterMode::k2D;
+    } else if (arg == "separable") {
+      options.mode = FilterMode::kSeparable;
+    } else if (arg == "tiled") {
+      options.mode = FilterMode::kTiled;
+    } else if (arg == "--compare") {
+      options.compare = true;
+    } else if (arg == "--radius" && i + 1 < argc) {
+      options.radius = std::atoi(argv[++i]);
+    } else if (arg == "--sigma" && i + 1 < argc) {
+      options.sigma = std::atof(argv[++i]);
+    } else if (arg == "--workgroup" && i + 1 < argc &&
+               sscanf(argv[i + 1], "%ux%u", &options.workgroup_x,
+                      &options.workgroup_y) == 2) {
+      ++i;
+    } else if (arg == "--no-pipeline-cache") {
+      options.pipeline_cache = false;
+    } else if (arg == "--cpu") {
+      options.cpu = true;
+    } else if (arg == "--threads" && i + 1 < argc) {
+      options.num_threads = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "bench") {
+      bench = true;
+    } else if (arg == "bench-cpu") {
+      bench_cpu = true;
+    } else if (arg == "batch") {
+      batch = true;
+    } else if (arg == "--oneshot") {
+      oneshot = true;
+    } else if (arg == "--ring" && i + 1 < argc) {
+      ring = std::max(1, std::atoi(argv[++i]));
+    } else if (batch && arg[0] != '-') {
+      positional_args.emplace_back(arg);
+    } else {
+      printf(
+          "usage: %s [2d|separable|tiled] [--compare] [--radius R] "
+          "[--sigma S] [--workgroup WxH] [--no-pipeline-cache]\n",
+          argv[0]);
+      printf("       %s --cpu [--threads N] [--radius R] [--sigma S]\n",
+             argv[0]);
+      printf("       %s bench [--no-pipeline-cache]\n", argv[0]);
+      printf("       %s bench-cpu [--threads N] [--radius R] [--sigma S]\n",
+             argv[0]);
+      printf(
+          "       %s batch <input dir|file list> <output dir> [--ring N] "
+          "[--oneshot] [filter options]\n",
+          argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  try {
+    validateFilterOptions(options);
+  } catch (const std::runtime_error& e) {
+    printf("%s\n", e.what());
+    return EXIT_FAILURE;
+  }
+
+  if (bench) {
+    return runBenchmark(10, options.pipeline_cache);
+  }
+  if (bench_cpu) {
+    return runCpuBenchmark(options, 5);
+  }
+  if (batch) {
+    if (positional_args.size() != 2) {
+      printf("batch requires <input dir|file list> and <output dir>\n");
+      return EXIT_FAILURE;
+    }
+    if (options.cpu) {
+      printf("--cpu is not supported in batch mode\n");
+      return EXIT_FAILURE;
+    }
+    return runBatch(positional_args[0], positional_args[1], options, ring,
+                    oneshot);
+  }
+  if (options.cpu) {
+    return runCpu(input_filepath, output_filepath, options);
+  }
 
   try {
+    clspv_test::Context context(/*require_int8=*/true, options.pipeline_cache);
+    ComputeApplication app(context, input_filepath, output_filepath, options);
     app.run();
   } catch (const std::runtime_error& e) {
     printf("%s\n", e.what());
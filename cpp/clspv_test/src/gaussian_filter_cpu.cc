@@ -0,0 +1,286 @@
+/*
+MIT License
+
+Copyright (c) 2022 kyawakyawa
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "gaussian_filter_cpu.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+// x86-64 では SSE2 が常に使える。AVX2 の関数は target 属性でコンパイルし、
+// 実行時に __builtin_cpu_supports で選ぶ
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define CLSPV_TEST_GAUSSIAN_CPU_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__)  // GCC, Clang (target 属性と __builtin_cpu_supports)
+#define CLSPV_TEST_GAUSSIAN_CPU_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CLSPV_TEST_GAUSSIAN_CPU_NEON
+#include <arm_neon.h>
+#endif
+
+namespace clspv_test {
+
+namespace {
+
+// 1つのタスクで処理する行数
+// 帯の上下 radius 行分の横方向の畳み込みは隣の帯と重複して計算する
+const uint32_t kBandRows = 32;
+
+/*
+kLanes 画素分の float をまとめて扱うための関数群
+(SIMD 版とスカラー版で同じ順序で加算し、結果を一致させる)
+*/
+#if defined(CLSPV_TEST_GAUSSIAN_CPU_SSE2)
+const uint32_t kLanes = 4;
+typedef __m128 VecF;
+inline VecF setZero() { return _mm_setzero_ps(); }
+inline VecF set1(const float v) { return _mm_set1_ps(v); }
+inline VecF add(const VecF a, const VecF b) { return _mm_add_ps(a, b); }
+inline VecF mul(const VecF a, const VecF b) { return _mm_mul_ps(a, b); }
+inline VecF loadF(const float* p) { return _mm_loadu_ps(p); }
+inline void storeF(float* p, const VecF v) { _mm_storeu_ps(p, v); }
+inline VecF loadU8(const unsigned char* p) {
+  int32_t bytes;
+  memcpy(&bytes, p, sizeof(bytes));
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i v    = _mm_unpacklo_epi16(
+      _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+  return _mm_cvtepi32_ps(v);
+}
+// 小数点以下を切り捨て、0..255 に飽和させて書き込む
+inline void storeU8(unsigned char* p, const VecF v) {
+  const __m128i i16 = _mm_packs_epi32(_mm_cvttps_epi32(v), _mm_setzero_si128());
+  const int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(i16, i16));
+  memcpy(p, &bytes, sizeof(bytes));
+}
+const char* kIsaName = "sse2";
+#elif defined(CLSPV_TEST_GAUSSIAN_CPU_NEON)
+const uint32_t kLanes = 4;
+typedef float32x4_t VecF;
+inline VecF setZero() { return vdupq_n_f32(0.f); }
+inline VecF set1(const float v) { return vdupq_n_f32(v); }
+inline VecF add(const VecF a, const VecF b) { return vaddq_f32(a, b); }
+inline VecF mul(const VecF a, const VecF b) { return vmulq_f32(a, b); }
+inline VecF loadF(const float* p) { return vld1q_f32(p); }
+inline void storeF(float* p, const VecF v) { vst1q_f32(p, v); }
+inline VecF loadU8(const unsigned char* p) {
+  uint32_t bytes;
+  memcpy(&bytes, p, sizeof(bytes));
+  const uint16x8_t v = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(bytes)));
+  return vcvtq_f32_u32(vmovl_u16(vget_low_u16(v)));
+}
+// 小数点以下を切り捨て、0..255 に飽和させて書き込む
+inline void storeU8(unsigned char* p, const VecF v) {
+  const uint16x4_t i16 = vqmovun_s32(vcvtq_s32_f32(v));
+  const uint8x8_t i8   = vqmovn_u16(vcombine_u16(i16, i16));
+  vst1_lane_u32(reinterpret_cast<uint32_t*>(p), vreinterpret_u32_u8(i8), 0);
+}
+const char* kIsaName = "neon";
+#else
+const uint32_t kLanes = 1;
+typedef float VecF;
+inline VecF setZero() { return 0.f; }
+inline VecF set1(const float v) { return v; }
+inline VecF add(const VecF a, const VecF b) { return a + b; }
+inline VecF mul(const VecF a, const VecF b) { return a * b; }
+inline VecF loadF(const float* p) { return *p; }
+inline void storeF(float* p, const VecF v) { *p = v; }
+inline VecF loadU8(const unsigned char* p) { return float(*p); }
+inline void storeU8(unsigned char* p, const VecF v) {
+  *p = static_cast<unsigned char>(std::min(255, std::max(0, int(v))));
+}
+const char* kIsaName = "scalar";
+#endif
+
+#ifdef CLSPV_TEST_GAUSSIAN_CPU_AVX2
+/*
+horizontalRow, verticalRow の AVX2 版 (8画素ずつ)。処理した画素数を返す。
+FMA は使わずに乗算と加算を分け、スカラー版と同じ結果にする。
+*/
+__attribute__((target("avx2"))) uint32_t horizontalRowAvx2(
+    const unsigned char* padded, float* out, const uint32_t w,
+    const float* weights, const int radius) {
+  uint32_t x = 0;
+  for (; x + 8 <= w; x += 8) {
+    __m256 sum = _mm256_setzero_ps();
+    for (int k = 0; k <= 2 * radius; ++k) {
+      const __m128i v =
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(padded + x + k));
+      const __m256 vf = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v));
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[k]), vf));
+    }
+    _mm256_storeu_ps(out + x, sum);
+  }
+  return x;
+}
+
+__attribute__((target("avx2"))) uint32_t verticalRowAvx2(
+    const float* const* rows, unsigned char* out, const uint32_t w,
+    const float* weights, const int radius) {
+  uint32_t x = 0;
+  for (; x + 8 <= w; x += 8) {
+    __m256 sum = _mm256_setzero_ps();
+    for (int k = 0; k <= 2 * radius; ++k) {
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[k]),
+                                             _mm256_loadu_ps(rows[k] + x)));
+    }
+    // 小数点以下を切り捨て、0..255 に飽和させて書き込む
+    const __m256i i   = _mm256_cvttps_epi32(sum);
+    const __m128i i16 = _mm_packs_epi32(_mm256_castsi256_si128(i),
+                                        _mm256_extracti128_si256(i, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x),
+                     _mm_packus_epi16(i16, i16));
+  }
+  return x;
+}
+
+bool hasAvx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+#endif  // CLSPV_TEST_GAUSSIAN_CPU_AVX2
+
+// 横方向: padded (左右に radius 画素の 0 を足した行) -> out (w 画素)
+void horizontalRow(const unsigned char* padded, float* out, const uint32_t w,
+                   const float* weights, const int radius) {
+  uint32_t x = 0;
+#ifdef CLSPV_TEST_GAUSSIAN_CPU_AVX2
+  if (hasAvx2()) {
+    x = horizontalRowAvx2(padded, out, w, weights, radius);
+  }
+#endif
+  for (; x + kLanes <= w; x += kLanes) {
+    VecF sum = setZero();
+    for (int k = 0; k <= 2 * radius; ++k) {
+      sum = add(sum, mul(set1(weights[k]), loadU8(padded + x + k)));
+    }
+    storeF(out + x, sum);
+  }
+  for (; x < w; ++x) {
+    float sum = 0.f;
+    for (int k = 0; k <= 2 * radius; ++k) {
+      sum += weights[k] * float(padded[x + k]);
+    }
+    out[x] = sum;
+  }
+}
+
+// 縦方向: rows[k] (k = 0..2 radius, 画像外の行は 0) -> out (w 画素)
+void verticalRow(const float* const* rows, unsigned char* out,
+                 const uint32_t w, const float* weights, const int radius) {
+  uint32_t x = 0;
+#ifdef CLSPV_TEST_GAUSSIAN_CPU_AVX2
+  if (hasAvx2()) {
+    x = verticalRowAvx2(rows, out, w, weights, radius);
+  }
+#endif
+  for (; x + kLanes <= w; x += kLanes) {
+    VecF sum = setZero();
+    for (int k = 0; k <= 2 * radius; ++k) {
+      sum = add(sum, mul(set1(weights[k]), loadF(rows[k] + x)));
+    }
+    storeU8(out + x, sum);
+  }
+  for (; x < w; ++x) {
+    float sum = 0.f;
+    for (int k = 0; k <= 2 * radius; ++k) {
+      sum += weights[k] * rows[k][x];
+    }
+    out[x] = static_cast<unsigned char>(std::min(255, std::max(0, int(sum))));
+  }
+}
+
+}  // namespace
+
+std::vector<float> computeGaussianWeights(const float sigma,
+                                          const int radius) {
+  const float norm_factor     = 0.15915494309189534561f;  // 1 / 2 * pi
+  const float inv_sigma       = 1.0f / sigma;
+  const float half_inv_simga2 = 0.5f * inv_sigma * inv_sigma;
+  const float scale           = std::sqrt(norm_factor * inv_sigma);
+
+  std::vector<float> weights(2 * radius + 1);
+  for (int k = -radius; k <= radius; ++k) {
+    const float kf       = static_cast<float>(k);
+    weights[k + radius] = scale * std::exp(-kf * kf * half_inv_simga2);
+  }
+  return weights;
+}
+
+void gaussianFilterCpu(const unsigned char* src, unsigned char* dst,
+                       const uint32_t w, const uint32_t h, const float sigma,
+                       const int radius, ThreadPool& pool) {
+  const std::vector<float> weights = computeGaussianWeights(sigma, radius);
+  const uint32_t num_bands         = (h + kBandRows - 1) / kBandRows;
+
+  pool.parallelFor(num_bands, [&](const size_t band) {
+    const int y_begin = int(band * kBandRows);
+    const int y_end   = std::min(int(h), y_begin + int(kBandRows));
+    // 帯の上下 radius 行も含めた横方向の結果 (画像外の行は 0)
+    const int tmp_rows = y_end - y_begin + 2 * radius;
+
+    // 作業用のバッファはスレッドごとに使い回す
+    thread_local std::vector<unsigned char> padded;
+    thread_local std::vector<float> tmp;
+    thread_local std::vector<const float*> rows;
+    padded.assign(w + 2 * radius, 0);
+    tmp.resize(size_t(tmp_rows) * w);
+    rows.resize(2 * radius + 1);
+
+    for (int i = 0; i < tmp_rows; ++i) {
+      const int y    = y_begin - radius + i;
+      float* tmp_row = tmp.data() + size_t(i) * w;
+      if (y < 0 || int(h) <= y) {
+        std::fill(tmp_row, tmp_row + w, 0.f);
+        continue;
+      }
+      memcpy(padded.data() + radius, src + size_t(y) * w, w);
+      horizontalRow(padded.data(), tmp_row, w, weights.data(), radius);
+    }
+
+    for (int y = y_begin; y < y_end; ++y) {
+      for (int k = 0; k <= 2 * radius; ++k) {
+        rows[k] = tmp.data() + size_t(y - y_begin + k) * w;
+      }
+      verticalRow(rows.data(), dst + size_t(y) * w, w, weights.data(),
+                  radius);
+    }
+  });
+}
+
+const char* gaussianFilterCpuIsaName() {
+#ifdef CLSPV_TEST_GAUSSIAN_CPU_AVX2
+  if (hasAvx2()) {
+    return "avx2";
+  }
+#endif
+  return kIsaName;
+}
+
+}  // namespace clspv_test
@@ -0,0 +1,61 @@
+/*
+MIT License
+
+Copyright (c) 2022 kyawakyawa
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifndef CLSPV_TEST_GAUSSIAN_FILTER_CPU_H_
+#define CLSPV_TEST_GAUSSIAN_FILTER_CPU_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace clspv_test {
+
+// 1次元のガウス関数の重み weights[radius + k] (k = -radius..radius)
+//
+// 2次元版の重み
+//   norm_factor / sigma * exp(-(x^2 + y^2) / (2 sigma^2))
+// が g(x) * g(y) になるように、
+//   g(k) = sqrt(norm_factor / sigma) * exp(-k^2 / (2 sigma^2))
+// とする (GPU の分離型にも同じ重みを渡す)
+std::vector<float> computeGaussianWeights(const float sigma, const int radius);
+
+// CPU で分離型のガウシアンフィルタをかける (src, dst はグレースケール)
+//
+// gaussian_filter_horizontal_grayscale / gaussian_filter_vertical_grayscale
+// と同じ計算 (画像外は 0, k の昇順に加算, 小数点以下は切り捨て) を行う。
+// 画像を行の帯 (タイル) に分け、帯ごとに pool のスレッドで処理する。
+// 各帯の中では SIMD で横方向の複数画素をまとめて計算する。
+void gaussianFilterCpu(const unsigned char* src, unsigned char* dst,
+                       const uint32_t w, const uint32_t h, const float sigma,
+                       const int radius, ThreadPool& pool);
+
+// gaussianFilterCpu() が使う命令セットの名前
+const char* gaussianFilterCpuIsaName();
+
+}  // namespace clspv_test
+
+#endif  // CLSPV_TEST_GAUSSIAN_FILTER_CPU_H_
@@ -0,0 +1,253 @@
+/*
+MIT License
+
+Copyright (c) 2022 kyawakyawa
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "grayscale.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#define CLSPV_TEST_GRAYSCALE_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__)  // GCC, Clang (target 属性と __builtin_cpu_supports)
+#define CLSPV_TEST_GRAYSCALE_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CLSPV_TEST_GRAYSCALE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace clspv_test {
+
+namespace {
+
+// スカラー版と SIMD 版で同じ順序 ((r * kR + g * kG) + b * kB) で計算する
+// (FMA を使うと丸めが変わるので、乗算と加算は分ける)
+const float kR = 0.3f;
+const float kG = 0.59f;
+const float kB = 0.11f;
+
+inline unsigned char luma(const unsigned char* p) {
+  float vf = 0.f;
+  vf += kR * float(p[0]);
+  vf += kG * float(p[1]);
+  vf += kB * float(p[2]);
+  return static_cast<unsigned char>(vf);
+}
+
+void convertScalar(const unsigned char* src, const uint32_t channels,
+                   size_t begin, const size_t end, unsigned char* dst) {
+  for (; begin < end; ++begin) {
+    dst[begin] = luma(src + begin * channels);
+  }
+}
+
+#ifdef CLSPV_TEST_GRAYSCALE_SSE2
+// RGBA 4画素 (16 byte) -> 4画素分の int32
+inline __m128i lumaRgba4Sse2(const unsigned char* src) {
+  const __m128i mask = _mm_set1_epi32(0xff);
+  const __m128i v    = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+  const __m128 r     = _mm_cvtepi32_ps(_mm_and_si128(v, mask));
+  const __m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 8), mask));
+  const __m128 b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 16), mask));
+  const __m128 y =
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(kR)),
+                            _mm_mul_ps(g, _mm_set1_ps(kG))),
+                 _mm_mul_ps(b, _mm_set1_ps(kB)));
+  return _mm_cvttps_epi32(y);
+}
+
+// RGBA を 16画素ずつ変換し、変換した画素数を返す
+size_t convertRgbaSse2(const unsigned char* src, const size_t num_pixels,
+                       unsigned char* dst) {
+  size_t i = 0;
+  for (; i + 16 <= num_pixels; i += 16) {
+    const unsigned char* p = src + 4 * i;
+    const __m128i y01 =
+        _mm_packs_epi32(lumaRgba4Sse2(p), lumaRgba4Sse2(p + 16));
+    const __m128i y23 =
+        _mm_packs_epi32(lumaRgba4Sse2(p + 32), lumaRgba4Sse2(p + 48));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_packus_epi16(y01, y23));
+  }
+  return i;
+}
+#endif  // CLSPV_TEST_GRAYSCALE_SSE2
+
+#ifdef CLSPV_TEST_GRAYSCALE_AVX2
+// RGBA 8画素 (32 byte) -> 8画素分の int32
+__attribute__((target("avx2"))) inline __m256i lumaRgba8Avx2(
+    const unsigned char* src) {
+  const __m256i mask = _mm256_set1_epi32(0xff);
+  const __m256i v =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+  const __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(v, mask));
+  const __m256 g =
+      _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 8), mask));
+  const __m256 b =
+      _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 16), mask));
+  const __m256 y =
+      _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r, _mm256_set1_ps(kR)),
+                                  _mm256_mul_ps(g, _mm256_set1_ps(kG))),
+                    _mm256_mul_ps(b, _mm256_set1_ps(kB)));
+  return _mm256_cvttps_epi32(y);
+}
+
+// RGBA を 32画素ずつ変換し、変換した画素数を返す
+__attribute__((target("avx2"))) size_t convertRgbaAvx2(
+    const unsigned char* src, const size_t num_pixels, unsigned char* dst) {
+  // pack はレーン (128bit) ごとに行われるので、最後に 32bit 単位で並べ直す
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  size_t i            = 0;
+  for (; i + 32 <= num_pixels; i += 32) {
+    const unsigned char* p = src + 4 * i;
+    const __m256i y01 =
+        _mm256_packs_epi32(lumaRgba8Avx2(p), lumaRgba8Avx2(p + 32));
+    const __m256i y23 =
+        _mm256_packs_epi32(lumaRgba8Avx2(p + 64), lumaRgba8Avx2(p + 96));
+    const __m256i y = _mm256_permutevar8x32_epi32(
+        _mm256_packus_epi16(y01, y23), order);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), y);
+  }
+  return i;
+}
+
+bool hasAvx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+#endif  // CLSPV_TEST_GRAYSCALE_AVX2
+
+#ifdef CLSPV_TEST_GRAYSCALE_NEON
+// 4画素分の r, g, b (uint16) -> 4画素分の uint32
+inline uint32x4_t lumaNeon(const uint16x4_t r, const uint16x4_t g,
+                           const uint16x4_t b) {
+  const float32x4_t rf = vcvtq_f32_u32(vmovl_u16(r));
+  const float32x4_t gf = vcvtq_f32_u32(vmovl_u16(g));
+  const float32x4_t bf = vcvtq_f32_u32(vmovl_u16(b));
+  const float32x4_t y =
+      vaddq_f32(vaddq_f32(vmulq_n_f32(rf, kR), vmulq_n_f32(gf, kG)),
+                vmulq_n_f32(bf, kB));
+  return vcvtq_u32_f32(y);  // 0 方向への丸め
+}
+
+// 16画素分の r, g, b -> 16画素分のグレースケール
+inline uint8x16_t lumaNeon(const uint8x16_t r, const uint8x16_t g,
+                           const uint8x16_t b) {
+  const uint16x8_t r_lo = vmovl_u8(vget_low_u8(r));
+  const uint16x8_t r_hi = vmovl_u8(vget_high_u8(r));
+  const uint16x8_t g_lo = vmovl_u8(vget_low_u8(g));
+  const uint16x8_t g_hi = vmovl_u8(vget_high_u8(g));
+  const uint16x8_t b_lo = vmovl_u8(vget_low_u8(b));
+  const uint16x8_t b_hi = vmovl_u8(vget_high_u8(b));
+  const uint16x8_t y_lo = vcombine_u16(
+      vmovn_u32(lumaNeon(vget_low_u16(r_lo), vget_low_u16(g_lo),
+                         vget_low_u16(b_lo))),
+      vmovn_u32(lumaNeon(vget_high_u16(r_lo), vget_high_u16(g_lo),
+                         vget_high_u16(b_lo))));
+  const uint16x8_t y_hi = vcombine_u16(
+      vmovn_u32(lumaNeon(vget_low_u16(r_hi), vget_low_u16(g_hi),
+                         vget_low_u16(b_hi))),
+      vmovn_u32(lumaNeon(vget_high_u16(r_hi), vget_high_u16(g_hi),
+                         vget_high_u16(b_hi))));
+  return vcombine_u8(vmovn_u16(y_lo), vmovn_u16(y_hi));
+}
+
+// RGB / RGBA を 16画素ずつ変換し、変換した画素数を返す
+size_t convertNeon(const unsigned char* src, const uint32_t channels,
+                   const size_t num_pixels, unsigned char* dst) {
+  size_t i = 0;
+  if (channels == 4) {
+    for (; i + 16 <= num_pixels; i += 16) {
+      const uint8x16x4_t rgba = vld4q_u8(src + 4 * i);
+      vst1q_u8(dst + i, lumaNeon(rgba.val[0], rgba.val[1], rgba.val[2]));
+    }
+  } else if (channels == 3) {
+    for (; i + 16 <= num_pixels; i += 16) {
+      const uint8x16x3_t rgb = vld3q_u8(src + 3 * i);
+      vst1q_u8(dst + i, lumaNeon(rgb.val[0], rgb.val[1], rgb.val[2]));
+    }
+  }
+  return i;
+}
+#endif  // CLSPV_TEST_GRAYSCALE_NEON
+
+}  // namespace
+
+bool convertToGrayscaleScalar(const unsigned char* src,
+                              const uint32_t channels, const size_t num_pixels,
+                              unsigned char* dst) {
+  if (channels == 1) {
+    memcpy(dst, src, num_pixels);
+    return true;
+  }
+  if (channels != 3 && channels != 4) {
+    return false;
+  }
+  convertScalar(src, channels, 0, num_pixels, dst);
+  return true;
+}
+
+bool convertToGrayscale(const unsigned char* src, const uint32_t channels,
+                        const size_t num_pixels, unsigned char* dst) {
+  if (channels == 1) {
+    memcpy(dst, src, num_pixels);
+    return true;
+  }
+  if (channels != 3 && channels != 4) {
+    return false;
+  }
+
+  // SIMD で変換できなかった端数はスカラー版で変換する
+  // (x86 の RGB は 3byte 単位の並べ替えが重いのでスカラー版のまま)
+  size_t converted = 0;
+#if defined(CLSPV_TEST_GRAYSCALE_AVX2)
+  if (channels == 4) {
+    converted = hasAvx2() ? convertRgbaAvx2(src, num_pixels, dst)
+                          : convertRgbaSse2(src, num_pixels, dst);
+  }
+#elif defined(CLSPV_TEST_GRAYSCALE_SSE2)
+  if (channels == 4) {
+    converted = convertRgbaSse2(src, num_pixels, dst);
+  }
+#elif defined(CLSPV_TEST_GRAYSCALE_NEON)
+  converted = convertNeon(src, channels, num_pixels, dst);
+#endif
+  convertScalar(src, channels, converted, num_pixels, dst);
+  return true;
+}
+
+const char* grayscaleIsaName() {
+#if defined(CLSPV_TEST_GRAYSCALE_AVX2)
+  return hasAvx2() ? "avx2" : "sse2";
+#elif defined(CLSPV_TEST_GRAYSCALE_SSE2)
+  return "sse2";
+#elif defined(CLSPV_TEST_GRAYSCALE_NEON)
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
+
+}  // namespace clspv_test
@@ -0,0 +1,53 @@
+/*
+MIT License
+
+Copyright (c) 2022 kyawakyawa
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef CLSPV_TEST_GRAYSCALE_H_
+#define CLSPV_TEST_GRAYSCALE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace clspv_test {
+
+// src (1画素 channels byte) をグレースケール (1画素1byte) に変換して dst に
+// 書き込む。dst は map したバッファでもよい (dst は1度だけ順に書き込む)。
+//   y = 0.3 r + 0.59 g + 0.11 b (小数点以下は切り捨て)
+// channels は 1 (コピー), 3 (RGB), 4 (RGBA, a は無視する) のいずれか。
+// それ以外の場合は false を返す。
+// 実行時に使える命令セット (AVX2, SSE2, NEON) を選び、結果はスカラー版と
+// 完全に一致する。
+bool convertToGrayscale(const unsigned char* src, const uint32_t channels,
+                        const size_t num_pixels, unsigned char* dst);
+
+// 比較用のスカラー版
+bool convertToGrayscaleScalar(const unsigned char* src,
+                              const uint32_t channels, const size_t num_pixels,
+                              unsigned char* dst);
+
+// convertToGrayscale() が使う命令セットの名前
+const char* grayscaleIsaName();
+
+}  // namespace clspv_test
+
+#endif  // CLSPV_TEST_GRAYSCALE_H_
@@ -22,158 +22,164 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
-#include <assert.h>
+#include <stdio.h>
 #include <string.h>
-#include <vulkan/vulkan.h>
 
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <stdexcept>
-#include <unordered_set>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "clspv_runtime.h"
 #include "lodepng.h"  //Used for png encoding.
-
-const int WIDTH          = 3200;  // Size of rendered mandelbrot set.
-const int HEIGHT         = 2400;  // Size of renderered mandelbrot set.
-const int WORKGROUP_SIZE = 32;    // Workgroup size in compute shader.
-
-#ifdef NDEBUG
-const bool enableValidationLayers = false;
-#else
-const bool enableValidationLayers = true;
-#endif
-
-// Used for validating return values of Vulkan API calls.
-#define VK_CHECK_RESULT(f)                                               \
-  {                                                                      \
-    VkResult res = (f);                                                  \
-    if (res != VK_SUCCESS) {                                             \
-      printf("Fatal : VkResult is %d in %s at line %d\n", res, __FILE__, \
-             __LINE__);                                                  \
-      assert(res == VK_SUCCESS);                                         \
-    }                                                                    \
-  }
+#include "png_encoder.h"
+
+const int WORKGROUP_SIZE = 32;  // Workgroup size in compute shader.
+
+// 描画の設定 (どれも SPIR-V を作り直さずに変えられる)
+struct RenderOptions {
+  int width          = 3200;  // Size of rendered mandelbrot set.
+  int height         = 2400;  // Size of renderered mandelbrot set.
+  float center_x     = -.445f;
+  float center_y     = 0.0f;
+  float zoom         = 1.0f;  // 表示範囲 (2.34) を 1 / zoom にする
+  int max_iterations = 128;
+  // 0 なら画像全体を1回のディスパッチで描く。それ以外は tile x tile の
+  // タイルごとに描き、1つのバッファを使い回す (16K を超える画像用)
+  int tile                = 0;
+  std::string output_path = "mandelbrot.png";
+};
 
 /*
 The application launches a compute shader that renders the mandelbrot set,
 by rendering it into a storage buffer.
 The storage buffer is then read from the GPU, and saved as .png.
+
+インスタンスやデバイスは clspv_test::Context が持つので、ここではバッファと
+descriptor set, command buffer だけを作る。
+画像はタイルごとに描き、タイルの分だけのバッファを使い回す。タイルを描く
+たびに読み戻して画像に詰めるので、画像全体をデバイスに確保しなくてよい。
+カーネルが RGBA8 で書くので、1タイルの場合は map したバッファをそのまま
+PNG にする (ホストでの変換はしない)。
 */
 class ComputeApplication {
 private:
   // The pixels of the rendered mandelbrot set are in this format:
   struct Pixel {
-    float r, g, b, a;
+    unsigned char r, g, b, a;
   };
 
-  /*
-  In order to use Vulkan, you must create an instance.
-  */
-  VkInstance instance;
-
-  VkDebugReportCallbackEXT debugReportCallback;
-  /*
-  The physical device is some device on the system that supports usage of
-  Vulkan. Often, it is simply a graphics card that supports Vulkan.
-  */
-  VkPhysicalDevice physicalDevice;
-  /*
-  Then we have the logical device VkDevice, which basically allows
-  us to interact with the physical device.
-  */
-  VkDevice device;
-
-  // clang-format off
-  const std::vector<const char*> device_extensions_ = {
-      // VK_KHR_VARIABLE_POINTERS_EXTENSION_NAME,            // Clspvを使う場合に必要
-      VK_KHR_SHADER_NON_SEMANTIC_INFO_EXTENSION_NAME,     // Clspvを使う場合に必要
-      VK_KHR_STORAGE_BUFFER_STORAGE_CLASS_EXTENSION_NAME, // Clspvを使う場合に必要
+  // mandelbrot の push constant (カーネルの引数の順)
+  struct PushConstant {
+    int32_t width;
+    int32_t height;
+    int32_t tile_x;
+    int32_t tile_y;
+    int32_t tile_w;
+    int32_t tile_h;
+    float center_x;
+    float center_y;
+    float extent;
+    int32_t max_iterations;
   };
-  // clang-format on
 
-  /*
-  The pipeline specifies the pipeline that all graphics and compute commands
-  pass though in Vulkan.
+  clspv_test::Context& context_;
+  const RenderOptions options_;
+  // タイルの大きさ (tile = 0 なら画像全体)
+  const int tile_w_;
+  const int tile_h_;
 
-  We will be creating a simple compute pipeline in this application.
+  /*
+  SPIR-Vモジュールとパイプライン (Context がキャッシュする)
   */
-  VkPipeline pipeline;
-  VkPipelineLayout pipelineLayout;
-  VkShaderModule computeShaderModule;
+  clspv_test::Kernel* kernel_;
+  VkPipeline pipeline_;
 
   /*
   The command buffer is used to record commands, that will be submitted to a
   queue.
-
-  To allocate such command buffers, we use a command pool.
-  */
-  VkCommandPool commandPool;
-  VkCommandBuffer commandBuffer;
-
-  /*
-
-  Descriptors represent resources in shaders. They allow us to use things like
-  uniform buffers, storage buffers and images in GLSL.
-
-  A single descriptor represents a single resource, and several descriptors are
-  organized into descriptor sets, which are basically just collections of
-  descriptors.
-  */
-  VkDescriptorPool descriptorPool;
-  VkDescriptorSet descriptorSet;
-  VkDescriptorSetLayout descriptorSetLayout;
-
-  /*
-  The mandelbrot set will be rendered to this buffer.
-
-  The memory that backs the buffer is bufferMemory.
   */
-  VkBuffer buffer;
-  VkDeviceMemory bufferMemory;
-
-  uint32_t bufferSize;  // size of `buffer` in bytes.
+  VkCommandBuffer command_buffer_;
 
-  std::vector<const char*> enabledLayers;
+  VkDescriptorPool descriptor_pool_;
+  VkDescriptorSet descriptor_set_;
 
   /*
-  In order to execute commands on a device(GPU), the commands must be submitted
-  to a queue. The commands are stored in a command buffer, and this command
-  buffer is given to the queue.
-
-  There will be different kinds of queues on the device. Not all queues support
-  graphics operations, for instance. For this application, we at least want a
-  queue that supports compute operations.
+  The mandelbrot set will be rendered to this buffer (1タイル分).
   */
-  VkQueue queue;  // a queue supporting compute operations.
+  clspv_test::Buffer buffer_;
 
-  /*
-  Groups of queues that have the same capabilities(for instance, they all
-  supports graphics and computer operations), are grouped into queue families.
+  // 読み戻した画像 (RGBA8, width x height, タイルに分けた場合だけ使う)
+  std::vector<unsigned char> image_;
 
-  When submitting a command buffer, you must specify to which queue in the
-  family you are submitting to. This variable keeps track of the index of that
-  queue in its family.
-  */
-  uint32_t queueFamilyIndex;
+  // 計測結果
+  double kernel_ms_;
+  std::vector<double> dispatch_ms_;
 
 public:
-  void run() {
-    // Buffer size of the storage buffer that will contain the rendered
-    // mandelbrot set.
-    bufferSize = sizeof(Pixel) * WIDTH * HEIGHT;
-
-    // Initialize vulkan:
-    createInstance();
-    findPhysicalDevice();
-    createDevice();
+  ComputeApplication(clspv_test::Context& context,
+                     const RenderOptions& options)
+      : context_(context),
+        options_(options),
+        tile_w_(options.tile > 0 ? std::min(options.tile, options.width)
+                                 : options.width),
+        tile_h_(options.tile > 0 ? std::min(options.tile, options.height)
+                                 : options.height) {}
+
+  // repeat 回画像全体を描き、初回(コールド)と2回目以降(ウォーム)の
+  // レイテンシを表示する (タイルに分けた場合は全タイルの合計)
+  void run(const int repeat) {
     createBuffer();
-    createDescriptorSetLayout();
-    createDescriptorSet();
     createComputePipeline();
-    createCommandBuffer();
+    createDescriptorSet();
+    command_buffer_ = context_.allocateCommandBuffer();
+
+    const int tiles_x = (options_.width + tile_w_ - 1) / tile_w_;
+    const int tiles_y = (options_.height + tile_h_ - 1) / tile_h_;
+    const int tiles   = tiles_x * tiles_y;
+    if (tiles > 1) {
+      image_.resize(size_t(options_.width) * options_.height * sizeof(Pixel));
+    }
+    printf("%dx%d, center (%g, %g), zoom %g, %d iterations, %d tile(s) of "
+           "%dx%d\n",
+           options_.width, options_.height, options_.center_x,
+           options_.center_y, options_.zoom, options_.max_iterations, tiles,
+           tile_w_, tile_h_);
 
     // Finally, run the recorded command buffer.
-    runCommandBuffer();
+    // 読み戻しは最後の1回だけ行う (描いたタイルから順に画像に詰める)
+    dispatch_ms_.clear();
+    for (int i = 0; i < repeat; ++i) {
+      const bool last = i + 1 == repeat;
+      double frame_ms = 0.0;
+      for (int t = 0; t < tiles; ++t) {
+        const int tile_x = (t % tiles_x) * tile_w_;
+        const int tile_y = (t / tiles_x) * tile_h_;
+        const int tile_w = std::min(tile_w_, options_.width - tile_x);
+        const int tile_h = std::min(tile_h_, options_.height - tile_y);
+        // 1タイルなら記録済みのコマンドバッファを投入し直す
+        if (tiles > 1 || i == 0) {
+          recordCommandBuffer(tile_x, tile_y, tile_w, tile_h);
+        }
+        const auto begin = std::chrono::steady_clock::now();
+        context_.submitAndWait(command_buffer_);
+        frame_ms += clspv_test::elapsedMs(begin);
+        if (last && tiles > 1) {
+          copyTile(tile_x, tile_y, tile_w, tile_h);
+          printf("\r  tile %d / %d", t + 1, tiles);
+          fflush(stdout);
+        }
+      }
+      if (last && tiles > 1) {
+        printf("\n");
+      }
+      dispatch_ms_.emplace_back(frame_ms);
+    }
+    clspv_test::printLatency(context_.takeCreationTimeMs(), kernel_ms_,
+                             dispatch_ms_, kernel_->pipelineCacheState());
 
     // The former command rendered a mandelbrot set to a buffer.
     // Save that buffer as a png on disk.
@@ -183,788 +189,181 @@ public:
     cleanup();
   }
 
-  void saveRenderedImage() {
+  // 描いたタイルを読み戻し、画像の (tile_x, tile_y) の位置に詰める
+  void copyTile(const int tile_x, const int tile_y, const int tile_w,
+                const int tile_h) {
     void* mappedMemory = NULL;
     // Map the buffer memory, so that we can read from it on the CPU.
-    vkMapMemory(device, bufferMemory, 0, bufferSize, 0, &mappedMemory);
-    Pixel* pmappedMemory = (Pixel*)mappedMemory;
-
-    // Get the color data from the buffer, and cast it to bytes.
-    // We save the data to a vector.
-    std::vector<unsigned char> image;
-    image.reserve(WIDTH * HEIGHT * 4);
-    for (int i = 0; i < WIDTH * HEIGHT; i += 1) {
-      image.push_back((unsigned char)(255.0f * (pmappedMemory[i].r)));
-      image.push_back((unsigned char)(255.0f * (pmappedMemory[i].g)));
-      image.push_back((unsigned char)(255.0f * (pmappedMemory[i].b)));
-      image.push_back((unsigned char)(255.0f * (pmappedMemory[i].a)));
+    vkMapMemory(context_.device(), buffer_.memory, 0, buffer_.size, 0,
+                &mappedMemory);
+    const Pixel* pmappedMemory = (const Pixel*)mappedMemory;
+
+    // The color data is already RGBA8, so copy it row by row.
+    for (int y = 0; y < tile_h; ++y) {
+      memcpy(image_.data() +
+                 (size_t(tile_y + y) * options_.width + tile_x) * sizeof(Pixel),
+             pmappedMemory + size_t(tile_w) * y, tile_w * sizeof(Pixel));
     }
     // Done reading, so unmap.
-    vkUnmapMemory(device, bufferMemory);
-
-    // Now we save the acquired color data to a .png.
-    unsigned error = lodepng::encode("mandelbrot.png", image, WIDTH, HEIGHT);
-    if (error) printf("encoder error %d: %s", error, lodepng_error_text(error));
-  }
-
-  static VKAPI_ATTR VkBool32 VKAPI_CALL debugReportCallbackFn(
-      VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objectType,
-      uint64_t object, size_t location, int32_t messageCode,
-      const char* pLayerPrefix, const char* pMessage, void* pUserData) {
-    printf("Debug Report: %s: %s\n", pLayerPrefix, pMessage);
-
-    return VK_FALSE;
+    vkUnmapMemory(context_.device(), buffer_.memory);
   }
 
-  void createInstance() {
-    std::vector<const char*> enabledExtensions;
-
-    /*
-    By enabling validation layers, Vulkan will emit warnings if the API
-    is used incorrectly. We shall enable the layer VK_LAYER_KHRONOS_validation,
-    which is basically a collection of several useful validation layers.
-    */
-    if (enableValidationLayers) {
-      /*
-      We get all supported layers with vkEnumerateInstanceLayerProperties.
-      */
-      uint32_t layerCount;
-      vkEnumerateInstanceLayerProperties(&layerCount, NULL);
-
-      std::vector<VkLayerProperties> layerProperties(layerCount);
-      vkEnumerateInstanceLayerProperties(&layerCount, layerProperties.data());
-
-      /*
-      And then we simply check if VK_LAYER_KHRONOS_validation is among the
-      supported layers.
-      */
-      bool foundLayer = false;
-      for (VkLayerProperties prop : layerProperties) {
-        if (strcmp("VK_LAYER_KHRONOS_validation", prop.layerName) == 0) {
-          foundLayer = true;
-          break;
-        }
-      }
-
-      if (!foundLayer) {
-        throw std::runtime_error(
-            "Layer VK_LAYER_KHRONOS_validation not supported\n");
-      }
-      enabledLayers.push_back(
-          "VK_LAYER_KHRONOS_validation");  // Alright, we can use this layer.
-
-      /*
-      We need to enable an extension named VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
-      in order to be able to print the warnings emitted by the validation layer.
-
-      So again, we just check if the extension is among the supported
-      extensions.
-      */
-
-      uint32_t extensionCount;
-
-      vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, NULL);
-      std::vector<VkExtensionProperties> extensionProperties(extensionCount);
-      vkEnumerateInstanceExtensionProperties(NULL, &extensionCount,
-                                             extensionProperties.data());
-
-      bool foundExtension = false;
-      for (VkExtensionProperties prop : extensionProperties) {
-        if (strcmp(VK_EXT_DEBUG_REPORT_EXTENSION_NAME, prop.extensionName) ==
-            0) {
-          foundExtension = true;
-          break;
-        }
-      }
-
-      if (!foundExtension) {
-        throw std::runtime_error(
-            "Extension VK_EXT_DEBUG_REPORT_EXTENSION_NAME not supported\n");
-      }
-      enabledExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
-    }
-
-    /*
-    Next, we actually create the instance.
-
-    */
-
-    /*
-    Contains application info. This is actually not that important.
-    The only real important field is apiVersion.
-    */
-    VkApplicationInfo applicationInfo  = {};
-    applicationInfo.sType              = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-    applicationInfo.pApplicationName   = "Hello world app";
-    applicationInfo.applicationVersion = 0;
-    applicationInfo.pEngineName        = "awesomeengine";
-    applicationInfo.engineVersion      = 0;
-    applicationInfo.apiVersion         = VK_API_VERSION_1_0;
-    ;
-
-    VkInstanceCreateInfo createInfo = {};
-    createInfo.sType                = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-    createInfo.flags                = 0;
-    createInfo.pApplicationInfo     = &applicationInfo;
-
-    // Give our desired layers and extensions to vulkan.
-    createInfo.enabledLayerCount       = enabledLayers.size();
-    createInfo.ppEnabledLayerNames     = enabledLayers.data();
-    createInfo.enabledExtensionCount   = enabledExtensions.size();
-    createInfo.ppEnabledExtensionNames = enabledExtensions.data();
-
-    /*
-    Actually create the instance.
-    Having created the instance, we can actually start using vulkan.
-    */
-    VK_CHECK_RESULT(vkCreateInstance(&createInfo, NULL, &instance));
-
-    /*
-    Register a callback function for the extension
-    VK_EXT_DEBUG_REPORT_EXTENSION_NAME, so that warnings emitted from the
-    validation layer are actually printed.
-    */
-    if (enableValidationLayers) {
-      VkDebugReportCallbackCreateInfoEXT createInfo = {};
-      createInfo.sType =
-          VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
-      createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT |
-                         VK_DEBUG_REPORT_WARNING_BIT_EXT |
-                         VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT;
-      createInfo.pfnCallback = &debugReportCallbackFn;
-
-      // We have to explicitly load this function.
-      auto vkCreateDebugReportCallbackEXT =
-          (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(
-              instance, "vkCreateDebugReportCallbackEXT");
-      if (vkCreateDebugReportCallbackEXT == nullptr) {
-        throw std::runtime_error(
-            "Could not load vkCreateDebugReportCallbackEXT");
-      }
-
-      // Create and register callback.
-      VK_CHECK_RESULT(vkCreateDebugReportCallbackEXT(
-          instance, &createInfo, NULL, &debugReportCallback));
-    }
-  }
-
-  void findPhysicalDevice() {
-    /*
-    In this function, we find a physical device that can be used with Vulkan.
-    */
-
-    /*
-    So, first we will list all physical devices on the system with
-    vkEnumeratePhysicalDevices .
-    */
-    uint32_t deviceCount;
-    vkEnumeratePhysicalDevices(instance, &deviceCount, NULL);
-    if (deviceCount == 0) {
-      throw std::runtime_error("could not find a device with vulkan support");
-    }
-
-    std::vector<VkPhysicalDevice> devices(deviceCount);
-    vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
-
-    /*
-    Next, we choose a device that can be used for our purposes.
-
-    With VkPhysicalDeviceFeatures(), we can retrieve a fine-grained list of
-    physical features supported by the device. However, in this demo, we are
-    simply launching a simple compute shader, and there are no special physical
-    features demanded for this task.
-
-    With VkPhysicalDeviceProperties(), we can obtain a list of physical device
-    properties. Most importantly, we obtain a list of physical device
-    limitations. For this application, we launch a compute shader, and the
-    maximum size of the workgroups and total number of compute shader
-    invocations is limited by the physical device, and we should ensure that the
-    limitations named maxComputeWorkGroupCount, maxComputeWorkGroupInvocations
-    and maxComputeWorkGroupSize are not exceeded by our application.  Moreover,
-    we are using a storage buffer in the compute shader, and we should ensure
-    that it is not larger than the device can handle, by checking the limitation
-    maxStorageBufferRange.
-
-    However, in our application, the workgroup size and total number of shader
-    invocations is relatively small, and the storage buffer is not that large,
-    and thus a vast majority of devices will be able to handle it. This can be
-    verified by looking at some devices at_ http://vulkan.gpuinfo.org/
-
-    Therefore, to keep things simple and clean, we will not perform any such
-    checks here, and just pick the first physical device in the list. But in a
-    real and serious application, those limitations should certainly be taken
-    into account.
-
-    */
-    bool found_device = false;
-    for (VkPhysicalDevice device : devices) {
-      if (IsDeviceSuitable(
-              device)) {  // 一番最初に条件を満たすデバイスを見つけたらそれを選択
-        physicalDevice = device;
-        found_device   = true;
-        break;
-      }
-    }
-    if (!found_device) {
-      throw std::runtime_error("Physical Device not found\n");
-    }
-  }
-
-  bool IsDeviceSuitable(VkPhysicalDevice device) {
-    VkPhysicalDeviceProperties device_properties;
-    VkPhysicalDeviceFeatures device_features;
-
-    vkGetPhysicalDeviceProperties(device, &device_properties);
-    vkGetPhysicalDeviceFeatures(device, &device_features);
-
-    // グラフィックカードか？
-    const bool condition0 =
-        /* グラフィックカード */
-        device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU ||
-        /* 統合GPU */
-        device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU;
-
-#ifndef NDEBUG
-    if (device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-      printf("グラフィックカードが検出されました\n");
-    } else if (device_properties.deviceType ==
-               VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU) {
-      printf("統合GPUが検出されました\n");
-    }
-#endif
-
-    // 拡張機能に対応しているか
-    const bool extensions_supported = CheckDeviceExtensionSupport(device);
-
-    return condition0 && extensions_supported;
-  }
-  bool CheckDeviceExtensionSupport(const VkPhysicalDevice device) {
-    uint32_t extension_count;
-    vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
-                                         nullptr);
-
-    std::vector<VkExtensionProperties> available_extensions(extension_count);
-    vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
-                                         available_extensions.data());
-
-    std::unordered_set<std::string> required_extensions(
-        device_extensions_.begin(), device_extensions_.end());
-
-#ifndef NDEBUG
-    printf("----- Available Extensions -----\n");
-    for (const auto& extension : available_extensions) {
-      printf("     -- %s\n", extension.extensionName);
-    }
-#endif
-
-    for (const auto& extension : available_extensions) {
-      required_extensions.erase(extension.extensionName);
-    }
-
-    for (const auto& extension_name : required_extensions) {
-      fprintf(stderr, "not find Extension : %s\n", extension_name.c_str());
-    }
-
-    return required_extensions.empty();
-  }
-
-  // Returns the index of a queue family that supports compute operations.
-  uint32_t getComputeQueueFamilyIndex() {
-    uint32_t queueFamilyCount;
-
-    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
-                                             NULL);
-
-    // Retrieve all queue families.
-    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
-                                             queueFamilies.data());
-
-    // Now find a family that supports compute.
-    uint32_t i = 0;
-    for (; i < queueFamilies.size(); ++i) {
-      VkQueueFamilyProperties props = queueFamilies[i];
-
-      if (props.queueCount > 0 && (props.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
-        // found a queue with compute. We're done!
-        break;
-      }
-    }
-
-    if (i == queueFamilies.size()) {
-      throw std::runtime_error(
-          "could not find a queue family that supports operations");
+  void saveRenderedImage() {
+    // Now we save the acquired color data to a .png.
+    // 1タイルの場合はバッファ全体が画像なので、map したまま渡す
+    void* mappedMemory          = NULL;
+    const unsigned char* pixels = image_.data();
+    if (image_.empty()) {
+      vkMapMemory(context_.device(), buffer_.memory, 0, buffer_.size, 0,
+                  &mappedMemory);
+      pixels = (const unsigned char*)mappedMemory;
     }
-
-    return i;
-  }
-
-  void createDevice() {
-    /*
-    We create the logical device in this function.
-    */
-
-    /*
-    When creating the device, we also specify what queues it has.
-    */
-    VkDeviceQueueCreateInfo queueCreateInfo = {};
-    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queueFamilyIndex = getComputeQueueFamilyIndex();  // find queue family with
-                                                      // compute capability.
-    queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
-    queueCreateInfo.queueCount =
-        1;  // create one queue in this family. We don't need more.
-    float queuePriorities =
-        1.0;  // we only have one queue, so this is not that imporant.
-    queueCreateInfo.pQueuePriorities = &queuePriorities;
-
-    /*
-    Now we create the logical device. The logical device allows us to interact
-    with the physical device.
-    */
-    VkDeviceCreateInfo deviceCreateInfo = {};
-
-    // Specify any desired device features here. We do not need any for this
-    // application, though.
-    VkPhysicalDeviceFeatures deviceFeatures = {};
-
-    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceCreateInfo.enabledLayerCount =
-        enabledLayers
-            .size();  // need to specify validation layers here as well.
-    deviceCreateInfo.ppEnabledLayerNames = enabledLayers.data();
-    deviceCreateInfo.pQueueCreateInfos =
-        &queueCreateInfo;  // when creating the logical device, we also specify
-                           // what queues it has.
-    deviceCreateInfo.queueCreateInfoCount = 1;
-    deviceCreateInfo.pEnabledFeatures     = &deviceFeatures;
-
-    // 拡張を指定
-    deviceCreateInfo.enabledExtensionCount =
-        static_cast<uint32_t>(device_extensions_.size());
-    deviceCreateInfo.ppEnabledExtensionNames = device_extensions_.data();
-
-    VK_CHECK_RESULT(vkCreateDevice(physicalDevice, &deviceCreateInfo, NULL,
-                                   &device));  // create logical device.
-
-    // Get a handle to the only member of the queue family.
-    vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
-  }
-
-  // find memory type with desired properties.
-  uint32_t findMemoryType(uint32_t memoryTypeBits,
-                          VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memoryProperties;
-
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
-
-    /*
-    How does this search work?
-    See the documentation of VkPhysicalDeviceMemoryProperties for a detailed
-    description.
-    */
-    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
-      if ((memoryTypeBits & (1 << i)) &&
-          ((memoryProperties.memoryTypes[i].propertyFlags & properties) ==
-           properties))
-        return i;
+    // 行の帯に分けて、コア数のスレッドで符号化する
+    clspv_test::ThreadPool pool(
+        std::max(1u, std::thread::hardware_concurrency()));
+    unsigned error = clspv_test::encodePngParallel(
+        options_.output_path, pixels, options_.width, options_.height, pool);
+    if (error) printf("encoder error %d: %s", error, lodepng_error_text(error));
+    if (mappedMemory) {
+      vkUnmapMemory(context_.device(), buffer_.memory);
     }
-    return -1;
   }
 
   void createBuffer() {
     /*
     We will now create a buffer. We will render the mandelbrot set into this
     buffer in a computer shade later.
+    1タイル分だけ確保する。ストレージバッファの範囲の上限を超える場合は
+    タイルに分ける必要がある。
     */
-
-    VkBufferCreateInfo bufferCreateInfo = {};
-    bufferCreateInfo.sType              = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferCreateInfo.size               = bufferSize;  // buffer size in bytes.
-    bufferCreateInfo.usage =
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;  // buffer is used as a storage
-                                             // buffer.
-    bufferCreateInfo.sharingMode =
-        VK_SHARING_MODE_EXCLUSIVE;  // buffer is exclusive to a single queue
-                                    // family at a time.
-
-    VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, NULL,
-                                   &buffer));  // create buffer.
-
-    /*
-    But the buffer doesn't allocate memory for itself, so we must do that
-    manually.
-    */
-
-    /*
-    First, we find the memory requirements for the buffer.
-    */
-    VkMemoryRequirements memoryRequirements;
-    vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
-
-    /*
-    Now use obtained memory requirements info to allocate the memory for the
-    buffer.
-    */
-    VkMemoryAllocateInfo allocateInfo = {};
-    allocateInfo.sType                = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocateInfo.allocationSize =
-        memoryRequirements.size;  // specify required memory.
-    /*
-    There are several types of memory that can be allocated, and we must choose
-    a memory type that:
-
-    1) Satisfies the memory requirements(memoryRequirements.memoryTypeBits).
-    2) Satifies our own usage requirements. We want to be able to read the
-    buffer memory from the GPU to the CPU with vkMapMemory, so we set
-    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT. Also, by setting
-    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, memory written by the device(GPU) will
-    be easily visible to the host(CPU), without having to call any extra
-    flushing commands. So mainly for convenience, we set this flag.
-    */
-    allocateInfo.memoryTypeIndex =
-        findMemoryType(memoryRequirements.memoryTypeBits,
-                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
-                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-
-    VK_CHECK_RESULT(
-        vkAllocateMemory(device, &allocateInfo, NULL,
-                         &bufferMemory));  // allocate memory on device.
-
-    // Now associate that allocated memory with the buffer. With that, the
-    // buffer is backed by actual memory.
-    VK_CHECK_RESULT(vkBindBufferMemory(device, buffer, bufferMemory, 0));
+    const VkDeviceSize size = sizeof(Pixel) * VkDeviceSize(tile_w_) * tile_h_;
+    if (size > context_.properties().limits.maxStorageBufferRange) {
+      throw std::runtime_error(
+          "The output buffer exceeds maxStorageBufferRange. Use --tile.");
+    }
+    buffer_ = context_.createHostVisibleBuffer(size);
   }
 
-  void createDescriptorSetLayout() {
-    /*
-    Here we specify a descriptor set layout. This allows us to bind our
-    descriptors to resources in the shader.
-
-    */
-
+  void createComputePipeline() {
     /*
-    Here we specify a binding of type VK_DESCRIPTOR_TYPE_STORAGE_BUFFER to the
-    binding point 0. This binds to
-
-      layout(std140, binding = 0) buffer buf
-
-    in the compute shader.
+    mandelbrot.spv は1つのバッファ (binding = 0) と push constant
+    (PushConstant) を使う。ワークグループサイズは reqd_work_group_size で
+    固定されているので specialization constant は不要。
     */
-    VkDescriptorSetLayoutBinding descriptorSetLayoutBinding = {};
-    descriptorSetLayoutBinding.binding                      = 0;  // binding = 0
-    descriptorSetLayoutBinding.descriptorType =
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    descriptorSetLayoutBinding.descriptorCount = 1;
-    descriptorSetLayoutBinding.stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
-
-    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {};
-    descriptorSetLayoutCreateInfo.sType =
-        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    descriptorSetLayoutCreateInfo.bindingCount =
-        1;  // only a single binding in this descriptor set layout.
-    descriptorSetLayoutCreateInfo.pBindings = &descriptorSetLayoutBinding;
-
-    // Create the descriptor set layout.
-    VK_CHECK_RESULT(vkCreateDescriptorSetLayout(
-        device, &descriptorSetLayoutCreateInfo, NULL, &descriptorSetLayout));
+    const auto begin = std::chrono::steady_clock::now();
+    kernel_ = &context_.getKernel("spirv/c/mandelbrot.spv", 1,
+                                  sizeof(PushConstant));
+    pipeline_  = kernel_->getPipeline("mandelbrot");
+    kernel_ms_ = clspv_test::elapsedMs(begin);
   }
 
   void createDescriptorSet() {
-    /*
-    So we will allocate a descriptor set here.
-    But we need to first create a descriptor pool to do that.
-    */
-
     /*
     Our descriptor pool can only allocate a single storage buffer.
     */
-    VkDescriptorPoolSize descriptorPoolSize = {};
-    descriptorPoolSize.type                 = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    descriptorPoolSize.descriptorCount      = 1;
-
-    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
-    descriptorPoolCreateInfo.sType =
-        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    descriptorPoolCreateInfo.maxSets =
-        1;  // we only need to allocate one descriptor set from the pool.
-    descriptorPoolCreateInfo.poolSizeCount = 1;
-    descriptorPoolCreateInfo.pPoolSizes    = &descriptorPoolSize;
-
-    // create descriptor pool.
-    VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolCreateInfo,
-                                           NULL, &descriptorPool));
-
-    /*
-    With the pool allocated, we can now allocate the descriptor set.
-    */
-    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
-    descriptorSetAllocateInfo.sType =
-        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    descriptorSetAllocateInfo.descriptorPool =
-        descriptorPool;  // pool to allocate from.
-    descriptorSetAllocateInfo.descriptorSetCount =
-        1;  // allocate a single descriptor set.
-    descriptorSetAllocateInfo.pSetLayouts = &descriptorSetLayout;
-
-    // allocate descriptor set.
-    VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo,
-                                             &descriptorSet));
+    descriptor_pool_ = context_.createDescriptorPool(1, 1);
+    descriptor_set_  = kernel_->allocateDescriptorSet(descriptor_pool_);
 
     /*
     Next, we need to connect our actual storage buffer with the descrptor.
-    We use vkUpdateDescriptorSets() to update the descriptor set.
     */
-
-    // Specify the buffer to bind to the descriptor.
-    VkDescriptorBufferInfo descriptorBufferInfo = {};
-    descriptorBufferInfo.buffer                 = buffer;
-    descriptorBufferInfo.offset                 = 0;
-    descriptorBufferInfo.range                  = bufferSize;
-
-    VkWriteDescriptorSet writeDescriptorSet = {};
-    writeDescriptorSet.sType  = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writeDescriptorSet.dstSet = descriptorSet;  // write to this descriptor set.
-    writeDescriptorSet.dstBinding = 0;  // write to the first, and only binding.
-    writeDescriptorSet.descriptorCount = 1;  // update a single descriptor.
-    writeDescriptorSet.descriptorType =
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;  // storage buffer.
-    writeDescriptorSet.pBufferInfo = &descriptorBufferInfo;
-
-    // perform the update of the descriptor set.
-    vkUpdateDescriptorSets(device, 1, &writeDescriptorSet, 0, NULL);
+    context_.writeDescriptorSet(descriptor_set_,
+                                {{buffer_.buffer, 0, buffer_.size}});
   }
 
-  // Read file into array of bytes, and cast to uint32_t*, then return.
-  // The data has been padded, so that it fits into an array uint32_t.
-  uint32_t* readFile(uint32_t& length, const char* filename) {
-    FILE* fp = fopen(filename, "rb");
-    if (fp == NULL) {
-      printf("Could not find or open file: %s\n", filename);
-    }
-
-    // get file size.
-    fseek(fp, 0, SEEK_END);
-    long filesize = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    long filesizepadded = long(ceil(filesize / 4.0)) * 4;
-
-    // read file contents.
-    char* str = new char[filesizepadded];
-    fread(str, filesize, sizeof(char), fp);
-    fclose(fp);
-
-    // data padding.
-    for (int i = filesize; i < filesizepadded; i++) {
-      str[i] = 0;
-    }
-
-    length = filesizepadded;
-    return (uint32_t*)str;
-  }
-
-  void createComputePipeline() {
-    /*
-    We create a compute pipeline here.
-    */
-
-    /*
-    Create a shader module. A shader module basically just encapsulates some
-    shader code.
-    */
-    uint32_t filelength;
-    // the code in mandelbrot.spv was created by running the command:
-    // glslangValidator.exe -V shader.comp
-    uint32_t* code = readFile(filelength, "spirv/c/mandelbrot.spv");
-    VkShaderModuleCreateInfo createInfo = {};
-    createInfo.sType    = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.pCode    = code;
-    createInfo.codeSize = filelength;
-
-    VK_CHECK_RESULT(
-        vkCreateShaderModule(device, &createInfo, NULL, &computeShaderModule));
-    delete[] code;
-
-    /*
-    Now let us actually create the compute pipeline.
-    A compute pipeline is very simple compared to a graphics pipeline.
-    It only consists of a single stage with a compute shader.
-
-    So first we specify the compute shader stage, and it's entry point(main).
-    */
-    VkPipelineShaderStageCreateInfo shaderStageCreateInfo = {};
-    shaderStageCreateInfo.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    shaderStageCreateInfo.stage  = VK_SHADER_STAGE_COMPUTE_BIT;
-    shaderStageCreateInfo.module = computeShaderModule;
-    shaderStageCreateInfo.pName  = "mandelbrot";
-
-    /*
-    The pipeline layout allows the pipeline to access descriptor sets.
-    So we just specify the descriptor set layout we created earlier.
-    */
-    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
-    pipelineLayoutCreateInfo.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutCreateInfo.setLayoutCount = 1;
-    pipelineLayoutCreateInfo.pSetLayouts    = &descriptorSetLayout;
-    VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo,
-                                           NULL, &pipelineLayout));
-
-    VkComputePipelineCreateInfo pipelineCreateInfo = {};
-    pipelineCreateInfo.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-    pipelineCreateInfo.stage  = shaderStageCreateInfo;
-    pipelineCreateInfo.layout = pipelineLayout;
-
-    /*
-    Now, we finally create the compute pipeline.
-    */
-    VK_CHECK_RESULT(vkCreateComputePipelines(
-        device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, NULL, &pipeline));
-  }
-
-  void createCommandBuffer() {
-    /*
-    We are getting closer to the end. In order to send commands to the
-    device(GPU), we must first record commands into a command buffer. To
-    allocate a command buffer, we must first create a command pool. So let us do
-    that.
-    */
-    VkCommandPoolCreateInfo commandPoolCreateInfo = {};
-    commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    commandPoolCreateInfo.flags = 0;
-    // the queue family of this command pool. All command buffers allocated from
-    // this command pool, must be submitted to queues of this family ONLY.
-    commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
-    VK_CHECK_RESULT(vkCreateCommandPool(device, &commandPoolCreateInfo, NULL,
-                                        &commandPool));
-
-    /*
-    Now allocate a command buffer from the command pool.
-    */
-    VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
-    commandBufferAllocateInfo.sType =
-        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    commandBufferAllocateInfo.commandPool =
-        commandPool;  // specify the command pool to allocate from.
-    // if the command buffer is primary, it can be directly submitted to queues.
-    // A secondary buffer has to be called from some primary command buffer, and
-    // cannot be directly submitted to a queue. To keep things simple, we use a
-    // primary command buffer.
-    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    commandBufferAllocateInfo.commandBufferCount =
-        1;  // allocate a single command buffer.
-    VK_CHECK_RESULT(
-        vkAllocateCommandBuffers(device, &commandBufferAllocateInfo,
-                                 &commandBuffer));  // allocate command buffer.
-
+  // タイル (tile_x, tile_y, tile_w x tile_h) を描くコマンドを記録する
+  // (vkBeginCommandBuffer がコマンドバッファをリセットする)
+  void recordCommandBuffer(const int tile_x, const int tile_y,
+                           const int tile_w, const int tile_h) {
     /*
     Now we shall start recording commands into the newly allocated command
     buffer.
     */
     VkCommandBufferBeginInfo beginInfo = {};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags =
-        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;  // the buffer is only
-                                                      // submitted and used once
-                                                      // in this application.
+    beginInfo.flags = 0;  // 計測のために複数回投入する
     VK_CHECK_RESULT(vkBeginCommandBuffer(
-        commandBuffer, &beginInfo));  // start recording commands.
+        command_buffer_, &beginInfo));  // start recording commands.
 
-    /*
-    We need to bind a pipeline, AND a descriptor set before we dispatch.
-
-    The validation layer will NOT give warnings if you forget these, so be very
-    careful not to forget them.
-    */
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-                            pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+    PushConstant push_constant;
+    push_constant.width          = options_.width;
+    push_constant.height         = options_.height;
+    push_constant.tile_x         = tile_x;
+    push_constant.tile_y         = tile_y;
+    push_constant.tile_w         = tile_w;
+    push_constant.tile_h         = tile_h;
+    push_constant.center_x       = options_.center_x;
+    push_constant.center_y       = options_.center_y;
+    push_constant.extent         = (2.0f + 1.7f * 0.2f) / options_.zoom;
+    push_constant.max_iterations = options_.max_iterations;
 
     /*
     Calling vkCmdDispatch basically starts the compute pipeline, and executes
     the compute shader. The number of workgroups is specified in the arguments.
-    If you are already familiar with compute shaders from OpenGL, this should be
-    nothing new to you.
     */
-    vkCmdDispatch(commandBuffer, (uint32_t)ceil(WIDTH / float(WORKGROUP_SIZE)),
-                  (uint32_t)ceil(HEIGHT / float(WORKGROUP_SIZE)), 1);
+    kernel_->dispatch(command_buffer_, pipeline_, descriptor_set_,
+                      &push_constant,
+                      (uint32_t)ceil(tile_w / float(WORKGROUP_SIZE)),
+                      (uint32_t)ceil(tile_h / float(WORKGROUP_SIZE)));
 
     VK_CHECK_RESULT(
-        vkEndCommandBuffer(commandBuffer));  // end recording commands.
-  }
-
-  void runCommandBuffer() {
-    /*
-    Now we shall finally submit the recorded command buffer to a queue.
-    */
-
-    VkSubmitInfo submitInfo       = {};
-    submitInfo.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;  // submit a single command buffer
-    submitInfo.pCommandBuffers =
-        &commandBuffer;  // the command buffer to submit.
-
-    /*
-      We create a fence.
-    */
-    VkFence fence;
-    VkFenceCreateInfo fenceCreateInfo = {};
-    fenceCreateInfo.sType             = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceCreateInfo.flags             = 0;
-    VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, NULL, &fence));
-
-    /*
-    We submit the command buffer on the queue, at the same time giving a fence.
-    */
-    VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
-    /*
-    The command will not have finished executing until the fence is signalled.
-    So we wait here.
-    We will directly after this read our buffer from the GPU,
-    and we will not be sure that the command has finished executing unless we
-    wait for the fence. Hence, we use a fence here.
-    */
-    VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, 100000000000));
-
-    vkDestroyFence(device, fence, NULL);
+        vkEndCommandBuffer(command_buffer_));  // end recording commands.
   }
 
   void cleanup() {
     /*
-    Clean up all Vulkan Resources.
+    Clean up the Vulkan resources owned by this application.
+    The device and the kernel are kept alive by the context.
     */
-
-    if (enableValidationLayers) {
-      // destroy callback.
-      auto func = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(
-          instance, "vkDestroyDebugReportCallbackEXT");
-      if (func == nullptr) {
-        throw std::runtime_error(
-            "Could not load vkDestroyDebugReportCallbackEXT");
-      }
-      func(instance, debugReportCallback, NULL);
-    }
-
-    vkFreeMemory(device, bufferMemory, NULL);
-    vkDestroyBuffer(device, buffer, NULL);
-    vkDestroyShaderModule(device, computeShaderModule, NULL);
-    vkDestroyDescriptorPool(device, descriptorPool, NULL);
-    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, NULL);
-    vkDestroyPipelineLayout(device, pipelineLayout, NULL);
-    vkDestroyPipeline(device, pipeline, NULL);
-    vkDestroyCommandPool(device, commandPool, NULL);
-    vkDestroyDevice(device, NULL);
-    vkDestroyInstance(instance, NULL);
+    const VkDevice device = context_.device();
+    vkFreeCommandBuffers(device, context_.commandPool(), 1, &command_buffer_);
+    vkDestroyDescriptorPool(device, descriptor_pool_, NULL);
+    context_.destroyBuffer(buffer_);
   }
 };
 
-int main() {
-  ComputeApplication app;
+// usage: main [--repeat N] [--no-pipeline-cache] [--size W H]
+//             [--center X Y] [--zoom Z] [--iterations M] [--tile N]
+//             [--output FILE]
+int main(int argc, char** argv) {
+  int repeat              = 10;
+  bool use_pipeline_cache = true;
+  RenderOptions options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--repeat" && i + 1 < argc) {
+      repeat = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--no-pipeline-cache") {
+      use_pipeline_cache = false;
+    } else if (arg == "--size" && i + 2 < argc) {
+      options.width  = std::max(1, std::atoi(argv[++i]));
+      options.height = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--center" && i + 2 < argc) {
+      options.center_x = float(std::atof(argv[++i]));
+      options.center_y = float(std::atof(argv[++i]));
+    } else if (arg == "--zoom" && i + 1 < argc) {
+      options.zoom = std::max(1e-6f, float(std::atof(argv[++i])));
+    } else if (arg == "--iterations" && i + 1 < argc) {
+      options.max_iterations = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--tile" && i + 1 < argc) {
+      options.tile = std::max(0, std::atoi(argv[++i]));
+    } else if (arg == "--output" && i + 1 < argc) {
+      options.output_path = argv[++i];
+    } else {
+      printf("usage: %s [--repeat N] [--no-pipeline-cache] [--size W H]\n"
+             "          [--center X Y] [--zoom Z] [--iterations M] "
+             "[--tile N]\n"
+             "          [--output FILE]\n",
+             argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
 
   try {
-    app.run();
+    // mandelbrot.spv は uchar4 で書くので 8bit の型を使う
+    clspv_test::Context context(/*require_int8=*/true, use_pipeline_cache);
+    ComputeApplication app(context, options);
+    app.run(repeat);
   } catch (const std::runtime_error& e) {
     printf("%s\n", e.what());
     return EXIT_FAILURE;
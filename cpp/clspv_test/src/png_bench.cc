@@ -0,0 +1,489 @@
+/*
+MIT License
+
+Copyright (c) 2022 kyawakyawa
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// PNG の読み書き (deps/load_png の lodepng) のベンチマーク
+//
+// usage: png_bench [inflate|decode|encode|checksum] [--repeat N]
+//                  [--threads N] [input.png ...]
+//
+// inflate: IDAT (zlib) の展開を、表を使う高速版と1シンボルずつ復号する
+//          参照版 (LodePNGDecompressSettings::reference_inflate) で比べ、
+//          展開後の MB/s と結果が一致するかを表示する
+// decode : PNG 全体の復号を、SIMD でフィルタを戻すものとスカラー版
+//          (LodePNGDecoderSettings::reference_unfilter) で比べ、画像の
+//          MB/s と結果が一致するかを表示する
+// encode : 既定の設定と速度優先の設定 (lodepng_encoder_settings_fast) で、
+//          行の帯に分けた並列の符号化 (clspv_test::setParallelEncoder) を
+//          1, 2, 4, ... スレッドと --threads N (またはコア数) で比べ、画像の
+//          MB/s, 既定の設定の1スレッドに対する速度と PNG の大きさ, 復号した
+//          結果が元の画像と一致するかを表示する
+// checksum: 展開した IDAT の CRC32 と Adler-32 を、lodepng の実装と
+//          1バイトずつの参照実装で比べ、GB/s と結果が一致するかを表示する
+// モードを指定しない場合は全てを実行する。
+// 入力を与えない場合は合成画像 (ノイズを加えたグラデーション, 矩形, ノイズ)
+// を lodepng で符号化したものを使う。
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lodepng.h"
+#include "png_encoder.h"
+#include "thread_pool.h"
+
+namespace {
+
+// ベンチマークに使う PNG
+struct CorpusEntry {
+  std::string name;
+  std::vector<unsigned char> png;
+};
+
+double elapsedMs(const std::chrono::steady_clock::time_point begin) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - begin)
+      .count();
+}
+
+// repeat 回実行して最短の時間 [ms] を返す
+template <class Func>
+double bestOfMs(const int repeat, Func&& func) {
+  double best_ms = 0.0;
+  for (int i = 0; i < repeat; ++i) {
+    const auto begin = std::chrono::steady_clock::now();
+    func();
+    const double ms = elapsedMs(begin);
+    best_ms         = i == 0 ? ms : std::min(best_ms, ms);
+  }
+  return best_ms;
+}
+
+double megabytesPerSecond(const size_t bytes, const double ms) {
+  return ms > 0.0 ? double(bytes) / (ms * 1e3) : 0.0;
+}
+
+// 合成画像 (width x height, channels = 1, 3, 4) を PNG に符号化する
+std::vector<unsigned char> encodeSynthetic(const uint32_t width,
+                                           const uint32_t height,
+                                           const uint32_t channels,
+                                           const int kind) {
+  std::vector<unsigned char> image(size_t(width) * height * channels);
+  std::mt19937 engine(kind);
+  if (kind == 0) {
+    // 写真に近いもの: なめらかなグラデーションにノイズを加える
+    for (uint32_t y = 0; y < height; ++y) {
+      for (uint32_t x = 0; x < width; ++x) {
+        for (uint32_t c = 0; c < channels; ++c) {
+          const int v = int((x * (c + 1) + y * 2) * 255 / (width + height)) +
+                        int(engine() % 9) - 4;
+          image[(size_t(y) * width + x) * channels + c] =
+              static_cast<unsigned char>(std::min(255, std::max(0, v)));
+        }
+      }
+    }
+  } else if (kind == 1) {
+    // スクリーンショットに近いもの: 一様な矩形を重ねる (長い一致が多い)
+    const size_t num_rects = size_t(width) * height / 4000;
+    for (size_t i = 0; i < num_rects; ++i) {
+      const uint32_t w  = 8 + engine() % 64;
+      const uint32_t h  = 8 + engine() % 64;
+      const uint32_t x0 = engine() % width;
+      const uint32_t y0 = engine() % height;
+      const unsigned char v = static_cast<unsigned char>(engine());
+      for (uint32_t y = y0; y < std::min(y0 + h, height); ++y) {
+        memset(image.data() + (size_t(y) * width + x0) * channels, v,
+               std::min(w, width - x0) * channels);
+      }
+    }
+  } else {
+    // 圧縮できないもの: 一様乱数のノイズ
+    for (auto& v : image) {
+      v = static_cast<unsigned char>(engine());
+    }
+  }
+
+  std::vector<unsigned char> png;
+  const unsigned error =
+      lodepng::encode(png, image, width, height,
+                      channels == 1   ? LCT_GREY
+                      : channels == 3 ? LCT_RGB
+                                      : LCT_RGBA,
+                      8);
+  if (error) {
+    printf("encoder error %u: %s\n", error, lodepng_error_text(error));
+  }
+  return png;
+}
+
+std::vector<CorpusEntry> makeSyntheticCorpus() {
+  const uint32_t width = 2048, height = 1536;
+  std::vector<CorpusEntry> corpus;
+  corpus.push_back(
+      {"gradient+noise gray", encodeSynthetic(width, height, 1, 0)});
+  corpus.push_back(
+      {"gradient+noise rgb", encodeSynthetic(width, height, 3, 0)});
+  corpus.push_back(
+      {"gradient+noise rgba", encodeSynthetic(width, height, 4, 0)});
+  corpus.push_back({"rectangles gray", encodeSynthetic(width, height, 1, 1)});
+  corpus.push_back({"noise gray", encodeSynthetic(width, height, 1, 2)});
+  return corpus;
+}
+
+// PNG の IDAT を連結した zlib のストリームを返す
+std::vector<unsigned char> extractIdat(const std::vector<unsigned char>& png) {
+  std::vector<unsigned char> idat;
+  if (png.size() < 8) {
+    return idat;
+  }
+  const unsigned char* end = png.data() + png.size();
+  for (const unsigned char* chunk = png.data() + 8; chunk + 12 <= end;
+       chunk = lodepng_chunk_next_const(chunk, end)) {
+    if (lodepng_chunk_type_equals(chunk, "IDAT")) {
+      const unsigned char* data = lodepng_chunk_data_const(chunk);
+      idat.insert(idat.end(), data, data + lodepng_chunk_length(chunk));
+    } else if (lodepng_chunk_type_equals(chunk, "IEND")) {
+      break;
+    }
+  }
+  return idat;
+}
+
+// IDAT の展開を高速版と参照版で比べる
+int runInflate(const std::vector<CorpusEntry>& corpus, const int repeat) {
+  printf("----- inflate (IDAT), best of %d -----\n", repeat);
+  printf("  %-24s %10s %12s %12s %8s\n", "", "MB", "fast MB/s",
+         "ref MB/s", "");
+  size_t total_bytes = 0;
+  double total_fast_ms = 0.0, total_reference_ms = 0.0;
+  bool all_match = true;
+  for (const auto& entry : corpus) {
+    const std::vector<unsigned char> idat = extractIdat(entry.png);
+    std::vector<unsigned char> outputs[2];
+    double ms[2];
+    unsigned errors[2];
+    for (int reference = 0; reference < 2; ++reference) {
+      LodePNGDecompressSettings settings;
+      lodepng_decompress_settings_init(&settings);
+      settings.reference_inflate = reference;
+      ms[reference] = bestOfMs(repeat, [&] {
+        outputs[reference].clear();
+        errors[reference] =
+            lodepng::decompress(outputs[reference], idat, settings);
+      });
+    }
+    if (errors[0] || errors[1]) {
+      printf("  %-24s decoder error %u / %u: %s\n", entry.name.c_str(),
+             errors[0], errors[1], lodepng_error_text(errors[0]));
+      all_match = false;
+      continue;
+    }
+    const bool match = outputs[0] == outputs[1];
+    all_match        = all_match && match;
+    const size_t bytes = outputs[0].size();
+    printf("  %-24s %10.1f %12.1f %12.1f %7.2fx %s\n", entry.name.c_str(),
+           bytes / 1e6, megabytesPerSecond(bytes, ms[0]),
+           megabytesPerSecond(bytes, ms[1]), ms[0] > 0.0 ? ms[1] / ms[0] : 0.0,
+           match ? "match" : "DIFFER");
+    total_bytes += bytes;
+    total_fast_ms += ms[0];
+    total_reference_ms += ms[1];
+  }
+  printf("  %-24s %10.1f %12.1f %12.1f %7.2fx\n", "total", total_bytes / 1e6,
+         megabytesPerSecond(total_bytes, total_fast_ms),
+         megabytesPerSecond(total_bytes, total_reference_ms),
+         total_fast_ms > 0.0 ? total_reference_ms / total_fast_ms : 0.0);
+  return all_match ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// PNG 全体の復号を SIMD 版とスカラー版のフィルタで比べる
+// (色の変換はせず、PNG のままの色の型で復号する)
+int runDecode(const std::vector<CorpusEntry>& corpus, const int repeat) {
+  printf("----- decode (unfilter), best of %d -----\n", repeat);
+  printf("  %-24s %10s %12s %12s %8s\n", "", "MB", "simd MB/s",
+         "ref MB/s", "");
+  bool all_match = true;
+  for (const auto& entry : corpus) {
+    std::vector<unsigned char> images[2];
+    double ms[2];
+    unsigned errors[2];
+    for (int reference = 0; reference < 2; ++reference) {
+      ms[reference] = bestOfMs(repeat, [&] {
+        lodepng::State state;
+        state.decoder.color_convert      = 0;
+        state.decoder.reference_unfilter = reference;
+        unsigned width, height;
+        images[reference].clear();
+        errors[reference] = lodepng::decode(images[reference], width, height,
+                                            state, entry.png);
+      });
+    }
+    if (errors[0] || errors[1]) {
+      printf("  %-24s decoder error %u / %u: %s\n", entry.name.c_str(),
+             errors[0], errors[1], lodepng_error_text(errors[0]));
+      all_match = false;
+      continue;
+    }
+    const bool match   = images[0] == images[1];
+    all_match          = all_match && match;
+    const size_t bytes = images[0].size();
+    printf("  %-24s %10.1f %12.1f %12.1f %7.2fx %s\n", entry.name.c_str(),
+           bytes / 1e6, megabytesPerSecond(bytes, ms[0]),
+           megabytesPerSecond(bytes, ms[1]), ms[0] > 0.0 ? ms[1] / ms[0] : 0.0,
+           match ? "match" : "DIFFER");
+  }
+  return all_match ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// 既定の設定と速度優先の設定で、帯に分けた並列の符号化のスレッド数に
+// 対するスケーリングを計測する
+// (PNG の色の型のまま符号化し、出力を復号して元の画像と比べる)
+int runEncode(const std::vector<CorpusEntry>& corpus, const int repeat,
+              const size_t max_threads) {
+  std::vector<size_t> thread_counts;
+  for (size_t n = 1; n < max_threads; n *= 2) {
+    thread_counts.emplace_back(n);
+  }
+  thread_counts.emplace_back(max_threads);
+
+  printf("----- encode (row stripes), best of %d -----\n", repeat);
+  printf("  %-24s %8s %8s %10s %12s %8s %8s\n", "", "preset", "threads", "MB",
+         "MB/s", "", "size");
+  bool all_match = true;
+  for (const auto& entry : corpus) {
+    lodepng::State decoder;
+    decoder.decoder.color_convert = 0;
+    std::vector<unsigned char> image;
+    unsigned width, height;
+    unsigned error =
+        lodepng::decode(image, width, height, decoder, entry.png);
+    if (error) {
+      printf("  %-24s decoder error %u: %s\n", entry.name.c_str(), error,
+             lodepng_error_text(error));
+      all_match = false;
+      continue;
+    }
+
+    // 既定の設定の1スレッドでの時間と大きさ
+    double single_thread_ms   = 0.0;
+    size_t single_thread_size = 0;
+    for (const bool fast : {false, true}) {
+      for (const size_t num_threads : thread_counts) {
+        clspv_test::ThreadPool pool(num_threads);
+        std::vector<unsigned char> png;
+        const double ms = bestOfMs(repeat, [&] {
+          lodepng::State encoder;
+          lodepng_color_mode_copy(&encoder.info_raw,
+                                  &decoder.info_png.color);
+          if (fast) {
+            lodepng_color_mode_copy(&encoder.info_png.color,
+                                    &decoder.info_png.color);
+            lodepng_encoder_settings_fast(&encoder.encoder);
+          }
+          clspv_test::setParallelEncoder(&encoder, pool);
+          png.clear();
+          error = lodepng::encode(png, image, width, height, encoder);
+        });
+        if (error) {
+          printf("  %-24s encoder error %u: %s\n", entry.name.c_str(), error,
+                 lodepng_error_text(error));
+          all_match = false;
+          break;
+        }
+
+        lodepng::State redecoder;
+        lodepng_color_mode_copy(&redecoder.info_raw, &decoder.info_png.color);
+        std::vector<unsigned char> decoded;
+        unsigned decoded_width, decoded_height;
+        const bool match =
+            lodepng::decode(decoded, decoded_width, decoded_height, redecoder,
+                            png) == 0 &&
+            decoded == image;
+        all_match = all_match && match;
+
+        if (!fast && num_threads == 1) {
+          single_thread_ms   = ms;
+          single_thread_size = png.size();
+        }
+        printf("  %-24s %8s %8zu %10.1f %12.1f %7.2fx %7.3fx %s\n",
+               !fast && num_threads == 1 ? entry.name.c_str() : "",
+               num_threads == 1 ? (fast ? "fast" : "default") : "",
+               num_threads, image.size() / 1e6,
+               megabytesPerSecond(image.size(), ms),
+               ms > 0.0 ? single_thread_ms / ms : 0.0,
+               single_thread_size > 0
+                   ? double(png.size()) / single_thread_size
+                   : 0.0,
+               match ? "match" : "DIFFER");
+      }
+    }
+  }
+  return all_match ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// 1バイトずつ表を引く CRC32 (lodepng の以前の実装と同じもの)
+unsigned referenceCrc32(const unsigned char* data, const size_t length) {
+  static const std::vector<uint32_t> table = [] {
+    std::vector<uint32_t> t(256);
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1u) ? (c >> 1) ^ 0xedb88320u : c >> 1;
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+  uint32_t r = 0xffffffffu;
+  for (size_t i = 0; i < length; ++i) {
+    r = table[(r ^ data[i]) & 0xffu] ^ (r >> 8);
+  }
+  return r ^ 0xffffffffu;
+}
+
+// スカラーの Adler-32 (lodepng の以前の実装と同じもの)
+unsigned referenceAdler32(const unsigned char* data, size_t length) {
+  uint32_t s1 = 1, s2 = 0;
+  while (length != 0) {
+    const size_t amount = std::min<size_t>(length, 5552);
+    length -= amount;
+    for (size_t i = 0; i < amount; ++i) {
+      s1 += *data++;
+      s2 += s1;
+    }
+    s1 %= 65521u;
+    s2 %= 65521u;
+  }
+  return (s2 << 16) | s1;
+}
+
+// 展開した IDAT (フィルタ済みの行) の CRC32 と Adler-32 を、lodepng の
+// 実装 (slice-by-8 / PCLMULQDQ, SSSE3 / AVX2) と1バイトずつの参照実装で比べる
+int runChecksum(const std::vector<CorpusEntry>& corpus, const int repeat) {
+  printf("----- checksum (inflated IDAT), best of %d -----\n", repeat);
+  printf("  %-24s %8s %10s %10s %8s %10s %10s %8s\n", "", "MB",
+         "crc GB/s", "ref GB/s", "", "adler GB/s", "ref GB/s", "");
+  bool all_match = true;
+  for (const auto& entry : corpus) {
+    std::vector<unsigned char> data;
+    const unsigned error =
+        lodepng::decompress(data, extractIdat(entry.png));
+    if (error) {
+      printf("  %-24s decoder error %u: %s\n", entry.name.c_str(), error,
+             lodepng_error_text(error));
+      all_match = false;
+      continue;
+    }
+
+    unsigned crcs[2], adlers[2];
+    const double crc_ms = bestOfMs(
+        repeat, [&] { crcs[0] = lodepng_crc32(data.data(), data.size()); });
+    const double crc_reference_ms = bestOfMs(
+        repeat, [&] { crcs[1] = referenceCrc32(data.data(), data.size()); });
+    const double adler_ms = bestOfMs(
+        repeat, [&] { adlers[0] = lodepng_adler32(data.data(), data.size()); });
+    const double adler_reference_ms = bestOfMs(repeat, [&] {
+      adlers[1] = referenceAdler32(data.data(), data.size());
+    });
+
+    const bool match = crcs[0] == crcs[1] && adlers[0] == adlers[1];
+    all_match        = all_match && match;
+    // MB/s を 1e3 で割って GB/s にする
+    printf("  %-24s %8.1f %10.2f %10.2f %7.2fx %10.2f %10.2f %7.2fx %s\n",
+           entry.name.c_str(), data.size() / 1e6,
+           megabytesPerSecond(data.size(), crc_ms) / 1e3,
+           megabytesPerSecond(data.size(), crc_reference_ms) / 1e3,
+           crc_ms > 0.0 ? crc_reference_ms / crc_ms : 0.0,
+           megabytesPerSecond(data.size(), adler_ms) / 1e3,
+           megabytesPerSecond(data.size(), adler_reference_ms) / 1e3,
+           adler_ms > 0.0 ? adler_reference_ms / adler_ms : 0.0,
+           match ? "match" : "DIFFER");
+  }
+  return all_match ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int repeat         = 5;
+  size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::string mode;  // 空なら全て
+  std::vector<std::string> input_filepaths;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "inflate" || arg == "decode" || arg == "encode" ||
+        arg == "checksum") {
+      mode = arg;
+    } else if (arg == "--repeat" && i + 1 < argc) {
+      repeat = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--threads" && i + 1 < argc) {
+      max_threads = size_t(std::max(1, std::atoi(argv[++i])));
+    } else if (arg[0] != '-') {
+      input_filepaths.emplace_back(arg);
+    } else {
+      printf(
+          "usage: %s [inflate|decode|encode|checksum] [--repeat N]\n"
+          "          [--threads N] [input.png ...]\n",
+          argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::vector<CorpusEntry> corpus;
+  if (input_filepaths.empty()) {
+    corpus = makeSyntheticCorpus();
+  }
+  for (const auto& filepath : input_filepaths) {
+    CorpusEntry entry;
+    entry.name = filepath.substr(filepath.find_last_of('/') + 1);
+    const unsigned error = lodepng::load_file(entry.png, filepath);
+    if (error) {
+      printf("%s: %s\n", filepath.c_str(), lodepng_error_text(error));
+      return EXIT_FAILURE;
+    }
+    corpus.emplace_back(std::move(entry));
+  }
+
+  int result = EXIT_SUCCESS;
+  if (mode.empty() || mode == "inflate") {
+    result |= runInflate(corpus, repeat);
+  }
+  if (mode.empty() || mode == "decode") {
+    result |= runDecode(corpus, repeat);
+  }
+  if (mode.empty() || mode == "encode") {
+    result |= runEncode(corpus, repeat, max_threads);
+  }
+  if (mode.empty() || mode == "checksum") {
+    result |= runChecksum(corpus, repeat);
+  }
+  return result;
+}
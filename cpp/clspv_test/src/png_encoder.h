@@ -0,0 +1,83 @@
+/*
+MIT License
+
+Copyright (c) 2022 kyawakyawa
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef CLSPV_TEST_PNG_ENCODER_H_
+#define CLSPV_TEST_PNG_ENCODER_H_
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "lodepng.h"
+#include "thread_pool.h"
+
+namespace clspv_test {
+
+// LodePNGEncoderSettings::parallel_for の実装 (context は ThreadPool)
+inline void lodepngParallelFor(void (*task)(void* data, size_t index),
+                               void* data, const size_t count,
+                               const void* context) {
+  ThreadPool* pool = static_cast<ThreadPool*>(const_cast<void*>(context));
+  pool->parallelFor(count, [&](const size_t i) { task(data, i); });
+}
+
+/*
+pool のスレッドで PNG を符号化するように state を設定する
+
+画像を行の帯に分け、帯ごとにフィルタと deflate を並列に行う。帯の zlib の
+データは空の stored block で終わるのでそのまま連結でき、普通の PNG として
+読める。帯の境界をまたぐ一致は使えないので、1スレッドの場合より少しだけ
+大きくなる。pool が1スレッドの場合は何もしない (lodepng の出力と同じ)。
+pool の parallelFor() は同時に1つしか呼べないので、符号化している間は
+他で pool を使わないこと。
+*/
+inline void setParallelEncoder(lodepng::State* state, ThreadPool& pool) {
+  if (pool.numThreads() <= 1) {
+    return;
+  }
+  state->encoder.num_stripes      = static_cast<unsigned>(pool.numThreads());
+  state->encoder.parallel_for     = lodepngParallelFor;
+  state->encoder.parallel_context = &pool;
+}
+
+// RGBA8 の画像を pool のスレッドで PNG に符号化して filepath に保存する
+// (lodepng::encode(filepath, pixels, width, height) の並列版)
+inline unsigned encodePngParallel(const std::string& filepath,
+                                  const unsigned char* pixels,
+                                  const unsigned width, const unsigned height,
+                                  ThreadPool& pool) {
+  lodepng::State state;
+  setParallelEncoder(&state, pool);
+  std::vector<unsigned char> png;
+  unsigned error = lodepng::encode(png, pixels, width, height, state);
+  if (!error) {
+    error = lodepng::save_file(png, filepath);
+  }
+  return error;
+}
+
+}  // namespace clspv_test
+
+#endif  // CLSPV_TEST_PNG_ENCODER_H_
@@ -0,0 +1,132 @@
+/*
+MIT License
+
+Copyright (c) 2022 kyawakyawa
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifndef CLSPV_TEST_THREAD_POOL_H_
+#define CLSPV_TEST_THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace clspv_test {
+
+/*
+固定数のスレッドでタスクを分担して実行するスレッドプール
+
+parallelFor() を呼んだスレッドも計算に参加するので、num_threads = 1 の
+場合はスレッドを作らずに呼び出したスレッドだけで実行する。
+タスクは番号の小さい順に、空いたスレッドが1つずつ取っていく。
+*/
+class ThreadPool {
+public:
+  explicit ThreadPool(const size_t num_threads) {
+    for (size_t i = 1; i < num_threads; ++i) {
+      workers_.emplace_back([this] { workerLoop(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    start_cv_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  size_t numThreads() const { return workers_.size() + 1; }
+
+  // task(0), task(1), ..., task(num_tasks - 1) を分担して実行し、
+  // 全て終わるまで待つ
+  void parallelFor(const size_t num_tasks,
+                   const std::function<void(size_t)>& task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      task_       = &task;
+      num_tasks_  = num_tasks;
+      next_task_  = 0;
+      num_active_ = workers_.size();
+      ++generation_;
+    }
+    start_cv_.notify_all();
+
+    runTasks();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return num_active_ == 0; });
+    task_ = nullptr;
+  }
+
+private:
+  void workerLoop() {
+    size_t generation = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_cv_.wait(lock,
+                       [&] { return stop_ || generation_ != generation; });
+        if (stop_) {
+          return;
+        }
+        generation = generation_;
+      }
+
+      runTasks();
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--num_active_ == 0) {
+        done_cv_.notify_one();
+      }
+    }
+  }
+
+  void runTasks() {
+    for (size_t i = next_task_++; i < num_tasks_; i = next_task_++) {
+      (*task_)(i);
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable start_cv_, done_cv_;
+  const std::function<void(size_t)>* task_ = nullptr;
+  size_t num_tasks_                        = 0;
+  std::atomic<size_t> next_task_{0};
+  size_t generation_ = 0;
+  size_t num_active_ = 0;  // runTasks() を実行中のワーカーの数
+  bool stop_         = false;
+};
+
+}  // namespace clspv_test
+
+#endif  // CLSPV_TEST_THREAD_POOL_H_